@@ -33,11 +33,21 @@ typedef int (*mln_alloc_shm_lock_cb_t)(void *);
 #define M_ALLOC_SHM_BIT_SIZE     64
 #define M_ALLOC_SHM_LARGE_SIZE   (1*1024+512)*1024
 #define M_ALLOC_SHM_DEFAULT_SIZE 2*1024*1024
+#define M_ALLOC_SHM_CLASS_BLK_SIZE (16*1024)
+#define M_ALLOC_SHM_CLASS_MAX    64
 #define M_ALLOC_INFINITE_SIZE    (~((mln_size_t)0))
 
+#define M_ALLOC_TCACHE_MAX       64
+#define M_ALLOC_TCACHE_BATCH     16
+#define M_ALLOC_TCACHE_BLK_SIZE  (16*1024)
+
+#define M_ALLOC_ARENA_SLAB_SIZE  (32*1024)
+#define M_ALLOC_ARENA_ALIGN      16
+
 typedef struct mln_alloc_s       mln_alloc_t;
 typedef struct mln_alloc_mgr_s   mln_alloc_mgr_t;
 typedef struct mln_alloc_chunk_s mln_alloc_chunk_t;
+typedef struct mln_alloc_tcache_s mln_alloc_tcache_t;
 
 /*
  * Note:
@@ -56,9 +66,23 @@ typedef struct mln_alloc_blk_s {
     mln_size_t                blk_size;
     mln_size_t                is_large:1;
     mln_size_t                in_used:1;
-    mln_size_t                padding:30;
+    mln_size_t                is_arena:1;
+    mln_size_t                padding:29;
 } mln_alloc_blk_t;
 
+/*
+ * Arena pools carve memory linearly out of slabs. An arena allocation only
+ * carries the trailing blk_size and flag words of mln_alloc_blk_t in front
+ * of the returned address, which is enough for mln_alloc_free and
+ * mln_alloc_re to recognise it.
+ */
+typedef struct mln_alloc_arena_s {
+    struct mln_alloc_arena_s *prev;
+    struct mln_alloc_arena_s *next;
+    mln_size_t                size;
+    mln_size_t                pos;
+} mln_alloc_arena_t;
+
 struct mln_alloc_chunk_s {
     struct mln_alloc_chunk_s *prev;
     struct mln_alloc_chunk_s *next;
@@ -75,6 +99,7 @@ struct mln_alloc_mgr_s {
     mln_alloc_blk_t          *free_tail;
     mln_alloc_chunk_t        *chunk_head;
     mln_alloc_chunk_t        *chunk_tail;
+    mln_size_t                free_count; /* shared memory only */
 };
 
 typedef struct mln_alloc_shm_s {
@@ -90,7 +115,9 @@ typedef struct mln_alloc_shm_s {
     mln_u32_t                 nfree;
     mln_u32_t                 base:31;
     mln_u32_t                 large:1;
-    mln_u8_t                  bitmap[M_ALLOC_SHM_BITMAP_LEN];
+    mln_u32_t                 nblks;
+    mln_u32_t                 hint;
+    mln_u64_t                 bitmap[M_ALLOC_SHM_BITMAP_LEN >> 3];
 } mln_alloc_shm_t;
 
 struct mln_alloc_s {
@@ -113,6 +140,12 @@ struct mln_alloc_s {
     mln_alloc_chunk_t        *large_used_tail;
     mln_alloc_shm_t          *shm_head;
     mln_alloc_shm_t          *shm_tail;
+    mln_alloc_arena_t        *arena_head;
+    mln_alloc_arena_t        *arena_tail;
+    mln_alloc_arena_t        *arena_cur;
+    mln_alloc_arena_t        *arena_large_head;
+    mln_alloc_arena_t        *arena_large_tail;
+    mln_u32_t                 is_arena;
 };
 
 
@@ -121,12 +154,21 @@ struct mln_alloc_s {
 
 mln_alloc_t *mln_alloc_shm_init(mln_size_t capacity, void *locker, mln_alloc_shm_lock_cb_t lock, mln_alloc_shm_lock_cb_t unlock);
 mln_alloc_t *mln_alloc_init(mln_alloc_t *parent, mln_size_t capacity);
+mln_alloc_t *mln_alloc_arena_init(mln_alloc_t *parent, mln_size_t capacity);
+void mln_alloc_reset(mln_alloc_t *pool);
 void mln_alloc_destroy(mln_alloc_t *pool);
 void *mln_alloc_m(mln_alloc_t *pool, mln_size_t size);
 void *mln_alloc_c(mln_alloc_t *pool, mln_size_t size);
 void *mln_alloc_re(mln_alloc_t *pool, void *ptr, mln_size_t size);
 void mln_alloc_free(void *ptr);
 mln_size_t mln_alloc_available_capacity(mln_alloc_t *pool);
+/*
+ * Destroying a shared memory pool detaches every thread's cache of it, so
+ * other threads need not flush first, but none may still use the pool.
+ */
+void *mln_alloc_tcache_m(mln_alloc_t *pool, mln_size_t size);
+void mln_alloc_tcache_free(void *ptr);
+void mln_alloc_tcache_flush(mln_alloc_t *pool);
 
 #endif
 
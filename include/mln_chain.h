@@ -33,6 +33,7 @@ typedef struct mln_buf_s {
     mln_u32_t           sync:1;
     mln_u32_t           last_buf:1;
     mln_u32_t           last_in_chain:1;
+    mln_u32_t           no_sendfile:1;
 } mln_buf_t;
 
 typedef struct mln_chain_s {
@@ -77,7 +78,7 @@ static inline mln_buf_t *mln_buf_new(mln_alloc_t *pool)
 #if !defined(MSVC) && defined(MLN_MMAP)
     b->mmap = 0;
 #endif
-    b->flush = b->sync = b->last_buf = b->last_in_chain = 0;
+    b->flush = b->sync = b->last_buf = b->last_in_chain = b->no_sendfile = 0;
     return b;
 }
 
@@ -34,6 +34,18 @@
 #define M_C_TYPE_MEMORY 0x1
 #define M_C_TYPE_FILE   0x2
 
+/*
+ * memory receive buffers
+ * The buffer size adapts between M_C_RECV_MIN and M_C_RECV_MAX according to
+ * how much each read returns. At M_C_RECV_MAX, up to M_C_RECV_NVEC buffers
+ * are filled by one readv. Recycled buffers are kept in a per-connection
+ * free list of at most M_C_RECV_FREE_MAX nodes.
+ */
+#define M_C_RECV_MIN      4096
+#define M_C_RECV_MAX      65536
+#define M_C_RECV_NVEC     4
+#define M_C_RECV_FREE_MAX 8
+
 typedef struct {
     mln_alloc_t *pool;
     mln_chain_t *rcv_head;
@@ -42,6 +54,9 @@ typedef struct {
     mln_chain_t *snd_tail;
     mln_chain_t *sent_head;
     mln_chain_t *sent_tail;
+    mln_chain_t *free_head;
+    mln_u32_t    free_cnt;
+    mln_u32_t    rcv_size;
     int          sockfd;
     mln_u32_t    nonblock:1;
 } mln_tcp_conn_t;
@@ -69,6 +84,7 @@ extern mln_chain_t *mln_tcp_conn_pop(mln_tcp_conn_t *tc, int type) __NONNULL1(1)
 extern mln_chain_t *mln_tcp_conn_tail(mln_tcp_conn_t *tc, int type) __NONNULL1(1);
 extern int mln_tcp_conn_send(mln_tcp_conn_t *tc) __NONNULL1(1);
 extern int mln_tcp_conn_recv(mln_tcp_conn_t *tc, mln_u32_t flag) __NONNULL1(1);
+extern void mln_tcp_conn_recycle(mln_tcp_conn_t *tc, mln_chain_t *c) __NONNULL1(1);
 extern void mln_tcp_conn_move_sent(mln_tcp_conn_t *tc) __NONNULL1(1);
 extern int mln_tcp_conn_send_chain(mln_tcp_conn_t *tc, mln_chain_t *chain) __NONNULL2(1,2);
 
@@ -32,6 +32,9 @@
 /*common*/
 #define M_EV_HASH_LEN 64
 #define M_EV_EPOLL_SIZE 1024 /*already ignored, see man epoll_create*/
+#define M_EV_URING_ENTRIES 256 /*pending epoll_ctl operations batched per io_uring_enter*/
+#define M_EV_FD_TABLE_MIN 64
+#define M_EV_FD_TABLE_MAX 1048576 /*fds below this are indexed directly, others go into ev_fd_tree*/
 /*for fd*/
 #define M_EV_RECV ((mln_u32_t)0x1)
 #define M_EV_SEND ((mln_u32_t)0x2)
@@ -55,7 +58,8 @@
 
 typedef struct mln_event_s      mln_event_t;
 typedef struct mln_event_desc_s mln_event_desc_t;
-typedef mln_fheap_node_t        mln_event_timer_t;
+typedef struct mln_event_desc_s mln_event_timer_t;
+typedef struct mln_event_wheel_slot_s mln_event_wheel_slot_t;
 
 typedef void (*ev_fd_handler)  (mln_event_t *, int, void *);
 typedef void (*ev_tm_handler)  (mln_event_t *, void *);
@@ -95,6 +99,7 @@ typedef struct mln_event_tm_s {
     void                    *data;
     ev_tm_handler            handler;
     mln_uauto_t              end_tm;/*us*/
+    mln_fheap_node_t        *node;
 } mln_event_tm_t;
 
 struct mln_event_desc_s {
@@ -102,6 +107,9 @@ struct mln_event_desc_s {
     struct mln_event_desc_s *next;
     struct mln_event_desc_s *act_prev;
     struct mln_event_desc_s *act_next;
+    struct mln_event_desc_s *wh_prev;
+    struct mln_event_desc_s *wh_next;
+    mln_event_wheel_slot_t  *wh_slot;
     enum mln_event_type      type;
     mln_u32_t                flag;
     union {
@@ -115,14 +123,25 @@ struct mln_event_s {
     pthread_mutex_t          fd_lock;
     pthread_mutex_t          timer_lock;
     pthread_mutex_t          cb_lock;
+    pthread_mutex_t          post_lock;
 #endif
     dispatch_callback        callback;
     void                    *callback_data;
     mln_u32_t                is_break:1;
-    mln_u32_t                padding:31;
+    mln_u32_t                timer_wheel:1;
+    mln_u32_t                single_thread:1;
+    mln_u32_t                padding:29;
+    int                      post_rfd;
+    int                      post_wfd;
+    int                      post_new;
+    struct mln_event_post_s *post_head;
+    struct mln_event_post_s *post_tail;
 #if defined(MLN_EPOLL)
     int                      epollfd;
     int                      unusedfd;
+#if defined(MLN_IO_URING)
+    struct mln_event_uring_s *uring;
+#endif
 #elif defined(MLN_KQUEUE)
     int                      kqfd;
     int                      unusedfd;
@@ -133,6 +152,8 @@ struct mln_event_s {
     fd_set                   err_set;
 #endif
 
+    mln_event_desc_t       **ev_fd_table;
+    mln_u32_t                ev_fd_table_size;
     mln_rbtree_t            *ev_fd_tree;
     mln_event_desc_t        *ev_fd_wait_head;
     mln_event_desc_t        *ev_fd_wait_tail;
@@ -140,12 +161,25 @@ struct mln_event_s {
     mln_event_desc_t        *ev_fd_active_tail;
     mln_fheap_t             *ev_fd_timeout_heap;
     mln_fheap_t             *ev_timer_heap;
+    struct mln_event_wheel_s *ev_fd_timeout_wheel;
+    struct mln_event_wheel_s *ev_timer_wheel;
+};
+
+struct mln_event_attr {
+    mln_u32_t                timer_wheel; /*non-zero: use timing wheels instead of fheaps for timers and fd timeouts*/
+    mln_u32_t                single_thread; /*non-zero: only the dispatching thread touches this event, no locking*/
+};
+
+struct mln_event_wheel_slot_s {
+    mln_event_desc_t        *head;
+    mln_event_desc_t        *tail;
 };
 
 #define mln_event_break_set(ev) ((ev)->is_break = 1);
 #define mln_event_break_reset(ev) ((ev)->is_break = 0);
 #define mln_event_signal_set signal
 extern mln_event_t *mln_event_new(void);
+extern mln_event_t *mln_event_new_with_attr(struct mln_event_attr *attr);
 extern void mln_event_free(mln_event_t *ev);
 extern void mln_event_dispatch(mln_event_t *event) __NONNULL1(1);
 /*
@@ -175,5 +209,10 @@ mln_event_fd_timeout_handler_set(mln_event_t *event, \
 extern void mln_event_callback_set(mln_event_t *ev, \
                                    dispatch_callback dc, \
                                    void *dc_data) __NONNULL1(1);
+/*
+ * The only call that may be made from other threads on a single_thread event.
+ * handler is run by the dispatching thread with data.
+ */
+extern int mln_event_post(mln_event_t *event, ev_tm_handler handler, void *data) __NONNULL2(1,2);
 #endif
 
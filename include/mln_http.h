@@ -12,6 +12,9 @@
 
 #define M_HTTP_HASH_LEN                        31
 #define M_HTTP_GENERATE_ALLOC_SIZE             4096
+#define M_HTTP_GENERATE_REF_SIZE               64
+#define M_HTTP_INDEX_FIELDS                    32
+#define M_HTTP_INDEX_SLOTS                     64
 
 /*http type*/
 #define M_HTTP_UNKNOWN                         0
@@ -21,6 +24,40 @@
 #define M_HTTP_RET_OK                          0
 #define M_HTTP_RET_DONE                        1
 #define M_HTTP_RET_ERROR                       2
+/*body framing*/
+#define M_HTTP_BODY_UNKNOWN                    0
+#define M_HTTP_BODY_NONE                       1
+#define M_HTTP_BODY_LENGTH                     2
+#define M_HTTP_BODY_CHUNKED                    3
+
+/*well-known header fields*/
+#define M_HTTP_H_HOST                          0
+#define M_HTTP_H_CONTENT_LENGTH                1
+#define M_HTTP_H_CONTENT_TYPE                  2
+#define M_HTTP_H_CONNECTION                    3
+#define M_HTTP_H_TRANSFER_ENCODING             4
+#define M_HTTP_H_USER_AGENT                    5
+#define M_HTTP_H_ACCEPT                        6
+#define M_HTTP_H_ACCEPT_ENCODING               7
+#define M_HTTP_H_ACCEPT_LANGUAGE               8
+#define M_HTTP_H_COOKIE                        9
+#define M_HTTP_H_AUTHORIZATION                 10
+#define M_HTTP_H_CACHE_CONTROL                 11
+#define M_HTTP_H_UPGRADE                       12
+#define M_HTTP_H_REFERER                       13
+#define M_HTTP_H_ORIGIN                        14
+#define M_HTTP_H_IF_NONE_MATCH                 15
+#define M_HTTP_H_IF_MODIFIED_SINCE             16
+#define M_HTTP_H_RANGE                         17
+#define M_HTTP_H_EXPECT                        18
+#define M_HTTP_H_CONTENT_ENCODING              19
+#define M_HTTP_H_SET_COOKIE                    20
+#define M_HTTP_H_LOCATION                      21
+#define M_HTTP_H_DATE                          22
+#define M_HTTP_H_SERVER                        23
+#define M_HTTP_H_KEEP_ALIVE                    24
+#define M_HTTP_H_X_FORWARDED_FOR               25
+#define M_HTTP_H_MAX                           26
 
 /*request method*/
 #define M_HTTP_GET                             0
@@ -102,10 +139,44 @@ typedef struct {
     mln_u32_t               code;
 } mln_http_map_t;
 
+typedef struct {
+    mln_string_t            key;
+    mln_string_t            val;
+    mln_u32_t               hash;
+} mln_http_slice_t;
+
+/*
+ * Header index: fields are kept as slices of the input buffers,
+ * 'slots' is an open-addressed table of field positions (1-based)
+ * keyed by name hash, 'known' maps well-known fields to positions.
+ */
+typedef struct {
+    mln_http_slice_t        fields[M_HTTP_INDEX_FIELDS];
+    mln_u8_t                slots[M_HTTP_INDEX_SLOTS];
+    mln_u8_t                known[M_HTTP_H_MAX];
+    mln_u32_t               nfield;
+    mln_string_t            uri;
+    mln_string_t            args;
+    mln_string_t            response_msg;
+    mln_chain_t            *hold;
+    void                   *lines;
+} mln_http_index_t;
+
+/*
+ * Pre-serialized start line and header fields, without the empty
+ * line that ends the header. 'block' points right behind the struct.
+ */
+typedef struct {
+    mln_string_t            block;
+    mln_u32_t               chunked:1;
+} mln_http_header_cache_t;
+
 struct mln_http_s {
     mln_tcp_conn_t         *connection;
     mln_alloc_t            *pool;
     mln_hash_t             *header_fields;
+    mln_http_index_t       *index;
+    mln_http_header_cache_t *header_cache;
     mln_chain_t            *body_head;
     mln_chain_t            *body_tail;
     mln_http_handler        body_handler;
@@ -113,12 +184,17 @@ struct mln_http_s {
     mln_string_t           *uri;
     mln_string_t           *args;
     mln_string_t           *response_msg;
+    mln_u64_t               body_left;
     mln_u32_t               error;
     mln_u32_t               status;
     mln_u32_t               method;
     mln_u32_t               version;
     mln_u32_t               type:2;
     mln_u32_t               done:1;
+    mln_u32_t               framing:1;
+    mln_u32_t               body_mode:2;
+    mln_u32_t               chunk_state:4;
+    mln_u32_t               zerocopy:1;
 };
 
 /*for internal*/
@@ -151,11 +227,30 @@ struct mln_http_s {
 #define mln_http_error_get(h)            ((h)->error)
 #define mln_http_error_set(h,e)          (h)->error = (e)
 #define mln_http_header_get(h)           ((h)->header_fields)
+#define mln_http_framing_get(h)          ((h)->framing)
+#define mln_http_framing_set(h,f)        (h)->framing = !!(f)
+#define mln_http_body_mode_get(h)        ((h)->body_mode)
+#define mln_http_index_get(h)            ((h)->index)
+#define mln_http_zerocopy_get(h)         ((h)->zerocopy)
+#define mln_http_zerocopy_set(h,z)       (h)->zerocopy = !!(z)
+#define mln_http_header_cache_get(h)     ((h)->header_cache)
+#define mln_http_header_cache_set(h,c)   (h)->header_cache = (c)
 
 extern mln_http_t *
 mln_http_init(mln_tcp_conn_t *connection, void *data, mln_http_handler body_handler);
 extern void mln_http_destroy(mln_http_t *http);
 extern void mln_http_reset(mln_http_t *http);
+/*
+ * mln_http_index_enable():
+ * Switch 'http' to the zero-copy header index. From then on the
+ * parsed URI, arguments, response message and header fields refer
+ * to the input buffers, so the input chain passed to mln_http_parse()
+ * must be kept until mln_http_reset(). Input chain nodes consumed by
+ * the parser are held by 'http' and released by mln_http_reset().
+ * Fields beyond M_HTTP_INDEX_FIELDS and fields set by
+ * mln_http_field_set() are still stored in the header hash.
+ */
+extern int mln_http_index_enable(mln_http_t *http);
 /*
  * mln_http_parse():
  * If return M_HTTP_RET_OK, that means input not enough.
@@ -168,6 +263,15 @@ extern void mln_http_reset(mln_http_t *http);
  * you have processed should be freed in this callback function.
  * And the third argument of this callback function will be
  * set NULL. Just ignore it.
+ * If framing is enabled via mln_http_framing_set(), the body is
+ * delimited by Content-Length or Transfer-Encoding: chunked and
+ * decoded here. 'body_handler' then receives a chain of decoded
+ * payload slices (and their tail as the third argument) which
+ * point into the buffers of 'in' and are only valid during the
+ * call. The last slice of a message has last_in_chain set.
+ * M_HTTP_RET_DONE is returned right after the message, and the
+ * bytes of pipelined messages are left in 'in' for the next call
+ * after mln_http_reset().
  */
 extern int mln_http_parse(mln_http_t *http, mln_chain_t **in);
 /*
@@ -176,12 +280,44 @@ extern int mln_http_parse(mln_http_t *http, mln_chain_t **in);
  * When you processed HTTP body in function 'body_handler' called
  * in mln_http_generate(), the body chain should be returned
  * via the second and third arguments of 'body_handler'.
+ * If framing is enabled and the header field 'Transfer-Encoding'
+ * is 'chunked', the header is generated on the first call and
+ * every following call emits the body returned by 'body_handler'
+ * as one chunk. The last chunk is sent when 'body_handler' returns
+ * M_HTTP_RET_DONE (or there is no 'body_handler').
+ * If zero-copy is enabled via mln_http_zerocopy_set(), the URI,
+ * arguments and field values of at least M_HTTP_GENERATE_REF_SIZE
+ * bytes are referred to by the output chain instead of being copied,
+ * so they must not be freed (e.g. by mln_http_reset()) before the
+ * output has been sent.
  */
 extern int mln_http_generate(mln_http_t *http, mln_chain_t **out_head, mln_chain_t **out_tail);
+/*
+ * mln_http_header_cache_new():
+ * Serialize the start line and the header fields of 'http' into one
+ * block allocated from 'pool'. Once it is set via
+ * mln_http_header_cache_set(), mln_http_generate() emits the block
+ * by reference instead of the start line, followed by the fields
+ * currently set in 'http' (e.g. Content-Length) and the empty line.
+ * The cache is kept by mln_http_reset(), so the block must outlive
+ * every output chain that refers to it.
+ */
+extern mln_http_header_cache_t *mln_http_header_cache_new(mln_http_t *http, mln_alloc_t *pool);
+extern void mln_http_header_cache_free(mln_http_header_cache_t *cache);
 extern int mln_http_field_set(mln_http_t *http, mln_string_t *key, mln_string_t *val);
 extern mln_string_t *mln_http_field_get(mln_http_t *http, mln_string_t *key);
+/*
+ * Get a well-known field by its M_HTTP_H_* id, which skips hashing
+ * the name when the header index is enabled.
+ */
+extern mln_string_t *mln_http_known_field_get(mln_http_t *http, mln_u32_t id);
 extern mln_string_t *mln_http_field_iterator(mln_http_t *http, mln_string_t *key);
 extern void mln_http_field_remove(mln_http_t *http, mln_string_t *key);
+/*
+ * Return 1 if the connection can be reused for the next message
+ * according to the version and the 'Connection' header field.
+ */
+extern int mln_http_keepalive(mln_http_t *http);
 
 extern void mln_http_dump(mln_http_t *http);
 
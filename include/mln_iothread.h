@@ -7,6 +7,7 @@
 
 #if !defined(MSVC)
 #include "mln_types.h"
+#include "mln_event.h"
 #include <pthread.h>
 
 typedef struct mln_iothread_msg_s mln_iothread_msg_t;
@@ -19,16 +20,61 @@ typedef enum {
 
 typedef void *(*mln_iothread_entry_t)(void *);
 typedef void (*mln_iothread_msg_process_t)(mln_iothread_t *, mln_iothread_ep_type_t, mln_iothread_msg_t *);
+typedef void (*mln_iothread_reply_process_t)(mln_iothread_t *, mln_u32_t, void *, void *, void *);
 
+/*
+ * Pooled messages (ring mode feedback) do not use @mutex. The sender
+ * waits on @state instead, a futex word on Linux: 0 pending, 1 done,
+ * 2 the sender is asleep. Async ones carry the event loop to reply on.
+ */
 struct mln_iothread_msg_s {
     struct mln_iothread_msg_s  *prev;
     struct mln_iothread_msg_s  *next;
     mln_u32_t                   feedback:1;
     mln_u32_t                   hold:1;
-    mln_u32_t                   padding:30;
+    mln_u32_t                   pooled:1;
+    mln_u32_t                   padding:29;
     mln_u32_t                   type;
     void                       *data;
     pthread_mutex_t             mutex;
+    mln_u32_t                   state;
+    void                       *reply;
+    mln_iothread_t             *t;
+    mln_event_t                *ev;
+    mln_iothread_reply_process_t reply_handler;
+    void                       *udata;
+};
+
+/*
+ * Ring mode: one bounded ring per direction with preallocated slots.
+ * Any number of threads may push or pop, a slot is claimed by CAS on
+ * @head/@tail and published through its @seq. @signaled coalesces
+ * wakeups: only the first push after the consumer rearmed it writes to
+ * the notification fd.
+ */
+typedef struct {
+    mln_size_t                  seq;
+    mln_u32_t                   type;
+    void                       *data;
+    mln_iothread_msg_t         *msg; /*pooled feedback message or NULL*/
+} mln_iothread_slot_t;
+
+typedef struct {
+    mln_size_t                  head;
+    mln_u8_t                    head_pad[64 - sizeof(mln_size_t)];
+    mln_size_t                  tail;
+    mln_u8_t                    tail_pad[64 - sizeof(mln_size_t)];
+    mln_u32_t                   signaled;
+    mln_size_t                  mask;
+    mln_iothread_slot_t        *slots;
+} mln_iothread_ring_t;
+
+struct mln_iothread_attr {
+    mln_u32_t                   nthread;
+    mln_iothread_entry_t        entry;
+    void                       *args;
+    mln_iothread_msg_process_t  handler;
+    mln_u32_t                   ring_size; /*0: malloc a message per send, otherwise slots per direction*/
 };
 
 struct mln_iothread_s {
@@ -45,18 +91,26 @@ struct mln_iothread_s {
     mln_u32_t                   nthread;
     mln_iothread_msg_t         *user_head;
     mln_iothread_msg_t         *user_tail;
+    mln_iothread_ring_t        *io_ring;
+    mln_iothread_ring_t        *user_ring;
+    mln_iothread_ring_t        *msg_pool;
 };
 
 #define mln_iothread_sockfd_get(p,t)   ((t) == io_thread? (p)->io_fd: (p)->user_fd)
 #define mln_iothread_msg_hold(m)       ((m)->hold = 1)
-#define mln_iothread_msg_release(m)    pthread_mutex_unlock(&(m)->mutex)
 #define mln_iothread_msg_type(m)       ((m)->type)
 #define mln_iothread_msg_data(m)       ((m)->data)
+#define mln_iothread_msg_reply_set(m,r) ((m)->reply = (r))
 
 extern int mln_iothread_init(mln_iothread_t *t, mln_u32_t nthread, mln_iothread_entry_t entry, void *args, mln_iothread_msg_process_t handler);
+extern int mln_iothread_init_with_attr(mln_iothread_t *t, struct mln_iothread_attr *attr);
 extern void mln_iothread_destroy(mln_iothread_t *t);
 extern int mln_iothread_send(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, mln_u32_t feedback);
 extern int mln_iothread_recv(mln_iothread_t *t, mln_iothread_ep_type_t from);
+extern void mln_iothread_msg_release(mln_iothread_msg_t *msg);
+extern int mln_iothread_call(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, void **reply);
+extern int mln_iothread_call_async(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, \
+                                   mln_event_t *ev, mln_iothread_reply_process_t handler, void *udata);
 
 #endif
 
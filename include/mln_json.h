@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include "mln_string.h"
 #include "mln_array.h"
+#include "mln_chain.h"
 
 #define M_JSON_LEN              31
 #define M_JSON_BUFLEN           1024
@@ -19,6 +20,13 @@
 #define M_JSON_V_TRUE           1
 #define M_JSON_V_NULL           NULL
 
+/*
+ * number representations, in mln_json_t.num_type
+ */
+#define M_JSON_NUM_DOUBLE       0
+#define M_JSON_NUM_INT          1  /* int64 */
+#define M_JSON_NUM_UINT         2  /* uint64 */
+
 #define M_JSON_ENCODE_DEFAULT   0x0
 #define M_JSON_ENCODE_UNICODE   0x1  /* escape non-ASCII to \uXXXX */
 
@@ -32,6 +40,22 @@
 #define M_JSON_ARRELEM          4
 #define M_JSON_OBJKV            5
 
+/*
+ * stream decoder
+ */
+#define M_JSON_STREAM_ERROR     -1
+#define M_JSON_STREAM_NOTYET    0
+#define M_JSON_STREAM_DONE      1
+
+#define M_JSON_EVENT_OBJECT_BEGIN 0
+#define M_JSON_EVENT_OBJECT_END   1
+#define M_JSON_EVENT_ARRAY_BEGIN  2
+#define M_JSON_EVENT_ARRAY_END    3
+#define M_JSON_EVENT_KEY          4
+#define M_JSON_EVENT_VALUE        5
+
+#define M_JSON_STREAM_NUMLEN    512 /* longest number token */
+
 typedef struct mln_json_s mln_json_t;
 typedef int (*mln_json_iterator_t)(mln_json_t *, void *);
 typedef int (*mln_json_object_iterator_t)(mln_json_t * /*key*/, mln_json_t * /*val*/, void *);
@@ -62,6 +86,7 @@ typedef struct mln_json_obj_s {
     struct mln_json_kv_s        *tail;      /* iteration list tail */
     struct mln_json_kv_s        *pool;      /* inline KV pool base */
     struct mln_json_kv_s        *freelist;  /* recycled pool slots */
+    mln_alloc_t                 *alloc;     /* memory pool, NULL for malloc */
     mln_u32_t                    len;        /* number of buckets */
     mln_u32_t                    nr_nodes;   /* number of entries */
     mln_u32_t                    pool_used;  /* next free pool slot */
@@ -70,11 +95,14 @@ typedef struct mln_json_obj_s {
 
 struct mln_json_s {
     enum json_type               type;
+    mln_u32_t                    num_type;  /* M_JSON_NUM_*, for M_JSON_NUM only */
     union {
         mln_json_obj_t   *m_j_obj;
         mln_array_t      *m_j_array;
         mln_string_t     *m_j_string;
         double            m_j_number;
+        mln_s64_t         m_j_int;
+        mln_u64_t         m_j_uint;
         mln_u8_t          m_j_true;
         mln_u8_t          m_j_false;
         mln_u8ptr_t       m_j_null;
@@ -103,10 +131,45 @@ typedef struct {
     int                          error;
 } mln_json_policy_t;
 
+/*
+ * Stream decoder. The handler gets one call per event, 'val' is the key or
+ * scalar value for M_JSON_EVENT_KEY/M_JSON_EVENT_VALUE and NULL otherwise.
+ * A non-zero return aborts the decoding.
+ */
+typedef int (*mln_json_stream_handler_t)(int /*event*/, mln_json_t * /*val*/, mln_size_t /*depth*/, void *);
+
+typedef struct {
+    mln_json_t                  *json;      /* container being filled, NULL for handlers */
+    mln_size_t                   nelts;
+    mln_u32_t                    is_obj;
+} mln_json_stream_frame_t;
+
+typedef struct {
+    mln_json_policy_t           *policy;
+    mln_json_stream_handler_t    handler;
+    void                        *data;
+    mln_json_t                   root;
+    mln_json_t                   key;       /* pending object key */
+    mln_json_stream_frame_t     *stack;
+    mln_size_t                   depth;
+    mln_size_t                   stack_cap;
+    mln_u8ptr_t                  buf;       /* head of a token split across fragments */
+    mln_size_t                   buf_len;
+    mln_size_t                   buf_cap;
+    mln_size_t                   consumed;
+    mln_u32_t                    state:4;
+    mln_u32_t                    token:2;
+    mln_u32_t                    escape:1;
+    mln_u32_t                    is_key:1;
+    mln_u32_t                    error:1;
+} mln_json_stream_t;
+
 #define mln_json_is_object(json)                 ((json)->type == M_JSON_OBJECT)
 #define mln_json_is_array(json)                  ((json)->type == M_JSON_ARRAY)
 #define mln_json_is_string(json)                 ((json)->type == M_JSON_STRING)
 #define mln_json_is_number(json)                 ((json)->type == M_JSON_NUM)
+#define mln_json_is_int(json)                    ((json)->type == M_JSON_NUM && (json)->num_type == M_JSON_NUM_INT)
+#define mln_json_is_uint(json)                   ((json)->type == M_JSON_NUM && (json)->num_type == M_JSON_NUM_UINT)
 #define mln_json_is_true(json)                   ((json)->type == M_JSON_TRUE)
 #define mln_json_is_false(json)                  ((json)->type == M_JSON_FALSE)
 #define mln_json_is_null(json)                   ((json)->type == M_JSON_NULL)
@@ -115,7 +178,11 @@ typedef struct {
 #define mln_json_object_data_get(json)           ((json)->data.m_j_obj)
 #define mln_json_array_data_get(json)            ((json)->data.m_j_array)
 #define mln_json_string_data_get(json)           ((json)->data.m_j_string)
-#define mln_json_number_data_get(json)           ((json)->data.m_j_number)
+#define mln_json_number_data_get(json)           ((json)->num_type == M_JSON_NUM_INT? (double)(json)->data.m_j_int: \
+                                                  (json)->num_type == M_JSON_NUM_UINT? (double)(json)->data.m_j_uint: \
+                                                  (json)->data.m_j_number)
+#define mln_json_int_data_get(json)              ((json)->data.m_j_int)
+#define mln_json_uint_data_get(json)             ((json)->data.m_j_uint)
 #define mln_json_true_data_get(json)             ((json)->data.m_j_true)
 #define mln_json_false_data_get(json)            ((json)->data.m_j_false)
 #define mln_json_null_data_get(json)             ((json)->data.m_j_null)
@@ -124,7 +191,7 @@ typedef struct {
 #define mln_json_object_type_set(json)           (json)->type = M_JSON_OBJECT
 #define mln_json_array_type_set(json)            (json)->type = M_JSON_ARRAY
 #define mln_json_string_type_set(json)           (json)->type = M_JSON_STRING
-#define mln_json_number_type_set(json)           (json)->type = M_JSON_NUM
+#define mln_json_number_type_set(json)           ((json)->type = M_JSON_NUM, (json)->num_type = M_JSON_NUM_DOUBLE)
 #define mln_json_true_type_set(json)             (json)->type = M_JSON_TRUE
 #define mln_json_false_type_set(json)            (json)->type = M_JSON_FALSE
 #define mln_json_null_type_set(json)             (json)->type = M_JSON_NULL
@@ -141,6 +208,18 @@ typedef struct {
     mln_json_number_type_set(json);\
     json->data.m_j_number = (double)(n);\
 } while (0)
+#define mln_json_int_init(j, n) do {\
+    mln_json_t *json = (j);\
+    json->type = M_JSON_NUM;\
+    json->num_type = M_JSON_NUM_INT;\
+    json->data.m_j_int = (mln_s64_t)(n);\
+} while (0)
+#define mln_json_uint_init(j, n) do {\
+    mln_json_t *json = (j);\
+    json->type = M_JSON_NUM;\
+    json->num_type = M_JSON_NUM_UINT;\
+    json->data.m_j_uint = (mln_u64_t)(n);\
+} while (0)
 #define mln_json_true_init(j) do {\
     mln_json_t *json = (j);\
     mln_json_true_type_set(json);\
@@ -175,6 +254,18 @@ typedef struct {
     mln_json_number_type_set(json);\
     json->data.m_j_number = (double)(n);\
 })
+#define mln_json_int_init(j, n)                ({\
+    mln_json_t *json = (j);\
+    json->type = M_JSON_NUM;\
+    json->num_type = M_JSON_NUM_INT;\
+    json->data.m_j_int = (mln_s64_t)(n);\
+})
+#define mln_json_uint_init(j, n)               ({\
+    mln_json_t *json = (j);\
+    json->type = M_JSON_NUM;\
+    json->num_type = M_JSON_NUM_UINT;\
+    json->data.m_j_uint = (mln_u64_t)(n);\
+})
 #define mln_json_true_init(j)                  ({\
     mln_json_t *json = (j);\
     mln_json_true_type_set(json);\
@@ -215,7 +306,13 @@ extern int mln_json_array_append(mln_json_t *j, mln_json_t *value) __NONNULL2(1,
 extern int mln_json_array_update(mln_json_t *j, mln_json_t *value, mln_uauto_t index) __NONNULL2(1,2);
 extern void mln_json_array_remove(mln_json_t *j, mln_uauto_t index);
 extern int mln_json_decode(mln_string_t *jstr, mln_json_t *out, mln_json_policy_t *policy);
+extern int mln_json_pool_decode(mln_string_t *jstr, mln_json_t *out, mln_json_policy_t *policy, mln_alloc_t *pool);
 extern mln_string_t *mln_json_encode(mln_json_t *j, mln_u32_t flags);
+extern mln_json_stream_t *mln_json_stream_new(mln_json_policy_t *policy, mln_json_stream_handler_t handler, void *data);
+extern void mln_json_stream_free(mln_json_stream_t *s);
+extern int mln_json_stream_feed(mln_json_stream_t *s, mln_u8ptr_t buf, mln_size_t len) __NONNULL1(1);
+extern int mln_json_stream_feed_chain(mln_json_stream_t *s, mln_chain_t *c) __NONNULL1(1);
+extern int mln_json_stream_result(mln_json_stream_t *s, mln_json_t *out) __NONNULL2(1,2);
 extern int mln_json_fetch(mln_json_t *j, mln_string_t *exp, mln_json_iterator_t iterator, void *data) __NONNULL2(1,2);
 extern int mln_json_generate(mln_json_t *j, char *fmt, ...) __NONNULL2(1,2);
 extern int mln_json_object_iterate(mln_json_t *j, mln_json_object_iterator_t it, void *data) __NONNULL2(1,2);
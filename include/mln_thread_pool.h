@@ -15,20 +15,52 @@
 #include <pthread.h>
 #include "mln_types.h"
 #include "mln_string.h"
+#include "mln_event.h"
+
+/*
+ * Upper bound on the futures handed to a completion handler at once.
+ */
+#define M_THREAD_POOL_CQ_BATCH 64
 
 typedef struct mln_thread_pool_s mln_thread_pool_t;
+typedef struct mln_thread_pool_future_s mln_thread_pool_future_t;
+typedef struct mln_thread_pool_cq_s mln_thread_pool_cq_t;
 
 typedef int  (*mln_thread_process)(void *);
 typedef void (*mln_thread_data_free)(void *);
+typedef void *(*mln_thread_task)(void *);
+typedef void (*mln_thread_pool_cq_handler)(mln_thread_pool_cq_t *, mln_thread_pool_future_t **, mln_size_t, void *);
 
 typedef struct mln_thread_pool_resource_s {
     void                              *data;
     struct mln_thread_pool_resource_s *next;
 } mln_thread_pool_resource_t;
 
+/*
+ * Work-stealing mode: every worker owns a Chase-Lev deque. The owner pushes
+ * and pops at the bottom, idle peers steal from the top, and the worker
+ * parks on its own mutex/cond instead of the pool-wide one.
+ */
+typedef struct mln_thread_pool_ws_array_s {
+    struct mln_thread_pool_ws_array_s *retired;
+    mln_sptr_t                         mask;
+    void                             **buf;
+} mln_thread_pool_ws_array_t;
+
+typedef struct {
+    mln_sptr_t                         top;
+    mln_sptr_t                         bottom;
+    mln_thread_pool_ws_array_t        *array;
+    pthread_mutex_t                    mutex;
+    pthread_cond_t                     cond;
+    mln_u32_t                          parked;
+    mln_u32_t                          seed;
+} mln_thread_pool_ws_t;
+
 typedef struct mln_thread_pool_member_s {
     void                              *data;
     mln_thread_pool_t                 *pool;
+    mln_thread_pool_ws_t              *ws;
     mln_u32_t                          idle:1;
     mln_u32_t                          locked:1;
     mln_u32_t                          forked:1;
@@ -61,12 +93,55 @@ struct mln_thread_pool_s {
     mln_u32_t                          counter;
     mln_u32_t                          waiters;
     mln_u32_t                          quit:1;
-    mln_u32_t                          padding:31;
+    mln_u32_t                          work_stealing:1;
+    mln_u32_t                          instance:1;
+    mln_u32_t                          padding:29;
     mln_u64_t                          cond_timeout;/*ms*/
     mln_size_t                         n_res;
     mln_size_t                         free_list_size;
     mln_thread_process                 process_handler;
     mln_thread_data_free               free_handler;
+    mln_thread_pool_ws_t              *ws;
+    mln_u32_t                          ws_n;
+    mln_u32_t                          ws_parked;
+    mln_u32_t                          ws_quit;
+    mln_u32_t                          ws_next;
+    /*
+     * Instance pools (mln_thread_pool_new) may be fed by any thread, so
+     * free-list pops are serialized by @take_lock.
+     */
+    mln_u32_t                          queue_max;
+    mln_size_t                         n_pending;
+    mln_u64_t                          cpu_affinity;
+    mln_u8_t                           take_lock;
+};
+
+/*
+ * A future is the handle of one mln_thread_pool_async task. Workers push
+ * finished futures onto @done of their completion queue without locking,
+ * and the first push onto an empty queue wakes the event loop up.
+ * @refs counts the caller's handle and the queue's delivery; whichever
+ * drops the last one frees the future.
+ */
+struct mln_thread_pool_future_s {
+    mln_thread_task                    task;
+    void                              *data;
+    void                              *result;
+    mln_thread_pool_cq_t              *cq;
+    struct mln_thread_pool_future_s   *next;
+    mln_u32_t                          cancelled;
+    mln_u32_t                          refs;
+};
+
+struct mln_thread_pool_cq_s {
+    mln_event_t                       *ev;
+    int                                rfd;
+    int                                wfd;
+    mln_thread_pool_future_t          *done;
+    mln_size_t                         inflight;
+    mln_u32_t                          wake_lost;
+    mln_thread_pool_cq_handler         handler;
+    void                              *data;
 };
 
 struct mln_thread_pool_attr {
@@ -77,6 +152,9 @@ struct mln_thread_pool_attr {
     mln_u64_t                          cond_timeout; /*ms*/
     mln_u32_t                          max;
     mln_u32_t                          concurrency;
+    mln_u32_t                          work_stealing;
+    mln_u32_t                          queue_max; /*0 means unlimited*/
+    mln_u64_t                          cpu_affinity; /*bit i pins workers to CPU i, 0 means no pinning*/
 };
 
 struct mln_thread_pool_info {
@@ -91,6 +169,23 @@ extern int mln_thread_pool_resource_add(void *data) __NONNULL1(1);
 extern int mln_thread_pool_resource_addn(void **data, mln_size_t n) __NONNULL1(1);
 extern void mln_thread_quit(void);
 extern void mln_thread_resource_info(struct mln_thread_pool_info *info);
+extern mln_thread_pool_t *mln_thread_pool_new(struct mln_thread_pool_attr *tpattr) __NONNULL1(1);
+extern int mln_thread_pool_submit(mln_thread_pool_t *tpool, void *data) __NONNULL2(1,2);
+extern int mln_thread_pool_submitn(mln_thread_pool_t *tpool, void **data, mln_size_t n) __NONNULL2(1,2);
+extern void mln_thread_pool_resource_info(mln_thread_pool_t *tpool, struct mln_thread_pool_info *info) __NONNULL1(1);
+extern void mln_thread_pool_destroy(mln_thread_pool_t *tpool);
+
+#define mln_thread_pool_future_data(f)      ((f)->data)
+#define mln_thread_pool_future_result(f)    ((f)->result)
+#define mln_thread_pool_future_cancelled(f) ((f)->cancelled)
+#define mln_thread_pool_cq_inflight(cq)     __atomic_load_n(&((cq)->inflight), __ATOMIC_ACQUIRE)
+extern mln_thread_pool_cq_t *
+mln_thread_pool_cq_new(mln_event_t *ev, mln_thread_pool_cq_handler handler, void *data) __NONNULL1(2);
+extern void mln_thread_pool_cq_free(mln_thread_pool_cq_t *cq);
+extern mln_size_t mln_thread_pool_cq_harvest(mln_thread_pool_cq_t *cq) __NONNULL1(1);
+extern mln_thread_pool_future_t *
+mln_thread_pool_async(mln_thread_pool_t *tpool, mln_thread_pool_cq_t *cq, mln_thread_task task, void *data) __NONNULL3(1,2,3);
+extern void mln_thread_pool_future_release(mln_thread_pool_future_t *f);
 #endif
 
 #endif
@@ -53,10 +53,30 @@
 #define M_WS_FLAG_END                     0x2
 #define M_WS_FLAG_CLIENT                  0x4
 #define M_WS_FLAG_SERVER                  0x8
+/*
+ * permessage-deflate (RFC 7692)
+ */
+#define M_WS_DEFLATE_MAX_MESSAGE          (16*1024*1024)
 
 typedef struct mln_websocket_s mln_websocket_t;
 typedef int (*mln_ws_extension_handle)(mln_websocket_t *);
 
+/*
+ * Local permessage-deflate preferences. 'window_bits', 'mem_level' and 'level'
+ * configure our own compressor, the peer_* fields are what we ask of the peer.
+ * Per connection memory is about 2^(window_bits+2) + 2^(mem_level+9) bytes for
+ * the compressor plus 2^peer_window_bits + 7KB for the decompressor.
+ */
+struct mln_websocket_deflate_attr {
+    mln_u32_t                window_bits;             /*9~15*/
+    mln_u32_t                peer_window_bits;        /*8~15*/
+    mln_u32_t                mem_level;               /*1~9*/
+    mln_s32_t                level;                   /*-1~9, -1 is zlib default*/
+    mln_u32_t                no_context_takeover;
+    mln_u32_t                peer_no_context_takeover;
+    mln_u64_t                max_message;             /*inflated message limit, 0 means no limit*/
+};
+
 struct mln_websocket_s {
     mln_http_t              *http;
     mln_alloc_t             *pool;
@@ -69,6 +89,7 @@ struct mln_websocket_s {
     void                    *data;
     void                    *content;
     mln_ws_extension_handle  extension_handler;
+    void                    *deflate;/*permessage-deflate context*/
     mln_u64_t                content_len;
     mln_u16_t                content_free:1;
     mln_u16_t                fin:1;
@@ -161,6 +182,8 @@ extern int mln_websocket_ping_generate(mln_websocket_t *ws, mln_chain_t **out_cn
 extern int mln_websocket_pong_generate(mln_websocket_t *ws, mln_chain_t **out_cnode, mln_u32_t flags) __NONNULL2(1,2);
 extern int mln_websocket_generate(mln_websocket_t *ws, mln_chain_t **out_cnode) __NONNULL1(1);
 extern int mln_websocket_parse(mln_websocket_t *ws, mln_chain_t **in) __NONNULL1(1);
+extern int mln_websocket_deflate_enable(mln_websocket_t *ws, struct mln_websocket_deflate_attr *attr) __NONNULL1(1);
+extern int mln_websocket_deflate_negotiated(mln_websocket_t *ws) __NONNULL1(1);
 /*
  * These are internal helpers, not part of the public API.
  * They are declared static in mln_websocket.c.
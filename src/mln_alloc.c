@@ -4,6 +4,55 @@
  */
 
 #include "mln_alloc.h"
+#include <stddef.h>
+#include <stdint.h>
+#if !defined(MSVC)
+#include <pthread.h>
+#endif
+
+#define M_ALLOC_ARENA_HDR   (sizeof(mln_alloc_blk_t) - offsetof(mln_alloc_blk_t, blk_size))
+/*
+ * The first carve starts far enough into a slab that the (partial) block
+ * header in front of it never reaches before the slab itself.
+ */
+#define M_ALLOC_ARENA_BEGIN (sizeof(mln_alloc_arena_t) > sizeof(mln_alloc_blk_t) - M_ALLOC_ARENA_HDR? \
+                             sizeof(mln_alloc_arena_t): \
+                             sizeof(mln_alloc_blk_t) - M_ALLOC_ARENA_HDR)
+
+#if !defined(MSVC) && !defined(__DEBUG__)
+/*
+ * Per-thread block caches for shared memory pools.
+ * A thread keeps one cache for every shared memory pool it has used. Each
+ * cache holds a LIFO stack of ready blocks per size class of mgr_tbl, so
+ * most mln_alloc_tcache_m/mln_alloc_tcache_free calls never take the pool
+ * lock. Misses and overflows move M_ALLOC_TCACHE_BATCH blocks at a time.
+ * Every cache of the process is also on one list under
+ * mln_alloc_tcache_lock, so that destroying a pool can detach the caches
+ * other threads still keep for it. A detached cache has a NULL pool and is
+ * only freed by its owner.
+ */
+typedef struct {
+    mln_alloc_blk_t          *head;
+    mln_u32_t                 count;
+} mln_alloc_tbin_t;
+
+struct mln_alloc_tcache_s {
+    struct mln_alloc_tcache_s *next;
+    struct mln_alloc_tcache_s *all_prev;
+    struct mln_alloc_tcache_s *all_next;
+    mln_alloc_t               *pool;
+    mln_alloc_tbin_t           bins[M_ALLOC_MGR_LEN];
+};
+
+static pthread_key_t mln_alloc_tcache_key;
+static pthread_once_t mln_alloc_tcache_once = PTHREAD_ONCE_INIT;
+static int mln_alloc_tcache_key_ok = 0;
+static __thread mln_alloc_tcache_t *mln_alloc_tcache_list = NULL;
+static pthread_mutex_t mln_alloc_tcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static mln_alloc_tcache_t *mln_alloc_tcache_all = NULL;
+
+static void mln_alloc_tcache_detach(mln_alloc_t *pool);
+#endif
 
 MLN_CHAIN_FUNC_DECLARE(static inline, \
                        mln_blk, \
@@ -14,20 +63,80 @@ MLN_CHAIN_FUNC_DECLARE(static inline, \
 MLN_CHAIN_FUNC_DECLARE(static inline, \
                        mln_alloc_shm, \
                        mln_alloc_shm_t, );
+MLN_CHAIN_FUNC_DECLARE(static inline, \
+                       mln_alloc_arena, \
+                       mln_alloc_arena_t, );
 static inline void
 mln_alloc_mgr_table_init(mln_alloc_mgr_t *tbl);
 static inline mln_alloc_mgr_t *
 mln_alloc_get_mgr_by_size(mln_alloc_mgr_t *tbl, mln_size_t size);
 static inline void *mln_alloc_shm_m(mln_alloc_t *pool, mln_size_t size);
 static inline void *mln_alloc_shm_large_m(mln_alloc_t *pool, mln_size_t size);
-static inline int mln_alloc_shm_allowed(mln_alloc_shm_t *as, mln_off_t *Boff, mln_off_t *boff, mln_size_t size);
-static inline void *mln_alloc_shm_set_bitmap(mln_alloc_shm_t *as, mln_off_t Boff, mln_off_t boff, mln_size_t size);
-static inline mln_alloc_shm_t *mln_alloc_shm_new_block(mln_alloc_t *pool, mln_off_t *Boff, mln_off_t *boff, mln_size_t size);
+static inline mln_s32_t mln_alloc_shm_allowed(mln_alloc_shm_t *as, mln_u32_t n);
+static inline void *mln_alloc_shm_set_bitmap(mln_alloc_shm_t *as, mln_u32_t off, mln_u32_t n, mln_size_t size);
 static inline void mln_alloc_free_shm(void *ptr);
+static inline void *mln_alloc_arena_m(mln_alloc_t *pool, mln_size_t size);
+static inline void mln_alloc_arena_release(mln_alloc_t *pool, mln_alloc_arena_t *a);
+
+/*
+ * Shared memory bitmap: unit u lives in bit (u & 63) of word (u >> 6).
+ * Words are scanned whole, and count-trailing-zeros walks the mixed ones.
+ */
+static inline mln_u32_t mln_alloc_shm_ctz(mln_u64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (mln_u32_t)__builtin_ctzll((unsigned long long)w);
+#else
+    mln_u32_t n = 0;
+    while (!(w & 1)) {
+        w >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+static inline mln_u32_t mln_alloc_shm_popcount(mln_u64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (mln_u32_t)__builtin_popcountll((unsigned long long)w);
+#else
+    mln_u32_t n = 0;
+    for (; w; w &= w - 1) ++n;
+    return n;
+#endif
+}
+
+static inline mln_u64_t mln_alloc_shm_mask(mln_u32_t bit, mln_u32_t n)
+{
+    return (n >= 64? ~((mln_u64_t)0): ((((mln_u64_t)1) << n) - 1)) << bit;
+}
+
+static inline void mln_alloc_shm_bits_set(mln_u64_t *bitmap, mln_u32_t off, mln_u32_t n)
+{
+    mln_u32_t bit, len;
+
+    for (; n > 0; off += len, n -= len) {
+        bit = off & 63;
+        len = 64 - bit < n? 64 - bit: n;
+        bitmap[off >> 6] |= mln_alloc_shm_mask(bit, len);
+    }
+}
+
+static inline void mln_alloc_shm_bits_clear(mln_u64_t *bitmap, mln_u32_t off, mln_u32_t n)
+{
+    mln_u32_t bit, len;
+
+    for (; n > 0; off += len, n -= len) {
+        bit = off & 63;
+        len = 64 - bit < n? 64 - bit: n;
+        bitmap[off >> 6] &= ~mln_alloc_shm_mask(bit, len);
+    }
+}
 
 static inline mln_alloc_shm_t *mln_alloc_shm_new(mln_alloc_t *pool, mln_size_t size, int is_large)
 {
-    int n, i, j;
+    int n;
     mln_alloc_shm_t *shm, *tmp;
     mln_u8ptr_t p = pool->mem + sizeof(mln_alloc_t);
 
@@ -46,6 +155,8 @@ static inline mln_alloc_shm_t *mln_alloc_shm_new(mln_alloc_t *pool, mln_size_t s
     shm->nfree = is_large ? 1: (size / M_ALLOC_SHM_BIT_SIZE);
     shm->base = shm->nfree;
     shm->large = is_large;
+    shm->nblks = 0;
+    shm->hint = 0;
     shm->prev = shm->next = NULL;
     if (tmp == NULL) {
         mln_alloc_shm_chain_add(&pool->shm_head, &pool->shm_tail, shm);
@@ -68,13 +179,7 @@ static inline mln_alloc_shm_t *mln_alloc_shm_new(mln_alloc_t *pool, mln_size_t s
         n = (sizeof(mln_alloc_shm_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
         shm->nfree -= n;
         shm->base -= n;
-        for (i = 0, j = 0; n > 0; --n) {
-            shm->bitmap[i] |= (1 << (7-j));
-            if (++j >= 8) {
-                j = 0;
-                ++i;
-            }
-        }
+        mln_alloc_shm_bits_set(shm->bitmap, 0, n);
     }
 
     return shm;
@@ -127,9 +232,17 @@ mln_alloc_t *mln_alloc_shm_init(mln_size_t capacity, void *locker, mln_alloc_shm
     return NULL;
 #endif
 #endif
+    /*
+     * The shared memory allocator does not use the size class lists, but
+     * the thread caches bin blocks by the same classes.
+     */
+    mln_alloc_mgr_table_init(pool->mgr_tbl);
     pool->parent = NULL;
     pool->large_used_head = pool->large_used_tail = NULL;
     pool->shm_head = pool->shm_tail = NULL;
+    pool->arena_head = pool->arena_tail = pool->arena_cur = NULL;
+    pool->arena_large_head = pool->arena_large_tail = NULL;
+    pool->is_arena = 0;
 #if defined(MSVC)
     pool->mem = (mln_u8ptr_t)pool;
 #else
@@ -172,6 +285,9 @@ mln_alloc_t *mln_alloc_init(mln_alloc_t *parent, mln_size_t capacity)
     pool->parent = parent;
     pool->large_used_head = pool->large_used_tail = NULL;
     pool->shm_head = pool->shm_tail = NULL;
+    pool->arena_head = pool->arena_tail = pool->arena_cur = NULL;
+    pool->arena_large_head = pool->arena_large_tail = NULL;
+    pool->is_arena = 0;
     pool->mem = NULL;
     pool->capacity = capacity;
     pool->in_used = 0;
@@ -181,6 +297,13 @@ mln_alloc_t *mln_alloc_init(mln_alloc_t *parent, mln_size_t capacity)
     return pool;
 }
 
+mln_alloc_t *mln_alloc_arena_init(mln_alloc_t *parent, mln_size_t capacity)
+{
+    mln_alloc_t *pool = mln_alloc_init(parent, capacity);
+    if (pool != NULL) pool->is_arena = 1;
+    return pool;
+}
+
 MLN_FUNC_VOID(static inline, void, mln_alloc_mgr_table_init, (mln_alloc_mgr_t *tbl), (tbl), {
     int i, j;
     mln_size_t blk_size;
@@ -193,11 +316,13 @@ MLN_FUNC_VOID(static inline, void, mln_alloc_mgr_table_init, (mln_alloc_mgr_t *t
         am = &tbl[i];
         am->free_head = am->free_tail = NULL;
         am->chunk_head = am->chunk_tail = NULL;
+        am->free_count = 0;
         am->blk_size = blk_size + 1;
         if (i != 0) {
             amprev = &tbl[i-1];
             amprev->free_head = amprev->free_tail = NULL;
             amprev->chunk_head = amprev->chunk_tail = NULL;
+            amprev->free_count = 0;
             amprev->blk_size = (am->blk_size + tbl[i-2].blk_size) >> 1;
         }
     }
@@ -215,6 +340,15 @@ void mln_alloc_destroy(mln_alloc_t *pool)
         mln_alloc_mgr_t *am, *amend;
         amend = pool->mgr_tbl + M_ALLOC_MGR_LEN;
         mln_alloc_chunk_t *ch;
+        mln_alloc_arena_t *a;
+        while ((a = pool->arena_head) != NULL) {
+            mln_alloc_arena_chain_del(&(pool->arena_head), &(pool->arena_tail), a);
+            mln_alloc_arena_release(pool, a);
+        }
+        while ((a = pool->arena_large_head) != NULL) {
+            mln_alloc_arena_chain_del(&(pool->arena_large_head), &(pool->arena_large_tail), a);
+            mln_alloc_arena_release(pool, a);
+        }
         for (am = pool->mgr_tbl; am < amend; ++am) {
             while ((ch = am->chunk_head) != NULL) {
                 mln_chunk_chain_del(&(am->chunk_head), &(am->chunk_tail), ch);
@@ -230,6 +364,9 @@ void mln_alloc_destroy(mln_alloc_t *pool)
         if (parent != NULL) mln_alloc_free(pool);
         else free(pool);
     } else {
+#if !defined(MSVC) && !defined(__DEBUG__)
+        mln_alloc_tcache_detach(pool);
+#endif
 #if defined(MSVC)
         HANDLE handle = pool->map_handle;
         UnmapViewOfFile(pool->mem);
@@ -258,6 +395,9 @@ void *mln_alloc_m(mln_alloc_t *pool, mln_size_t size)
     if (pool->mem != NULL) {
         return mln_alloc_shm_m(pool, size);
     }
+    if (pool->is_arena) {
+        return mln_alloc_arena_m(pool, size);
+    }
 
     am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, size);
 
@@ -296,6 +436,7 @@ void *mln_alloc_m(mln_alloc_t *pool, mln_size_t size)
         blk->blk_size = size - (sizeof(mln_alloc_chunk_t) + sizeof(mln_alloc_blk_t));
         blk->is_large = 1;
         blk->in_used = 1;
+        blk->is_arena = 0;
         ch->blks[0] = blk;
         return blk->data;
     }
@@ -357,7 +498,7 @@ oom:
                 blk->data = ptr + sizeof(mln_alloc_blk_t);
                 blk->chunk = ch;
                 blk->blk_size = am->blk_size;
-                blk->is_large = blk->in_used = 0;
+                blk->is_large = blk->in_used = blk->is_arena = 0;
                 ch->blks[n] = blk;
                 prev_blk = blk;
                 ptr += size;
@@ -460,7 +601,24 @@ void *mln_alloc_re(mln_alloc_t *pool, void *ptr, mln_size_t size)
     }
 
     mln_alloc_blk_t *old_blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
-    if (old_blk->pool == pool && old_blk->blk_size >= size) {
+    if (old_blk->is_arena) {
+        /*
+         * Arena memory has no owner pointer. Growing in place is only
+         * possible for the most recent carve of the current slab.
+         */
+        mln_alloc_arena_t *a = pool->arena_cur;
+        if (old_blk->blk_size >= size) return ptr;
+        if (pool->is_arena && a != NULL && \
+            (mln_u8ptr_t)ptr + old_blk->blk_size == (mln_u8ptr_t)a + a->pos)
+        {
+            mln_size_t n = (size + M_ALLOC_ARENA_ALIGN - 1) & ~((mln_size_t)M_ALLOC_ARENA_ALIGN - 1);
+            if ((mln_u8ptr_t)ptr + n <= (mln_u8ptr_t)a + a->size) {
+                a->pos += n - old_blk->blk_size;
+                old_blk->blk_size = n;
+                return ptr;
+            }
+        }
+    } else if (old_blk->pool == pool && old_blk->blk_size >= size) {
         return ptr;
     }
 
@@ -489,6 +647,7 @@ void mln_alloc_free(void *ptr)
     mln_size_t size;
 
     blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+    if (blk->is_arena) return;
     size = blk->chunk->size;
 
     ASSERT(blk->in_used);
@@ -566,27 +725,42 @@ void mln_alloc_free(void *ptr)
 
 MLN_FUNC(static inline, void *, mln_alloc_shm_m, (mln_alloc_t *pool, mln_size_t size), (pool, size), {
     mln_alloc_shm_t *as;
-    mln_off_t Boff = -1, boff = -1;
+    mln_alloc_mgr_t *am;
+    mln_alloc_blk_t *blk;
+    mln_s32_t off = -1;
+    mln_u32_t n;
 
     if (size > M_ALLOC_SHM_LARGE_SIZE) {
         return mln_alloc_shm_large_m(pool, size);
     }
 
-    if (pool->shm_head == NULL) {
-new_block:
-        as = mln_alloc_shm_new_block(pool, &Boff, &boff, size);
-        if (as == NULL) {
-            return NULL;
+    /*
+     * Small requests are rounded up to a size class so that freed blocks
+     * can be handed out again straight from the per-class free list.
+     */
+    am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, size);
+    if (am != NULL && am->blk_size <= M_ALLOC_SHM_CLASS_BLK_SIZE) {
+        if ((blk = am->free_head) != NULL) {
+            am->free_head = blk->next;
+            --(am->free_count);
+            blk->in_used = 1;
+            ++(((mln_alloc_shm_t *)(blk->chunk))->nblks);
+            return blk->data;
         }
-    } else {
-        for (as = pool->shm_head; as != NULL; as = as->next) {
-            if (mln_alloc_shm_allowed(as, &Boff, &boff, size)) {
-                break;
-            }
+        size = am->blk_size;
+    }
+
+    n = (size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
+    for (as = pool->shm_head; as != NULL; as = as->next) {
+        if ((off = mln_alloc_shm_allowed(as, n)) >= 0) break;
+    }
+    if (as == NULL) {
+        if ((as = mln_alloc_shm_new(pool, M_ALLOC_SHM_DEFAULT_SIZE, 0)) == NULL) {
+            return NULL;
         }
-        if (as == NULL) goto new_block;
+        if ((off = mln_alloc_shm_allowed(as, n)) < 0) return NULL;
     }
-    return mln_alloc_shm_set_bitmap(as, Boff, boff, size);
+    return mln_alloc_shm_set_bitmap(as, (mln_u32_t)off, n, size);
 })
 
 static inline void *mln_alloc_shm_large_m(mln_alloc_t *pool, mln_size_t size)
@@ -608,136 +782,130 @@ static inline void *mln_alloc_shm_large_m(mln_alloc_t *pool, mln_size_t size)
     return blk->data;
 }
 
-MLN_FUNC(static inline, mln_alloc_shm_t *, mln_alloc_shm_new_block, \
-         (mln_alloc_t *pool, mln_off_t *Boff, mln_off_t *boff, mln_size_t size), \
-         (pool, Boff, boff, size), \
-{
-    mln_alloc_shm_t *ret;
-    if ((ret = mln_alloc_shm_new(pool, M_ALLOC_SHM_DEFAULT_SIZE, 0)) == NULL) {
-        return NULL;
-    }
-    mln_alloc_shm_allowed(ret, Boff, boff, size);
-    return ret;
-})
+/*
+ * First fit for n free units, returns the first unit or -1. Full words are
+ * skipped whole, and hint remembers the first word that may have room.
+ */
+MLN_FUNC(static inline, mln_s32_t, mln_alloc_shm_allowed, (mln_alloc_shm_t *as, mln_u32_t n), (as, n), {
+    mln_u64_t *bitmap = as->bitmap, w;
+    mln_u32_t i, bit, len, run = 0, start = 0;
+    mln_u32_t nwords = M_ALLOC_SHM_BITMAP_LEN >> 3;
 
-MLN_FUNC(static inline, int, mln_alloc_shm_allowed, \
-         (mln_alloc_shm_t *as, mln_off_t *Boff, mln_off_t *boff, mln_size_t size), \
-         (as, Boff, boff, size), \
-{
-    int i, j = -1, s = -1;
-    int n = (size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
-    mln_u8ptr_t p, pend, save = NULL;
+    if (n > as->nfree) return -1;
 
-    if (n > as->nfree) return 0;
+    while (as->hint < nwords && bitmap[as->hint] == ~((mln_u64_t)0))
+        ++(as->hint);
 
-    p = as->bitmap;
-    for (pend = p + M_ALLOC_SHM_BITMAP_LEN; p < pend; ++p) {
-        if ((*p & 0xff) == 0xff) {
-            if (save != NULL) {
-                j = -1;
-                s = -1;
-                save = NULL;
-            }
+    for (i = as->hint; i < nwords; ++i) {
+        w = bitmap[i];
+        if (w == 0) {
+            if (!run) start = i << 6;
+            if ((run += 64) >= n) return (mln_s32_t)start;
             continue;
         }
-
-        for (i = 7; i >= 0; --i) {
-            if (!(*p & ((mln_u8_t)1 << i))) {
-                if (save == NULL) {
-                    j = n;
-                    s = i;
-                    save = p;
-                }
-                if (--j <= 0) {
-                    break;
-                }
-            } else if (save != NULL) {
-                j = -1;
-                s = -1;
-                save = NULL;
-            }
+        if (w == ~((mln_u64_t)0)) {
+            run = 0;
+            continue;
         }
-
-        if (save != NULL && !j) {
-            *Boff = save - as->bitmap;
-            *boff = s;
-            return 1;
+        for (bit = 0; bit < 64; bit += len) {
+            w = bitmap[i] >> bit;
+            if (w & 1) {
+                run = 0;
+                len = mln_alloc_shm_ctz(~w);
+                continue;
+            }
+            len = w? mln_alloc_shm_ctz(w): 64 - bit;
+            if (!run) start = (i << 6) + bit;
+            if ((run += len) >= n) return (mln_s32_t)start;
         }
     }
-    return 0;
+    return -1;
 })
 
 MLN_FUNC(static inline, void *, mln_alloc_shm_set_bitmap, \
-         (mln_alloc_shm_t *as, mln_off_t Boff, mln_off_t boff, mln_size_t size), \
-         (as, Boff, boff, size), \
+         (mln_alloc_shm_t *as, mln_u32_t off, mln_u32_t n, mln_size_t size), \
+         (as, off, n, size), \
 {
-    int i, n = (size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
-    mln_u8ptr_t p, pend, addr;
+    mln_u8ptr_t addr;
     mln_alloc_blk_t *blk;
 
-    addr = as->addr + (Boff * 8 + (7 - boff)) * M_ALLOC_SHM_BIT_SIZE;
+    addr = as->addr + off * M_ALLOC_SHM_BIT_SIZE;
     blk = (mln_alloc_blk_t *)addr;
     memset(blk, 0, sizeof(mln_alloc_blk_t));
     blk->pool = as->pool;
     blk->data = addr + sizeof(mln_alloc_blk_t);
     blk->chunk = (mln_alloc_chunk_t *)as;
     blk->blk_size = size;
-    blk->padding = ((Boff & 0xffff) << 8) | (boff & 0xff);
+    blk->padding = off;
     blk->is_large = 0;
     blk->in_used = 1;
-    p = as->bitmap + Boff;
-    pend = p + M_ALLOC_SHM_BITMAP_LEN;
-    for (i = boff; p < pend;) {
-        *p |= ((mln_u8_t)1 << i);
-        --as->nfree;
-        if (--n <= 0) break;
-        if (--i < 0) {
-            i = 7;
-            ++p;
-        }
-    }
+    mln_alloc_shm_bits_set(as->bitmap, off, n);
+    as->nfree -= n;
+    ++(as->nblks);
 
     return blk->data;
 })
 
+static inline void mln_alloc_shm_unmark(mln_alloc_shm_t *as, mln_alloc_blk_t *blk)
+{
+    mln_u32_t off = blk->padding;
+    mln_u32_t n = (blk->blk_size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
+
+    mln_alloc_shm_bits_clear(as->bitmap, off, n);
+    as->nfree += n;
+    if ((off >> 6) < as->hint) as->hint = off >> 6;
+}
+
+/*
+ * Every block of a sub-block still allocated is sitting in the per-class
+ * free lists. Pull them out so the sub-block can be given back.
+ */
+MLN_FUNC_VOID(static inline, void, mln_alloc_shm_purge, (mln_alloc_t *pool, mln_alloc_shm_t *as), (pool, as), {
+    mln_alloc_mgr_t *am, *amend = pool->mgr_tbl + M_ALLOC_MGR_LEN;
+    mln_alloc_blk_t **pp, *blk;
+
+    for (am = pool->mgr_tbl; am < amend && am->blk_size <= M_ALLOC_SHM_CLASS_BLK_SIZE; ++am) {
+        for (pp = &(am->free_head); (blk = *pp) != NULL;) {
+            if ((mln_alloc_shm_t *)(blk->chunk) != as) {
+                pp = &(blk->next);
+                continue;
+            }
+            *pp = blk->next;
+            --(am->free_count);
+            mln_alloc_shm_unmark(as, blk);
+        }
+    }
+})
+
 MLN_FUNC_VOID(static inline, void, mln_alloc_free_shm, (void *ptr), (ptr), {
     mln_alloc_blk_t *blk;
     mln_alloc_shm_t *as;
-    mln_off_t Boff, boff;
-    mln_u8ptr_t p, pend;
-    int i, n;
+    mln_alloc_mgr_t *am;
+    mln_alloc_t *pool;
 
     blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
     as = (mln_alloc_shm_t *)(blk->chunk);
+    pool = as->pool;
     if (!as->large) {
-        Boff = (blk->padding >> 8) & 0xffff;
-        boff = blk->padding & 0xff;
         blk->in_used = 0;
-        p = as->bitmap + Boff;
-        n = (blk->blk_size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE;
-        i = boff;
-        for (pend = as->bitmap+M_ALLOC_SHM_BITMAP_LEN; p < pend;) {
-            *p &= (~((mln_u8_t)1 << i));
-            ++as->nfree;
-            if (--n <= 0) break;
-            if (--i < 0) {
-                i = 7;
-                ++p;
+        --(as->nblks);
+        if (as->nblks && blk->blk_size <= M_ALLOC_SHM_CLASS_BLK_SIZE) {
+            am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, blk->blk_size);
+            if (am->blk_size == blk->blk_size && am->free_count < M_ALLOC_SHM_CLASS_MAX) {
+                blk->next = am->free_head;
+                am->free_head = blk;
+                ++(am->free_count);
+                return;
             }
         }
+        mln_alloc_shm_unmark(as, blk);
+        if (!as->nblks && as->nfree != as->base) mln_alloc_shm_purge(pool, as);
     }
     if (as->large || as->nfree == as->base) {
-        mln_alloc_shm_chain_del(&as->pool->shm_head, &as->pool->shm_tail, as);
+        mln_alloc_shm_chain_del(&pool->shm_head, &pool->shm_tail, as);
     }
 })
 
-static inline mln_u8_t mln_alloc_shm_count_bits(mln_u8_t n) {
-    n = n - ((n >> 1) & 0x55);
-    n = (n & 0x33) + ((n >> 2) & 0x33);
-    n = (n + (n >> 4)) & 0x0F;
-    return n;
-}
-
 mln_size_t mln_alloc_available_capacity(mln_alloc_t *pool)
 {
     if (pool->mem == NULL) {
@@ -745,19 +913,464 @@ mln_size_t mln_alloc_available_capacity(mln_alloc_t *pool)
     }
 
     mln_alloc_shm_t *as = pool->shm_head;
-    mln_u8ptr_t p, pend;
-    mln_size_t sum = 0;
+    mln_alloc_mgr_t *am, *amend = pool->mgr_tbl + M_ALLOC_MGR_LEN;
+    mln_u64_t *p, *pend;
+    mln_size_t sum = 0, cached = 0;
 
     for (; as != NULL; as = as->next) {
+        if (as->large) continue;
         p = as->bitmap;
-        for (pend = p + M_ALLOC_SHM_BITMAP_LEN; p < pend; ++p) {
-            sum += (mln_size_t)mln_alloc_shm_count_bits(*p);
+        for (pend = p + (M_ALLOC_SHM_BITMAP_LEN >> 3); p < pend; ++p) {
+            sum += (mln_size_t)mln_alloc_shm_popcount(*p);
         }
     }
-    sum = (((mln_size_t)M_ALLOC_SHM_BITMAP_LEN) << 3) - sum;
+    /* blocks parked in the per-class free lists are available too */
+    for (am = pool->mgr_tbl; am < amend && am->blk_size <= M_ALLOC_SHM_CLASS_BLK_SIZE; ++am) {
+        cached += am->free_count * \
+                  ((am->blk_size+sizeof(mln_alloc_blk_t)+M_ALLOC_SHM_BIT_SIZE-1) / M_ALLOC_SHM_BIT_SIZE);
+    }
+    sum = (((mln_size_t)M_ALLOC_SHM_BITMAP_LEN) << 3) - (sum - cached);
     return sum * M_ALLOC_SHM_BIT_SIZE;
 }
 
+/*
+ * arena
+ */
+MLN_FUNC(static inline, mln_alloc_arena_t *, mln_alloc_arena_new, (mln_alloc_t *pool, mln_size_t size), (pool, size), {
+    mln_alloc_arena_t *a;
+
+    if (pool->capacity) {
+        if (size + pool->in_used > pool->capacity)
+            return NULL;
+    }
+
+    if (pool->parent != NULL) {
+        if (mln_alloc_is_shm(pool->parent)) {
+            if (pool->parent->lock(pool->parent->locker) != 0)
+                return NULL;
+        }
+        a = (mln_alloc_arena_t *)mln_alloc_m(pool->parent, size);
+        if (mln_alloc_is_shm(pool->parent)) {
+            (void)pool->parent->unlock(pool->parent->locker);
+        }
+    } else {
+        a = (mln_alloc_arena_t *)malloc(size);
+    }
+    if (a == NULL) return NULL;
+
+    if (pool->capacity) pool->in_used += size;
+    a->prev = a->next = NULL;
+    a->size = size;
+    a->pos = M_ALLOC_ARENA_BEGIN;
+    return a;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_alloc_arena_release, (mln_alloc_t *pool, mln_alloc_arena_t *a), (pool, a), {
+    if (pool->capacity) {
+        ASSERT(pool->in_used >= a->size);
+        pool->in_used -= a->size;
+    }
+    if (pool->parent != NULL) {
+        if (mln_alloc_is_shm(pool->parent)) {
+            if (pool->parent->lock(pool->parent->locker) != 0)
+                return;
+        }
+        mln_alloc_free(a);
+        if (mln_alloc_is_shm(pool->parent)) {
+            (void)pool->parent->unlock(pool->parent->locker);
+        }
+    } else {
+        free(a);
+    }
+})
+
+MLN_FUNC(static inline, void *, mln_alloc_arena_carve, (mln_alloc_arena_t *a, mln_size_t size), (a, size), {
+    mln_u8ptr_t p = (mln_u8ptr_t)a + a->pos + M_ALLOC_ARENA_HDR;
+    mln_alloc_blk_t *blk;
+
+    p = (mln_u8ptr_t)(((uintptr_t)p + M_ALLOC_ARENA_ALIGN - 1) & ~((uintptr_t)M_ALLOC_ARENA_ALIGN - 1));
+    if (p + size > (mln_u8ptr_t)a + a->size) return NULL;
+    a->pos = (p + size) - (mln_u8ptr_t)a;
+
+    /* only the trailing blk_size and flag words lie inside the slab */
+    blk = (mln_alloc_blk_t *)(p - sizeof(mln_alloc_blk_t));
+    blk->blk_size = size;
+    blk->is_large = 0;
+    blk->in_used = 1;
+    blk->is_arena = 1;
+    blk->padding = 0;
+    return p;
+})
+
+MLN_FUNC(static inline, void *, mln_alloc_arena_m, (mln_alloc_t *pool, mln_size_t size), (pool, size), {
+    mln_alloc_arena_t *a = pool->arena_cur;
+    void *p;
+
+    size = (size + M_ALLOC_ARENA_ALIGN - 1) & ~((mln_size_t)M_ALLOC_ARENA_ALIGN - 1);
+
+    if (size > (M_ALLOC_ARENA_SLAB_SIZE >> 2)) {
+        a = mln_alloc_arena_new(pool, M_ALLOC_ARENA_BEGIN + M_ALLOC_ARENA_HDR + M_ALLOC_ARENA_ALIGN + size);
+        if (a == NULL) return NULL;
+        mln_alloc_arena_chain_add(&(pool->arena_large_head), &(pool->arena_large_tail), a);
+        return mln_alloc_arena_carve(a, size);
+    }
+
+    if (a != NULL && (p = mln_alloc_arena_carve(a, size)) != NULL)
+        return p;
+
+    /* slabs after the current one are left over from before the last reset */
+    if (a != NULL && a->next != NULL) {
+        a = a->next;
+        a->pos = M_ALLOC_ARENA_BEGIN;
+    } else {
+        if ((a = mln_alloc_arena_new(pool, M_ALLOC_ARENA_SLAB_SIZE)) == NULL)
+            return NULL;
+        mln_alloc_arena_chain_add(&(pool->arena_head), &(pool->arena_tail), a);
+    }
+    pool->arena_cur = a;
+    return mln_alloc_arena_carve(a, size);
+})
+
+void mln_alloc_reset(mln_alloc_t *pool)
+{
+    mln_alloc_arena_t *a;
+
+    if (!pool->is_arena) return;
+
+    while ((a = pool->arena_large_head) != NULL) {
+        mln_alloc_arena_chain_del(&(pool->arena_large_head), &(pool->arena_large_tail), a);
+        mln_alloc_arena_release(pool, a);
+    }
+    if ((a = pool->arena_cur = pool->arena_head) != NULL)
+        a->pos = M_ALLOC_ARENA_BEGIN;
+}
+
+/*
+ * thread cache
+ */
+#if !defined(MSVC) && !defined(__DEBUG__)
+MLN_FUNC_VOID(static inline, void, mln_alloc_tcache_drain, \
+              (mln_alloc_tbin_t *bin, mln_u32_t n), (bin, n), \
+{
+    mln_alloc_blk_t *blk;
+
+    for (; n > 0 && (blk = bin->head) != NULL; --n) {
+        bin->head = blk->next;
+        --(bin->count);
+        mln_alloc_free_shm(blk->data);
+    }
+})
+
+MLN_FUNC_VOID(static inline, void, mln_alloc_tcache_drain_all, (mln_alloc_tcache_t *tc), (tc), {
+    mln_alloc_tbin_t *bin, *end = tc->bins + M_ALLOC_MGR_LEN;
+
+    for (bin = tc->bins; bin < end; ++bin) {
+        mln_alloc_tcache_drain(bin, bin->count);
+    }
+})
+
+#define mln_alloc_tcache_pool(tc) __atomic_load_n(&((tc)->pool), __ATOMIC_RELAXED)
+
+/*
+ * The all list helpers and everything that may meet a detached cache run
+ * under mln_alloc_tcache_lock.
+ */
+static inline void mln_alloc_tcache_all_add(mln_alloc_tcache_t *tc)
+{
+    tc->all_prev = NULL;
+    if ((tc->all_next = mln_alloc_tcache_all) != NULL)
+        tc->all_next->all_prev = tc;
+    mln_alloc_tcache_all = tc;
+}
+
+static inline void mln_alloc_tcache_all_del(mln_alloc_tcache_t *tc)
+{
+    if (tc->all_prev == NULL) mln_alloc_tcache_all = tc->all_next;
+    else tc->all_prev->all_next = tc->all_next;
+    if (tc->all_next != NULL) tc->all_next->all_prev = tc->all_prev;
+}
+
+static void mln_alloc_tcache_exit(void *data)
+{
+    mln_alloc_tcache_t *tc, *next;
+
+    (void)pthread_mutex_lock(&mln_alloc_tcache_lock);
+    for (tc = (mln_alloc_tcache_t *)data; tc != NULL; tc = next) {
+        next = tc->next;
+        if (tc->pool != NULL && tc->pool->lock(tc->pool->locker) == 0) {
+            mln_alloc_tcache_drain_all(tc);
+            (void)tc->pool->unlock(tc->pool->locker);
+        }
+        mln_alloc_tcache_all_del(tc);
+        free(tc);
+    }
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+    mln_alloc_tcache_list = NULL;
+}
+
+static void mln_alloc_tcache_atfork_prepare(void)
+{
+    (void)pthread_mutex_lock(&mln_alloc_tcache_lock);
+}
+
+static void mln_alloc_tcache_atfork_parent(void)
+{
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+}
+
+/*
+ * A forked child inherits every thread's caches, but the cached blocks still
+ * belong to the parent. Drop the copies without returning them to the pool.
+ */
+static void mln_alloc_tcache_atfork_child(void)
+{
+    mln_alloc_tcache_t *tc;
+
+    while ((tc = mln_alloc_tcache_all) != NULL) {
+        mln_alloc_tcache_all = tc->all_next;
+        free(tc);
+    }
+    mln_alloc_tcache_list = NULL;
+    if (mln_alloc_tcache_key_ok)
+        (void)pthread_setspecific(mln_alloc_tcache_key, NULL);
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+}
+
+static void mln_alloc_tcache_init(void)
+{
+    if (pthread_key_create(&mln_alloc_tcache_key, mln_alloc_tcache_exit) != 0)
+        return;
+    if (pthread_atfork(mln_alloc_tcache_atfork_prepare, \
+                       mln_alloc_tcache_atfork_parent, \
+                       mln_alloc_tcache_atfork_child) != 0)
+    {
+        (void)pthread_key_delete(mln_alloc_tcache_key);
+        return;
+    }
+    mln_alloc_tcache_key_ok = 1;
+}
+
+/*
+ * Unlink tc from the calling thread's list. Called with
+ * mln_alloc_tcache_lock held.
+ */
+static inline void mln_alloc_tcache_del(mln_alloc_tcache_t *tc, mln_alloc_tcache_t *prev)
+{
+    if (prev == NULL) {
+        mln_alloc_tcache_list = tc->next;
+        (void)pthread_setspecific(mln_alloc_tcache_key, mln_alloc_tcache_list);
+    } else {
+        prev->next = tc->next;
+    }
+    mln_alloc_tcache_all_del(tc);
+    free(tc);
+}
+
+MLN_FUNC(static inline, mln_alloc_tcache_t *, mln_alloc_tcache_get, (mln_alloc_t *pool), (pool), {
+    mln_alloc_tcache_t *tc, *prev, *next;
+
+    for (tc = mln_alloc_tcache_list; tc != NULL; tc = tc->next) {
+        if (mln_alloc_tcache_pool(tc) == pool) return tc;
+    }
+
+    (void)pthread_once(&mln_alloc_tcache_once, mln_alloc_tcache_init);
+    if (!mln_alloc_tcache_key_ok) return NULL;
+
+    if ((tc = (mln_alloc_tcache_t *)calloc(1, sizeof(mln_alloc_tcache_t))) == NULL)
+        return NULL;
+    tc->pool = pool;
+
+    (void)pthread_mutex_lock(&mln_alloc_tcache_lock);
+    /*drop the caches of pools destroyed since*/
+    for (prev = NULL, next = mln_alloc_tcache_list; next != NULL; ) {
+        mln_alloc_tcache_t *cur = next;
+        next = cur->next;
+        if (cur->pool == NULL) mln_alloc_tcache_del(cur, prev);
+        else prev = cur;
+    }
+    tc->next = mln_alloc_tcache_list;
+    if (pthread_setspecific(mln_alloc_tcache_key, tc) != 0) {
+        (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+        free(tc);
+        return NULL;
+    }
+    mln_alloc_tcache_all_add(tc);
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+    mln_alloc_tcache_list = tc;
+    return tc;
+})
+
+MLN_FUNC(static inline, int, mln_alloc_tcache_unlink, (mln_alloc_t *pool), (pool), {
+    mln_alloc_tcache_t *tc, *prev = NULL;
+    int rc = 0;
+
+    (void)pthread_mutex_lock(&mln_alloc_tcache_lock);
+    for (tc = mln_alloc_tcache_list; tc != NULL; prev = tc, tc = tc->next) {
+        if (tc->pool == pool) break;
+    }
+    if (tc == NULL) {
+        (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+        return 0;
+    }
+    if (pool->lock(pool->locker) == 0) {
+        mln_alloc_tcache_drain_all(tc);
+        (void)pool->unlock(pool->locker);
+        mln_alloc_tcache_del(tc, prev);
+    } else {
+        rc = -1;
+    }
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+    return rc;
+})
+
+/*
+ * The pool is going away, so nothing is drained: the caches of every thread
+ * just stop referring to it. Their owners free them later.
+ */
+static void mln_alloc_tcache_detach(mln_alloc_t *pool)
+{
+    mln_alloc_tcache_t *tc;
+
+    (void)pthread_mutex_lock(&mln_alloc_tcache_lock);
+    for (tc = mln_alloc_tcache_all; tc != NULL; tc = tc->all_next) {
+        if (tc->pool == pool) __atomic_store_n(&(tc->pool), NULL, __ATOMIC_RELAXED);
+    }
+    (void)pthread_mutex_unlock(&mln_alloc_tcache_lock);
+}
+
+MLN_FUNC(static inline, void *, mln_alloc_tcache_refill, \
+         (mln_alloc_tcache_t *tc, mln_alloc_tbin_t *bin, mln_size_t size), \
+         (tc, bin, size), \
+{
+    mln_alloc_t *pool = tc->pool;
+    mln_alloc_blk_t *blk;
+    void *ptr;
+    int n;
+
+    if (pool->lock(pool->locker) != 0) return NULL;
+    for (n = 0; n < M_ALLOC_TCACHE_BATCH; ++n) {
+        if ((ptr = mln_alloc_shm_m(pool, size)) == NULL) break;
+        blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+        blk->next = bin->head;
+        bin->head = blk;
+        ++(bin->count);
+    }
+    if (bin->head == NULL) {
+        /*
+         * The pool is exhausted. Give back whatever this thread holds in
+         * other classes and try once more.
+         */
+        mln_alloc_tcache_drain_all(tc);
+        if ((ptr = mln_alloc_shm_m(pool, size)) != NULL) {
+            blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+            blk->next = NULL;
+            bin->head = blk;
+            bin->count = 1;
+        }
+    }
+    (void)pool->unlock(pool->locker);
+
+    if ((blk = bin->head) == NULL) return NULL;
+    bin->head = blk->next;
+    --(bin->count);
+    return blk->data;
+})
+#endif
+
+void *mln_alloc_tcache_m(mln_alloc_t *pool, mln_size_t size)
+{
+#ifdef __DEBUG__
+    return malloc(size);
+#else
+    void *ptr;
+
+    if (pool->mem == NULL) return mln_alloc_m(pool, size);
+
+#if !defined(MSVC)
+    mln_alloc_mgr_t *am;
+    mln_alloc_tcache_t *tc;
+    mln_alloc_tbin_t *bin;
+    mln_alloc_blk_t *blk;
+
+    am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, size);
+    if (am != NULL && am->blk_size <= M_ALLOC_TCACHE_BLK_SIZE && (tc = mln_alloc_tcache_get(pool)) != NULL) {
+        bin = &(tc->bins[am - pool->mgr_tbl]);
+        if ((blk = bin->head) == NULL)
+            return mln_alloc_tcache_refill(tc, bin, am->blk_size);
+        bin->head = blk->next;
+        --(bin->count);
+        return blk->data;
+    }
+#endif
+
+    if (pool->lock(pool->locker) != 0) return NULL;
+    ptr = mln_alloc_shm_m(pool, size);
+    (void)pool->unlock(pool->locker);
+    return ptr;
+#endif
+}
+
+void mln_alloc_tcache_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+#ifdef __DEBUG__
+    return free(ptr);
+#else
+    mln_alloc_blk_t *blk;
+    mln_alloc_t *pool;
+
+    blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+    if (blk->is_arena) return;
+    pool = blk->pool;
+    if (pool->mem == NULL) {
+        mln_alloc_free(ptr);
+        return;
+    }
+
+#if !defined(MSVC)
+    mln_alloc_mgr_t *am;
+    mln_alloc_tcache_t *tc;
+    mln_alloc_tbin_t *bin;
+
+    /*
+     * Only blocks whose size is exactly a class size may be cached,
+     * otherwise a later request of that class could overrun them.
+     */
+    if (!blk->is_large && blk->blk_size <= M_ALLOC_TCACHE_BLK_SIZE && \
+        (am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, blk->blk_size)) != NULL && \
+        am->blk_size == blk->blk_size && \
+        (tc = mln_alloc_tcache_get(pool)) != NULL)
+    {
+        bin = &(tc->bins[am - pool->mgr_tbl]);
+        if (bin->count >= M_ALLOC_TCACHE_MAX && pool->lock(pool->locker) == 0) {
+            mln_alloc_tcache_drain(bin, M_ALLOC_TCACHE_BATCH);
+            (void)pool->unlock(pool->locker);
+        }
+        blk->next = bin->head;
+        bin->head = blk;
+        ++(bin->count);
+        return;
+    }
+#endif
+
+    if (pool->lock(pool->locker) != 0) return;
+    mln_alloc_free_shm(ptr);
+    (void)pool->unlock(pool->locker);
+#endif
+}
+
+void mln_alloc_tcache_flush(mln_alloc_t *pool)
+{
+#if !defined(MSVC) && !defined(__DEBUG__)
+    if (pool->mem == NULL) return;
+    (void)mln_alloc_tcache_unlink(pool);
+#else
+    (void)pool;
+#endif
+}
+
 /*
  * chain
  */
@@ -776,4 +1389,9 @@ MLN_CHAIN_FUNC_DEFINE(static inline, \
                       mln_alloc_shm_t, \
                       prev, \
                       next);
+MLN_CHAIN_FUNC_DEFINE(static inline, \
+                      mln_alloc_arena, \
+                      mln_alloc_arena_t, \
+                      prev, \
+                      next);
 
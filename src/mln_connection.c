@@ -23,9 +23,16 @@
 #include "mln_func.h"
 #if defined(MLN_WRITEV)
 #include <sys/uio.h>
+#include <limits.h>
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define M_C_IOV_MAX IOV_MAX
+#else
+#define M_C_IOV_MAX 1024
+#endif
 #endif
 #if defined(MLN_SENDFILE)
 #include <sys/sendfile.h>
+#define M_C_SENDFILE_MAX 0x7ffff000
 #endif
 
 
@@ -39,8 +46,18 @@ mln_tcp_conn_recv_chain_file(int sockfd, \
                              mln_alloc_t *pool, \
                              mln_buf_t *b, \
                              mln_buf_t *last);
+static inline mln_chain_t *
+mln_tcp_conn_recv_node_get(mln_tcp_conn_t *tc, mln_size_t size);
+static inline void
+mln_tcp_conn_recv_node_put(mln_tcp_conn_t *tc, mln_chain_t *c);
+static inline int
+mln_tcp_conn_recv_chain_mem(mln_tcp_conn_t *tc);
+#if defined(MLN_WRITEV)
 static inline int
-mln_tcp_conn_recv_chain_mem(int sockfd, mln_alloc_t *pool, mln_buf_t *b);
+mln_tcp_conn_send_iov_fill(mln_tcp_conn_t *tc, struct iovec *vector, mln_size_t *total);
+static inline int
+mln_tcp_conn_send_iov_advance(mln_tcp_conn_t *tc, mln_size_t n);
+#endif
 static inline int
 mln_tcp_conn_send_chain_memory(mln_tcp_conn_t *tc);
 static inline int
@@ -70,6 +87,9 @@ MLN_FUNC(, int, mln_tcp_conn_init, (mln_tcp_conn_t *tc, int sockfd), (tc, sockfd
     tc->rcv_head = tc->rcv_tail = NULL;
     tc->snd_head = tc->snd_tail = NULL;
     tc->sent_head = tc->sent_tail = NULL;
+    tc->free_head = NULL;
+    tc->free_cnt = 0;
+    tc->rcv_size = M_C_RECV_MIN;
     tc->sockfd = sockfd;
     tc->nonblock = mln_fd_is_nonblock(sockfd);
     return 0;
@@ -108,6 +128,9 @@ MLN_FUNC_VOID(, void, mln_tcp_conn_destroy, (mln_tcp_conn_t *tc), (tc), {
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_SEND));
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_RECV));
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_SENT));
+    mln_chain_pool_release_all(tc->free_head);
+    tc->free_head = NULL;
+    tc->free_cnt = 0;
     mln_alloc_destroy(tc->pool);
 })
 
@@ -278,97 +301,48 @@ fi:
 
 
 #if defined(MLN_WRITEV)
-MLN_FUNC(static inline, int, mln_tcp_conn_send_chain_memory, (mln_tcp_conn_t *tc), (tc), {
+/*
+ * Scatter/gather send: the iovec entries point straight at the
+ * [left_pos, last) range of every in-memory buffer at the head of
+ * the send queue, so nothing is copied before it reaches the kernel.
+ */
+MLN_FUNC(static inline, int, mln_tcp_conn_send_iov_fill, \
+         (mln_tcp_conn_t *tc, struct iovec *vector, mln_size_t *total), \
+         (tc, vector, total), \
+{
     mln_chain_t *c;
     mln_buf_t *b;
-    int n, is_done = 0;
-    register mln_size_t buf_left_size;
-    int proc_vec, nvec = 256;
-    struct iovec vector[256];
-
-    if (tc->nonblock) {
-        while (1) {
-            proc_vec = 0;
-            for (c = tc->snd_head; c != NULL; c = c->next) {
-                if (proc_vec >= nvec) break;
-                if ((b = c->buf) == NULL) continue;
-                if (!b->in_memory) break;
-                buf_left_size = mln_buf_left_size(b);
-                if (buf_left_size) {
-                    vector[proc_vec].iov_base = b->left_pos;
-                    vector[proc_vec].iov_len = buf_left_size;
-                    ++proc_vec;
-                }
-                if (b->last_in_chain) break;
-            }
-
-            if (!proc_vec) {
-                if (tc->snd_head != NULL) mln_chain_pool_release_all(tc->snd_head);
-                tc->snd_head = tc->snd_tail = NULL;
-                return 0;
-            }
-
-non:
-            n = writev(tc->sockfd, vector, proc_vec);
-            if (n <= 0) {
-                if (errno == EINTR) goto non;
-                if (errno == EAGAIN) return 0;
-                return -1;
-            }
-
-            while ((c = tc->snd_head) != NULL) {
-                if ((b = c->buf) == NULL) {
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                    continue;
-                }
-                if (!b->in_memory) break;
-                if (b->last_in_chain) is_done = 1;
-
-                buf_left_size = mln_buf_left_size(b);
-                if (n >= buf_left_size) {
-                    b->left_pos += buf_left_size;
-                    n -= buf_left_size;
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                } else {
-                    b->left_pos += n;
-                    n = 0;
-                }
-                if (is_done || n == 0) break;
-            }
-
-            if (is_done) break;
-        }
-        return 1;
-    }
+    mln_size_t buf_left_size;
+    int nvec = 0;
 
-    proc_vec = 0;
-    for (c = tc->snd_head; c != NULL; c = c->next) {
-        if (proc_vec >= nvec) break;
+    *total = 0;
+    for (c = tc->snd_head; c != NULL && nvec < M_C_IOV_MAX; c = c->next) {
         if ((b = c->buf) == NULL) continue;
         if (!b->in_memory) break;
         buf_left_size = mln_buf_left_size(b);
         if (buf_left_size) {
-            vector[proc_vec].iov_base = b->left_pos;
-            vector[proc_vec].iov_len = buf_left_size;
-            ++proc_vec;
+            vector[nvec].iov_base = b->left_pos;
+            vector[nvec].iov_len = buf_left_size;
+            *total += buf_left_size;
+            ++nvec;
         }
         if (b->last_in_chain) break;
     }
 
-    if (!proc_vec) {
-        if (tc->snd_head != NULL) mln_chain_pool_release_all(tc->snd_head);
-        tc->snd_head = tc->snd_tail = NULL;
-        return 0;
-    }
+    return nvec;
+})
 
-blk:
-    n = writev(tc->sockfd, vector, proc_vec);
-    if (n <= 0) {
-        if (errno == EINTR) goto blk;
-        return -1;
-    }
+/*
+ * Consume n sent bytes from the head of the send queue.
+ * Fully sent and empty buffers are moved into the sent queue.
+ * Return 1 if the last_in_chain buffer has been sent completely, otherwise 0.
+ */
+MLN_FUNC(static inline, int, mln_tcp_conn_send_iov_advance, \
+         (mln_tcp_conn_t *tc, mln_size_t n), (tc, n), \
+{
+    mln_chain_t *c;
+    mln_buf_t *b;
+    mln_size_t buf_left_size;
 
     while ((c = tc->snd_head) != NULL) {
         if ((b = c->buf) == NULL) {
@@ -377,22 +351,49 @@ blk:
             continue;
         }
         if (!b->in_memory) break;
-        if (b->last_in_chain) is_done = 1;
 
         buf_left_size = mln_buf_left_size(b);
-        if (n >= buf_left_size) {
-            b->left_pos += buf_left_size;
-            n -= buf_left_size;
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-        } else {
+        if (n < buf_left_size) {
             b->left_pos += n;
-            n = 0;
+            break;
         }
-        if (is_done || n == 0) break;
+        b->left_pos += buf_left_size;
+        n -= buf_left_size;
+        c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
+        mln_tcp_conn_append(tc, c, M_C_SENT);
+        if (b->last_in_chain) return 1;
     }
 
-    return is_done;
+    return 0;
+})
+
+MLN_FUNC(static inline, int, mln_tcp_conn_send_chain_memory, (mln_tcp_conn_t *tc), (tc), {
+    int nvec;
+    ssize_t n;
+    mln_size_t total;
+    struct iovec vector[M_C_IOV_MAX];
+
+    while (1) {
+        nvec = mln_tcp_conn_send_iov_fill(tc, vector, &total);
+        if (!nvec) return mln_tcp_conn_send_iov_advance(tc, 0);
+
+again:
+        n = writev(tc->sockfd, vector, nvec);
+        if (n <= 0) {
+            if (errno == EINTR) goto again;
+            if (tc->nonblock && errno == EAGAIN) return 0;
+            return -1;
+        }
+
+        if (mln_tcp_conn_send_iov_advance(tc, n)) return 1;
+        /*
+         * A short write means the socket buffer is full,
+         * the next writev would fail with EAGAIN or block.
+         */
+        if ((mln_size_t)n < total) return 0;
+    }
+
+    return 0;
 })
 #else
 static inline int mln_tcp_conn_send_chain_memory(mln_tcp_conn_t *tc)
@@ -530,134 +531,72 @@ blk:
 #endif
 
 
-#if defined(MLN_SENDFILE)
-MLN_FUNC(static inline, int, mln_tcp_conn_send_chain_file, (mln_tcp_conn_t *tc), (tc), {
-    int sockfd = tc->sockfd;
-    int n, is_done = 0;
-    mln_chain_t *c;
-    mln_buf_t *b;
-    mln_size_t buf_left_size;
-
-    if (tc->nonblock) {
-        while ((c = tc->snd_head) != NULL) {
-            if ((b = c->buf) == NULL) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                continue;
-            }
-            if (!b->in_file) break;
-            buf_left_size = mln_buf_left_size(b);
-            if (b->last_in_chain) is_done = 1;
-
-            if (buf_left_size) {
-non:
-                n = sendfile(sockfd, \
-                             mln_file_fd(b->file), \
-                             &b->file_left_pos, \
-                             buf_left_size);
-                if (n <= 0) {
-                    if (errno == EINTR) goto non;
-                    if (errno == EAGAIN) return 0;
-                    return -1;
-                }
-
-                if (mln_buf_left_size(b)) {
-                    goto non;
-                }
-            }
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (is_done) break;
-        }
-        return 1;
-    }
+/*
+ * Copy fallback for file buffers: read a piece of the file at
+ * file_left_pos and send it. Only the bytes actually accepted by
+ * the socket are consumed, the rest will be read again next time.
+ */
+MLN_FUNC(static inline, int, mln_tcp_conn_send_file_copy, (int sockfd, mln_buf_t *b), (sockfd, b), {
+    int n;
+    mln_u8_t buf[16384];
+    mln_size_t len = mln_buf_left_size(b);
 
-    while ((c = tc->snd_head) != NULL) {
-        if ((b = c->buf) != NULL) {
-            if (mln_buf_left_size(b)) break;
-            if (b->last_in_chain) is_done = 1;
-        }
-        c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-        mln_tcp_conn_append(tc, c, M_C_SENT);
-        if (is_done) return 1;
-    }
-    if (tc->snd_head == NULL) return 0;
-    if (!b->in_file) return 0;
+    if (len > sizeof(buf)) len = sizeof(buf);
 
-blk:
-    n = sendfile(sockfd, \
-                 mln_file_fd(b->file), \
-                 &b->file_left_pos, \
-                 mln_buf_left_size(b));
+#if defined(MSVC)
+    lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET);
+    n = read(mln_file_fd(b->file), buf, len);
+#else
+    n = pread(mln_file_fd(b->file), buf, len, b->file_left_pos);
+#endif
     if (n <= 0) {
-        if (errno == EINTR) goto blk;
+        if (n == 0) errno = EIO; /* file is shorter than the buffer claims */
         return -1;
     }
 
-    if (mln_buf_left_size(b)) goto blk;
-    if (b->last_in_chain) is_done = 1;
-    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-    mln_tcp_conn_append(tc, c, M_C_SENT);
+#if defined(MSVC)
+    n = send(sockfd, (char *)buf, n, 0);
+#else
+    n = send(sockfd, buf, n, 0);
+#endif
+    if (n > 0) b->file_left_pos += n;
 
-    return is_done;
+    return n;
 })
-#else
-static inline int mln_tcp_conn_send_chain_file(mln_tcp_conn_t *tc)
-{
-    int sockfd = tc->sockfd;
-    int n;
-    mln_buf_t *b;
-    mln_chain_t *c;
-    mln_u8_t buf[16384];
-    mln_size_t len, buf_left_size;
 
-    if (tc->nonblock) {
-        while ((c = tc->snd_head) != NULL) {
-            if ((b = c->buf) == NULL) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                continue;
-            }
-            if (!b->in_file) break;
-
-            buf_left_size = mln_buf_left_size(b);
-            if (buf_left_size == 0) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                if (b->last_in_chain) return 1;
-                continue;
-            }
+#if defined(MLN_SENDFILE)
+/*
+ * Zero-copy path: the kernel moves the file pages to the socket directly.
+ * Falls back to the copy path if the file does not support sendfile, and
+ * marks the buffer so the rest of it does not try sendfile again.
+ */
+MLN_FUNC(static inline, int, mln_tcp_conn_send_file_once, (int sockfd, mln_buf_t *b), (sockfd, b), {
+    ssize_t n;
+    mln_size_t len = mln_buf_left_size(b);
 
-            lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET);
-            len = buf_left_size > sizeof(buf)? sizeof(buf): buf_left_size;
-non_rd:
-            n = read(mln_file_fd(b->file), buf, len);
-            if (n <= 0) {
-                if (errno == EINTR) goto non_rd;
-                return -1;
-            }
+    if (b->no_sendfile) return mln_tcp_conn_send_file_copy(sockfd, b);
+    if (len > M_C_SENDFILE_MAX) len = M_C_SENDFILE_MAX;
 
-            len = n;
-non_snd:
-#if defined(MSVC)
-            n = send(sockfd, (char *)buf, len, 0);
+    n = sendfile(sockfd, mln_file_fd(b->file), &b->file_left_pos, len);
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        b->no_sendfile = 1;
+        return mln_tcp_conn_send_file_copy(sockfd, b);
+    }
+    if (n == 0) {
+        errno = EIO; /* file is shorter than the buffer claims */
+        return -1;
+    }
+
+    return (int)n;
+})
 #else
-            n = send(sockfd, buf, len, 0);
+#define mln_tcp_conn_send_file_once(sockfd, b) mln_tcp_conn_send_file_copy(sockfd, b)
 #endif
-            if (n <= 0) {
-                if (errno == EINTR) goto non_snd;
-                if (errno == EAGAIN) return 0;
-                return -1;
-            }
-            b->file_left_pos += n;
-            if (mln_buf_left_size(b)) continue;
 
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (b->last_in_chain) return 1;
-        }
-        return 0;
-    }
+MLN_FUNC(static inline, int, mln_tcp_conn_send_chain_file, (mln_tcp_conn_t *tc), (tc), {
+    int n;
+    mln_chain_t *c;
+    mln_buf_t *b;
 
     while ((c = tc->snd_head) != NULL) {
         if ((b = c->buf) == NULL) {
@@ -665,49 +604,24 @@ non_snd:
             mln_tcp_conn_append(tc, c, M_C_SENT);
             continue;
         }
-        if (!b->in_file) return 0;
+        if (!b->in_file) return 0; /* memory buffers are sent by mln_tcp_conn_send_chain_memory */
 
-        buf_left_size = mln_buf_left_size(b);
-        if (buf_left_size == 0) {
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (b->last_in_chain) return 1;
-            continue;
+        while (mln_buf_left_size(b) > 0) {
+            n = mln_tcp_conn_send_file_once(tc->sockfd, b);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (tc->nonblock && errno == EAGAIN) return 0;
+                return -1;
+            }
         }
 
-        break;
-    }
-    if (c == NULL) return 0;
-
-    lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET);
-    len = buf_left_size > sizeof(buf)? sizeof(buf): buf_left_size;
-blk_rd:
-    n = read(mln_file_fd(b->file), buf, len);
-    if (n <= 0) {
-        if (errno == EINTR) goto blk_rd;
-        return -1;
-    }
-
-    len = n;
-blk_snd:
-#if defined(MSVC)
-    n = send(sockfd, (char *)buf, len, 0);
-#else
-    n = send(sockfd, buf, len, 0);
-#endif
-    if (n <= 0) {
-        if (errno == EINTR) goto blk_snd;
-        return -1;
+        c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
+        mln_tcp_conn_append(tc, c, M_C_SENT);
+        if (b->last_in_chain) return 1;
     }
-    b->file_left_pos += n;
-    if (mln_buf_left_size(b)) return 0;
-
-    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-    mln_tcp_conn_append(tc, c, M_C_SENT);
 
-    return b->last_in_chain == 0? 0: 1;
-}
-#endif
+    return 0;
+})
 
 MLN_FUNC(static inline, mln_chain_t *, mln_tcp_conn_pop_inline, \
          (mln_tcp_conn_t *tc, int type), (tc, type), \
@@ -792,32 +706,29 @@ MLN_FUNC(static inline, int, mln_tcp_conn_recv_chain, \
          (mln_tcp_conn_t *tc, mln_u32_t flag), (tc, flag), \
 {
     mln_buf_t *last = NULL;
-    int n = -1;
+    int n;
     mln_buf_t *b;
     mln_chain_t *c;
     mln_alloc_t *pool = mln_tcp_conn_pool_get(tc);
 
-    c = mln_chain_new(pool);
-    b = mln_buf_new(pool);
-    if (c == NULL || b == NULL) {
+    if (!(flag & M_C_TYPE_FILE)) {
+        ASSERT(flag & M_C_TYPE_MEMORY);
+        return mln_tcp_conn_recv_chain_mem(tc);
+    }
+
+    if ((c = mln_chain_new_with_buf(pool)) == NULL) {
         errno = ENOMEM;
         return -1;
     }
-    c->buf = b;
+    b = c->buf;
 
-    if (flag & M_C_TYPE_FILE) {
-        if (flag & M_C_TYPE_FOLLOW && tc->rcv_tail != NULL && tc->rcv_tail->buf != NULL) {
-            last = tc->rcv_tail->buf;
-            if (!last->in_file) {
-                last = NULL;
-            }
+    if (flag & M_C_TYPE_FOLLOW && tc->rcv_tail != NULL && tc->rcv_tail->buf != NULL) {
+        last = tc->rcv_tail->buf;
+        if (!last->in_file) {
+            last = NULL;
         }
-        n = mln_tcp_conn_recv_chain_file(tc->sockfd, pool, b, last);
-    } else if (flag & M_C_TYPE_MEMORY) {
-        n = mln_tcp_conn_recv_chain_mem(tc->sockfd, pool, b);
-    } else {
-        ASSERT(0);
     }
+    n = mln_tcp_conn_recv_chain_file(tc->sockfd, pool, b, last);
 
     if (n <= 0) {
         mln_chain_pool_release(c);
@@ -861,32 +772,146 @@ static inline int mln_tcp_conn_recv_chain_file(int sockfd, mln_alloc_t *pool, ml
     return n;
 }
 
-static inline int mln_tcp_conn_recv_chain_mem(int sockfd, mln_alloc_t *pool, mln_buf_t *b)
+/*
+ * Take a receive node with at least size bytes of memory,
+ * from the free list if possible.
+ */
+MLN_FUNC(static inline, mln_chain_t *, mln_tcp_conn_recv_node_get, \
+         (mln_tcp_conn_t *tc, mln_size_t size), (tc, size), \
 {
+    mln_chain_t *c;
+    mln_buf_t *b;
     mln_u8ptr_t buf;
-    int n;
 
-    buf = (mln_u8ptr_t)mln_alloc_m(pool, 4096);
-    if (buf == NULL) {
-        errno = ENOMEM;
-        return -1;
+    while ((c = tc->free_head) != NULL) {
+        tc->free_head = c->next;
+        --(tc->free_cnt);
+        c->next = NULL;
+        b = c->buf;
+        if (b->end - b->start >= size) return c;
+        mln_chain_pool_release(c);
     }
 
-#if defined(MSVC)
-    n = recv(sockfd, (char *)buf, 4096, 0);
+    if ((c = mln_chain_new_with_buf(tc->pool)) == NULL) return NULL;
+    if ((buf = (mln_u8ptr_t)mln_alloc_m(tc->pool, size)) == NULL) {
+        mln_chain_pool_release(c);
+        return NULL;
+    }
+    b = c->buf;
+    b->left_pos = b->pos = b->last = b->start = buf;
+    b->end = buf + size;
+    b->in_memory = 1;
+    b->last_buf = 1;
+
+    return c;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_tcp_conn_recv_node_put, \
+              (mln_tcp_conn_t *tc, mln_chain_t *c), (tc, c), \
+{
+    mln_buf_t *b = c->buf;
+
+    if (tc->free_cnt >= M_C_RECV_FREE_MAX || b == NULL || !b->in_memory) goto out;
+    if (b->shadow != NULL || b->temporary || b->start == NULL) goto out;
+#if !defined(MSVC) && defined(MLN_MMAP)
+    if (b->mmap) goto out;
+#endif
+    if (b->end - b->start < M_C_RECV_MIN) goto out;
+
+    b->left_pos = b->pos = b->last = b->start;
+    b->flush = b->sync = b->last_in_chain = 0;
+    b->last_buf = 1;
+    c->next = tc->free_head;
+    tc->free_head = c;
+    ++(tc->free_cnt);
+    return;
+
+out:
+    mln_chain_pool_release(c);
+})
+
+MLN_FUNC_VOID(, void, mln_tcp_conn_recycle, (mln_tcp_conn_t *tc, mln_chain_t *c), (tc, c), {
+    mln_chain_t *next;
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+        c->next = NULL;
+        mln_tcp_conn_recv_node_put(tc, c);
+    }
+})
+
+/*
+ * Receive into pooled memory buffers. The buffer size follows the amount of
+ * data each read returns: it doubles when a read fills every buffer and
+ * halves when a read uses less than a quarter of one buffer. At the maximum
+ * size, several buffers are filled by a single readv.
+ */
+MLN_FUNC(static inline, int, mln_tcp_conn_recv_chain_mem, (mln_tcp_conn_t *tc), (tc), {
+    int n, i, nvec, err;
+    mln_size_t size, total = 0, len;
+    mln_buf_t *b;
+    mln_chain_t *nodes[M_C_RECV_NVEC];
+#if defined(MLN_WRITEV)
+    struct iovec vector[M_C_RECV_NVEC];
+#endif
+
+    size = tc->rcv_size;
+#if defined(MLN_WRITEV)
+    nvec = size >= M_C_RECV_MAX? M_C_RECV_NVEC: 1;
+#else
+    nvec = 1;
+#endif
+    for (i = 0; i < nvec; ++i) {
+        if ((nodes[i] = mln_tcp_conn_recv_node_get(tc, size)) == NULL) {
+            while (i-- > 0) mln_tcp_conn_recv_node_put(tc, nodes[i]);
+            errno = ENOMEM;
+            return -1;
+        }
+        b = nodes[i]->buf;
+#if defined(MLN_WRITEV)
+        vector[i].iov_base = b->start;
+        vector[i].iov_len = b->end - b->start;
+#endif
+        total += b->end - b->start;
+    }
+
+#if defined(MLN_WRITEV)
+    n = readv(tc->sockfd, vector, nvec);
+#elif defined(MSVC)
+    b = nodes[0]->buf;
+    n = recv(tc->sockfd, (char *)b->start, total, 0);
 #else
-    n = recv(sockfd, buf, 4096, 0);
+    b = nodes[0]->buf;
+    n = recv(tc->sockfd, b->start, total, 0);
 #endif
     if (n <= 0) {
-        mln_alloc_free(buf);
+        err = errno;
+        for (i = 0; i < nvec; ++i) mln_tcp_conn_recv_node_put(tc, nodes[i]);
+        errno = err;
         return n;
     }
 
-    b->left_pos = b->pos = b->start = buf;
-    b->last = b->end = buf + n;
-    b->in_memory = 1;
-    b->last_buf = 1;
+    if ((mln_size_t)n == total) {
+        if (size < M_C_RECV_MAX) tc->rcv_size = size << 1;
+    } else if (n < (size >> 2) && size > M_C_RECV_MIN) {
+        tc->rcv_size = size >> 1;
+    }
 
-    return n;
-}
+    len = n;
+    for (i = 0; i < nvec; ++i) {
+        b = nodes[i]->buf;
+        if (len == 0) {
+            mln_tcp_conn_recv_node_put(tc, nodes[i]);
+            continue;
+        }
+        if (len > b->end - b->start) {
+            b->last = b->end;
+        } else {
+            b->last = b->start + len;
+        }
+        len -= b->last - b->start;
+        mln_tcp_conn_append(tc, nodes[i], M_C_RECV);
+    }
 
+    return n;
+})
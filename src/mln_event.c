@@ -15,6 +15,32 @@
 #if !defined(MSVC)
 #include <sys/socket.h>
 #endif
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#if defined(MLN_IO_URING)
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * single_thread events skip the fd/timer/callback mutexes entirely.
+ */
+#define mln_event_lock(ev,l) do {\
+    if (!(ev)->single_thread) pthread_mutex_lock(&((ev)->l));\
+} while (0)
+#define mln_event_unlock(ev,l) do {\
+    if (!(ev)->single_thread) pthread_mutex_unlock(&((ev)->l));\
+} while (0)
+#define mln_event_trylock(ev,l) ((ev)->single_thread? 0: pthread_mutex_trylock(&((ev)->l)))
+
+struct mln_event_post_s {
+    ev_tm_handler            handler;
+    void                    *data;
+    struct mln_event_post_s *next;
+};
 
 /*declarations*/
 MLN_CHAIN_FUNC_DECLARE(static inline, \
@@ -23,10 +49,29 @@ MLN_CHAIN_FUNC_DECLARE(static inline, \
 MLN_CHAIN_FUNC_DECLARE(static inline, \
                        ev_fd_active, \
                        mln_event_desc_t, );
+MLN_CHAIN_FUNC_DECLARE(static inline, \
+                       ev_wheel, \
+                       mln_event_desc_t, );
 static inline void
 mln_event_desc_free(void *data);
 static int
 mln_event_rbtree_fd_cmp(const void *k1, const void *k2) __NONNULL2(1,2);
+static inline mln_event_desc_t *
+mln_event_fd_search(mln_event_t *event, int fd) __NONNULL1(1);
+static inline int
+mln_event_fd_insert(mln_event_t *event, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline void
+mln_event_fd_remove(mln_event_t *event, int fd) __NONNULL1(1);
+static struct mln_event_wheel_s *mln_event_wheel_new(void);
+static void mln_event_wheel_free(struct mln_event_wheel_s *w, int free_desc);
+static inline void
+mln_event_wheel_add(struct mln_event_wheel_s *w, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline void
+mln_event_wheel_del(struct mln_event_wheel_s *w, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline mln_event_desc_t *
+mln_event_wheel_expired(struct mln_event_wheel_s *w, mln_uauto_t now) __NONNULL1(1);
+static inline void
+mln_event_fd_timeout_del(mln_event_t *ev, mln_event_desc_t *ed) __NONNULL2(1,2);
 static inline int
 mln_event_fd_timeout_cmp(const void *k1, const void *k2);
 static inline void
@@ -44,6 +89,9 @@ mln_event_fd_clr_set(mln_event_t *event, int fd) __NONNULL1(1);
 static inline void
 mln_event_active_fd_process(mln_event_t *event) __NONNULL1(1);
 static inline void mln_event_fd_timeout_process(mln_event_t *event);
+static int mln_event_post_channel(mln_event_t *ev) __NONNULL1(1);
+static void mln_event_post_register(mln_event_t *ev) __NONNULL1(1);
+static void mln_event_post_process(mln_event_t *ev, int fd, void *data);
 static inline void mln_event_timer_process(mln_event_t *event);
 static inline int
 mln_event_fd_normal_set(mln_event_t *event, \
@@ -69,15 +117,256 @@ mln_event_fd_timeout_set(mln_event_t *ev, mln_event_desc_t *ed, int timeout_ms);
 /*varliables*/
 mln_event_desc_t fheap_min = {
     NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL,
     M_EV_TM, 0,
 #if defined(MSVC)
     {0},
 #else
-    {(mln_event_tm_t){NULL, NULL, 0}},
+    {(mln_event_tm_t){NULL, NULL, 0, NULL}},
 #endif
 };
 
+/*
+ * Hierarchical timing wheel, one tick per millisecond.
+ * The root wheel holds the next 256 ticks, each upper level covers 64 times
+ * the span of the level below, so four levels reach 2^32 ms (~49 days).
+ * Longer timeouts are parked at the far end and cascaded down again.
+ */
+#define M_EV_WHEEL_ROOT_BITS 8
+#define M_EV_WHEEL_ROOT_SIZE (1 << M_EV_WHEEL_ROOT_BITS)
+#define M_EV_WHEEL_ROOT_MASK (M_EV_WHEEL_ROOT_SIZE - 1)
+#define M_EV_WHEEL_LVL_BITS  6
+#define M_EV_WHEEL_LVL_SIZE  (1 << M_EV_WHEEL_LVL_BITS)
+#define M_EV_WHEEL_LVL_MASK  (M_EV_WHEEL_LVL_SIZE - 1)
+#define M_EV_WHEEL_LVL_NUM   4
+#define M_EV_WHEEL_MAX_TICKS ((mln_u64_t)0xffffffff)
+#define mln_event_wheel_lvl_shift(i) (M_EV_WHEEL_ROOT_BITS + (i) * M_EV_WHEEL_LVL_BITS)
+
+struct mln_event_wheel_s {
+    mln_u64_t                cur;/*next tick (ms) to be expired*/
+    mln_size_t               count;
+    mln_event_wheel_slot_t   root[M_EV_WHEEL_ROOT_SIZE];
+    mln_event_wheel_slot_t   lvl[M_EV_WHEEL_LVL_NUM][M_EV_WHEEL_LVL_SIZE];
+    mln_event_wheel_slot_t   expired;
+};
+
+#if defined(MLN_IO_URING)
+/*
+ * io_uring is only used as a batched submission channel for epoll_ctl.
+ * Readiness still comes from epoll_wait, but every ADD/MOD issued while
+ * the fd lock is held is queued as an IORING_OP_EPOLL_CTL entry and the whole
+ * batch is handed to the kernel by one io_uring_enter right before the next
+ * epoll_wait. Entries are hard-linked so they are applied in issue order.
+ * DEL is not batched: the caller frees the descriptor and may close the fd
+ * right after it, and a queued DEL on a closed fd would fail with EBADF
+ * while a dup of the file keeps the registration alive. So the batch is
+ * flushed and DEL goes through epoll_ctl at once.
+ * If the ring can not be set up (old kernel, seccomp, io_uring_disabled),
+ * epoll_ctl is called directly as before.
+ */
+struct mln_event_uring_s {
+    int                  fd;
+    mln_u32_t            entries;
+    mln_u32_t            tail;
+    mln_u32_t            pending;
+    mln_u32_t           *sq_head;
+    mln_u32_t           *sq_tail;
+    mln_u32_t           *sq_mask;
+    mln_u32_t           *sq_array;
+    mln_u32_t           *cq_head;
+    mln_u32_t           *cq_tail;
+    mln_u32_t           *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    struct epoll_event  *evs;
+    void                *sq_ptr;
+    size_t               sq_len;
+    void                *cq_ptr;
+    size_t               cq_len;
+    size_t               sqes_len;
+};
+
+MLN_FUNC_VOID(static, void, mln_event_uring_free, (struct mln_event_uring_s *u), (u), {
+    if (u == NULL) return;
+    if (u->sqes != NULL) munmap(u->sqes, u->sqes_len);
+    if (u->cq_ptr != NULL && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+    if (u->sq_ptr != NULL) munmap(u->sq_ptr, u->sq_len);
+    if (u->evs != NULL) free(u->evs);
+    if (u->fd >= 0) close(u->fd);
+    free(u);
+})
+
+MLN_FUNC(static, struct mln_event_uring_s *, mln_event_uring_new, (void), (), {
+    struct io_uring_params p;
+    struct mln_event_uring_s *u;
+
+    if ((u = (struct mln_event_uring_s *)calloc(1, sizeof(struct mln_event_uring_s))) == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    if ((u->fd = (int)syscall(__NR_io_uring_setup, M_EV_URING_ENTRIES, &p)) < 0) {
+        free(u);
+        return NULL;
+    }
+    u->entries = p.sq_entries;
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(mln_u32_t);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+        u->cq_len = u->sq_len;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            u->cq_ptr = NULL;
+            goto err;
+        }
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto err;
+    }
+    if ((u->evs = (struct epoll_event *)calloc(p.sq_entries, sizeof(struct epoll_event))) == NULL)
+        goto err;
+
+    u->sq_head = (mln_u32_t *)((char *)u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (mln_u32_t *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (mln_u32_t *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (mln_u32_t *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (mln_u32_t *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (mln_u32_t *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (mln_u32_t *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+    u->tail = *(u->sq_tail);
+    u->pending = 0;
+    return u;
+
+err:
+    mln_event_uring_free(u);
+    return NULL;
+})
+
+/*
+ * Hand every queued entry to the kernel and wait until all of them are
+ * applied, so the following epoll_wait never reports a descriptor whose
+ * EPOLL_CTL_DEL is still in flight. On a hard error the remaining entries
+ * are replayed through epoll_ctl and the ring is dropped.
+ * Returns the result of the last applied entry.
+ */
+MLN_FUNC(static, int, mln_event_uring_flush, (mln_event_t *event), (event), {
+    struct mln_event_uring_s *u = event->uring;
+    struct io_uring_sqe *sqe;
+    mln_u32_t mask, head, tail, total;
+    int n, res;
+
+    if (u == NULL || !u->pending) return 0;
+
+    mask = *(u->sq_mask);
+    u->sqes[(u->tail - 1) & mask].flags &= ~IOSQE_IO_HARDLINK;
+    total = u->pending;
+    while (u->pending) {
+        n = (int)syscall(__NR_io_uring_enter, u->fd, u->pending, u->pending, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0) {
+            u->pending -= n;
+            continue;
+        }
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+
+        res = 0;
+        for (head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE); head != u->tail; ++head) {
+            sqe = &u->sqes[head & mask];
+            res = epoll_ctl(event->epollfd, (int)sqe->len, (int)sqe->off, &u->evs[head & mask]);
+        }
+        total -= u->pending;
+        while (__atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *(u->cq_head) < total) {
+            if (syscall(__NR_io_uring_enter, u->fd, 0, total, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                break;
+        }
+        mln_event_uring_free(u);
+        event->uring = NULL;
+        return res < 0? -errno: res;
+    }
+    while ((tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) - *(u->cq_head) < total) {
+        syscall(__NR_io_uring_enter, u->fd, 0, total, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    res = u->cqes[(tail - 1) & *(u->cq_mask)].res;
+    __atomic_store_n(u->cq_head, tail, __ATOMIC_RELEASE);
+    return res;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_uring_queue, \
+              (mln_event_t *event, int op, int fd, struct epoll_event *ev), \
+              (event, op, fd, ev), \
+{
+    struct mln_event_uring_s *u;
+    struct io_uring_sqe *sqe;
+    mln_u32_t idx;
+
+    if (event->uring != NULL && event->uring->pending >= event->uring->entries)
+        mln_event_uring_flush(event);
+    if ((u = event->uring) == NULL) {
+        epoll_ctl(event->epollfd, op, fd, ev);
+        return;
+    }
+
+    idx = u->tail & *(u->sq_mask);
+    u->evs[idx] = *ev;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_EPOLL_CTL;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->fd = event->epollfd;
+    sqe->off = (mln_u64_t)fd;
+    sqe->len = (mln_u32_t)op;
+    sqe->addr = (mln_u64_t)(uintptr_t)&u->evs[idx];
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, ++(u->tail), __ATOMIC_RELEASE);
+    ++(u->pending);
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_epoll_ctl, \
+              (mln_event_t *event, int op, int fd, struct epoll_event *ev), \
+              (event, op, fd, ev), \
+{
+    if (op != EPOLL_CTL_DEL) {
+        mln_event_uring_queue(event, op, fd, ev);
+        return;
+    }
+    /*earlier entries for this fd have to be applied before it is deleted*/
+    mln_event_uring_flush(event);
+    epoll_ctl(event->epollfd, op, fd, ev);
+})
+
+/*
+ * Make sure the running kernel knows IORING_OP_EPOLL_CTL: deleting a
+ * descriptor that was never added fails with ENOENT, not EINVAL.
+ */
+MLN_FUNC(static, int, mln_event_uring_probe, (mln_event_t *event), (event), {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    mln_event_uring_queue(event, EPOLL_CTL_DEL, event->unusedfd, &ev);
+    return mln_event_uring_flush(event) == -EINVAL? -1: 0;
+})
+#elif defined(MLN_EPOLL)
+#define mln_event_epoll_ctl(event,op,fd,ev) epoll_ctl((event)->epollfd, (op), (fd), (ev))
+#endif
+
 mln_event_t *mln_event_new(void)
+{
+    return mln_event_new_with_attr(NULL);
+}
+
+mln_event_t *mln_event_new_with_attr(struct mln_event_attr *attr)
 {
     int rc;
 #if defined(MSVC)
@@ -103,6 +392,8 @@ mln_event_t *mln_event_new(void)
     if (ev->ev_fd_tree == NULL) {
         goto err1;
     }
+    ev->ev_fd_table = NULL;
+    ev->ev_fd_table_size = 0;
     ev->ev_fd_wait_head = NULL;
     ev->ev_fd_wait_tail = NULL;
     ev->ev_fd_active_head = NULL;
@@ -120,6 +411,19 @@ mln_event_t *mln_event_new(void)
     if (ev->ev_timer_heap == NULL) {
         goto err3;
     }
+    ev->ev_fd_timeout_wheel = NULL;
+    ev->ev_timer_wheel = NULL;
+    ev->timer_wheel = (attr != NULL && attr->timer_wheel)? 1: 0;
+    ev->single_thread = (attr != NULL && attr->single_thread)? 1: 0;
+    ev->post_rfd = ev->post_wfd = -1;
+    ev->post_new = 0;
+    ev->post_head = ev->post_tail = NULL;
+    if (ev->timer_wheel) {
+        ev->ev_fd_timeout_wheel = mln_event_wheel_new();
+        ev->ev_timer_wheel = mln_event_wheel_new();
+        if (ev->ev_fd_timeout_wheel == NULL || ev->ev_timer_wheel == NULL)
+            goto err4;
+    }
     ev->is_break = 0;
 #if defined(MLN_EPOLL)
     ev->epollfd = epoll_create(M_EV_EPOLL_SIZE);
@@ -131,6 +435,13 @@ mln_event_t *mln_event_new(void)
         close(ev->epollfd);
         goto err4;
     }
+#if defined(MLN_IO_URING)
+    ev->uring = mln_event_uring_new();
+    if (ev->uring != NULL && mln_event_uring_probe(ev) < 0) {
+        mln_event_uring_free(ev->uring);
+        ev->uring = NULL;
+    }
+#endif
 #elif defined(MLN_KQUEUE)
     ev->kqfd = kqueue();
     if (ev->kqfd < 0) {
@@ -154,6 +465,8 @@ mln_event_t *mln_event_new(void)
         rc = -1;
     if (pthread_mutex_init(&ev->cb_lock, NULL) != 0)
         rc = -1;
+    if (pthread_mutex_init(&ev->post_lock, NULL) != 0)
+        rc = -1;
 #else
     rc = 0;
 #endif
@@ -162,11 +475,17 @@ mln_event_t *mln_event_new(void)
         pthread_mutex_destroy(&ev->fd_lock);
         pthread_mutex_destroy(&ev->timer_lock);
         pthread_mutex_destroy(&ev->cb_lock);
+        pthread_mutex_destroy(&ev->post_lock);
 #endif
 #if defined(MLN_EPOLL)
+#if defined(MLN_IO_URING)
+        mln_event_uring_free(ev->uring);
+#endif
         close(ev->epollfd);
+        close(ev->unusedfd);
 #elif defined(MLN_KQUEUE)
         close(ev->kqfd);
+        close(ev->unusedfd);
 #endif
         goto err4;
     }
@@ -174,6 +493,8 @@ mln_event_t *mln_event_new(void)
     return ev;
 
 err4:
+    mln_event_wheel_free(ev->ev_fd_timeout_wheel, 0);
+    mln_event_wheel_free(ev->ev_timer_wheel, 1);
     mln_fheap_inline_free(ev->ev_timer_heap, mln_event_fheap_timer_cmp, mln_event_desc_free);
 err3:
     mln_fheap_inline_free(ev->ev_fd_timeout_heap, mln_event_fd_timeout_cmp, NULL);
@@ -188,8 +509,18 @@ void mln_event_free(mln_event_t *ev)
 {
     if (ev == NULL) return;
     mln_event_desc_t *ed;
+    struct mln_event_post_s *ep;
+    while ((ep = ev->post_head) != NULL) {
+        ev->post_head = ep->next;
+        free(ep);
+    }
+    if (ev->post_rfd >= 0) mln_socket_close(ev->post_rfd);
+    if (ev->post_wfd >= 0 && ev->post_wfd != ev->post_rfd) mln_socket_close(ev->post_wfd);
     mln_fheap_inline_free(ev->ev_fd_timeout_heap, mln_event_fd_timeout_cmp, NULL);
+    mln_event_wheel_free(ev->ev_fd_timeout_wheel, 0);
+    mln_event_wheel_free(ev->ev_timer_wheel, 1);
     mln_rbtree_free(ev->ev_fd_tree);
+    if (ev->ev_fd_table != NULL) free(ev->ev_fd_table);
     while ((ed = ev->ev_fd_wait_head) != NULL) {
         ev_fd_wait_chain_del(&(ev->ev_fd_wait_head), \
                              &(ev->ev_fd_wait_tail), \
@@ -198,6 +529,9 @@ void mln_event_free(mln_event_t *ev)
     }
     mln_fheap_inline_free(ev->ev_timer_heap, mln_event_fheap_timer_cmp, mln_event_desc_free);
 #if defined(MLN_EPOLL)
+#if defined(MLN_IO_URING)
+    mln_event_uring_free(ev->uring);
+#endif
     close(ev->epollfd);
     close(ev->unusedfd);
 #elif defined(MLN_KQUEUE)
@@ -210,6 +544,7 @@ void mln_event_free(mln_event_t *ev)
     pthread_mutex_destroy(&ev->fd_lock);
     pthread_mutex_destroy(&ev->timer_lock);
     pthread_mutex_destroy(&ev->cb_lock);
+    pthread_mutex_destroy(&ev->post_lock);
 #endif
     free(ev);
 }
@@ -241,30 +576,44 @@ mln_event_timer_t *mln_event_timer_set(mln_event_t *event, mln_u32_t msec, void
     ed->next = NULL;
     ed->act_prev = NULL;
     ed->act_next = NULL;
-    mln_fheap_node_t *fn = mln_fheap_node_new(event->ev_timer_heap, ed);
-    if (fn == NULL) {
-        free(ed);
-        return NULL;
+    ed->wh_prev = NULL;
+    ed->wh_next = NULL;
+    ed->wh_slot = NULL;
+    ed->data.tm.node = NULL;
+    if (!event->timer_wheel) {
+        ed->data.tm.node = mln_fheap_node_new(event->ev_timer_heap, ed);
+        if (ed->data.tm.node == NULL) {
+            free(ed);
+            return NULL;
+        }
     }
 #if !defined(MSVC)
-    pthread_mutex_lock(&event->timer_lock);
+    mln_event_lock(event, timer_lock);
 #endif
-    mln_fheap_inline_insert(event->ev_timer_heap, fn, mln_event_fheap_timer_cmp);
+    if (event->timer_wheel)
+        mln_event_wheel_add(event->ev_timer_wheel, ed);
+    else
+        mln_fheap_inline_insert(event->ev_timer_heap, ed->data.tm.node, mln_event_fheap_timer_cmp);
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->timer_lock);
+    mln_event_unlock(event, timer_lock);
 #endif
-    return fn;
+    return ed;
 }
 
 void mln_event_timer_cancel(mln_event_t *event, mln_event_timer_t *timer)
 {
 #if !defined(MSVC)
-    pthread_mutex_lock(&event->timer_lock);
+    mln_event_lock(event, timer_lock);
 #endif
-    mln_fheap_inline_delete(event->ev_timer_heap, timer, mln_event_fheap_timer_copy, mln_event_fheap_timer_cmp);
-    mln_fheap_inline_node_free(event->ev_timer_heap, timer, mln_event_desc_free);
+    if (event->timer_wheel) {
+        mln_event_wheel_del(event->ev_timer_wheel, timer);
+        mln_event_desc_free(timer);
+    } else {
+        mln_fheap_inline_delete(event->ev_timer_heap, timer->data.tm.node, mln_event_fheap_timer_copy, mln_event_fheap_timer_cmp);
+        mln_fheap_inline_node_free(event->ev_timer_heap, timer->data.tm.node, mln_event_desc_free);
+    }
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->timer_lock);
+    mln_event_unlock(event, timer_lock);
 #endif
 }
 
@@ -279,14 +628,28 @@ static inline void mln_event_timer_process(mln_event_t *event)
 
 lp:
 #if !defined(MSVC)
-    if (pthread_mutex_trylock(&event->timer_lock))
+    if (mln_event_trylock(event, timer_lock))
         return;
 #endif
 
+    if (event->timer_wheel) {
+        ed = mln_event_wheel_expired(event->ev_timer_wheel, now);
+#if !defined(MSVC)
+        mln_event_unlock(event, timer_lock);
+#endif
+        if (ed == NULL) return;
+        if (ed->data.tm.handler != NULL)
+            ed->data.tm.handler(event, ed->data.tm.data);
+        mln_event_desc_free(ed);
+        if (!event->is_break)
+            goto lp;
+        return;
+    }
+
     fn = mln_fheap_minimum(event->ev_timer_heap);
     if (fn == NULL) {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->timer_lock);
+        mln_event_unlock(event, timer_lock);
 #endif
         return;
     }
@@ -294,7 +657,7 @@ lp:
     ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
     if (ed->data.tm.end_tm > now) {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->timer_lock);
+        mln_event_unlock(event, timer_lock);
 #endif
         return;
     }
@@ -306,7 +669,7 @@ lp:
 #endif
 
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->timer_lock);
+    mln_event_unlock(event, timer_lock);
 #endif
 
     if (ed->data.tm.handler != NULL)
@@ -324,23 +687,14 @@ lp:
 void mln_event_fd_timeout_handler_set(mln_event_t *event, int fd, void *data, ev_fd_handler timeout_handler)
 {
 #if !defined(MSVC)
-    pthread_mutex_lock(&event->fd_lock);
-#endif
-    mln_event_desc_t tmp;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-#if defined(MSVC)
-    mln_rbtree_node_t *rn = mln_rbtree_search(event->ev_fd_tree, &tmp);
-#else
-    mln_rbtree_node_t *rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
+    mln_event_lock(event, fd_lock);
 #endif
-    ASSERT(!mln_rbtree_null(rn, event->ev_fd_tree));
-    mln_event_desc_t *ed = (mln_event_desc_t *)mln_rbtree_node_data_get(rn);
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    ASSERT(ed != NULL);
     ed->data.fd.timeout_data = data;
     ed->data.fd.timeout_handler = timeout_handler;
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, fd_lock);
 #endif
 }
 
@@ -349,34 +703,25 @@ int mln_event_fd_set(mln_event_t *event, int fd, mln_u32_t flag, int timeout_ms,
     ASSERT(fd >= 0 && !(flag & ~M_EV_FD_MASK) && flag <= M_EV_CLR && !((flag & M_EV_NONBLOCK) && (flag & M_EV_BLOCK)));
 
 #if !defined(MSVC)
-    pthread_mutex_lock(&event->fd_lock);
+    mln_event_lock(event, fd_lock);
 #endif
     if (flag == M_EV_CLR) {
         mln_event_fd_clr_set(event, fd);
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
         return 0;
     }
-    mln_event_desc_t tmp;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-    mln_rbtree_node_t *rn;
-#if defined(MSVC)
-    rn = mln_rbtree_search(event->ev_fd_tree, &tmp);
-#else
-    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
-#endif
-    if (!mln_rbtree_null(rn, event->ev_fd_tree)) {
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    if (ed != NULL) {
         if (flag & M_EV_APPEND) {
             if (flag & M_EV_NONBLOCK) mln_event_fd_nonblock_set(fd);
             if (flag & M_EV_BLOCK) mln_event_fd_block_set(fd);
 
-            ASSERT(!(((mln_event_desc_t *)mln_rbtree_node_data_get(rn))->data.fd.is_clear));
+            ASSERT(!(ed->data.fd.is_clear));
 
             if (mln_event_fd_append_set(event, \
-                                        (mln_event_desc_t *)mln_rbtree_node_data_get(rn), \
+                                        ed, \
                                         fd, \
                                         flag, \
                                         timeout_ms, \
@@ -385,7 +730,7 @@ int mln_event_fd_set(mln_event_t *event, int fd, mln_u32_t flag, int timeout_ms,
                                         1) < 0)
             {
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 return -1;
             }
@@ -396,22 +741,22 @@ int mln_event_fd_set(mln_event_t *event, int fd, mln_u32_t flag, int timeout_ms,
                 mln_event_fd_block_set(fd);
             }
             if (mln_event_fd_normal_set(event, \
-                                        (mln_event_desc_t *)(rn->data), \
+                                        ed, \
                                         fd, \
                                         flag, \
                                         timeout_ms, \
                                         data, \
                                         fd_handler, \
-                                        ((mln_event_desc_t *)(rn->data))->data.fd.is_clear?0:1) < 0)
+                                        ed->data.fd.is_clear?0:1) < 0)
             {
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 return -1;
             }
         }
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
         return 0;
     }
@@ -422,12 +767,12 @@ int mln_event_fd_set(mln_event_t *event, int fd, mln_u32_t flag, int timeout_ms,
     }
     if (mln_event_fd_normal_set(event, NULL, fd, flag, timeout_ms, data, fd_handler, 0) < 0) {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
         return -1;
     }
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, fd_lock);
 #endif
     return 0;
 }
@@ -450,17 +795,21 @@ MLN_FUNC(static inline, int, mln_event_fd_normal_set, \
         ed->prev = NULL;
         ed->act_next = NULL;
         ed->act_prev = NULL;
-        mln_rbtree_node_t *rn;
-        rn = mln_rbtree_node_new(event->ev_fd_tree, ed);
-        if (rn == NULL) {
+        ed->wh_prev = NULL;
+        ed->wh_next = NULL;
+        ed->wh_slot = NULL;
+        if (mln_event_fd_insert(event, ed) < 0) {
             free(ed);
             return -1;
         }
-        mln_rbtree_inline_insert(event->ev_fd_tree, rn, mln_event_rbtree_fd_cmp);
         ev_fd_wait_chain_add(&(event->ev_fd_wait_head), \
                              &(event->ev_fd_wait_tail), \
                              ed);
         if (mln_event_fd_timeout_set(event, ed, timeout_ms) < 0) {
+            mln_event_fd_remove(event, fd);
+            ev_fd_wait_chain_del(&(event->ev_fd_wait_head), \
+                                 &(event->ev_fd_wait_tail), \
+                                 ed);
             free(ed);
             return -1;
         }
@@ -509,21 +858,21 @@ static inline int mln_event_fd_append_set(mln_event_t *event, \
         if (oneshot) {\
             ev.events = (flg)|EPOLLONESHOT;\
             ev.data.ptr = ed;\
-            epoll_ctl(event->epollfd, EPOLL_CTL_MOD, fd, &ev);\
+            mln_event_epoll_ctl(event, EPOLL_CTL_MOD, fd, &ev);\
         } else {\
             ev.events = (flg);\
             ev.data.ptr = ed;\
-            epoll_ctl(event->epollfd, EPOLL_CTL_MOD, fd, &ev);\
+            mln_event_epoll_ctl(event, EPOLL_CTL_MOD, fd, &ev);\
         }\
     } else {\
         if (oneshot) {\
             ev.events = (flg)|EPOLLONESHOT;\
             ev.data.ptr = ed;\
-            epoll_ctl(event->epollfd, EPOLL_CTL_ADD, fd, &ev);\
+            mln_event_epoll_ctl(event, EPOLL_CTL_ADD, fd, &ev);\
         } else {\
             ev.events = (flg);\
             ev.data.ptr = ed;\
-            epoll_ctl(event->epollfd, EPOLL_CTL_ADD, fd, &ev);\
+            mln_event_epoll_ctl(event, EPOLL_CTL_ADD, fd, &ev);\
         }\
     }
 
@@ -658,19 +1007,18 @@ MLN_FUNC(static, int, mln_event_fd_timeout_set, \
     if (timeout_ms == M_EV_UNMODIFIED) return 0;
     mln_event_fd_t *ef = &(ed->data.fd);
     if (timeout_ms == M_EV_UNLIMITED) {
-        if (ef->timeout_node != NULL) {
-            mln_fheap_inline_delete(ev->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-            mln_fheap_inline_node_free(ev->ev_fd_timeout_heap, ef->timeout_node, NULL);
-            ef->timeout_node = NULL;
-            ef->end_us = 0;
-        }
+        mln_event_fd_timeout_del(ev, ed);
         return 0;
     }
     mln_fheap_node_t *fn;
     struct timeval tv;
     memset(&tv, 0, sizeof(tv));
     gettimeofday(&tv, NULL);
-    if (ef->timeout_node == NULL) {
+    if (ev->timer_wheel) {
+        mln_event_wheel_del(ev->ev_fd_timeout_wheel, ed);
+        ef->end_us = tv.tv_sec*1000000+tv.tv_usec+timeout_ms*1000;
+        mln_event_wheel_add(ev->ev_fd_timeout_wheel, ed);
+    } else if (ef->timeout_node == NULL) {
         ef->end_us = tv.tv_sec*1000000+tv.tv_usec+timeout_ms*1000;
         fn = mln_fheap_node_new(ev->ev_fd_timeout_heap, ed);
         if (fn == NULL) {
@@ -689,31 +1037,16 @@ MLN_FUNC(static, int, mln_event_fd_timeout_set, \
 
 static inline void mln_event_fd_clr_set(mln_event_t *event, int fd)
 {
-    mln_event_desc_t tmp, *ed;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-    mln_rbtree_node_t *rn;
-#if defined(MSVC)
-    rn = mln_rbtree_search(event->ev_fd_tree, &tmp);
-#else
-    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
-#endif
-    if (mln_rbtree_null(rn, event->ev_fd_tree)) {
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    if (ed == NULL) {
         return;
     }
-    ed = (mln_event_desc_t *)mln_rbtree_node_data_get(rn);
-    if (ed->data.fd.timeout_node != NULL) {
-        mln_fheap_inline_delete(event->ev_fd_timeout_heap, ed->data.fd.timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-        mln_fheap_inline_node_free(event->ev_fd_timeout_heap, ed->data.fd.timeout_node, NULL);
-        ed->data.fd.timeout_node = NULL;
-        ed->data.fd.end_us = 0;
-    }
+    mln_event_fd_timeout_del(event, ed);
 #if defined(MLN_EPOLL)
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     ev.data.ptr = ed;
-    epoll_ctl(event->epollfd, EPOLL_CTL_DEL, fd, &ev);
+    mln_event_epoll_ctl(event, EPOLL_CTL_DEL, fd, &ev);
 #elif defined(MLN_KQUEUE)
     struct kevent ev;
     EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, ed);
@@ -732,8 +1065,7 @@ static inline void mln_event_fd_clr_set(mln_event_t *event, int fd)
         ed->data.fd.is_clear = 1;
         return;
     }
-    mln_rbtree_delete(event->ev_fd_tree, rn);
-    mln_rbtree_node_free(event->ev_fd_tree, rn);
+    mln_event_fd_remove(event, fd);
     if (ed->data.fd.in_active) {
         ev_fd_active_chain_del(&(event->ev_fd_active_head), \
                                &(event->ev_fd_active_tail), \
@@ -747,18 +1079,151 @@ static inline void mln_event_fd_clr_set(mln_event_t *event, int fd)
     mln_event_desc_free(ed);
 }
 
+/*
+ * cross-thread post queue
+ * Callbacks are queued under post_lock (taken even in single_thread mode).
+ * The wakeup channel, an eventfd or a socket pair where eventfd does not
+ * exist (a loopback one on Windows, see pipe() in mln_utils.c), is only
+ * created by the first mln_event_post. The poster may be any thread, so it
+ * does not touch the fd table: it raises post_new and the dispatching
+ * thread registers the channel on its next round.
+ */
+#if defined(MSVC)
+#define mln_event_post_new_get(ev)   ((ev)->post_new)
+#define mln_event_post_new_set(ev,v) ((ev)->post_new = (v))
+#else
+#define mln_event_post_new_get(ev)   __atomic_load_n(&((ev)->post_new), __ATOMIC_ACQUIRE)
+#define mln_event_post_new_set(ev,v) __atomic_store_n(&((ev)->post_new), (v), __ATOMIC_RELEASE)
+#endif
+
+MLN_FUNC(static, int, mln_event_post_channel, (mln_event_t *ev), (ev), {
+#if defined(__linux__)
+    if ((ev->post_rfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0) {
+        ev->post_rfd = -1;
+        return -1;
+    }
+    ev->post_wfd = ev->post_rfd;
+#else
+    int fds[2];
+#if defined(MSVC)
+    if (pipe(fds) < 0)
+#else
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+#endif
+        return -1;
+    ev->post_rfd = fds[0];
+    ev->post_wfd = fds[1];
+    mln_event_fd_nonblock_set(ev->post_wfd);
+#endif
+    mln_event_post_new_set(ev, 1);
+    return 0;
+})
+
+MLN_FUNC_VOID(static, void, mln_event_post_register, (mln_event_t *ev), (ev), {
+    /*on failure post_new stays set and the next round retries*/
+    if (mln_event_fd_set(ev, ev->post_rfd, M_EV_RECV|M_EV_NONBLOCK, M_EV_UNLIMITED, NULL, mln_event_post_process) == 0)
+        mln_event_post_new_set(ev, 0);
+})
+
+/*
+ * Wake the dispatching thread up. EAGAIN means the eventfd counter or the
+ * socket buffer is full, so a wakeup is pending anyway.
+ */
+MLN_FUNC(static inline, int, mln_event_post_signal, (int wfd), (wfd), {
+    int n;
+#if defined(__linux__)
+    mln_u64_t one = 1;
+    while ((n = write(wfd, &one, sizeof(one))) < 0 && errno == EINTR)
+        ;
+#else
+    while ((n = send(wfd, "p", 1, 0)) < 0 && errno == EINTR)
+        ;
+#endif
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    return 0;
+})
+
+int mln_event_post(mln_event_t *event, ev_tm_handler handler, void *data)
+{
+    struct mln_event_post_s *ep;
+
+    if ((ep = (struct mln_event_post_s *)malloc(sizeof(struct mln_event_post_s))) == NULL)
+        return -1;
+    ep->handler = handler;
+    ep->data = data;
+    ep->next = NULL;
+
+#if !defined(MSVC)
+    pthread_mutex_lock(&event->post_lock);
+#endif
+    if (event->post_wfd < 0 && mln_event_post_channel(event) < 0) {
+#if !defined(MSVC)
+        pthread_mutex_unlock(&event->post_lock);
+#endif
+        free(ep);
+        return -1;
+    }
+    /*a non-empty queue already has a wakeup pending*/
+    if (event->post_head == NULL) {
+        if (mln_event_post_signal(event->post_wfd) < 0) {
+#if !defined(MSVC)
+            pthread_mutex_unlock(&event->post_lock);
+#endif
+            free(ep);
+            return -1;
+        }
+        event->post_head = ep;
+    } else {
+        event->post_tail->next = ep;
+    }
+    event->post_tail = ep;
+#if !defined(MSVC)
+    pthread_mutex_unlock(&event->post_lock);
+#endif
+    return 0;
+}
+
+MLN_FUNC_VOID(static, void, mln_event_post_process, (mln_event_t *ev, int fd, void *data), (ev, fd, data), {
+    struct mln_event_post_s *ep;
+    char buf[64];
+
+#if defined(__linux__)
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+#else
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+#endif
+
+#if !defined(MSVC)
+    pthread_mutex_lock(&ev->post_lock);
+#endif
+    ep = ev->post_head;
+    ev->post_head = ev->post_tail = NULL;
+#if !defined(MSVC)
+    pthread_mutex_unlock(&ev->post_lock);
+#endif
+
+    while (ep != NULL) {
+        struct mln_event_post_s *next = ep->next;
+        ep->handler(ev, ep->data);
+        free(ep);
+        ep = next;
+    }
+})
+
 /*
  * set dispatch callback
  */
 void mln_event_callback_set(mln_event_t *ev, dispatch_callback dc, void *dc_data)
 {
 #if !defined(MSVC)
-    pthread_mutex_lock(&ev->cb_lock);
+    mln_event_lock(ev, cb_lock);
 #endif
     ev->callback = dc;
     ev->callback_data = dc_data;
 #if !defined(MSVC)
-    pthread_mutex_unlock(&ev->cb_lock);
+    mln_event_unlock(ev, cb_lock);
 #endif
 }
 
@@ -808,14 +1273,15 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
     struct epoll_event events[M_EV_EPOLL_SIZE], *ev, mod_ev;
 
     while (1) {
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (mln_event_post_new_get(event)) mln_event_post_register(event);
+        if (!mln_event_trylock(event, cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
             }
         }
         BREAK_OUT();
@@ -828,19 +1294,22 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
         mln_event_timer_process(event);
         BREAK_OUT();
 
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, fd_lock)) {
             epoll_wait(event->unusedfd, events, M_EV_EPOLL_SIZE, M_EV_NOLOCK_TIMEOUT_MS);
         } else {
+#if defined(MLN_IO_URING)
+            mln_event_uring_flush(event);
+#endif
             nfds = epoll_wait(event->epollfd, events, M_EV_EPOLL_SIZE, M_EV_TIMEOUT_MS);
             if (nfds < 0) {
                 if (errno == EINTR) {
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, fd_lock);
                     continue;
                 } else {
                     ASSERT(0);
                 }
             } else if (nfds == 0) {
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
                 epoll_wait(event->unusedfd, events, M_EV_EPOLL_SIZE, M_EV_NOLOCK_TIMEOUT_MS);
                 continue;
             }
@@ -937,15 +1406,15 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
                     if (other_oneshot) {
                         mod_ev.events = mod_event|EPOLLONESHOT;\
                         mod_ev.data.ptr = ed;\
-                        epoll_ctl(event->epollfd, EPOLL_CTL_MOD, ed->data.fd.fd, &mod_ev);\
+                        mln_event_epoll_ctl(event, EPOLL_CTL_MOD, ed->data.fd.fd, &mod_ev);\
                     } else {
                         mod_ev.events = mod_event;\
                         mod_ev.data.ptr = ed;\
-                        epoll_ctl(event->epollfd, EPOLL_CTL_MOD, ed->data.fd.fd, &mod_ev);\
+                        mln_event_epoll_ctl(event, EPOLL_CTL_MOD, ed->data.fd.fd, &mod_ev);\
                     }
                 }
             }
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, fd_lock);
         }
     }
 })
@@ -957,14 +1426,15 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
     struct timespec ts;
 
     while (1) {
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (mln_event_post_new_get(event)) mln_event_post_register(event);
+        if (!mln_event_trylock(event, cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
             }
         }
         BREAK_OUT();
@@ -977,7 +1447,7 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
         mln_event_timer_process(event);
         BREAK_OUT();
 
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, fd_lock)) {
             ts.tv_sec = 0;
             ts.tv_nsec = M_EV_NOLOCK_TIMEOUT_NS;
             kevent(event->unusedfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
@@ -987,13 +1457,13 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
             nfds = kevent(event->kqfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
             if (nfds < 0) {
                 if (errno == EINTR) {
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, fd_lock);
                     continue;
                 } else {
                     ASSERT(0);
                 }
             } else if (nfds == 0) {
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
                 ts.tv_sec = 0;
                 ts.tv_nsec = M_EV_NOLOCK_TIMEOUT_NS;
                 kevent(event->unusedfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
@@ -1081,7 +1551,7 @@ MLN_FUNC_VOID(, void, mln_event_dispatch, (mln_event_t *event), (event), {
                                        ed);
                 ed->data.fd.in_active = 1;
             }
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, fd_lock);
         }
     }
 })
@@ -1097,15 +1567,16 @@ void mln_event_dispatch(mln_event_t *event)
     mln_u32_t move;
 
     while (1) {
+        if (mln_event_post_new_get(event)) mln_event_post_register(event);
 #if !defined(MSVC)
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (!mln_event_trylock(event, cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, cb_lock);
             }
         }
 #else
@@ -1126,7 +1597,7 @@ void mln_event_dispatch(mln_event_t *event)
         FD_ZERO(err_set);
 
 #if !defined(MSVC)
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, fd_lock)) {
             tm.tv_sec = 0;
             tm.tv_usec = M_EV_NOLOCK_TIMEOUT_US;
             select(event->select_fd, rd_set, wr_set, err_set, &tm);
@@ -1149,7 +1620,7 @@ void mln_event_dispatch(mln_event_t *event)
             if (nfds < 0) {
 #if !defined(MSVC)
                 if (errno == EINTR || errno == ENOMEM) {
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, fd_lock);
                     continue;
                 } else {
                     ASSERT(0);
@@ -1159,7 +1630,7 @@ void mln_event_dispatch(mln_event_t *event)
 #endif
             } else if (nfds == 0) {
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 tm.tv_sec = 0;
                 tm.tv_usec = M_EV_NOLOCK_TIMEOUT_US;
@@ -1208,7 +1679,7 @@ void mln_event_dispatch(mln_event_t *event)
                 }
             }
 #if !defined(MSVC)
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, fd_lock);
         }
 #endif
     }
@@ -1225,7 +1696,7 @@ static inline void mln_event_active_fd_process(mln_event_t *event)
 
 lp:
 #if !defined(MSVC)
-    if (pthread_mutex_trylock(&event->fd_lock))
+    if (mln_event_trylock(event, fd_lock))
         return;
 #endif
 
@@ -1235,12 +1706,7 @@ lp:
                                &(event->ev_fd_active_tail), \
                                ed);
         ef = &(ed->data.fd);
-        if (ef->timeout_node != NULL) {
-            mln_fheap_inline_delete(event->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-            mln_fheap_inline_node_free(event->ev_fd_timeout_heap, ef->timeout_node, NULL);
-            ef->timeout_node = NULL;
-            ef->end_us = 0;
-        }
+        mln_event_fd_timeout_del(event, ed);
 
         ef->in_active = 0;
         ef->in_process = 1;
@@ -1252,11 +1718,11 @@ lp:
                 data = ef->rcv_data;
                 fd = ef->fd;
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 h(event, fd, data);
 #if !defined(MSVC)
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, fd_lock);
 #endif
             }
             ef->active_flag &= (~M_EV_RECV);
@@ -1268,11 +1734,11 @@ lp:
                 data = ef->snd_data;
                 fd = ef->fd;
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 h(event, fd, data);
 #if !defined(MSVC)
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, fd_lock);
 #endif
             }
             ef->active_flag &= (~M_EV_SEND);
@@ -1284,11 +1750,11 @@ lp:
                 data = ef->err_data;
                 fd = ef->fd;
 #if !defined(MSVC)
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, fd_lock);
 #endif
                 h(event, fd, data);
 #if !defined(MSVC)
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, fd_lock);
 #endif
             }
             ef->active_flag &= (~M_EV_ERROR);
@@ -1298,14 +1764,14 @@ lp:
         if (ef->is_clear) mln_event_fd_clr_set(event, ef->fd);
 
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
 
         if (event->is_break) return;
         goto lp;
     } else {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
     }
 }
@@ -1325,46 +1791,64 @@ static inline void mln_event_fd_timeout_process(mln_event_t *event)
 
 lp:
 #if !defined(MSVC)
-    if (pthread_mutex_trylock(&event->fd_lock))
+    if (mln_event_trylock(event, fd_lock))
         return;
 #endif
 
-    fn = mln_fheap_minimum(event->ev_fd_timeout_heap);
-    if (fn == NULL) {
+    if (event->timer_wheel) {
+        ed = mln_event_wheel_expired(event->ev_fd_timeout_wheel, now);
+        if (ed == NULL) {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, fd_lock);
 #endif
-        return;
-    }
-    ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
-    ef = &(ed->data.fd);
-    if (ef->in_active) {
-        ev_fd_active_chain_del(&(event->ev_fd_active_head), \
-                               &(event->ev_fd_active_tail), \
-                               ed);
-        ef->in_active = 0;
-    }
-    if (ef->end_us > now) {
+            return;
+        }
+        ef = &(ed->data.fd);
+        if (ef->in_active) {
+            ev_fd_active_chain_del(&(event->ev_fd_active_head), \
+                                   &(event->ev_fd_active_tail), \
+                                   ed);
+            ef->in_active = 0;
+        }
+        ef->in_process = 1;
+    } else {
+        fn = mln_fheap_minimum(event->ev_fd_timeout_heap);
+        if (fn == NULL) {
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, fd_lock);
 #endif
-        return;
+            return;
+        }
+        ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
+        ef = &(ed->data.fd);
+        if (ef->in_active) {
+            ev_fd_active_chain_del(&(event->ev_fd_active_head), \
+                                   &(event->ev_fd_active_tail), \
+                                   ed);
+            ef->in_active = 0;
+        }
+        if (ef->end_us > now) {
+#if !defined(MSVC)
+            mln_event_unlock(event, fd_lock);
+#endif
+            return;
+        }
+        ef->in_process = 1;
+        mln_fheap_inline_delete(event->ev_fd_timeout_heap, fn, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
+        mln_fheap_inline_node_free(event->ev_fd_timeout_heap, fn, NULL);
+        ed->data.fd.timeout_node = NULL;
     }
-    ef->in_process = 1;
-    mln_fheap_inline_delete(event->ev_fd_timeout_heap, fn, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-    mln_fheap_inline_node_free(event->ev_fd_timeout_heap, fn, NULL);
-    ed->data.fd.timeout_node = NULL;
 
     if (ed->data.fd.timeout_handler != NULL) {
         h = ed->data.fd.timeout_handler;
         fd = ed->data.fd.fd;
         data = ed->data.fd.timeout_data;
 #if !defined(MSVC)
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, fd_lock);
 #endif
         h(event, fd, data);
 #if !defined(MSVC)
-        pthread_mutex_lock(&event->fd_lock);
+        mln_event_lock(event, fd_lock);
 #endif
     }
 
@@ -1373,13 +1857,222 @@ lp:
     if (ef->is_clear) mln_event_fd_clr_set(event, ef->fd);
 
 #if !defined(MSVC)
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, fd_lock);
 #endif
 
     if (event->is_break) return;
     goto lp;
 }
 
+/*
+ * fd table functions
+ * Descriptors below M_EV_FD_TABLE_MAX live in ev_fd_table which grows to the
+ * highest fd seen, so lookups in fd_set and clr_set are a single array access.
+ * Anything larger (e.g. sparse socket handles) falls back to ev_fd_tree.
+ */
+MLN_FUNC(static inline, mln_event_desc_t *, mln_event_fd_search, (mln_event_t *event, int fd), (event, fd), {
+    mln_event_desc_t tmp;
+    mln_rbtree_node_t *rn;
+
+    if ((mln_u32_t)fd < event->ev_fd_table_size) return event->ev_fd_table[fd];
+    if (fd < M_EV_FD_TABLE_MAX) return NULL;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.type = M_EV_FD;
+    tmp.data.fd.fd = fd;
+#if defined(MSVC)
+    rn = mln_rbtree_search(event->ev_fd_tree, &tmp);
+#else
+    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
+#endif
+    if (mln_rbtree_null(rn, event->ev_fd_tree)) return NULL;
+    return (mln_event_desc_t *)mln_rbtree_node_data_get(rn);
+})
+
+MLN_FUNC(static inline, int, mln_event_fd_insert, (mln_event_t *event, mln_event_desc_t *ed), (event, ed), {
+    int fd = ed->data.fd.fd;
+    mln_u32_t size;
+    mln_event_desc_t **table;
+    mln_rbtree_node_t *rn;
+
+    /*a negative fd would wrap the table size below*/
+    if (fd < 0) return -1;
+    if (fd < M_EV_FD_TABLE_MAX) {
+        if ((mln_u32_t)fd >= event->ev_fd_table_size) {
+            size = event->ev_fd_table_size? event->ev_fd_table_size: M_EV_FD_TABLE_MIN;
+            while (size <= (mln_u32_t)fd) size <<= 1;
+            if (size > M_EV_FD_TABLE_MAX) size = M_EV_FD_TABLE_MAX;
+            table = (mln_event_desc_t **)realloc(event->ev_fd_table, size * sizeof(mln_event_desc_t *));
+            if (table == NULL) return -1;
+            memset(table + event->ev_fd_table_size, 0, (size - event->ev_fd_table_size) * sizeof(mln_event_desc_t *));
+            event->ev_fd_table = table;
+            event->ev_fd_table_size = size;
+        }
+        event->ev_fd_table[fd] = ed;
+        return 0;
+    }
+
+    if ((rn = mln_rbtree_node_new(event->ev_fd_tree, ed)) == NULL) return -1;
+    mln_rbtree_inline_insert(event->ev_fd_tree, rn, mln_event_rbtree_fd_cmp);
+    return 0;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_fd_remove, (mln_event_t *event, int fd), (event, fd), {
+    mln_event_desc_t tmp;
+    mln_rbtree_node_t *rn;
+
+    if (fd < M_EV_FD_TABLE_MAX) {
+        if ((mln_u32_t)fd < event->ev_fd_table_size) event->ev_fd_table[fd] = NULL;
+        return;
+    }
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.type = M_EV_FD;
+    tmp.data.fd.fd = fd;
+#if defined(MSVC)
+    rn = mln_rbtree_search(event->ev_fd_tree, &tmp);
+#else
+    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
+#endif
+    if (mln_rbtree_null(rn, event->ev_fd_tree)) return;
+    mln_rbtree_delete(event->ev_fd_tree, rn);
+    mln_rbtree_node_free(event->ev_fd_tree, rn);
+})
+
+/*
+ * timing wheel functions
+ */
+MLN_FUNC(static, struct mln_event_wheel_s *, mln_event_wheel_new, (void), (), {
+    struct timeval tv;
+    struct mln_event_wheel_s *w;
+
+    if ((w = (struct mln_event_wheel_s *)calloc(1, sizeof(struct mln_event_wheel_s))) == NULL)
+        return NULL;
+    gettimeofday(&tv, NULL);
+    w->cur = (mln_u64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    return w;
+})
+
+MLN_FUNC_VOID(static, void, mln_event_wheel_free, (struct mln_event_wheel_s *w, int free_desc), (w, free_desc), {
+    mln_event_wheel_slot_t *slot, *end;
+    mln_event_desc_t *ed;
+
+    if (w == NULL) return;
+    if (free_desc) {
+        slot = &w->root[0];
+        end = &w->expired + 1;
+        for (; slot < end; ++slot) {
+            while ((ed = slot->head) != NULL) {
+                ev_wheel_chain_del(&(slot->head), &(slot->tail), ed);
+                mln_event_desc_free(ed);
+            }
+        }
+    }
+    free(w);
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_wheel_add, \
+              (struct mln_event_wheel_s *w, mln_event_desc_t *ed), (w, ed), \
+{
+    mln_u64_t us = ed->type == M_EV_TM? ed->data.tm.end_tm: ed->data.fd.end_us;
+    mln_u64_t expires = (us + 999) / 1000, idx;
+    mln_event_wheel_slot_t *slot;
+    int i;
+
+    if (expires < w->cur) expires = w->cur;
+    idx = expires - w->cur;
+    if (idx < M_EV_WHEEL_ROOT_SIZE) {
+        slot = &w->root[expires & M_EV_WHEEL_ROOT_MASK];
+    } else {
+        if (idx > M_EV_WHEEL_MAX_TICKS) {
+            expires = w->cur + M_EV_WHEEL_MAX_TICKS;
+            idx = M_EV_WHEEL_MAX_TICKS;
+        }
+        for (i = 0; i < M_EV_WHEEL_LVL_NUM - 1; ++i) {
+            if (idx < ((mln_u64_t)1 << mln_event_wheel_lvl_shift(i + 1))) break;
+        }
+        slot = &w->lvl[i][(expires >> mln_event_wheel_lvl_shift(i)) & M_EV_WHEEL_LVL_MASK];
+    }
+    ev_wheel_chain_add(&(slot->head), &(slot->tail), ed);
+    ed->wh_slot = slot;
+    ++(w->count);
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_wheel_del, \
+              (struct mln_event_wheel_s *w, mln_event_desc_t *ed), (w, ed), \
+{
+    mln_event_wheel_slot_t *slot = ed->wh_slot;
+
+    if (slot == NULL) return;
+    ev_wheel_chain_del(&(slot->head), &(slot->tail), ed);
+    ed->wh_slot = NULL;
+    if (slot != &w->expired) --(w->count);
+})
+
+/*
+ * Move everything due up to 'now' (us) into the expired slot, cascading the
+ * upper levels each time the root wheel wraps, then pop one expired entry.
+ */
+MLN_FUNC(static inline, mln_event_desc_t *, mln_event_wheel_expired, \
+         (struct mln_event_wheel_s *w, mln_uauto_t now), (w, now), \
+{
+    mln_u64_t tick = (mln_u64_t)now / 1000, n;
+    mln_event_wheel_slot_t *slot, tmp;
+    mln_event_desc_t *ed;
+    int i;
+
+    while (w->cur <= tick) {
+        if (!w->count) {
+            w->cur = tick + 1;
+            break;
+        }
+        if (!(w->cur & M_EV_WHEEL_ROOT_MASK)) {
+            for (i = 0; i < M_EV_WHEEL_LVL_NUM; ++i) {
+                n = (w->cur >> mln_event_wheel_lvl_shift(i)) & M_EV_WHEEL_LVL_MASK;
+                slot = &w->lvl[i][n];
+                tmp = *slot;
+                slot->head = slot->tail = NULL;
+                while ((ed = tmp.head) != NULL) {
+                    ev_wheel_chain_del(&(tmp.head), &(tmp.tail), ed);
+                    --(w->count);
+                    mln_event_wheel_add(w, ed);
+                }
+                if (n) break;
+            }
+        }
+        slot = &w->root[w->cur & M_EV_WHEEL_ROOT_MASK];
+        while ((ed = slot->head) != NULL) {
+            ev_wheel_chain_del(&(slot->head), &(slot->tail), ed);
+            --(w->count);
+            ev_wheel_chain_add(&(w->expired.head), &(w->expired.tail), ed);
+            ed->wh_slot = &w->expired;
+        }
+        ++(w->cur);
+    }
+
+    if ((ed = w->expired.head) != NULL) {
+        ev_wheel_chain_del(&(w->expired.head), &(w->expired.tail), ed);
+        ed->wh_slot = NULL;
+    }
+    return ed;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_event_fd_timeout_del, (mln_event_t *ev, mln_event_desc_t *ed), (ev, ed), {
+    mln_event_fd_t *ef = &(ed->data.fd);
+
+    if (ev->timer_wheel) {
+        mln_event_wheel_del(ev->ev_fd_timeout_wheel, ed);
+        ef->end_us = 0;
+        return;
+    }
+    if (ef->timeout_node != NULL) {
+        mln_fheap_inline_delete(ev->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
+        mln_fheap_inline_node_free(ev->ev_fd_timeout_heap, ef->timeout_node, NULL);
+        ef->timeout_node = NULL;
+        ef->end_us = 0;
+    }
+})
+
 /*
  * rbtree functions
  */
@@ -1431,3 +2124,8 @@ MLN_CHAIN_FUNC_DEFINE(static inline, \
                       mln_event_desc_t, \
                       act_prev, \
                       act_next);
+MLN_CHAIN_FUNC_DEFINE(static inline, \
+                      ev_wheel, \
+                      mln_event_desc_t, \
+                      wh_prev, \
+                      wh_next);
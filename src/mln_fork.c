@@ -559,7 +559,7 @@ MLN_FUNC(static inline, int, mln_ipc_get_buf_with_len, \
         pos += size;
         len -= size;
         b->left_pos += size;
-        mln_chain_pool_release(mln_tcp_conn_pop(tc, M_C_RECV));
+        mln_tcp_conn_recycle(tc, mln_tcp_conn_pop(tc, M_C_RECV));
         if (len == 0) break;
     }
 
@@ -588,7 +588,7 @@ MLN_FUNC(static inline, mln_size_t, mln_ipc_discard_bytes, \
 
         b->left_pos += left_size;
         size -= left_size;
-        mln_chain_pool_release(mln_tcp_conn_pop(tc, M_C_RECV));
+        mln_tcp_conn_recycle(tc, mln_tcp_conn_pop(tc, M_C_RECV));
         if (size == 0) return 0;
     }
 
@@ -11,6 +11,13 @@
 #include "mln_types.h"
 #include "mln_func.h"
 
+#if !defined(MLN_HTTP_DISABLE_SIMD) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define MLN_HTTP_SIMD
+#include <immintrin.h>
+#endif
+
 
 struct mln_http_chain_s {
     mln_http_t  *http;
@@ -18,6 +25,8 @@ struct mln_http_chain_s {
     mln_chain_t *tail;
     mln_u8ptr_t  pos;
     mln_size_t   left_size;
+    mln_size_t   alloc_size;
+    int          split;
 };
 
 static inline int mln_http_line_length(mln_http_t *http, mln_chain_t *in, mln_size_t *len);
@@ -47,6 +56,223 @@ mln_http_generate_write(struct mln_http_chain_s *hc, void *buf, mln_size_t size)
 #endif
 static inline int
 mln_http_generate_set_last_in_chain(struct mln_http_chain_s *hc);
+static inline mln_chain_t *mln_http_generate_node(struct mln_http_chain_s *hc);
+static inline int mln_http_generate_ref(struct mln_http_chain_s *hc, mln_u8ptr_t data, mln_size_t size);
+static inline int mln_http_generate_value(struct mln_http_chain_s *hc, mln_u8ptr_t data, mln_size_t size);
+static inline int mln_http_generate_line(struct mln_http_chain_s *hc);
+static inline int mln_http_generate_fields(struct mln_http_chain_s *hc);
+static inline int mln_http_generate_head(struct mln_http_chain_s *hc);
+static int mln_http_generate_chunked(struct mln_http_chain_s *hc);
+static int mln_http_parse_body(mln_http_t *http, mln_chain_t **in);
+static inline int mln_http_body_mode_detect(mln_http_t *http);
+static inline int mln_http_chunk_step(mln_http_t *http, mln_u8_t ch);
+static inline int
+mln_http_field_token(mln_string_t *val, char *token, int last_only);
+static inline int mln_http_parse_field_index(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len);
+static inline mln_u32_t mln_http_name_hash(mln_u8ptr_t data, mln_size_t len);
+static inline int mln_http_known_find(mln_string_t *name, mln_u32_t hash);
+static inline mln_http_slice_t *mln_http_index_search(mln_http_index_t *idx, mln_string_t *key);
+static inline void mln_http_chain_drop(mln_http_t *http, mln_chain_t *c);
+static void mln_http_index_clear(mln_http_t *http);
+
+/*chunked decoder states*/
+#define M_HTTP_CHUNK_SIZE_START  0
+#define M_HTTP_CHUNK_SIZE        1
+#define M_HTTP_CHUNK_EXT         2
+#define M_HTTP_CHUNK_SIZE_LF     3
+#define M_HTTP_CHUNK_DATA        4
+#define M_HTTP_CHUNK_DATA_CR     5
+#define M_HTTP_CHUNK_DATA_LF     6
+#define M_HTTP_CHUNK_TRAILER     7
+#define M_HTTP_CHUNK_TRAILER_LN  8
+#define M_HTTP_CHUNK_TRAILER_LF  9
+#define M_HTTP_CHUNK_LINE_SIZE   32
+/*what is left of the header after a cached block is a few fields*/
+#define M_HTTP_CACHED_TAIL_SIZE  256
+
+#define mln_http_syntax_error(h) \
+    mln_http_error_set((h), mln_http_type_get(h) == M_HTTP_REQUEST? \
+                            M_HTTP_BAD_REQUEST: M_HTTP_UNPARSEABLE_RESPONSE_HEADERS)
+
+/*
+ * Well-known fields, indexed by M_HTTP_H_*. The hashes are the
+ * FNV-1a values of mln_http_name_hash() and
+ * mln_http_known_slot is the open-addressed table built from them
+ * (slot = hash & 63, linear probing, value = id + 1).
+ */
+static struct {
+    mln_string_t name;
+    mln_u32_t    hash;
+} mln_http_known[M_HTTP_H_MAX] = {
+{mln_string("Host"),                0xaffea56fU},
+{mln_string("Content-Length"),      0x4df9451dU},
+{mln_string("Content-Type"),        0xfcf70995U},
+{mln_string("Connection"),          0x38b99ed9U},
+{mln_string("Transfer-Encoding"),   0xddb4744cU},
+{mln_string("User-Agent"),          0x24259beeU},
+{mln_string("Accept"),              0x08247e29U},
+{mln_string("Accept-Encoding"),     0xc9715a99U},
+{mln_string("Accept-Language"),     0x75f67716U},
+{mln_string("Cookie"),              0x77a740bfU},
+{mln_string("Authorization"),       0x913657beU},
+{mln_string("Cache-Control"),       0x50c8a4cdU},
+{mln_string("Upgrade"),             0xdc97cc77U},
+{mln_string("Referer"),             0xec9af966U},
+{mln_string("Origin"),              0xd97f9a4fU},
+{mln_string("If-None-Match"),       0x972b6177U},
+{mln_string("If-Modified-Since"),   0x83e879a9U},
+{mln_string("Range"),               0xfadc0cd2U},
+{mln_string("Expect"),              0x96da6b58U},
+{mln_string("Content-Encoding"),    0x03e2ed88U},
+{mln_string("Set-Cookie"),          0x6e2be738U},
+{mln_string("Location"),            0x0bf5a9a6U},
+{mln_string("Date"),                0xd472dc59U},
+{mln_string("Server"),              0x40ac3dd2U},
+{mln_string("Keep-Alive"),          0xe18edb80U},
+{mln_string("X-Forwarded-For"),     0xadb2f988U}
+};
+
+static mln_u8_t mln_http_known_slot[64] = {
+    25, 0, 0, 0, 0, 0, 0, 0, 20, 26, 0, 0, 5, 12, 0, 15,
+    0, 0, 18, 24, 0, 3, 9, 0, 19, 4, 8, 23, 0, 2, 0, 0,
+    0, 0, 0, 0, 0, 0, 14, 22, 0, 7, 17, 0, 0, 0, 6, 1,
+    0, 0, 0, 0, 0, 0, 0, 13, 16, 21, 0, 0, 0, 0, 11, 10
+};
+
+/*URI, arguments and response message are slices too in index mode*/
+#define mln_http_string_new(h,t,member) \
+    ((h)->index == NULL? mln_string_pool_dup((h)->pool, (t)): \
+                         ((h)->index->member = *(t), &(h)->index->member))
+#define mln_http_string_free(h,s) \
+    if ((h)->index == NULL || ((s) != &(h)->index->uri && (s) != &(h)->index->args && \
+                               (s) != &(h)->index->response_msg)) \
+        mln_string_free(s)
+
+/*
+ * Tokenizer character classes: bit 0 is tchar (RFC 7230), bit 1 is
+ * field-value (HTAB, SP, VCHAR, obs-text) and bit 2 is a request-line
+ * element (VCHAR, obs-text). Scans stop at the first byte without the
+ * requested bit.
+ */
+#define M_HTTP_SCAN_TOKEN 1
+#define M_HTTP_SCAN_VALUE 2
+#define M_HTTP_SCAN_ELEM  4
+
+static const mln_u8_t mln_http_char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    2, 7, 6, 7, 7, 7, 7, 7, 6, 6, 7, 7, 6, 7, 7, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 6, 6, 6,
+    6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 7, 6, 7, 0,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6
+};
+
+#if defined(MLN_HTTP_SIMD)
+/*
+ * Return the stop mask of 16 bytes, bit i is set if byte i stops the
+ * scan. Signed compares put obs-text (0x80-0xff) below zero.
+ */
+static inline int mln_http_scan_mask_sse2(__m128i v, int kind)
+{
+    __m128i stop;
+
+    if (kind == M_HTTP_SCAN_TOKEN) {
+        /*not 0x21-0x7e, or one of "(),/:;<=>?@[\]{}*/
+        stop = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x21)), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        stop = _mm_or_si128(stop, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x39)), \
+                                                _mm_cmplt_epi8(v, _mm_set1_epi8(0x41))));
+        stop = _mm_or_si128(stop, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x5a)), \
+                                                _mm_cmplt_epi8(v, _mm_set1_epi8(0x5e))));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+    } else {
+        /*CTLs, except HTAB in field values*/
+        stop = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-1)), \
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(kind == M_HTTP_SCAN_VALUE? 0x20: 0x21)));
+        if (kind == M_HTTP_SCAN_VALUE)
+            stop = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), stop);
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+    }
+    return _mm_movemask_epi8(stop);
+}
+
+/*
+ * tchar is tested by nibble lookup: bit h of lo[c & 0xf] is set if
+ * (h << 4 | (c & 0xf)) is a tchar, hi[c >> 4] is 1 << (c >> 4).
+ */
+__attribute__((target("avx2")))
+static mln_u8ptr_t mln_http_scan_avx2(mln_u8ptr_t p, mln_u8ptr_t end, int kind)
+{
+    const __m256i lo = _mm256_setr_epi8(
+        (char)0xe8, (char)0xfc, (char)0xf8, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc,
+        (char)0xf8, (char)0xf8, (char)0xf4, 0x54, (char)0xd0, 0x54, (char)0xf4, 0x70,
+        (char)0xe8, (char)0xfc, (char)0xf8, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc,
+        (char)0xf8, (char)0xf8, (char)0xf4, 0x54, (char)0xd0, 0x54, (char)0xf4, 0x70);
+    const __m256i hi = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+    __m256i v, stop;
+    unsigned int mask;
+
+    for (; end - p >= 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        if (kind == M_HTTP_SCAN_TOKEN) {
+            stop = _mm256_and_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)), \
+                                    _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+            stop = _mm256_cmpeq_epi8(stop, zero);
+        } else {
+            stop = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)), \
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(kind == M_HTTP_SCAN_VALUE? 0x20: 0x21), v));
+            if (kind == M_HTTP_SCAN_VALUE)
+                stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), stop);
+            stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+        }
+        if ((mask = (unsigned int)_mm256_movemask_epi8(stop)) != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return p;
+}
+#endif
+
+/*
+ * Return the first byte in [p, end) that is not of class 'kind'.
+ * Blocks of 32 bytes go through AVX2 when the CPU has it, blocks of
+ * 16 through SSE2, and the tail through the table.
+ */
+static inline mln_u8ptr_t mln_http_scan(mln_u8ptr_t p, mln_u8ptr_t end, int kind)
+{
+#if defined(MLN_HTTP_SIMD)
+    int mask;
+
+    if (end - p >= 32 && __builtin_cpu_supports("avx2")) {
+        p = mln_http_scan_avx2(p, end, kind);
+        if (end - p >= 32) return p;
+    }
+    for (; end - p >= 16; p += 16) {
+        if ((mask = mln_http_scan_mask_sse2(_mm_loadu_si128((const __m128i *)p), kind)) != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && (mln_http_char_class[*p] & kind))
+        ++p;
+    return p;
+}
 
 mln_string_t http_version[] = {
     mln_string("HTTP/1.0"),
@@ -155,11 +381,13 @@ MLN_FUNC(, int, mln_http_parse, (mln_http_t *http, mln_chain_t **in), (http, in)
     while (!mln_http_done_get(http) && \
            (ret = mln_http_line_length(http, *in, &len)) == M_HTTP_RET_DONE)
     {
-        if ((rc = mln_http_process_line(http, in, len) == M_HTTP_RET_ERROR))
+        if ((rc = mln_http_process_line(http, in, len)) == M_HTTP_RET_ERROR)
             return rc;
     }
     if (ret == M_HTTP_RET_OK || ret == M_HTTP_RET_ERROR) return ret;
 
+    if (mln_http_framing_get(http)) return mln_http_parse_body(http, in);
+
     if (handler != NULL) ret = handler(http, in, NULL);
     if (ret == M_HTTP_RET_DONE) {
         mln_http_done_set(http, 0);
@@ -167,6 +395,238 @@ MLN_FUNC(, int, mln_http_parse, (mln_http_t *http, mln_chain_t **in), (http, in)
     return ret;
 })
 
+MLN_FUNC(static, int, mln_http_parse_body, (mln_http_t *http, mln_chain_t **in), (http, in), {
+    int ret = M_HTTP_RET_OK;
+    mln_size_t n;
+    mln_buf_t *b, *sb;
+    mln_u8ptr_t p, end;
+    mln_chain_t *c, *sc, *head = NULL, *tail = NULL;
+    mln_alloc_t *pool = mln_http_pool_get(http);
+    mln_http_handler handler = mln_http_handler_get(http);
+
+    if (http->body_mode == M_HTTP_BODY_UNKNOWN) {
+        if (mln_http_body_mode_detect(http) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (http->body_mode == M_HTTP_BODY_NONE) {
+            ret = M_HTTP_RET_DONE;
+            goto out;
+        }
+    }
+
+    for (c = *in; c != NULL && ret == M_HTTP_RET_OK; c = c->next) {
+        if ((b = c->buf) == NULL || b->in_file) continue;
+        for (p = b->left_pos, end = b->last; p < end; ) {
+            if (http->body_mode == M_HTTP_BODY_CHUNKED && http->chunk_state != M_HTTP_CHUNK_DATA) {
+                if ((ret = mln_http_chunk_step(http, *p++)) != M_HTTP_RET_OK)
+                    break;
+                continue;
+            }
+            /*payload bytes are handed out in place, never copied*/
+            n = end - p;
+            if (n > http->body_left) n = http->body_left;
+            if ((sc = mln_chain_new(pool)) == NULL || (sb = mln_buf_new(pool)) == NULL) {
+                if (sc != NULL) mln_chain_pool_release(sc);
+                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+                ret = M_HTTP_RET_ERROR;
+                break;
+            }
+            sc->buf = sb;
+            sb->start = sb->pos = sb->left_pos = p;
+            sb->last = sb->end = p + n;
+            sb->in_memory = 1;
+            sb->temporary = 1;
+            mln_chain_add(&head, &tail, sc);
+            p += n;
+            if ((http->body_left -= n) == 0) {
+                if (http->body_mode == M_HTTP_BODY_LENGTH) {
+                    ret = M_HTTP_RET_DONE;
+                    break;
+                }
+                http->chunk_state = M_HTTP_CHUNK_DATA_CR;
+            }
+        }
+        b->left_pos = p;
+    }
+
+    if (ret == M_HTTP_RET_DONE) {
+        if (tail == NULL) {
+            if ((sc = mln_chain_new(pool)) == NULL || (sb = mln_buf_new(pool)) == NULL) {
+                if (sc != NULL) mln_chain_pool_release(sc);
+                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+                return M_HTTP_RET_ERROR;
+            }
+            sc->buf = sb;
+            sb->in_memory = 1;
+            sb->temporary = 1;
+            head = tail = sc;
+        }
+        tail->buf->last_in_chain = 1;
+    }
+    if (ret != M_HTTP_RET_ERROR && head != NULL && handler != NULL) {
+        if (handler(http, &head, &tail) == M_HTTP_RET_ERROR)
+            ret = M_HTTP_RET_ERROR;
+    }
+    mln_chain_pool_release_all(head);
+
+out:
+    while ((c = *in) != NULL && (c->buf == NULL || \
+           (!c->buf->in_file && mln_buf_left_size(c->buf) <= 0)))
+    {
+        *in = c->next;
+        mln_http_chain_drop(http, c);
+    }
+
+    if (ret == M_HTTP_RET_DONE) {
+        http->body_mode = M_HTTP_BODY_UNKNOWN;
+        mln_http_done_set(http, 0);
+    }
+    return ret;
+})
+
+MLN_FUNC(static inline, int, mln_http_body_mode_detect, (mln_http_t *http), (http), {
+    mln_u64_t len = 0;
+    mln_u8ptr_t p, end;
+    mln_string_t *val;
+    mln_u32_t status = mln_http_status_get(http);
+
+    if (mln_http_type_get(http) == M_HTTP_RESPONSE && \
+        (status < 200 || status == M_HTTP_NO_CONTENT || status == M_HTTP_NOT_MODIFIED))
+    {
+        http->body_mode = M_HTTP_BODY_NONE;
+        return M_HTTP_RET_OK;
+    }
+
+    if ((val = mln_http_known_field_get(http, M_HTTP_H_TRANSFER_ENCODING)) != NULL) {
+        if (mln_http_field_token(val, "chunked", 1)) {
+            http->body_mode = M_HTTP_BODY_CHUNKED;
+            http->chunk_state = M_HTTP_CHUNK_SIZE_START;
+            http->body_left = 0;
+            return M_HTTP_RET_OK;
+        }
+        if (mln_http_type_get(http) == M_HTTP_REQUEST) {
+            mln_http_error_set(http, M_HTTP_NOT_IMPLEMENTED);
+            return M_HTTP_RET_ERROR;
+        }
+        /*a response delimited by closing the connection is left to the caller*/
+        http->body_mode = M_HTTP_BODY_NONE;
+        return M_HTTP_RET_OK;
+    }
+
+    if ((val = mln_http_known_field_get(http, M_HTTP_H_CONTENT_LENGTH)) != NULL) {
+        for (p = val->data, end = p + val->len; p < end && mln_isdigit(*p); ++p) {
+            if (len > (((mln_u64_t)1 << 60) - 1) / 10) break;
+            len = len * 10 + (*p - '0');
+        }
+        for (; p < end && (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t'); ++p)
+            ;
+        if (p < end || p == val->data) {
+            mln_http_syntax_error(http);
+            return M_HTTP_RET_ERROR;
+        }
+        http->body_mode = len? M_HTTP_BODY_LENGTH: M_HTTP_BODY_NONE;
+        http->body_left = len;
+        return M_HTTP_RET_OK;
+    }
+
+    http->body_mode = M_HTTP_BODY_NONE;
+    return M_HTTP_RET_OK;
+})
+
+/*
+ * Consume one byte of chunk framing (size lines, CRLFs and trailers).
+ * Chunk data itself is sliced out by the caller.
+ */
+MLN_FUNC(static inline, int, mln_http_chunk_step, (mln_http_t *http, mln_u8_t ch), (http, ch), {
+    mln_u8_t v;
+
+    switch (http->chunk_state) {
+        case M_HTTP_CHUNK_SIZE_START:
+        case M_HTTP_CHUNK_SIZE:
+            if (mln_isdigit(ch)) v = ch - '0';
+            else if (ch >= 'a' && ch <= 'f') v = ch - 'a' + 10;
+            else if (ch >= 'A' && ch <= 'F') v = ch - 'A' + 10;
+            else if (http->chunk_state == M_HTTP_CHUNK_SIZE_START) goto err;
+            else if (ch == (mln_u8_t)';' || ch == (mln_u8_t)' ' || ch == (mln_u8_t)'\t') {
+                http->chunk_state = M_HTTP_CHUNK_EXT;
+                return M_HTTP_RET_OK;
+            } else if (ch == (mln_u8_t)'\r') {
+                http->chunk_state = M_HTTP_CHUNK_SIZE_LF;
+                return M_HTTP_RET_OK;
+            } else if (ch == (mln_u8_t)'\n') {
+                goto size_done;
+            } else {
+                goto err;
+            }
+            if (http->body_left >> 56) goto err;
+            http->body_left = (http->body_left << 4) | v;
+            http->chunk_state = M_HTTP_CHUNK_SIZE;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_EXT:
+            if (ch == (mln_u8_t)'\n') goto size_done;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_SIZE_LF:
+            if (ch != (mln_u8_t)'\n') goto err;
+            goto size_done;
+        case M_HTTP_CHUNK_DATA_CR:
+            if (ch == (mln_u8_t)'\r') {
+                http->chunk_state = M_HTTP_CHUNK_DATA_LF;
+                return M_HTTP_RET_OK;
+            }
+            if (ch != (mln_u8_t)'\n') goto err;
+            http->chunk_state = M_HTTP_CHUNK_SIZE_START;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_DATA_LF:
+            if (ch != (mln_u8_t)'\n') goto err;
+            http->chunk_state = M_HTTP_CHUNK_SIZE_START;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_TRAILER:
+            /*trailer fields are skipped*/
+            if (ch == (mln_u8_t)'\n') return M_HTTP_RET_DONE;
+            http->chunk_state = ch == (mln_u8_t)'\r'? M_HTTP_CHUNK_TRAILER_LF: M_HTTP_CHUNK_TRAILER_LN;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_TRAILER_LN:
+            if (ch == (mln_u8_t)'\n') http->chunk_state = M_HTTP_CHUNK_TRAILER;
+            return M_HTTP_RET_OK;
+        case M_HTTP_CHUNK_TRAILER_LF:
+            if (ch != (mln_u8_t)'\n') goto err;
+            return M_HTTP_RET_DONE;
+        default:
+            goto err;
+    }
+
+size_done:
+    http->chunk_state = http->body_left? M_HTTP_CHUNK_DATA: M_HTTP_CHUNK_TRAILER;
+    return M_HTTP_RET_OK;
+
+err:
+    mln_http_syntax_error(http);
+    return M_HTTP_RET_ERROR;
+})
+
+MLN_FUNC(static inline, int, mln_http_field_token, \
+         (mln_string_t *val, char *token, int last_only), \
+         (val, token, last_only), \
+{
+    mln_string_t tmp;
+    mln_u8ptr_t p, q, end = val->data + val->len;
+    int found = 0;
+
+    for (p = val->data; p < end; p = q + 1) {
+        for (; p < end && (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t'); ++p)
+            ;
+        for (q = p; q < end && *q != (mln_u8_t)','; ++q)
+            ;
+        mln_string_nset(&tmp, p, q - p);
+        for (; tmp.len > 0; --tmp.len) {
+            if (tmp.data[tmp.len-1] != (mln_u8_t)' ' && tmp.data[tmp.len-1] != (mln_u8_t)'\t')
+                break;
+        }
+        found = !mln_string_const_strcasecmp(&tmp, token);
+        if (found && !last_only) return 1;
+    }
+    return found;
+})
+
 MLN_FUNC(static inline, int, mln_http_line_length, \
          (mln_http_t *http, mln_chain_t *in, mln_size_t *len), \
          (http, in, len), \
@@ -217,11 +677,14 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
     c = *in;
     if (c != NULL) {
         b = c->buf;
-        if (b != NULL && !b->in_file && mln_buf_left_size(b) > 0) {
-            mln_u8ptr_t end = b->last;
-            mln_u8ptr_t newline_pos = (mln_u8ptr_t)memchr((void *)b->left_pos, '\n', end - b->left_pos);
-
-            if (newline_pos != NULL && newline_pos - b->left_pos == len) {
+        /*
+         * mln_http_line_length() has found the newline already, the line
+         * is in this buffer if the newline is, so do not scan it again.
+         */
+        if (b != NULL && !b->in_file && mln_buf_left_size(b) > len) {
+            mln_u8ptr_t newline_pos = b->left_pos + len;
+
+            if (*newline_pos == (mln_u8_t)'\n') {
                 /* Line is entirely in this buffer - zero-copy path */
                 line_buf = b->left_pos;
                 need_free = 0;
@@ -242,6 +705,8 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
 
                 if (type == M_HTTP_UNKNOWN) {
                     ret = mln_http_parse_headline(http, line_buf, actual_len);
+                } else if (http->index != NULL) {
+                    ret = mln_http_parse_field_index(http, line_buf, actual_len);
                 } else {
                     ret = mln_http_parse_field(http, line_buf, actual_len);
                 }
@@ -250,9 +715,21 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
         }
     }
 
-    /* Slow path: allocate buffer for multi-buffer or complex cases */
-    buf = (mln_u8ptr_t)mln_alloc_m(pool, len+1);
-    if (buf == NULL) {
+    /*
+     * Slow path: allocate buffer for multi-buffer or complex cases.
+     * In index mode the slices refer to this buffer, so it is linked
+     * into the index and kept until reset.
+     */
+    if (http->index != NULL) {
+        if ((buf = (mln_u8ptr_t)mln_alloc_m(pool, sizeof(void *) + len + 1)) == NULL) {
+            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            return M_HTTP_RET_ERROR;
+        }
+        *(void **)buf = http->index->lines;
+        http->index->lines = buf;
+        buf += sizeof(void *);
+        need_free = 0;
+    } else if ((buf = (mln_u8ptr_t)mln_alloc_m(pool, len+1)) == NULL) {
         mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
         return M_HTTP_RET_ERROR;
     }
@@ -264,7 +741,7 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
         b = c->buf;
         if (b == NULL || b->in_file || mln_buf_left_size(b) <= 0) {
             *in = (*in)->next;
-            mln_chain_pool_release(c);
+            mln_http_chain_drop(http, c);
             continue;
         }
         while (mln_buf_left_size(b) > 0) {
@@ -281,7 +758,7 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
         if (*last != 0) break;
     }
     if (actual_len == 0 || (actual_len == 1 && buf[0] == '\r')) {
-        mln_alloc_free(buf);
+        if (need_free) mln_alloc_free(buf);
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
@@ -293,6 +770,8 @@ MLN_FUNC(static inline, int, mln_http_process_line, \
 
     if (type == M_HTTP_UNKNOWN) {
         ret = mln_http_parse_headline(http, buf, actual_len);
+    } else if (http->index != NULL) {
+        ret = mln_http_parse_field_index(http, buf, actual_len);
     } else {
         ret = mln_http_parse_field(http, buf, actual_len);
     }
@@ -309,7 +788,6 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
     mln_u8ptr_t p, end = buf + len, ques;
     mln_string_t tmp, *s, *scan, *send;
     mln_u32_t type, status = 0;
-    mln_alloc_t *pool = mln_http_pool_get(http);
 
     /*first part*/
     for (; buf < end; ++buf) {
@@ -320,9 +798,10 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
-    for (p = buf; p < end; ++p) {
-        if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-            break;
+    p = mln_http_scan(buf, end, M_HTTP_SCAN_ELEM);
+    if (p < end && *p != (mln_u8_t)' ' && *p != (mln_u8_t)'\t') {
+        mln_http_error_set(http, M_HTTP_BAD_REQUEST);
+        return M_HTTP_RET_ERROR;
     }
     mln_string_nset(&tmp, buf, p-buf);
 
@@ -371,15 +850,16 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
         }
         return M_HTTP_RET_ERROR;
     }
+    p = mln_http_scan(buf, end, M_HTTP_SCAN_ELEM);
+    if (p < end && *p != (mln_u8_t)' ' && *p != (mln_u8_t)'\t') {
+        mln_http_syntax_error(http);
+        return M_HTTP_RET_ERROR;
+    }
     if (type == M_HTTP_REQUEST) {
-        for (ques = NULL, p = buf; p < end; ++p) {
-            if (ques == NULL && *p == (mln_u8_t)'?') ques = p;
-            if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-                break;
-        }
+        ques = (mln_u8ptr_t)memchr(buf, '?', p - buf);
         if (ques == NULL || ques+1 >= p) {
             mln_string_nset(&tmp, buf, (ques == NULL)? p-buf: ques-buf);
-            s = mln_string_pool_dup(pool, &tmp);
+            s = mln_http_string_new(http, &tmp, uri);
             if (s == NULL) {
                 mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
                 return M_HTTP_RET_ERROR;
@@ -388,14 +868,14 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
             mln_http_args_set(http, NULL);
         } else {
             mln_string_nset(&tmp, buf, ques-buf);
-            s = mln_string_pool_dup(pool, &tmp);
+            s = mln_http_string_new(http, &tmp, uri);
             if (s == NULL) {
                 mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
                 return M_HTTP_RET_ERROR;
             }
             mln_http_uri_set(http, s);
             mln_string_nset(&tmp, ++ques, p - ques);
-            s = mln_string_pool_dup(pool, &tmp);
+            s = mln_http_string_new(http, &tmp, args);
             if (s == NULL) {
                 mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
                 return M_HTTP_RET_ERROR;
@@ -403,10 +883,6 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
             mln_http_args_set(http, s);
         }
     } else {
-        for (p = buf; p < end; ++p) {
-            if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-                break;
-        }
         mln_string_nset(&tmp, buf, p-buf);
         if (mln_http_atou(&tmp, &status) == M_HTTP_RET_ERROR) {
             mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
@@ -444,8 +920,12 @@ MLN_FUNC(static inline, int, mln_http_parse_headline, \
         mln_http_version_set(http, scan - http_version);
         return M_HTTP_RET_OK;
     }
+    if (mln_http_scan(buf, end, M_HTTP_SCAN_VALUE) != end) {
+        mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
+        return M_HTTP_RET_ERROR;
+    }
     mln_string_nset(&tmp, buf, end-buf);
-    s = mln_string_pool_dup(pool, &tmp);
+    s = mln_http_string_new(http, &tmp, response_msg);
     if (s == NULL) {
         mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
         return M_HTTP_RET_ERROR;
@@ -473,11 +953,10 @@ MLN_FUNC(static inline, int, mln_http_parse_field, \
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
-    for (p = buf; p < end; ++p) {
-        if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t' || *p == (mln_u8_t)':')
-            break;
-    }
-    if (p - buf <= 0) {
+    p = mln_http_scan(buf, end, M_HTTP_SCAN_TOKEN);
+    if (p - buf <= 0 || \
+        (p < end && *p != (mln_u8_t)' ' && *p != (mln_u8_t)'\t' && *p != (mln_u8_t)':'))
+    {
         if (type == M_HTTP_REQUEST) {
             mln_http_error_set(http, M_HTTP_BAD_REQUEST);
         } else {
@@ -530,6 +1009,11 @@ MLN_FUNC(static inline, int, mln_http_parse_field, \
         }
         return M_HTTP_RET_OK;
     }
+    if (mln_http_scan(buf, end, M_HTTP_SCAN_VALUE) != end) {
+        mln_string_free(s);
+        mln_http_syntax_error(http);
+        return M_HTTP_RET_ERROR;
+    }
     mln_string_nset(&tmp, buf, end-buf);
     v = mln_string_pool_dup(pool, &tmp);
     if (v == NULL) {
@@ -547,6 +1031,160 @@ MLN_FUNC(static inline, int, mln_http_parse_field, \
     return M_HTTP_RET_OK;
 })
 
+MLN_FUNC(static inline, int, mln_http_parse_field_index, \
+         (mln_http_t *http, mln_u8ptr_t buf, mln_size_t len), \
+         (http, buf, len), \
+{
+    int id;
+    mln_u8_t slot;
+    mln_u32_t hash;
+    mln_u8ptr_t p, end = buf + len;
+    mln_http_slice_t *f;
+    mln_http_index_t *idx = http->index;
+
+    if (idx->nfield >= M_HTTP_INDEX_FIELDS)
+        return mln_http_parse_field(http, buf, len);
+
+    /*field name*/
+    for (; buf < end; ++buf) {
+        if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
+            break;
+    }
+    if (buf >= end) {
+        mln_http_done_set(http, 1);
+        return M_HTTP_RET_OK;
+    }
+    /*names are short, validate and hash them in the same pass*/
+    for (hash = 0x811c9dc5U, p = buf; p < end && (mln_http_char_class[*p] & M_HTTP_SCAN_TOKEN); ++p) {
+        hash ^= *p | 0x20;
+        hash *= 0x01000193U;
+    }
+    if (p - buf <= 0 || \
+        (p < end && *p != (mln_u8_t)' ' && *p != (mln_u8_t)'\t' && *p != (mln_u8_t)':'))
+    {
+        mln_http_syntax_error(http);
+        return M_HTTP_RET_ERROR;
+    }
+    f = &idx->fields[idx->nfield];
+    mln_string_nset(&f->key, buf, p - buf);
+    f->hash = hash;
+
+    /* : and field value*/
+    for (buf = p; buf < end; ++buf) {
+        if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
+            break;
+    }
+    if (buf < end) {
+        if (buf[0] != (mln_u8_t)':') {
+            mln_http_syntax_error(http);
+            return M_HTTP_RET_ERROR;
+        }
+        for (++buf; buf < end; ++buf) {
+            if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
+                break;
+        }
+    }
+    if (mln_http_scan(buf, end, M_HTTP_SCAN_VALUE) != end) {
+        mln_http_syntax_error(http);
+        return M_HTTP_RET_ERROR;
+    }
+    mln_string_nset(&f->val, buf, end - buf);
+
+    for (slot = f->hash & (M_HTTP_INDEX_SLOTS - 1); idx->slots[slot]; slot = (slot + 1) & (M_HTTP_INDEX_SLOTS - 1))
+        ;
+    idx->slots[slot] = ++(idx->nfield);
+    if ((id = mln_http_known_find(&f->key, f->hash)) >= 0 && !idx->known[id])
+        idx->known[id] = idx->nfield;
+
+    return M_HTTP_RET_OK;
+})
+
+MLN_FUNC(static inline, mln_u32_t, mln_http_name_hash, (mln_u8ptr_t data, mln_size_t len), (data, len), {
+    mln_u32_t hash = 0x811c9dc5U;
+    mln_u8ptr_t end = data + len;
+
+    /*'| 0x20' folds letters, other bytes may collide but are compared anyway*/
+    for (; data < end; ++data) {
+        hash ^= *data | 0x20;
+        hash *= 0x01000193U;
+    }
+    return hash;
+})
+
+MLN_FUNC(static inline, int, mln_http_known_find, (mln_string_t *name, mln_u32_t hash), (name, hash), {
+    mln_u8_t slot, id;
+
+    for (slot = hash & 63; (id = mln_http_known_slot[slot]) != 0; slot = (slot + 1) & 63) {
+        if (mln_http_known[id-1].hash == hash && \
+            !mln_string_strcasecmp(name, &mln_http_known[id-1].name))
+            return id - 1;
+    }
+    return -1;
+})
+
+/*
+ * Removed fields keep their slot with an empty key, so probing
+ * simply walks over them.
+ */
+MLN_FUNC(static inline, mln_http_slice_t *, mln_http_index_search, \
+         (mln_http_index_t *idx, mln_string_t *key), (idx, key), \
+{
+    mln_u8_t slot, pos;
+    mln_http_slice_t *f;
+    mln_u32_t hash = mln_http_name_hash(key->data, key->len);
+
+    for (slot = hash & (M_HTTP_INDEX_SLOTS - 1); (pos = idx->slots[slot]) != 0; slot = (slot + 1) & (M_HTTP_INDEX_SLOTS - 1)) {
+        f = &idx->fields[pos - 1];
+        if (f->hash == hash && f->key.len && !mln_string_strcasecmp(&f->key, key))
+            return f;
+    }
+    return NULL;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_http_chain_drop, (mln_http_t *http, mln_chain_t *c), (http, c), {
+    if (http->index == NULL) {
+        mln_chain_pool_release(c);
+        return;
+    }
+    c->next = http->index->hold;
+    http->index->hold = c;
+})
+
+MLN_FUNC_VOID(static, void, mln_http_index_clear, (mln_http_t *http), (http), {
+    void *line;
+    mln_http_index_t *idx = http->index;
+
+    if (idx->nfield) {
+        memset(idx->slots, 0, sizeof(idx->slots));
+        memset(idx->known, 0, sizeof(idx->known));
+        idx->nfield = 0;
+    }
+    if (idx->hold != NULL) {
+        mln_chain_pool_release_all(idx->hold);
+        idx->hold = NULL;
+    }
+    while ((line = idx->lines) != NULL) {
+        idx->lines = *(void **)line;
+        mln_alloc_free(line);
+    }
+})
+
+MLN_FUNC(, int, mln_http_index_enable, (mln_http_t *http), (http), {
+    if (http == NULL) return -1;
+    if (http->index != NULL) return 0;
+
+    mln_http_index_t *idx = (mln_http_index_t *)mln_alloc_m(mln_http_pool_get(http), sizeof(mln_http_index_t));
+    if (idx == NULL) return -1;
+    memset(idx->slots, 0, sizeof(idx->slots));
+    memset(idx->known, 0, sizeof(idx->known));
+    idx->nfield = 0;
+    idx->hold = NULL;
+    idx->lines = NULL;
+    http->index = idx;
+
+    return 0;
+})
+
 MLN_FUNC(, int, mln_http_generate, \
          (mln_http_t *http, mln_chain_t **out_head, mln_chain_t **out_tail), \
          (http, out_head, out_tail), \
@@ -555,8 +1193,8 @@ MLN_FUNC(, int, mln_http_generate, \
         return M_HTTP_RET_ERROR;
 
     mln_u32_t type = mln_http_type_get(http);
-    mln_hash_t *header_fields = mln_http_header_get(http);
     mln_http_handler handler = mln_http_handler_get(http);
+    mln_string_t *te;
     struct mln_http_chain_s hc;
     int ret;
 
@@ -574,6 +1212,21 @@ MLN_FUNC(, int, mln_http_generate, \
     }
     hc.pos = NULL;
     hc.left_size = 0;
+    hc.alloc_size = M_HTTP_GENERATE_ALLOC_SIZE;
+    hc.split = 0;
+
+    if (mln_http_framing_get(http) && \
+        ((http->header_cache != NULL && http->header_cache->chunked) || \
+         ((te = mln_http_known_field_get(http, M_HTTP_H_TRANSFER_ENCODING)) != NULL && \
+          mln_http_field_token(te, "chunked", 1))))
+    {
+        if ((ret = mln_http_generate_chunked(&hc)) == M_HTTP_RET_ERROR)
+            goto err;
+        mln_http_error_set(http, M_HTTP_OK);
+        *out_head = hc.head;
+        *out_tail = hc.tail;
+        return ret;
+    }
 
     if (!mln_http_done_get(http)) {
         if (handler != NULL) {
@@ -589,39 +1242,9 @@ MLN_FUNC(, int, mln_http_generate, \
         mln_http_done_set(http, 1);
     }
 
-    if (type == M_HTTP_RESPONSE) {
-        if (mln_http_generate_version(&hc) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_write(&hc, " ", 1) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_status(&hc) == M_HTTP_RET_ERROR)
-            goto err;
-    } else {
-        if (mln_http_generate_method(&hc) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_write(&hc, " ", 1) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_uri(&hc) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_write(&hc, " ", 1) == M_HTTP_RET_ERROR)
-            goto err;
-        if (mln_http_generate_version(&hc) == M_HTTP_RET_ERROR)
-            goto err;
-    }
-    if (mln_http_generate_write(&hc, "\r\n", 2) == M_HTTP_RET_ERROR)
-        goto err;
-
-    if (header_fields != NULL) {
-        if (mln_hash_iterate(header_fields, \
-                              mln_http_generate_fields_hash_iterate_handler, \
-                              &hc) < 0)
-            goto err;
-    }
-
-    if (mln_http_generate_write(&hc, "\r\n", 2) == M_HTTP_RET_ERROR)
+    if (mln_http_generate_head(&hc) == M_HTTP_RET_ERROR)
         goto err;
 
-
     if (http->body_head == NULL) {
         if (mln_http_generate_set_last_in_chain(&hc) == M_HTTP_RET_ERROR)
             goto err;
@@ -629,7 +1252,7 @@ MLN_FUNC(, int, mln_http_generate, \
     if (hc.head == NULL) {
         hc.head = http->body_head;
         hc.tail = http->body_tail;
-    } else {
+    } else if (http->body_head != NULL) {
         hc.tail->next = http->body_head;
         hc.tail = http->body_tail;
     }
@@ -647,6 +1270,177 @@ err:
     return M_HTTP_RET_ERROR;
 })
 
+MLN_FUNC(static inline, int, mln_http_generate_line, (struct mln_http_chain_s *hc), (hc), {
+    if (mln_http_type_get(hc->http) == M_HTTP_RESPONSE) {
+        if (mln_http_generate_version(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_write(hc, " ", 1) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_status(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+    } else {
+        if (mln_http_generate_method(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_write(hc, " ", 1) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_uri(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_write(hc, " ", 1) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        if (mln_http_generate_version(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+    }
+    return mln_http_generate_write(hc, "\r\n", 2);
+})
+
+MLN_FUNC(static inline, int, mln_http_generate_fields, (struct mln_http_chain_s *hc), (hc), {
+    mln_http_t *http = hc->http;
+    mln_hash_t *header_fields = mln_http_header_get(http);
+
+    if (http->index != NULL) {
+        mln_http_slice_t *f = http->index->fields, *fend = f + http->index->nfield;
+        for (; f < fend; ++f) {
+            if (!f->key.len) continue;
+            if (mln_http_generate_fields_hash_iterate_handler(NULL, &f->key, &f->val, hc) < 0)
+                return M_HTTP_RET_ERROR;
+        }
+    }
+
+    if (header_fields != NULL) {
+        if (mln_hash_iterate(header_fields, \
+                              mln_http_generate_fields_hash_iterate_handler, \
+                              hc) < 0)
+            return M_HTTP_RET_ERROR;
+    }
+
+    return M_HTTP_RET_OK;
+})
+
+MLN_FUNC(static inline, int, mln_http_generate_head, (struct mln_http_chain_s *hc), (hc), {
+    mln_http_header_cache_t *cache = hc->http->header_cache;
+
+    if (cache != NULL) {
+        if (mln_http_generate_ref(hc, cache->block.data, cache->block.len) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        hc->alloc_size = M_HTTP_CACHED_TAIL_SIZE;
+    } else if (mln_http_generate_line(hc) == M_HTTP_RET_ERROR) {
+        return M_HTTP_RET_ERROR;
+    }
+    if (mln_http_generate_fields(hc) == M_HTTP_RET_ERROR)
+        return M_HTTP_RET_ERROR;
+
+    return mln_http_generate_write(hc, "\r\n", 2);
+})
+
+MLN_FUNC(, mln_http_header_cache_t *, mln_http_header_cache_new, \
+         (mln_http_t *http, mln_alloc_t *pool), (http, pool), \
+{
+    struct mln_http_chain_s hc;
+    mln_http_header_cache_t *cache;
+    mln_string_t *te;
+    mln_chain_t *c;
+    mln_u8ptr_t p;
+    mln_size_t size = 0;
+
+    if (http == NULL || pool == NULL || mln_http_type_get(http) == M_HTTP_UNKNOWN)
+        return NULL;
+
+    hc.http = http;
+    hc.head = hc.tail = NULL;
+    hc.pos = NULL;
+    hc.left_size = 0;
+    hc.alloc_size = M_HTTP_GENERATE_ALLOC_SIZE;
+    hc.split = 0;
+    if (mln_http_generate_line(&hc) == M_HTTP_RET_ERROR || \
+        mln_http_generate_fields(&hc) == M_HTTP_RET_ERROR)
+    {
+        mln_chain_pool_release_all(hc.head);
+        return NULL;
+    }
+
+    for (c = hc.head; c != NULL; c = c->next)
+        size += mln_buf_left_size(c->buf);
+    if ((cache = (mln_http_header_cache_t *)mln_alloc_m(pool, sizeof(*cache) + size)) == NULL) {
+        mln_chain_pool_release_all(hc.head);
+        return NULL;
+    }
+    p = (mln_u8ptr_t)(cache + 1);
+    mln_string_nset(&cache->block, p, size);
+    for (c = hc.head; c != NULL; c = c->next) {
+        memcpy(p, c->buf->left_pos, mln_buf_left_size(c->buf));
+        p += mln_buf_left_size(c->buf);
+    }
+    mln_chain_pool_release_all(hc.head);
+
+    te = mln_http_known_field_get(http, M_HTTP_H_TRANSFER_ENCODING);
+    cache->chunked = te != NULL && mln_http_field_token(te, "chunked", 1);
+
+    return cache;
+})
+
+MLN_FUNC_VOID(, void, mln_http_header_cache_free, (mln_http_header_cache_t *cache), (cache), {
+    if (cache == NULL) return;
+    mln_alloc_free(cache);
+})
+
+/*
+ * Here 'done' marks that the header has been sent. Each call wraps
+ * whatever the body handler produced into one chunk without copying
+ * the payload, only the size line and CRLFs are written.
+ */
+MLN_FUNC(static, int, mln_http_generate_chunked, (struct mln_http_chain_s *hc), (hc), {
+    int ret = M_HTTP_RET_DONE, n;
+    char line[M_HTTP_CHUNK_LINE_SIZE];
+    mln_chain_t *c;
+    mln_size_t size = 0;
+    mln_http_t *http = hc->http;
+    mln_http_handler handler = mln_http_handler_get(http);
+
+    if (!mln_http_done_get(http)) {
+        if (mln_http_generate_head(hc) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        mln_http_done_set(http, 1);
+    }
+    /*framing lines are tiny, do not waste a whole page on each of them*/
+    hc->alloc_size = M_HTTP_CHUNK_LINE_SIZE;
+
+    if (handler != NULL) {
+        if ((ret = handler(http, &http->body_head, &http->body_tail)) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+    }
+
+    for (c = http->body_head; c != NULL; c = c->next) {
+        if (c->buf != NULL) {
+            c->buf->last_in_chain = 0;
+            size += mln_buf_left_size(c->buf);
+        }
+    }
+    if (size > 0) {
+        n = snprintf(line, sizeof(line), "%lx\r\n", (unsigned long)size);
+        if (mln_http_generate_write(hc, line, n) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+        hc->tail->next = http->body_head;
+        hc->tail = http->body_tail;
+        hc->pos = NULL;
+        hc->left_size = 0;
+        if (mln_http_generate_write(hc, "\r\n", 2) == M_HTTP_RET_ERROR)
+            return M_HTTP_RET_ERROR;
+    } else if (http->body_head != NULL) {
+        mln_chain_pool_release_all(http->body_head);
+    }
+    http->body_head = http->body_tail = NULL;
+
+    if (ret != M_HTTP_RET_DONE) return M_HTTP_RET_OK;
+
+    if (mln_http_generate_write(hc, "0\r\n\r\n", 5) == M_HTTP_RET_ERROR)
+        return M_HTTP_RET_ERROR;
+    if (mln_http_generate_set_last_in_chain(hc) == M_HTTP_RET_ERROR)
+        return M_HTTP_RET_ERROR;
+    mln_http_done_set(http, 0);
+
+    return M_HTTP_RET_DONE;
+})
+
 MLN_FUNC(static inline, int, mln_http_generate_set_last_in_chain, \
          (struct mln_http_chain_s *hc), (hc), \
 {
@@ -672,7 +1466,7 @@ MLN_FUNC(static inline, int, mln_http_generate_set_last_in_chain, \
     b->in_memory = 1;
     b->last_in_chain = 1;
     if (hc->head == NULL) {
-        hc->head = hc->tail;
+        hc->head = hc->tail = c;
     } else {
         hc->tail->next = c;
         hc->tail = c;
@@ -681,6 +1475,68 @@ MLN_FUNC(static inline, int, mln_http_generate_set_last_in_chain, \
     return M_HTTP_RET_OK;
 })
 
+static inline mln_chain_t *mln_http_generate_node(struct mln_http_chain_s *hc)
+{
+    mln_http_t *http = hc->http;
+    mln_alloc_t *pool = mln_http_pool_get(http);
+    mln_chain_t *c;
+    mln_buf_t *b;
+
+    if ((c = mln_chain_new(pool)) == NULL) {
+        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+        return NULL;
+    }
+    if ((b = mln_buf_new(pool)) == NULL) {
+        mln_chain_pool_release(c);
+        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+        return NULL;
+    }
+    c->buf = b;
+    b->in_memory = 1;
+    b->last_buf = 1;
+    if (hc->head == NULL) {
+        hc->head = hc->tail = c;
+    } else {
+        hc->tail->next = c;
+        hc->tail = c;
+    }
+
+    return c;
+}
+
+/*
+ * Append a node referring to 'data' without copying it. If the current
+ * buffer still has room, the next write goes on in that room behind
+ * the reference (see 'split'), so no new buffer is allocated for it.
+ */
+static inline int mln_http_generate_ref(struct mln_http_chain_s *hc, mln_u8ptr_t data, mln_size_t size)
+{
+    mln_chain_t *c;
+    mln_buf_t *b;
+
+    if (!size) return M_HTTP_RET_OK;
+    if ((c = mln_http_generate_node(hc)) == NULL)
+        return M_HTTP_RET_ERROR;
+    b = c->buf;
+    b->left_pos = b->pos = b->start = data;
+    b->last = b->end = data + size;
+    b->temporary = 1;
+    hc->split = hc->left_size > 0;
+
+    return M_HTTP_RET_OK;
+}
+
+/*
+ * Short values are cheaper to copy than to chain in,
+ * so only long ones are referred to in zero-copy mode.
+ */
+static inline int mln_http_generate_value(struct mln_http_chain_s *hc, mln_u8ptr_t data, mln_size_t size)
+{
+    if (mln_http_zerocopy_get(hc->http) && size >= M_HTTP_GENERATE_REF_SIZE)
+        return mln_http_generate_ref(hc, data, size);
+    return mln_http_generate_write(hc, data, size);
+}
+
 #if defined(MSVC)
 static inline int mln_http_generate_write(struct mln_http_chain_s *hc, mln_u8ptr_t buf, mln_size_t size)
 #else
@@ -688,43 +1544,37 @@ static inline int mln_http_generate_write(struct mln_http_chain_s *hc, void *buf
 #endif
 {
     mln_buf_t *cur;
+    mln_chain_t *c;
     mln_http_t *http = hc->http;
     mln_alloc_t *pool = mln_http_pool_get(http);
 
     while (size > 0) {
         if (hc->left_size == 0) {
-            mln_chain_t *c = mln_chain_new(pool);
-            if (c == NULL) {
-                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-                return M_HTTP_RET_ERROR;
-            }
-            mln_buf_t *b = mln_buf_new(pool);
-            if (b == NULL) {
-                mln_chain_pool_release(c);
+            mln_u8ptr_t buffer = (mln_u8ptr_t)mln_alloc_m(pool, hc->alloc_size);
+            if (buffer == NULL) {
                 mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
                 return M_HTTP_RET_ERROR;
             }
-            c->buf = b;
-            mln_u8ptr_t buffer = (mln_u8ptr_t)mln_alloc_m(pool, M_HTTP_GENERATE_ALLOC_SIZE);
-            if (buffer == NULL) {
-                mln_chain_pool_release(c);
-                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            if ((c = mln_http_generate_node(hc)) == NULL) {
+                mln_alloc_free(buffer);
                 return M_HTTP_RET_ERROR;
             }
-
-            b->left_pos = b->pos = b->start = buffer;
-            b->last = b->end = buffer;
-            b->in_memory = 1;
-            b->last_buf = 1;
+            cur = c->buf;
+            cur->left_pos = cur->pos = cur->start = buffer;
+            cur->last = cur->end = buffer;
 
             hc->pos = buffer;
-            hc->left_size = M_HTTP_GENERATE_ALLOC_SIZE;
-            if (hc->head == NULL) {
-                hc->head = hc->tail = c;
-            } else {
-                hc->tail->next = c;
-                hc->tail = c;
-            }
+            hc->left_size = hc->alloc_size;
+            hc->split = 0;
+        } else if (hc->split) {
+            /*the rest of the buffer in front of the last reference*/
+            if ((c = mln_http_generate_node(hc)) == NULL)
+                return M_HTTP_RET_ERROR;
+            cur = c->buf;
+            cur->left_pos = cur->pos = cur->start = hc->pos;
+            cur->last = cur->end = hc->pos;
+            cur->temporary = 1;
+            hc->split = 0;
         }
 
         if (hc->tail == NULL || hc->tail->buf == NULL) {
@@ -827,7 +1677,7 @@ MLN_FUNC(static inline, int, mln_http_generate_uri, (struct mln_http_chain_s *hc
         if (mln_http_generate_write(hc, "/", 1) == M_HTTP_RET_ERROR)
             return M_HTTP_RET_ERROR;
     } else {
-        if (mln_http_generate_write(hc, uri->data, uri->len) == M_HTTP_RET_ERROR)
+        if (mln_http_generate_value(hc, uri->data, uri->len) == M_HTTP_RET_ERROR)
             return M_HTTP_RET_ERROR;
     }
 
@@ -835,7 +1685,7 @@ MLN_FUNC(static inline, int, mln_http_generate_uri, (struct mln_http_chain_s *hc
     if (args != NULL) {
         if (mln_http_generate_write(hc, "?", 1) == M_HTTP_RET_ERROR)
             return M_HTTP_RET_ERROR;
-        if (mln_http_generate_write(hc, args->data, args->len) == M_HTTP_RET_ERROR)
+        if (mln_http_generate_value(hc, args->data, args->len) == M_HTTP_RET_ERROR)
             return M_HTTP_RET_ERROR;
     }
 
@@ -854,7 +1704,7 @@ MLN_FUNC(static, int, mln_http_generate_fields_hash_iterate_handler, \
     if (mln_http_generate_write(hc, ": ", 2) == M_HTTP_RET_ERROR)
         return -1;
     if (val != NULL) {
-        if (mln_http_generate_write(hc, v->data, v->len) == M_HTTP_RET_ERROR)
+        if (mln_http_generate_value(hc, v->data, v->len) == M_HTTP_RET_ERROR)
             return -1;
     }
     if (mln_http_generate_write(hc, "\r\n", 2) == M_HTTP_RET_ERROR)
@@ -875,6 +1725,13 @@ MLN_FUNC(, int, mln_http_field_set, \
     mln_hash_t *header_fields = mln_http_header_get(http);
     if (header_fields == NULL) return M_HTTP_RET_ERROR;
 
+    /*the new value replaces the indexed ones*/
+    if (http->index != NULL) {
+        mln_http_slice_t *f;
+        while ((f = mln_http_index_search(http->index, key)) != NULL)
+            f->key.len = 0;
+    }
+
     mln_alloc_t *pool = mln_http_pool_get(http);
     mln_string_t *dup_key, *dup_val;
     dup_key = mln_string_pool_dup(pool, key);
@@ -897,12 +1754,29 @@ MLN_FUNC(, mln_string_t *, mln_http_field_get, \
 {
     if (http == NULL) return NULL;
 
+    if (http->index != NULL) {
+        mln_http_slice_t *f = mln_http_index_search(http->index, key);
+        if (f != NULL) return &f->val;
+    }
+
     mln_hash_t *header_fields = mln_http_header_get(http);
     if (header_fields == NULL) return NULL;
 
     return (mln_string_t *)mln_hash_search(header_fields, key);
 })
 
+MLN_FUNC(, mln_string_t *, mln_http_known_field_get, \
+         (mln_http_t *http, mln_u32_t id), (http, id), \
+{
+    if (http == NULL || id >= M_HTTP_H_MAX) return NULL;
+
+    mln_http_index_t *idx = http->index;
+    if (idx != NULL && idx->known[id] && idx->fields[idx->known[id]-1].key.len)
+        return &idx->fields[idx->known[id]-1].val;
+
+    return mln_http_field_get(http, &mln_http_known[id].name);
+})
+
 MLN_FUNC(, mln_string_t *, mln_http_field_iterator, \
          (mln_http_t *http, mln_string_t *key), (http, key), \
 {
@@ -912,7 +1786,18 @@ MLN_FUNC(, mln_string_t *, mln_http_field_iterator, \
     mln_u32_t size = 0, cnt = 0;
     mln_alloc_t *pool = mln_http_pool_get(http);
     mln_hash_t *header = mln_http_header_get(http);
+    mln_http_slice_t *f = NULL, *fend = NULL;
 
+    if (http->index != NULL) {
+        f = http->index->fields;
+        fend = f + http->index->nfield;
+    }
+    for (; f < fend; ++f) {
+        if (f->key.len && !mln_string_strcasecmp(&f->key, key)) {
+            size += (f->val.len + 1);
+            ++cnt;
+        }
+    }
     do {
         val = mln_hash_search_iterator(header, key, &ctx);
         if (val != NULL) {
@@ -925,6 +1810,15 @@ MLN_FUNC(, mln_string_t *, mln_http_field_iterator, \
     buf = (mln_u8ptr_t)mln_alloc_m(pool, size+1);
     if (buf == NULL) return NULL;
     size = 0;
+    if (http->index != NULL) {
+        for (f = http->index->fields; f < fend; ++f) {
+            if (f->key.len && !mln_string_strcasecmp(&f->key, key)) {
+                memcpy(buf+size, f->val.data, f->val.len);
+                size += f->val.len;
+                if (cnt-- > 1) buf[size++] = ',';
+            }
+        }
+    }
     do {
         val = mln_hash_search_iterator(header, key, &ctx);
         if (val != NULL) {
@@ -947,11 +1841,27 @@ MLN_FUNC_VOID(, void, mln_http_field_remove, (mln_http_t *http, mln_string_t *ke
 
     mln_string_t *val;
     mln_hash_t *header = mln_http_header_get(http);
+    if (http->index != NULL) {
+        mln_http_slice_t *f;
+        while ((f = mln_http_index_search(http->index, key)) != NULL)
+            f->key.len = 0;
+    }
     while ((val = (mln_string_t *)mln_hash_search(header, key)) != NULL) {
         mln_hash_remove(header, key, M_HASH_F_KV);
     }
 })
 
+MLN_FUNC(, int, mln_http_keepalive, (mln_http_t *http), (http), {
+    if (http == NULL) return 0;
+
+    mln_string_t *val = mln_http_known_field_get(http, M_HTTP_H_CONNECTION);
+    if (val != NULL) {
+        if (mln_http_field_token(val, "close", 0)) return 0;
+        if (mln_http_field_token(val, "keep-alive", 0)) return 1;
+    }
+    return mln_http_version_get(http) >= M_HTTP_VERSION_1_1;
+})
+
 MLN_FUNC(static inline, int, mln_http_atou, (mln_string_t *s, mln_u32_t *status), (s, status), {
     mln_u32_t st = 0;
     mln_u8ptr_t p, end = s->data + s->len;
@@ -999,6 +1909,8 @@ MLN_FUNC(, mln_http_t *, mln_http_init, \
         mln_alloc_free(http);
         return NULL;
     }
+    http->index = NULL;
+    http->header_cache = NULL;
     http->body_head = http->body_tail = NULL;
     http->body_handler = body_handler;
     http->data = data;
@@ -1011,6 +1923,11 @@ MLN_FUNC(, mln_http_t *, mln_http_init, \
     http->version = 0;
     http->type = M_HTTP_UNKNOWN;
     http->done = 0;
+    http->framing = 0;
+    http->zerocopy = 0;
+    http->body_mode = M_HTTP_BODY_UNKNOWN;
+    http->chunk_state = 0;
+    http->body_left = 0;
 
     return http;
 })
@@ -1025,13 +1942,17 @@ MLN_FUNC_VOID(, void, mln_http_destroy, (mln_http_t *http), (http), {
         mln_chain_pool_release_all(http->body_head);
     }
     if (http->uri != NULL) {
-        mln_string_free(http->uri);
+        mln_http_string_free(http, http->uri);
     }
     if (http->args != NULL) {
-        mln_string_free(http->args);
+        mln_http_string_free(http, http->args);
     }
     if (http->response_msg != NULL) {
-        mln_string_free(http->response_msg);
+        mln_http_string_free(http, http->response_msg);
+    }
+    if (http->index != NULL) {
+        mln_http_index_clear(http);
+        mln_alloc_free(http->index);
     }
 
     mln_alloc_free(http);
@@ -1048,23 +1969,29 @@ MLN_FUNC_VOID(, void, mln_http_reset, (mln_http_t *http), (http), {
         http->body_head = http->body_tail = NULL;
     }
     if (http->uri != NULL) {
-        mln_string_free(http->uri);
+        mln_http_string_free(http, http->uri);
         http->uri = NULL;
     }
     if (http->args != NULL) {
-        mln_string_free(http->args);
+        mln_http_string_free(http, http->args);
         http->args = NULL;
     }
     if (http->response_msg != NULL) {
-        mln_string_free(http->response_msg);
+        mln_http_string_free(http, http->response_msg);
         http->response_msg = NULL;
     }
+    if (http->index != NULL) {
+        mln_http_index_clear(http);
+    }
     http->error = M_HTTP_OK;
     http->status = M_HTTP_OK;
     http->method = 0;
     http->version = 0;
     http->type = M_HTTP_UNKNOWN;
     http->done = 0;
+    http->body_mode = M_HTTP_BODY_UNKNOWN;
+    http->chunk_state = 0;
+    http->body_left = 0;
 })
 
 MLN_FUNC_VOID(static, void, mln_http_hash_free, (void *data), (data), {
@@ -1137,6 +2064,14 @@ void mln_http_dump(mln_http_t *http)
     printf("\ttype_code:%u\n", http->type);
     printf("\tfields:\n");
     if (rc <= 0) rc = 1;/*do nothing*/
+    if (http->index != NULL) {
+        mln_http_slice_t *f = http->index->fields, *fend = f + http->index->nfield;
+        for (; f < fend; ++f) {
+            if (!f->key.len) continue;
+            printf("\t\tkey:[%.*s] value:[%.*s]\n", \
+                   (int)f->key.len, (char *)f->key.data, (int)f->val.len, (char *)f->val.data);
+        }
+    }
     mln_hash_iterate(http->header_fields, mln_http_dump_iterate_handler, NULL);
 }
 
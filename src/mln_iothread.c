@@ -12,10 +12,26 @@
 #include <signal.h>
 #include "mln_func.h"
 #include <sys/socket.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/*
+ * Rounds a waiting sender polls its reply before it goes to sleep.
+ */
+#define M_IOTHREAD_SPIN 2000
 
 static inline void mln_iothread_fd_nonblock_set(int fd);
 static inline mln_iothread_msg_t *mln_iothread_msg_new(mln_u32_t type, void *data, int feedback);
 static inline void mln_iothread_msg_free(mln_iothread_msg_t *msg);
+static mln_iothread_ring_t *mln_iothread_ring_new(mln_u32_t size);
+static void mln_iothread_ring_free(mln_iothread_ring_t *r);
+static int mln_iothread_ring_send(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, mln_u32_t feedback);
+static int mln_iothread_ring_recv(mln_iothread_t *t, mln_iothread_ep_type_t from);
+static void mln_iothread_pool_put(mln_iothread_t *t, mln_iothread_msg_t *msg);
 MLN_CHAIN_FUNC_DECLARE(static inline, mln_iothread_msg, mln_iothread_msg_t,);
 MLN_CHAIN_FUNC_DEFINE(static inline, mln_iothread_msg, mln_iothread_msg_t, prev, next);
 
@@ -23,46 +39,90 @@ MLN_FUNC(, int, mln_iothread_init, \
          (mln_iothread_t *t, mln_u32_t nthread, mln_iothread_entry_t entry, void *args, mln_iothread_msg_process_t handler), \
          (t, nthread, entry, args, handler), \
 {
+    struct mln_iothread_attr attr;
+
+    attr.nthread = nthread;
+    attr.entry = entry;
+    attr.args = args;
+    attr.handler = handler;
+    attr.ring_size = 0;
+    return mln_iothread_init_with_attr(t, &attr);
+})
+
+MLN_FUNC(, int, mln_iothread_init_with_attr, (mln_iothread_t *t, struct mln_iothread_attr *attr), (t, attr), {
     mln_u32_t i;
     int fds[2];
 
-    if (!nthread || entry == NULL) {
+    if (!attr->nthread || attr->entry == NULL) {
         return -1;
     }
 
+    t->io_ring = t->user_ring = t->msg_pool = NULL;
+    if (attr->ring_size) {
+        if ((t->io_ring = mln_iothread_ring_new(attr->ring_size)) == NULL || \
+            (t->user_ring = mln_iothread_ring_new(attr->ring_size)) == NULL || \
+            (t->msg_pool = mln_iothread_ring_new(attr->ring_size)) == NULL)
+        {
+            goto err;
+        }
+    }
+
+#if defined(__linux__)
+    if (t->io_ring != NULL) {
+        /*
+         * Each side waits on its own eventfd and senders write to the
+         * receiver's one.
+         */
+        if ((fds[0] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0) {
+            goto err;
+        }
+        if ((fds[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0) {
+            close(fds[0]);
+            goto err;
+        }
+    } else
+#endif
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
-        return -1;
+        goto err;
     }
     t->io_fd = fds[0];
     t->user_fd = fds[1];
     mln_iothread_fd_nonblock_set(t->io_fd);
     mln_iothread_fd_nonblock_set(t->user_fd);
-    t->entry = entry;
-    t->args = args;
-    t->handler = handler;
+    t->entry = attr->entry;
+    t->args = attr->args;
+    t->handler = attr->handler;
     pthread_mutex_init(&(t->io_lock), NULL);
     pthread_mutex_init(&(t->user_lock), NULL);
     t->io_head = t->io_tail = NULL;
     t->user_head = t->user_tail = NULL;
-    t->nthread = nthread;
+    t->nthread = attr->nthread;
 
     if ((t->tids = (pthread_t *)calloc(t->nthread, sizeof(pthread_t))) == NULL) {
         mln_socket_close(fds[0]);
         mln_socket_close(fds[1]);
-        return -1;
+        goto err;
     }
     for (i = 0; i < t->nthread; ++i) {
         if (pthread_create(t->tids + i, NULL, t->entry, t->args) != 0) {
             mln_iothread_destroy(t);
             return -1;
         }
-        if (pthread_detach(t->tids[i]) != 0) {
+        /*ring mode keeps them joinable, destroy must not free the rings under them*/
+        if (t->io_ring == NULL && pthread_detach(t->tids[i]) != 0) {
             mln_iothread_destroy(t);
             return -1;
         }
     }
 
     return 0;
+
+err:
+    mln_iothread_ring_free(t->io_ring);
+    mln_iothread_ring_free(t->user_ring);
+    mln_iothread_ring_free(t->msg_pool);
+    t->io_ring = t->user_ring = t->msg_pool = NULL;
+    return -1;
 })
 
 MLN_FUNC_VOID(, void, mln_iothread_destroy, (mln_iothread_t *t), (t), {
@@ -77,6 +137,10 @@ MLN_FUNC_VOID(, void, mln_iothread_destroy, (mln_iothread_t *t), (t), {
     }
     mln_socket_close(t->io_fd);
     mln_socket_close(t->user_fd);
+    mln_iothread_ring_free(t->io_ring);
+    mln_iothread_ring_free(t->user_ring);
+    mln_iothread_ring_free(t->msg_pool);
+    t->io_ring = t->user_ring = t->msg_pool = NULL;
 })
 
 MLN_FUNC(, int, mln_iothread_send, \
@@ -88,6 +152,8 @@ MLN_FUNC(, int, mln_iothread_send, \
     mln_iothread_msg_t *msg;
     mln_iothread_msg_t **head, **tail;
 
+    if (t->io_ring != NULL) return mln_iothread_ring_send(t, type, data, to, feedback);
+
     if (to == io_thread) {
         fd = t->user_fd;
         plock = &(t->io_lock);
@@ -136,6 +202,8 @@ MLN_FUNC(, int, mln_iothread_recv, (mln_iothread_t *t, mln_iothread_ep_type_t fr
     mln_iothread_msg_t *msg, *pos;
     mln_iothread_msg_t **head, **tail;
 
+    if (t->io_ring != NULL) return mln_iothread_ring_recv(t, from);
+
     if (from == io_thread) {
         fd = t->user_fd;
         plock = &(t->user_lock);
@@ -172,6 +240,316 @@ MLN_FUNC(, int, mln_iothread_recv, (mln_iothread_t *t, mln_iothread_ep_type_t fr
     return n;
 })
 
+/*
+ * ring mode
+ */
+MLN_FUNC(static, mln_iothread_ring_t *, mln_iothread_ring_new, (mln_u32_t size), (size), {
+    mln_size_t i, n = 2;
+    mln_iothread_ring_t *r;
+
+    while (n < size) n <<= 1;
+    if ((r = (mln_iothread_ring_t *)malloc(sizeof(mln_iothread_ring_t))) == NULL)
+        return NULL;
+    if ((r->slots = (mln_iothread_slot_t *)malloc(n * sizeof(mln_iothread_slot_t))) == NULL) {
+        free(r);
+        return NULL;
+    }
+    for (i = 0; i < n; ++i) r->slots[i].seq = i;
+    r->head = r->tail = 0;
+    r->signaled = 0;
+    r->mask = n - 1;
+    return r;
+})
+
+/*
+ * Pooled messages still sitting in @r (the free pool, or requests
+ * nobody received) go with it.
+ */
+MLN_FUNC_VOID(static, void, mln_iothread_ring_free, (mln_iothread_ring_t *r), (r), {
+    mln_size_t pos;
+
+    if (r == NULL) return;
+    for (pos = r->tail; pos != r->head; ++pos) {
+        if (r->slots[pos & r->mask].msg != NULL) free(r->slots[pos & r->mask].msg);
+    }
+    free(r->slots);
+    free(r);
+})
+
+MLN_FUNC(static inline, int, mln_iothread_ring_push, \
+         (mln_iothread_ring_t *r, mln_u32_t type, void *data, mln_iothread_msg_t *msg), \
+         (r, type, data, msg), \
+{
+    mln_iothread_slot_t *slot;
+    mln_size_t pos = __atomic_load_n(&(r->head), __ATOMIC_RELAXED), seq;
+
+    while (1) {
+        slot = &(r->slots[pos & r->mask]);
+        seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&(r->head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((mln_sptr_t)(seq - pos) < 0) {
+            return -1; /*full*/
+        } else {
+            pos = __atomic_load_n(&(r->head), __ATOMIC_RELAXED);
+        }
+    }
+    slot->type = type;
+    slot->data = data;
+    slot->msg = msg;
+    __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+    return 0;
+})
+
+MLN_FUNC(static inline, int, mln_iothread_ring_pop, \
+         (mln_iothread_ring_t *r, mln_u32_t *type, void **data, mln_iothread_msg_t **msg), \
+         (r, type, data, msg), \
+{
+    mln_iothread_slot_t *slot;
+    mln_size_t pos = __atomic_load_n(&(r->tail), __ATOMIC_RELAXED), seq;
+
+    while (1) {
+        slot = &(r->slots[pos & r->mask]);
+        seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if (seq == pos + 1) {
+            if (__atomic_compare_exchange_n(&(r->tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((mln_sptr_t)(seq - (pos + 1)) < 0) {
+            return -1; /*empty*/
+        } else {
+            pos = __atomic_load_n(&(r->tail), __ATOMIC_RELAXED);
+        }
+    }
+    *type = slot->type;
+    *data = slot->data;
+    *msg = slot->msg;
+    __atomic_store_n(&(slot->seq), pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+})
+
+/*
+ * Only the first sender after the receiver rearmed @signaled pays for
+ * the syscall, the others know a wakeup is already pending. EAGAIN means
+ * the fd is already readable. On any other error @signaled is dropped
+ * again, so the next sender retries instead of relying on a wakeup that
+ * never reached the receiver.
+ */
+MLN_FUNC_VOID(static inline, void, mln_iothread_ring_wake, \
+              (mln_iothread_t *t, mln_iothread_ring_t *r, mln_iothread_ep_type_t to), (t, r, to), \
+{
+    int n;
+
+    if (__atomic_exchange_n(&(r->signaled), 1, __ATOMIC_SEQ_CST)) return;
+#if defined(__linux__)
+    mln_u64_t one = 1;
+    while ((n = write(to == io_thread? t->io_fd: t->user_fd, &one, sizeof(one))) < 0 && errno == EINTR)
+        ;
+#else
+    while ((n = send(to == io_thread? t->user_fd: t->io_fd, " ", 1, 0)) < 0 && errno == EINTR)
+        ;
+#endif
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        __atomic_store_n(&(r->signaled), 0, __ATOMIC_SEQ_CST);
+})
+
+/*
+ * Drain the notification fd before rearming, so a wakeup written after
+ * the rearm is never swallowed while @signaled stays set.
+ */
+MLN_FUNC_VOID(static inline, void, mln_iothread_ring_rearm, \
+              (mln_iothread_t *t, mln_iothread_ring_t *r, mln_iothread_ep_type_t from), (t, r, from), \
+{
+    char buf[64];
+    int fd = from == io_thread? t->user_fd: t->io_fd;
+#if defined(__linux__)
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+#else
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+#endif
+    __atomic_store_n(&(r->signaled), 0, __ATOMIC_SEQ_CST);
+})
+
+/*
+ * Pooled messages recycle through @msg_pool, a ring like the others, so
+ * taking and returning one is a CAS and never an ABA hazard.
+ */
+MLN_FUNC(static inline, mln_iothread_msg_t *, mln_iothread_pool_get, (mln_iothread_t *t), (t), {
+    mln_u32_t type;
+    void *data;
+    mln_iothread_msg_t *msg = NULL;
+
+    if (mln_iothread_ring_pop(t->msg_pool, &type, &data, &msg) < 0) {
+        if ((msg = (mln_iothread_msg_t *)malloc(sizeof(mln_iothread_msg_t))) == NULL)
+            return NULL;
+        msg->prev = msg->next = NULL;
+        msg->pooled = 1;
+        msg->t = t;
+    }
+    msg->feedback = 1;
+    msg->hold = 0;
+    msg->state = 0;
+    msg->reply = NULL;
+    msg->ev = NULL;
+    msg->reply_handler = NULL;
+    msg->udata = NULL;
+    return msg;
+})
+
+MLN_FUNC_VOID(static, void, mln_iothread_pool_put, (mln_iothread_t *t, mln_iothread_msg_t *msg), (t, msg), {
+    if (mln_iothread_ring_push(t->msg_pool, 0, NULL, msg) < 0)
+        free(msg);
+})
+
+MLN_FUNC_VOID(static, void, mln_iothread_reply_process, (mln_event_t *ev, void *data), (ev, data), {
+    mln_iothread_msg_t *msg = (mln_iothread_msg_t *)data;
+    (void)ev;
+
+    msg->reply_handler(msg->t, msg->type, msg->data, msg->reply, msg->udata);
+    mln_iothread_pool_put(msg->t, msg);
+})
+
+MLN_FUNC_VOID(static inline, void, mln_iothread_msg_wait, (mln_iothread_msg_t *msg), (msg), {
+    mln_u32_t i, expected = 0;
+
+    for (i = 0; i < M_IOTHREAD_SPIN; ++i) {
+        if (__atomic_load_n(&(msg->state), __ATOMIC_ACQUIRE) == 1) return;
+    }
+#if defined(__linux__)
+    if (!__atomic_compare_exchange_n(&(msg->state), &expected, 2, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return; /*replied in between*/
+    while (__atomic_load_n(&(msg->state), __ATOMIC_ACQUIRE) == 2)
+        syscall(SYS_futex, &(msg->state), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+#else
+    (void)expected;
+    while (__atomic_load_n(&(msg->state), __ATOMIC_ACQUIRE) != 1)
+        sched_yield();
+#endif
+})
+
+MLN_FUNC_VOID(, void, mln_iothread_msg_release, (mln_iothread_msg_t *msg), (msg), {
+    if (!msg->pooled) {
+        pthread_mutex_unlock(&(msg->mutex));
+        return;
+    }
+    if (msg->reply_handler != NULL) {
+        /*the message now belongs to the sender's event loop*/
+        while (mln_event_post(msg->ev, mln_iothread_reply_process, msg) < 0)
+            sched_yield();
+        return;
+    }
+#if defined(__linux__)
+    if (__atomic_exchange_n(&(msg->state), 1, __ATOMIC_RELEASE) == 2)
+        syscall(SYS_futex, &(msg->state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    __atomic_store_n(&(msg->state), 1, __ATOMIC_RELEASE);
+#endif
+})
+
+MLN_FUNC(static inline, int, mln_iothread_msg_post, \
+         (mln_iothread_t *t, mln_iothread_msg_t *msg, mln_u32_t type, void *data, mln_iothread_ep_type_t to), \
+         (t, msg, type, data, to), \
+{
+    mln_iothread_ring_t *r = to == io_thread? t->io_ring: t->user_ring;
+
+    msg->type = type;
+    msg->data = data;
+    if (mln_iothread_ring_push(r, type, data, msg) < 0) {
+        /*make sure a full ring is being drained*/
+        mln_iothread_ring_wake(t, r, to);
+        return 1;
+    }
+    mln_iothread_ring_wake(t, r, to);
+    return 0;
+})
+
+MLN_FUNC(, int, mln_iothread_call, \
+         (mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, void **reply), \
+         (t, type, data, to, reply), \
+{
+    int rc;
+    mln_iothread_msg_t *msg;
+
+    if (t->msg_pool == NULL) return -1;
+    if ((msg = mln_iothread_pool_get(t)) == NULL) return -1;
+    if ((rc = mln_iothread_msg_post(t, msg, type, data, to)) != 0) {
+        mln_iothread_pool_put(t, msg);
+        return rc;
+    }
+    mln_iothread_msg_wait(msg);
+    if (reply != NULL) *reply = msg->reply;
+    mln_iothread_pool_put(t, msg);
+    return 0;
+})
+
+MLN_FUNC(, int, mln_iothread_call_async, \
+         (mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, \
+          mln_event_t *ev, mln_iothread_reply_process_t handler, void *udata), \
+         (t, type, data, to, ev, handler, udata), \
+{
+    int rc;
+    mln_iothread_msg_t *msg;
+
+    if (t->msg_pool == NULL || ev == NULL || handler == NULL) return -1;
+    if ((msg = mln_iothread_pool_get(t)) == NULL) return -1;
+    msg->ev = ev;
+    msg->reply_handler = handler;
+    msg->udata = udata;
+    if ((rc = mln_iothread_msg_post(t, msg, type, data, to)) != 0)
+        mln_iothread_pool_put(t, msg);
+    return rc;
+})
+
+MLN_FUNC(static, int, mln_iothread_ring_send, \
+         (mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, mln_u32_t feedback), \
+         (t, type, data, to, feedback), \
+{
+    mln_iothread_ring_t *r = to == io_thread? t->io_ring: t->user_ring;
+
+    if (feedback) return mln_iothread_call(t, type, data, to, NULL);
+
+    if (mln_iothread_ring_push(r, type, data, NULL) < 0) {
+        mln_iothread_ring_wake(t, r, to);
+        return 1;
+    }
+    mln_iothread_ring_wake(t, r, to);
+    return 0;
+})
+
+MLN_FUNC(static, int, mln_iothread_ring_recv, (mln_iothread_t *t, mln_iothread_ep_type_t from), (t, from), {
+    int n = 0;
+    mln_size_t budget;
+    mln_iothread_msg_t local, *msg = NULL;
+    mln_iothread_ring_t *r = from == io_thread? t->user_ring: t->io_ring;
+    mln_iothread_ep_type_t to = from == io_thread? user_thread: io_thread;
+
+    mln_iothread_ring_rearm(t, r, from);
+
+    /*
+     * At most one ring's worth per call, so steady senders can not keep
+     * the receiver here forever. Leftovers re-signal the fd.
+     */
+    local.prev = local.next = NULL;
+    local.feedback = local.hold = local.pooled = 0;
+    for (budget = r->mask + 1; budget > 0; --budget) {
+        if (mln_iothread_ring_pop(r, &(local.type), &(local.data), &msg) < 0) break;
+        ++n;
+        if (msg == NULL) {
+            if (t->handler != NULL)
+                t->handler(t, from, &local);
+            continue;
+        }
+        if (t->handler != NULL)
+            t->handler(t, from, msg);
+        if (!msg->hold)
+            mln_iothread_msg_release(msg);
+    }
+    if (!budget) mln_iothread_ring_wake(t, r, to);
+
+    return n;
+})
 
 MLN_FUNC(static inline, mln_iothread_msg_t *, mln_iothread_msg_new, \
          (mln_u32_t type, void *data, int feedback), (type, data, feedback), \
@@ -182,6 +560,7 @@ MLN_FUNC(static inline, mln_iothread_msg_t *, mln_iothread_msg_new, \
 
     msg->feedback = feedback;
     msg->hold = 0;
+    msg->pooled = 0;
     msg->type = type;
     msg->data = data;
     msg->prev = msg->next = NULL;
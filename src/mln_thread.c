@@ -469,7 +469,7 @@ MLN_FUNC(static inline, int, mln_itc_get_buf_with_len, \
         pos += size;
         len -= size;
         b->left_pos += size;
-        mln_chain_pool_release(mln_tcp_conn_pop(tc, M_C_RECV));
+        mln_tcp_conn_recycle(tc, mln_tcp_conn_pop(tc, M_C_RECV));
         if (len == 0) break;
     }
 
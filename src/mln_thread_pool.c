@@ -5,6 +5,9 @@
 
 #if !defined(MSVC)
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <time.h>
 #include <stdlib.h>
 #include "mln_thread_pool.h"
@@ -13,6 +16,12 @@
 #include <stdio.h>
 #include "mln_utils.h"
 #include "mln_func.h"
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/eventfd.h>
+#endif
 
 /*
  * There is a problem in linux.
@@ -53,6 +62,11 @@
  */
 #define MLN_THREAD_POOL_BATCH 16
 
+/*
+ * Initial slot count of a work-stealing deque. Deques double on demand.
+ */
+#define MLN_THREAD_POOL_WS_SIZE 256
+
 /*
  * Atomic helpers. We rely on GCC/Clang __atomic_*. These are
  * available on every supported platform (Linux, *BSD, macOS,
@@ -70,7 +84,65 @@
 
 __thread mln_thread_pool_member_t *m_thread_pool_self = NULL;
 
+static pthread_once_t mln_thread_pool_atfork_once = PTHREAD_ONCE_INIT;
+static int mln_thread_pool_atfork_rc = 0;
+
+/*
+ * A pool started by mln_thread_pool_run counts the calling thread as a
+ * member, one created by mln_thread_pool_new only counts its workers.
+ */
+#define mln_thread_pool_limit(tp) ((tp)->max + !(tp)->instance)
+
 static void *child_thread_launcher(void *arg);
+static void *ws_child_thread_launcher(void *arg);
+static int mln_thread_pool_ws_init(mln_thread_pool_t *tp);
+static void mln_thread_pool_ws_destroy(mln_thread_pool_t *tp);
+static int mln_thread_pool_ws_add(mln_thread_pool_t *tpool, void **data, mln_size_t n);
+static void mln_thread_pool_ws_wake(mln_thread_pool_t *tpool, mln_size_t n);
+static int mln_thread_pool_future_run(void *data);
+static void mln_thread_pool_future_drop(void *data);
+
+/*
+ * The @locked flag tells the fork handlers whether the calling thread
+ * already holds its own pool's mutex. Threads outside the pool (callers
+ * of the instance API) have nothing to record.
+ */
+static inline void mln_thread_pool_lock(mln_thread_pool_t *tpool)
+{
+    if (m_thread_pool_self != NULL && m_thread_pool_self->pool == tpool)
+        m_thread_pool_self->locked = 1;
+    pthread_mutex_lock(&(tpool->mutex));
+}
+
+static inline void mln_thread_pool_unlock(mln_thread_pool_t *tpool)
+{
+    pthread_mutex_unlock(&(tpool->mutex));
+    if (m_thread_pool_self != NULL && m_thread_pool_self->pool == tpool)
+        m_thread_pool_self->locked = 0;
+}
+
+static inline void mln_thread_pool_done(mln_thread_pool_t *tpool, mln_size_t n)
+{
+    if (tpool->queue_max && n)
+        __atomic_sub_fetch(&(tpool->n_pending), n, __ATOMIC_RELAXED);
+}
+
+static inline void mln_thread_pool_set_affinity(mln_thread_pool_t *tpool)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    int i;
+
+    if (!tpool->cpu_affinity) return;
+    CPU_ZERO(&set);
+    for (i = 0; i < 64; ++i) {
+        if (tpool->cpu_affinity & (((mln_u64_t)1) << i)) CPU_SET(i, &set);
+    }
+    (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)tpool;
+#endif
+}
 static void mln_thread_pool_free(mln_thread_pool_t *tp);
 
 MLN_CHAIN_FUNC_DECLARE(static inline, \
@@ -89,6 +161,7 @@ MLN_FUNC(static inline, mln_thread_pool_member_t *, mln_thread_pool_member_new,
     }
     tpm->data = NULL;
     tpm->pool = tpool;
+    tpm->ws = NULL;
     tpm->idle = 1;
     tpm->locked = 0;
     tpm->forked = 0;
@@ -174,8 +247,16 @@ MLN_FUNC_VOID(static, void, mln_thread_pool_child, (void), (), {
     }
 })
 
-MLN_FUNC(static, mln_thread_pool_t *, mln_thread_pool_new, \
-         (struct mln_thread_pool_attr *tpattr, int *err), (tpattr, err), \
+static void mln_thread_pool_atfork_init(void)
+{
+    mln_thread_pool_atfork_rc = pthread_atfork(mln_thread_pool_prepare, \
+                                               mln_thread_pool_parent, \
+                                               mln_thread_pool_child);
+}
+
+MLN_FUNC(static, mln_thread_pool_t *, mln_thread_pool_alloc, \
+         (struct mln_thread_pool_attr *tpattr, mln_u32_t instance, int *err), \
+         (tpattr, instance, err), \
 {
     int rc;
     mln_thread_pool_t *tp;
@@ -222,13 +303,30 @@ MLN_FUNC(static, mln_thread_pool_t *, mln_thread_pool_new, \
     tp->process_handler = tpattr->child_process_handler;
     tp->free_handler = tpattr->free_handler;
     tp->max = tpattr->max;
+    tp->work_stealing = tpattr->work_stealing? 1: 0;
+    tp->instance = instance? 1: 0;
+    tp->queue_max = tpattr->queue_max;
+    tp->n_pending = 0;
+    tp->cpu_affinity = tpattr->cpu_affinity;
+    tp->take_lock = 0;
+    tp->ws = NULL;
+    tp->ws_n = tp->ws_parked = tp->ws_quit = tp->ws_next = 0;
+    if (tp->work_stealing && (rc = mln_thread_pool_ws_init(tp)) != 0) {
+        pthread_attr_destroy(&(tp->attr));
+        pthread_cond_destroy(&(tp->cond));
+        pthread_mutex_destroy(&(tp->mutex));
+        free(tp);
+        *err = rc;
+        return NULL;
+    }
 #if defined(MLN_USE_UNIX98) && !defined(MSYS2)
     if (tpattr->concurrency) pthread_setconcurrency(tpattr->concurrency);
 #endif
-    if ((rc = pthread_atfork(mln_thread_pool_prepare, \
-                             mln_thread_pool_parent, \
-                             mln_thread_pool_child)) != 0)
+    /* registered once, the handlers act on whichever pool the caller is in */
+    (void)pthread_once(&mln_thread_pool_atfork_once, mln_thread_pool_atfork_init);
+    if ((rc = mln_thread_pool_atfork_rc) != 0)
     {
+        mln_thread_pool_ws_destroy(tp);
         pthread_attr_destroy(&(tp->attr));
         pthread_cond_destroy(&(tp->cond));
         pthread_mutex_destroy(&(tp->mutex));
@@ -236,7 +334,8 @@ MLN_FUNC(static, mln_thread_pool_t *, mln_thread_pool_new, \
         *err = rc;
         return NULL;
     }
-    if ((m_thread_pool_self = mln_thread_pool_member_join(tp, 0)) == NULL) {
+    if (!instance && (m_thread_pool_self = mln_thread_pool_member_join(tp, 0)) == NULL) {
+        mln_thread_pool_ws_destroy(tp);
         pthread_attr_destroy(&(tp->attr));
         pthread_cond_destroy(&(tp->cond));
         pthread_mutex_destroy(&(tp->mutex));
@@ -249,7 +348,8 @@ MLN_FUNC(static, mln_thread_pool_t *, mln_thread_pool_new, \
 
 MLN_FUNC_VOID(static, void, mln_thread_pool_free, (mln_thread_pool_t *tp), (tp), {
     if (tp == NULL) return;
-    m_thread_pool_self = NULL;
+    if (m_thread_pool_self != NULL && m_thread_pool_self->pool == tp)
+        m_thread_pool_self = NULL;
     mln_thread_pool_resource_t *tpr;
     /* Drain anything left in the lock-free incoming stack. */
     tpr = MLN_ATOMIC_EXCHANGE(&tp->incoming, NULL);
@@ -269,6 +369,7 @@ MLN_FUNC_VOID(static, void, mln_thread_pool_free, (mln_thread_pool_t *tp), (tp),
         free(tpr);
     }
     ASSERT(tp->child_head == NULL && !tp->counter && !tp->idle);
+    mln_thread_pool_ws_destroy(tp);
     pthread_mutex_destroy(&(tp->mutex));
     pthread_cond_destroy(&(tp->cond));
     pthread_attr_destroy(&(tp->attr));
@@ -316,6 +417,13 @@ MLN_FUNC(static, mln_thread_pool_resource_t *, mln_thread_pool_node_take, \
      * popped and pushed back by a peer in the meantime.
      */
     mln_thread_pool_resource_t *tpr, *next;
+
+    /*
+     * Instance pools accept submissions from any thread, so poppers take
+     * turns through @take_lock. A busy lock just means a fresh malloc().
+     */
+    if (tpool->instance && __atomic_test_and_set(&(tpool->take_lock), __ATOMIC_ACQUIRE))
+        return NULL;
     tpr = MLN_ATOMIC_LOAD(&(tpool->res_free_list));
     while (tpr != NULL) {
         next = tpr->next;
@@ -323,10 +431,11 @@ MLN_FUNC(static, mln_thread_pool_resource_t *, mln_thread_pool_node_take, \
                                         1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
         {
             __atomic_sub_fetch(&(tpool->free_list_size), 1, __ATOMIC_RELAXED);
-            return tpr;
+            break;
         }
     }
-    return NULL;
+    if (tpool->instance) __atomic_clear(&(tpool->take_lock), __ATOMIC_RELEASE);
+    return tpr;
 })
 
 MLN_FUNC_VOID(static inline, void, mln_thread_pool_node_recycle, \
@@ -368,17 +477,29 @@ MLN_FUNC_VOID(static inline, void, mln_thread_pool_lockfree_push, \
     } while (!MLN_ATOMIC_CAS_WEAK(&(tpool->incoming), &expected, head));
 })
 
-MLN_FUNC(, int, mln_thread_pool_resource_add, (void *data), (data), {
-    /*
-     * Only main thread can call this function.
-     */
-    ASSERT(m_thread_pool_self != NULL);
+/*
+ * Reserve room for @n more pending tasks when the pool has a queue limit.
+ */
+MLN_FUNC(static inline, int, mln_thread_pool_reserve, (mln_thread_pool_t *tpool, mln_size_t n), (tpool, n), {
+    if (!tpool->queue_max) return 0;
+    if (__atomic_add_fetch(&(tpool->n_pending), n, __ATOMIC_RELAXED) > tpool->queue_max) {
+        __atomic_sub_fetch(&(tpool->n_pending), n, __ATOMIC_RELAXED);
+        return EAGAIN;
+    }
+    return 0;
+})
 
+MLN_FUNC(static, int, mln_thread_pool_add, (mln_thread_pool_t *tpool, void *data), (tpool, data), {
     mln_thread_pool_resource_t *tpr;
-    mln_thread_pool_t *tpool = m_thread_pool_self->pool;
+    int rc;
+
+    if ((rc = mln_thread_pool_reserve(tpool, 1)) != 0) return rc;
+
+    if (tpool->work_stealing) return mln_thread_pool_ws_add(tpool, &data, 1);
 
     if ((tpr = mln_thread_pool_node_take(tpool)) == NULL) {
         if ((tpr = (mln_thread_pool_resource_t *)malloc(sizeof(mln_thread_pool_resource_t))) == NULL) {
+            mln_thread_pool_done(tpool, 1);
             return ENOMEM;
         }
     }
@@ -401,21 +522,18 @@ MLN_FUNC(, int, mln_thread_pool_resource_add, (void *data), (data), {
      */
     mln_u32_t waiters_snap = MLN_ATOMIC_LOAD(&(tpool->waiters));
     mln_u32_t counter_snap = MLN_ATOMIC_RELAXED_LOAD(&(tpool->counter));
-    if (waiters_snap == 0 && counter_snap >= tpool->max + 1) {
+    if (waiters_snap == 0 && counter_snap >= mln_thread_pool_limit(tpool)) {
         return 0;
     }
 
-    m_thread_pool_self->locked = 1;
-    pthread_mutex_lock(&(tpool->mutex));
+    mln_thread_pool_lock(tpool);
     if (tpool->waiters > 0) {
         pthread_cond_signal(&(tpool->cond));
-    } else if (tpool->counter < tpool->max + 1) {
-        int rc;
+    } else if (tpool->counter < mln_thread_pool_limit(tpool)) {
         pthread_t threadid;
         mln_thread_pool_member_t *tpm;
         if ((tpm = mln_thread_pool_member_join(tpool, 1)) == NULL) {
-            pthread_mutex_unlock(&(tpool->mutex));
-            m_thread_pool_self->locked = 0;
+            mln_thread_pool_unlock(tpool);
             return ENOMEM;
         }
         if ((rc = pthread_create(&threadid, &(tpool->attr), child_thread_launcher, tpm)) != 0) {
@@ -423,29 +541,40 @@ MLN_FUNC(, int, mln_thread_pool_resource_add, (void *data), (data), {
             --(tpool->counter);
             --(tpool->idle);
             free(tpm);
-            pthread_mutex_unlock(&(tpool->mutex));
-            m_thread_pool_self->locked = 0;
+            mln_thread_pool_unlock(tpool);
             return rc;
         }
     }
-    pthread_mutex_unlock(&(tpool->mutex));
-    m_thread_pool_self->locked = 0;
+    mln_thread_pool_unlock(tpool);
     return 0;
 })
 
-MLN_FUNC(, int, mln_thread_pool_resource_addn, (void **data, mln_size_t n), (data, n), {
+MLN_FUNC(, int, mln_thread_pool_resource_add, (void *data), (data), {
+    /*
+     * Only main thread can call this function.
+     */
+    ASSERT(m_thread_pool_self != NULL);
+    return mln_thread_pool_add(m_thread_pool_self->pool, data);
+})
+
+MLN_FUNC(static, int, mln_thread_pool_addn, \
+         (mln_thread_pool_t *tpool, void **data, mln_size_t n), (tpool, data, n), \
+{
     /*
-     * Batched submission. Only main thread can call this function.
+     * Batched submission.
      * Builds a single linked list locally and hands it to @incoming
      * with one atomic CAS, which is much cheaper than @n individual
      * mutex round-trips.
      */
-    ASSERT(m_thread_pool_self != NULL);
     if (n == 0) return 0;
 
-    mln_thread_pool_t *tpool = m_thread_pool_self->pool;
     mln_thread_pool_resource_t *batch_head = NULL, *batch_tail = NULL;
     mln_size_t built = 0;
+    int rc;
+
+    if ((rc = mln_thread_pool_reserve(tpool, n)) != 0) return rc;
+
+    if (tpool->work_stealing) return mln_thread_pool_ws_add(tpool, data, n);
 
     /*
      * Build the batch chain. Reuse free-list nodes lock-free, fall
@@ -469,6 +598,7 @@ MLN_FUNC(, int, mln_thread_pool_resource_addn, (void **data, mln_size_t n), (dat
         if (batch_tail == NULL) batch_tail = tpr;
         ++built;
     }
+    mln_thread_pool_done(tpool, n - built);
     if (batch_head == NULL) return ENOMEM;
 
     mln_thread_pool_lockfree_push(tpool, batch_head, batch_tail);
@@ -478,15 +608,13 @@ MLN_FUNC(, int, mln_thread_pool_resource_addn, (void **data, mln_size_t n), (dat
      * once and either signal multiple times or spawn multiple new
      * threads, capped at the maximum.
      */
-    m_thread_pool_self->locked = 1;
-    pthread_mutex_lock(&(tpool->mutex));
+    mln_thread_pool_lock(tpool);
     mln_size_t needed = built;
     while (needed > 0 && tpool->waiters > 0) {
         pthread_cond_signal(&(tpool->cond));
         --needed;
     }
-    while (needed > 0 && tpool->counter < tpool->max + 1) {
-        int rc;
+    while (needed > 0 && tpool->counter < mln_thread_pool_limit(tpool)) {
         pthread_t threadid;
         mln_thread_pool_member_t *tpm;
         if ((tpm = mln_thread_pool_member_join(tpool, 1)) == NULL) break;
@@ -499,11 +627,18 @@ MLN_FUNC(, int, mln_thread_pool_resource_addn, (void **data, mln_size_t n), (dat
         }
         --needed;
     }
-    pthread_mutex_unlock(&(tpool->mutex));
-    m_thread_pool_self->locked = 0;
+    mln_thread_pool_unlock(tpool);
     return (built == n) ? 0 : ENOMEM;
 })
 
+MLN_FUNC(, int, mln_thread_pool_resource_addn, (void **data, mln_size_t n), (data, n), {
+    /*
+     * Only main thread can call this function.
+     */
+    ASSERT(m_thread_pool_self != NULL);
+    return mln_thread_pool_addn(m_thread_pool_self->pool, data, n);
+})
+
 MLN_FUNC_VOID(static, void, mln_thread_pool_drain_incoming, \
               (mln_thread_pool_t *tpool), (tpool), \
 {
@@ -534,6 +669,365 @@ MLN_FUNC_VOID(static, void, mln_thread_pool_drain_incoming, \
     tpool->n_res += added;
 })
 
+/*
+ * work stealing
+ *
+ * Each worker owns a Chase-Lev deque (the weak-memory-model formulation by
+ * Le, Pop, Cohen and Zappa Nardelli). The main thread still publishes into
+ * the lock-free @incoming stack. A worker that runs dry moves the whole
+ * stack into its own deque with one exchange, and otherwise steals from the
+ * top of a random peer's deque. Submissions made from inside a child
+ * handler go straight to the caller's own deque. Nothing on this path takes
+ * the pool mutex; idle workers park on their own mutex/cond.
+ */
+MLN_FUNC(static, mln_thread_pool_ws_array_t *, mln_thread_pool_ws_array_new, \
+         (mln_sptr_t size), (size), \
+{
+    mln_thread_pool_ws_array_t *a;
+
+    a = (mln_thread_pool_ws_array_t *)malloc(sizeof(mln_thread_pool_ws_array_t) + size * sizeof(void *));
+    if (a == NULL) return NULL;
+    a->retired = NULL;
+    a->mask = size - 1;
+    a->buf = (void **)(a + 1);
+    return a;
+})
+
+MLN_FUNC(static, int, mln_thread_pool_ws_init, (mln_thread_pool_t *tp), (tp), {
+    mln_thread_pool_ws_t *ws;
+
+    if (!tp->max) return EINVAL;
+    if ((tp->ws = (mln_thread_pool_ws_t *)calloc(tp->max, sizeof(mln_thread_pool_ws_t))) == NULL)
+        return ENOMEM;
+    for (; tp->ws_n < tp->max; ++(tp->ws_n)) {
+        ws = &(tp->ws[tp->ws_n]);
+        if ((ws->array = mln_thread_pool_ws_array_new(MLN_THREAD_POOL_WS_SIZE)) == NULL)
+            goto err;
+        if (pthread_mutex_init(&(ws->mutex), NULL) != 0) {
+            free(ws->array);
+            goto err;
+        }
+        if (pthread_cond_init(&(ws->cond), NULL) != 0) {
+            pthread_mutex_destroy(&(ws->mutex));
+            free(ws->array);
+            goto err;
+        }
+        ws->top = ws->bottom = 0;
+        ws->parked = 0;
+        ws->seed = (tp->ws_n + 1) * 2654435761u;
+    }
+    return 0;
+
+err:
+    mln_thread_pool_ws_destroy(tp);
+    return ENOMEM;
+})
+
+MLN_FUNC_VOID(static, void, mln_thread_pool_ws_destroy, (mln_thread_pool_t *tp), (tp), {
+    mln_u32_t i;
+    mln_sptr_t t;
+    mln_thread_pool_ws_t *ws;
+    mln_thread_pool_ws_array_t *a, *r;
+
+    if (tp->ws == NULL) return;
+    for (i = 0; i < tp->ws_n; ++i) {
+        ws = &(tp->ws[i]);
+        for (t = ws->top; t < ws->bottom; ++t) {
+            if (tp->free_handler != NULL) tp->free_handler(ws->array->buf[t & ws->array->mask]);
+        }
+        for (a = ws->array; a != NULL; a = r) {
+            r = a->retired;
+            free(a);
+        }
+        pthread_cond_destroy(&(ws->cond));
+        pthread_mutex_destroy(&(ws->mutex));
+    }
+    free(tp->ws);
+    tp->ws = NULL;
+    tp->ws_n = 0;
+})
+
+/*
+ * Owner only. The old array is kept on the retired chain because a thief
+ * may still be reading from it; all of them are freed with the pool.
+ */
+MLN_FUNC(static inline, int, mln_thread_pool_ws_push, (mln_thread_pool_ws_t *ws, void *data), (ws, data), {
+    mln_sptr_t b = MLN_ATOMIC_RELAXED_LOAD(&(ws->bottom));
+    mln_sptr_t t = MLN_ATOMIC_LOAD(&(ws->top));
+    mln_thread_pool_ws_array_t *a = MLN_ATOMIC_RELAXED_LOAD(&(ws->array)), *na;
+
+    if (b - t > a->mask) {
+        if ((na = mln_thread_pool_ws_array_new((a->mask + 1) << 1)) == NULL)
+            return ENOMEM;
+        for (; t < b; ++t) na->buf[t & na->mask] = MLN_ATOMIC_RELAXED_LOAD(&(a->buf[t & a->mask]));
+        na->retired = a;
+        MLN_ATOMIC_STORE(&(ws->array), na);
+        a = na;
+    }
+    MLN_ATOMIC_RELAXED_STORE(&(a->buf[b & a->mask]), data);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    MLN_ATOMIC_RELAXED_STORE(&(ws->bottom), b + 1);
+    return 0;
+})
+
+/* Owner only. */
+MLN_FUNC(static inline, void *, mln_thread_pool_ws_take, (mln_thread_pool_ws_t *ws), (ws), {
+    mln_sptr_t b = MLN_ATOMIC_RELAXED_LOAD(&(ws->bottom)) - 1;
+    mln_thread_pool_ws_array_t *a = MLN_ATOMIC_RELAXED_LOAD(&(ws->array));
+    mln_sptr_t t;
+    void *data = NULL;
+
+    MLN_ATOMIC_RELAXED_STORE(&(ws->bottom), b);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = MLN_ATOMIC_RELAXED_LOAD(&(ws->top));
+    if (t <= b) {
+        data = MLN_ATOMIC_RELAXED_LOAD(&(a->buf[b & a->mask]));
+        if (t == b) {
+            /* last item, race against thieves */
+            if (!__atomic_compare_exchange_n(&(ws->top), &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                data = NULL;
+            MLN_ATOMIC_RELAXED_STORE(&(ws->bottom), b + 1);
+        }
+    } else {
+        MLN_ATOMIC_RELAXED_STORE(&(ws->bottom), b + 1);
+    }
+    return data;
+})
+
+/* Any thread. Returns NULL if the deque looked empty or the race was lost. */
+MLN_FUNC(static inline, void *, mln_thread_pool_ws_steal, (mln_thread_pool_ws_t *ws), (ws), {
+    mln_sptr_t t = MLN_ATOMIC_LOAD(&(ws->top)), b;
+    mln_thread_pool_ws_array_t *a;
+    void *data;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = MLN_ATOMIC_LOAD(&(ws->bottom));
+    if (t >= b) return NULL;
+    a = MLN_ATOMIC_LOAD(&(ws->array));
+    data = MLN_ATOMIC_RELAXED_LOAD(&(a->buf[t & a->mask]));
+    if (!__atomic_compare_exchange_n(&(ws->top), &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return data;
+})
+
+/*
+ * Move everything published by the main thread into @ws. The stack is
+ * newest-first, so pushing in that order leaves the oldest item at the
+ * bottom where the owner pops next, while thieves take the newest ones.
+ */
+MLN_FUNC(static, void *, mln_thread_pool_ws_grab, \
+         (mln_thread_pool_t *tpool, mln_thread_pool_ws_t *ws), (tpool, ws), \
+{
+    mln_thread_pool_resource_t *node, *next;
+    mln_size_t skipped = 0;
+
+    if (MLN_ATOMIC_RELAXED_LOAD(&(tpool->incoming)) == NULL) return NULL;
+    node = MLN_ATOMIC_EXCHANGE(&(tpool->incoming), NULL);
+    for (; node != NULL; node = next) {
+        next = node->next;
+        if (node->data == NULL) ++skipped;
+        else if (mln_thread_pool_ws_push(ws, node->data) != 0) {
+            /* out of memory, hand the rest back */
+            mln_thread_pool_resource_t *tail = node;
+            while (tail->next != NULL) tail = tail->next;
+            mln_thread_pool_lockfree_push(tpool, node, tail);
+            break;
+        }
+        mln_thread_pool_node_recycle(tpool, node);
+    }
+    mln_thread_pool_done(tpool, skipped);
+    return mln_thread_pool_ws_take(ws);
+})
+
+MLN_FUNC(static, void *, mln_thread_pool_ws_steal_any, \
+         (mln_thread_pool_t *tpool, mln_thread_pool_ws_t *ws), (tpool, ws), \
+{
+    mln_u32_t i, n = tpool->ws_n, start;
+    mln_thread_pool_ws_t *victim;
+    void *data;
+
+    /* xorshift32 picks where to start so thieves spread over victims */
+    ws->seed ^= ws->seed << 13;
+    ws->seed ^= ws->seed >> 17;
+    ws->seed ^= ws->seed << 5;
+    start = ws->seed % n;
+    for (i = 0; i < n; ++i) {
+        victim = &(tpool->ws[(start + i) % n]);
+        if (victim == ws) continue;
+        if ((data = mln_thread_pool_ws_steal(victim)) != NULL) return data;
+    }
+    return NULL;
+})
+
+MLN_FUNC(static, int, mln_thread_pool_ws_has_work, (mln_thread_pool_t *tpool), (tpool), {
+    mln_u32_t i;
+    mln_thread_pool_ws_t *ws;
+
+    if (MLN_ATOMIC_LOAD(&(tpool->incoming)) != NULL) return 1;
+    for (i = 0; i < tpool->ws_n; ++i) {
+        ws = &(tpool->ws[i]);
+        if (MLN_ATOMIC_LOAD(&(ws->bottom)) - MLN_ATOMIC_LOAD(&(ws->top)) > 0) return 1;
+    }
+    return 0;
+})
+
+/*
+ * Wake up to @n parked workers. A worker is claimed by flipping its
+ * @parked flag before its cond is signalled under its own mutex, so a
+ * worker that is just about to wait cannot miss the wakeup.
+ */
+MLN_FUNC_VOID(static, void, mln_thread_pool_ws_wake, (mln_thread_pool_t *tpool, mln_size_t n), (tpool, n), {
+    mln_u32_t i, start, expected;
+    mln_thread_pool_ws_t *ws;
+
+    start = __atomic_fetch_add(&(tpool->ws_next), 1, __ATOMIC_RELAXED);
+    for (i = 0; i < tpool->ws_n && n > 0; ++i) {
+        if (MLN_ATOMIC_LOAD(&(tpool->ws_parked)) == 0) break;
+        ws = &(tpool->ws[(start + i) % tpool->ws_n]);
+        expected = 1;
+        if (!__atomic_compare_exchange_n(&(ws->parked), &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            continue;
+        MLN_ATOMIC_DEC(&(tpool->ws_parked));
+        pthread_mutex_lock(&(ws->mutex));
+        pthread_cond_signal(&(ws->cond));
+        pthread_mutex_unlock(&(ws->mutex));
+        --n;
+    }
+})
+
+MLN_FUNC_VOID(static, void, mln_thread_pool_ws_park, \
+              (mln_thread_pool_t *tpool, mln_thread_pool_ws_t *ws), (tpool, ws), \
+{
+    struct timespec ts;
+    mln_u32_t expected = 1;
+    mln_u64_t timeout = tpool->cond_timeout? tpool->cond_timeout: 1000;
+
+    __atomic_store_n(&(ws->parked), 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(tpool->ws_parked), 1, __ATOMIC_SEQ_CST);
+    /*
+     * Pairs with the fence in mln_thread_pool_ws_add: either the producer
+     * sees us parked, or we see its item here.
+     */
+    if (mln_thread_pool_ws_has_work(tpool) || MLN_ATOMIC_LOAD(&(tpool->ws_quit))) {
+        if (__atomic_compare_exchange_n(&(ws->parked), &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            MLN_ATOMIC_DEC(&(tpool->ws_parked));
+        return;
+    }
+
+    pthread_mutex_lock(&(ws->mutex));
+    while (MLN_ATOMIC_LOAD(&(ws->parked)) && !MLN_ATOMIC_LOAD(&(tpool->ws_quit))) {
+        ts.tv_sec = time(NULL) + timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        if (pthread_cond_timedwait(&(ws->cond), &(ws->mutex), &ts) == ETIMEDOUT) {
+            expected = 1;
+            if (__atomic_compare_exchange_n(&(ws->parked), &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                MLN_ATOMIC_DEC(&(tpool->ws_parked));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(ws->mutex));
+})
+
+MLN_FUNC(static, int, mln_thread_pool_ws_add, \
+         (mln_thread_pool_t *tpool, void **data, mln_size_t n), (tpool, data, n), \
+{
+    mln_thread_pool_resource_t *head = NULL, *tail = NULL, *tpr;
+    mln_size_t i;
+
+    if (n == 0) return 0;
+
+    if (m_thread_pool_self != NULL && m_thread_pool_self->pool == tpool && m_thread_pool_self->ws != NULL) {
+        /* called from a worker: keep the work local, peers steal it */
+        for (i = 0; i < n; ++i) {
+            if (data[i] == NULL) {
+                /* a NULL slot would read as an empty deque */
+                mln_thread_pool_done(tpool, 1);
+                continue;
+            }
+            if (mln_thread_pool_ws_push(m_thread_pool_self->ws, data[i]) != 0) break;
+        }
+    } else {
+        for (i = 0; i < n; ++i) {
+            if ((tpr = mln_thread_pool_node_take(tpool)) == NULL) {
+                if ((tpr = (mln_thread_pool_resource_t *)malloc(sizeof(mln_thread_pool_resource_t))) == NULL)
+                    break;
+            }
+            tpr->data = data[i];
+            tpr->next = head;
+            head = tpr;
+            if (tail == NULL) tail = tpr;
+        }
+        if (head != NULL) mln_thread_pool_lockfree_push(tpool, head, tail);
+    }
+    mln_thread_pool_done(tpool, n - i);
+    if (i == 0) return ENOMEM;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (MLN_ATOMIC_LOAD(&(tpool->ws_parked)) > 0)
+        mln_thread_pool_ws_wake(tpool, i);
+    return i == n? 0: ENOMEM;
+})
+
+MLN_FUNC(static, int, mln_thread_pool_ws_spawn, (mln_thread_pool_t *tpool), (tpool), {
+    int rc = 0;
+    mln_u32_t i;
+    pthread_t threadid;
+    mln_thread_pool_member_t *tpm;
+
+    mln_thread_pool_lock(tpool);
+    for (i = 0; i < tpool->ws_n; ++i) {
+        if ((tpm = mln_thread_pool_member_join(tpool, 1)) == NULL) {
+            rc = ENOMEM;
+            break;
+        }
+        tpm->ws = &(tpool->ws[i]);
+        if ((rc = pthread_create(&threadid, &(tpool->attr), ws_child_thread_launcher, tpm)) != 0) {
+            mln_child_chain_del(&(tpool->child_head), &(tpool->child_tail), tpm);
+            --(tpool->counter);
+            --(tpool->idle);
+            free(tpm);
+            break;
+        }
+    }
+    mln_thread_pool_unlock(tpool);
+    return rc;
+})
+
+MLN_FUNC(static, void *, ws_child_thread_launcher, (void *arg), (arg), {
+    mln_sptr_t rc = 0;
+    mln_u32_t forked = 0;
+    pthread_cleanup_push(mln_thread_pool_member_exit, arg);
+
+    mln_thread_pool_member_t *tpm = (mln_thread_pool_member_t *)arg;
+    mln_thread_pool_t *tpool = tpm->pool;
+    mln_thread_pool_ws_t *ws = tpm->ws;
+    void *data;
+
+    m_thread_pool_self = tpm;
+    tpm->locked = 0;
+    mln_thread_pool_set_affinity(tpool);
+
+    while (!MLN_ATOMIC_LOAD(&(tpool->ws_quit))) {
+        if ((data = mln_thread_pool_ws_take(ws)) == NULL && \
+            (data = mln_thread_pool_ws_grab(tpool, ws)) == NULL && \
+            (data = mln_thread_pool_ws_steal_any(tpool, ws)) == NULL)
+        {
+            mln_thread_pool_ws_park(tpool, ws);
+            continue;
+        }
+        mln_thread_pool_done(tpool, 1);
+        tpm->data = data;
+        rc = tpool->process_handler(data);
+        tpm->data = NULL;
+    }
+
+    forked = m_thread_pool_self->forked;
+    pthread_cleanup_pop(1);
+    m_thread_pool_self = NULL;
+    if (forked) exit(rc);
+    return (void *)rc;
+})
+
 /*
  * launcher
  */
@@ -547,11 +1041,13 @@ MLN_FUNC(, int, mln_thread_pool_run, (struct mln_thread_pool_attr *tpattr), (tpa
         return EINVAL;
     }
 
-    if ((tpool = mln_thread_pool_new(tpattr, &rc)) == NULL) {
+    if ((tpool = mln_thread_pool_alloc(tpattr, 0, &rc)) == NULL) {
         return rc;
     }
-    rc = tpattr->main_process_handler(tpattr->main_data);
+    if (!tpool->work_stealing || (rc = mln_thread_pool_ws_spawn(tpool)) == 0)
+        rc = tpattr->main_process_handler(tpattr->main_data);
     tpool->quit = 1;
+    MLN_ATOMIC_STORE(&(tpool->ws_quit), 1);
     while (1) {
         m_thread_pool_self->locked = 1;
         pthread_mutex_lock(&(tpool->mutex));
@@ -563,6 +1059,7 @@ MLN_FUNC(, int, mln_thread_pool_run, (struct mln_thread_pool_attr *tpattr), (tpa
         pthread_cond_broadcast(&(tpool->cond));
         pthread_mutex_unlock(&(tpool->mutex));
         m_thread_pool_self->locked = 0;
+        if (tpool->work_stealing) mln_thread_pool_ws_wake(tpool, tpool->ws_n);
         usleep(50000);
     }
     mln_thread_pool_member_exit(m_thread_pool_self);
@@ -582,9 +1079,10 @@ MLN_FUNC(static, void *, child_thread_launcher, (void *arg), (arg), {
     mln_thread_pool_t *tpool = tpm->pool;
     mln_thread_pool_resource_t *recycle_local = NULL;
     mln_thread_pool_resource_t *batch_head, *batch_tail, *node;
-    int batch_count;
+    int batch_count, popped;
 
     m_thread_pool_self = tpm;
+    mln_thread_pool_set_affinity(tpool);
 
     while (1) {
         tpm->locked = 1;
@@ -637,12 +1135,13 @@ again:
 
         /* Pop a FIFO batch under the lock. */
         batch_head = batch_tail = NULL;
-        batch_count = 0;
+        batch_count = popped = 0;
         while (batch_count < MLN_THREAD_POOL_BATCH && tpool->res_chain_head != NULL) {
             node = tpool->res_chain_head;
             tpool->res_chain_head = node->next;
             if (tpool->res_chain_head == NULL) tpool->res_chain_tail = NULL;
             --(tpool->n_res);
+            ++popped;
             if (node->data == NULL) {
                 node->next = recycle_local;
                 recycle_local = node;
@@ -654,6 +1153,7 @@ again:
             batch_tail = node;
             ++batch_count;
         }
+        mln_thread_pool_done(tpool, popped);
 
         if (batch_head == NULL) {
             /* All items had NULL data. */
@@ -703,19 +1203,17 @@ MLN_FUNC_VOID(, void, mln_thread_quit, (void), (), {
     m_thread_pool_self->locked = 1;
     pthread_mutex_lock(&(tpool->mutex));
     tpool->quit = 1;
+    MLN_ATOMIC_STORE(&(tpool->ws_quit), 1);
     pthread_cond_broadcast(&(tpool->cond));
     pthread_mutex_unlock(&(tpool->mutex));
     m_thread_pool_self->locked = 0;
+    if (tpool->work_stealing) mln_thread_pool_ws_wake(tpool, tpool->ws_n);
 })
 
-MLN_FUNC_VOID(, void, mln_thread_resource_info, (struct mln_thread_pool_info *info), (info), {
-    if (info == NULL) return;
-
-    ASSERT(m_thread_pool_self != NULL);
-
-    mln_thread_pool_t *tpool = m_thread_pool_self->pool;
-    m_thread_pool_self->locked = 1;
-    pthread_mutex_lock(&(tpool->mutex));
+MLN_FUNC_VOID(static, void, mln_thread_pool_info_fill, \
+              (mln_thread_pool_t *tpool, struct mln_thread_pool_info *info), (tpool, info), \
+{
+    mln_thread_pool_lock(tpool);
     /*
      * res_num counts the FIFO queue exactly and the lock-free
      * incoming list approximately (the walk can race with the
@@ -732,8 +1230,283 @@ MLN_FUNC_VOID(, void, mln_thread_resource_info, (struct mln_thread_pool_info *in
     info->idle_num = tpool->idle;
     info->cur_num = tpool->counter;
     info->res_num = tpool->n_res + pending_incoming;
-    pthread_mutex_unlock(&(tpool->mutex));
-    m_thread_pool_self->locked = 0;
+    if (tpool->work_stealing) {
+        /* workers are only idle while parked, and queue in their deques */
+        mln_u32_t i;
+        mln_sptr_t size;
+        info->idle_num = MLN_ATOMIC_LOAD(&(tpool->ws_parked));
+        for (i = 0; i < tpool->ws_n; ++i) {
+            size = MLN_ATOMIC_LOAD(&(tpool->ws[i].bottom)) - MLN_ATOMIC_LOAD(&(tpool->ws[i].top));
+            if (size > 0) info->res_num += size;
+        }
+    }
+    mln_thread_pool_unlock(tpool);
+})
+
+MLN_FUNC_VOID(, void, mln_thread_resource_info, (struct mln_thread_pool_info *info), (info), {
+    if (info == NULL) return;
+
+    ASSERT(m_thread_pool_self != NULL);
+
+    mln_thread_pool_info_fill(m_thread_pool_self->pool, info);
+})
+
+/*
+ * Instance pools
+ *
+ * Unlike mln_thread_pool_run, these neither block nor take over the
+ * calling thread, so a process may keep several of them side by side
+ * (e.g. one for CPU-bound jobs and one for blocking I/O). Any thread
+ * may submit to any pool.
+ */
+MLN_FUNC(, mln_thread_pool_t *, mln_thread_pool_new, (struct mln_thread_pool_attr *tpattr), (tpattr), {
+    int rc;
+    mln_thread_pool_t *tpool;
+
+    if ((tpool = mln_thread_pool_alloc(tpattr, 1, &rc)) == NULL) return NULL;
+    if (tpattr->child_process_handler == NULL) {
+        /* no handler: the pool runs mln_thread_pool_async tasks */
+        tpool->process_handler = mln_thread_pool_future_run;
+        tpool->free_handler = mln_thread_pool_future_drop;
+    }
+    if (tpool->work_stealing && mln_thread_pool_ws_spawn(tpool) != 0) {
+        mln_thread_pool_destroy(tpool);
+        return NULL;
+    }
+    return tpool;
+})
+
+MLN_FUNC(, int, mln_thread_pool_submit, (mln_thread_pool_t *tpool, void *data), (tpool, data), {
+    return mln_thread_pool_add(tpool, data);
+})
+
+MLN_FUNC(, int, mln_thread_pool_submitn, \
+         (mln_thread_pool_t *tpool, void **data, mln_size_t n), (tpool, data, n), \
+{
+    return mln_thread_pool_addn(tpool, data, n);
+})
+
+MLN_FUNC_VOID(, void, mln_thread_pool_resource_info, \
+              (mln_thread_pool_t *tpool, struct mln_thread_pool_info *info), (tpool, info), \
+{
+    if (info == NULL) return;
+    mln_thread_pool_info_fill(tpool, info);
+})
+
+/*
+ * Workers finish the task in hand and exit. Tasks that never started
+ * are released through @free_handler. Must not be called by a worker of
+ * @tpool itself.
+ */
+MLN_FUNC_VOID(, void, mln_thread_pool_destroy, (mln_thread_pool_t *tpool), (tpool), {
+    if (tpool == NULL) return;
+
+    ASSERT(m_thread_pool_self == NULL || m_thread_pool_self->pool != tpool);
+
+    while (1) {
+        pthread_mutex_lock(&(tpool->mutex));
+        tpool->quit = 1;
+        MLN_ATOMIC_STORE(&(tpool->ws_quit), 1);
+        if (tpool->counter == 0) {
+            pthread_mutex_unlock(&(tpool->mutex));
+            break;
+        }
+        pthread_cond_broadcast(&(tpool->cond));
+        pthread_mutex_unlock(&(tpool->mutex));
+        if (tpool->work_stealing) mln_thread_pool_ws_wake(tpool, tpool->ws_n);
+        usleep(1000);
+    }
+    mln_thread_pool_free(tpool);
+})
+
+/*
+ * Futures and completion queues
+ *
+ * A completion queue is a lock-free LIFO of finished futures plus an
+ * eventfd (a pipe where eventfd does not exist) registered in an event.
+ * Only the push that finds the queue empty writes to the fd, so a burst
+ * of completions costs one wakeup, and the loop swaps the whole list out
+ * with one exchange and hands it over in batches.
+ */
+MLN_FUNC_VOID(static, void, mln_thread_pool_cq_process, \
+              (mln_event_t *ev, int fd, void *data), (ev, fd, data), \
+{
+    (void)ev;
+    (void)fd;
+    mln_thread_pool_cq_harvest((mln_thread_pool_cq_t *)data);
+})
+
+MLN_FUNC(, mln_thread_pool_cq_t *, mln_thread_pool_cq_new, \
+         (mln_event_t *ev, mln_thread_pool_cq_handler handler, void *data), \
+         (ev, handler, data), \
+{
+    mln_thread_pool_cq_t *cq;
+
+    if ((cq = (mln_thread_pool_cq_t *)malloc(sizeof(mln_thread_pool_cq_t))) == NULL)
+        return NULL;
+    cq->ev = ev;
+    cq->done = NULL;
+    cq->inflight = 0;
+    cq->wake_lost = 0;
+    cq->handler = handler;
+    cq->data = data;
+#if defined(__linux__)
+    if ((cq->rfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0) {
+        free(cq);
+        return NULL;
+    }
+    cq->wfd = cq->rfd;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) {
+        free(cq);
+        return NULL;
+    }
+    cq->rfd = fds[0];
+    cq->wfd = fds[1];
+    fcntl(cq->rfd, F_SETFL, fcntl(cq->rfd, F_GETFL, NULL) | O_NONBLOCK);
+    fcntl(cq->wfd, F_SETFL, fcntl(cq->wfd, F_GETFL, NULL) | O_NONBLOCK);
+#endif
+    if (ev != NULL && \
+        mln_event_fd_set(ev, cq->rfd, M_EV_RECV|M_EV_NONBLOCK, M_EV_UNLIMITED, cq, mln_thread_pool_cq_process) < 0)
+    {
+        close(cq->rfd);
+        if (cq->wfd != cq->rfd) close(cq->wfd);
+        free(cq);
+        return NULL;
+    }
+    return cq;
+})
+
+/*
+ * Futures still running on a pool would complete into freed memory, so
+ * their pools must be destroyed (or the queue drained) first.
+ */
+MLN_FUNC_VOID(, void, mln_thread_pool_cq_free, (mln_thread_pool_cq_t *cq), (cq), {
+    mln_thread_pool_future_t *f, *next;
+
+    if (cq == NULL) return;
+
+    if (cq->ev != NULL) mln_event_fd_set(cq->ev, cq->rfd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    for (f = MLN_ATOMIC_EXCHANGE(&(cq->done), NULL); f != NULL; f = next) {
+        next = f->next;
+        mln_thread_pool_future_release(f);
+    }
+    close(cq->rfd);
+    if (cq->wfd != cq->rfd) close(cq->wfd);
+    free(cq);
+})
+
+MLN_FUNC(, mln_size_t, mln_thread_pool_cq_harvest, (mln_thread_pool_cq_t *cq), (cq), {
+    mln_thread_pool_future_t *list, *fifo = NULL, *f;
+    mln_thread_pool_future_t *batch[M_THREAD_POOL_CQ_BATCH];
+    mln_size_t n = 0, total = 0;
+    char buf[64];
+
+    /* consume the wakeup before the list, a later push then signals again */
+    while (read(cq->rfd, buf, sizeof(buf)) > 0)
+        ;
+    list = MLN_ATOMIC_EXCHANGE(&(cq->done), NULL);
+    while (list != NULL) {
+        f = list;
+        list = f->next;
+        f->next = fifo;
+        fifo = f;
+    }
+
+    while (fifo != NULL) {
+        for (n = 0; fifo != NULL && n < M_THREAD_POOL_CQ_BATCH; ++n) {
+            batch[n] = fifo;
+            fifo = fifo->next;
+        }
+        __atomic_sub_fetch(&(cq->inflight), n, __ATOMIC_RELEASE);
+        cq->handler(cq, batch, n, cq->data);
+        total += n;
+        while (n > 0) mln_thread_pool_future_release(batch[--n]);
+    }
+    return total;
+})
+
+MLN_FUNC_VOID(static inline, void, mln_thread_pool_future_complete, (mln_thread_pool_future_t *f), (f), {
+    mln_thread_pool_cq_t *cq = f->cq;
+    mln_thread_pool_future_t *expected = MLN_ATOMIC_RELAXED_LOAD(&(cq->done));
+    int n;
+
+    do {
+        f->next = expected;
+    } while (!MLN_ATOMIC_CAS_WEAK(&(cq->done), &expected, f));
+
+    /*
+     * Only a push onto an empty list signals, otherwise a wakeup is already
+     * pending. EAGAIN means the fd is readable anyway. Any other failure is
+     * kept in wake_lost so the next completion signals again instead of
+     * leaving the consumer asleep.
+     */
+    if (expected == NULL || __atomic_exchange_n(&(cq->wake_lost), 0, __ATOMIC_ACQ_REL)) {
+#if defined(__linux__)
+        mln_u64_t one = 1;
+        while ((n = write(cq->wfd, &one, sizeof(one))) < 0 && errno == EINTR)
+            ;
+#else
+        while ((n = write(cq->wfd, "f", 1)) < 0 && errno == EINTR)
+            ;
+#endif
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            __atomic_store_n(&(cq->wake_lost), 1, __ATOMIC_RELEASE);
+    }
+})
+
+static int mln_thread_pool_future_run(void *data)
+{
+    mln_thread_pool_future_t *f = (mln_thread_pool_future_t *)data;
+    f->result = f->task(f->data);
+    mln_thread_pool_future_complete(f);
+    return 0;
+}
+
+/* tasks that never ran are still reported, flagged as cancelled */
+static void mln_thread_pool_future_drop(void *data)
+{
+    mln_thread_pool_future_t *f = (mln_thread_pool_future_t *)data;
+    f->cancelled = 1;
+    mln_thread_pool_future_complete(f);
+}
+
+MLN_FUNC(, mln_thread_pool_future_t *, mln_thread_pool_async, \
+         (mln_thread_pool_t *tpool, mln_thread_pool_cq_t *cq, mln_thread_task task, void *data), \
+         (tpool, cq, task, data), \
+{
+    int rc;
+    mln_thread_pool_future_t *f;
+
+    if (tpool->process_handler != mln_thread_pool_future_run) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((f = (mln_thread_pool_future_t *)malloc(sizeof(mln_thread_pool_future_t))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    f->task = task;
+    f->data = data;
+    f->result = NULL;
+    f->cq = cq;
+    f->next = NULL;
+    f->cancelled = 0;
+    f->refs = 2; /*the caller's handle and the delivery to cq*/
+    __atomic_add_fetch(&(cq->inflight), 1, __ATOMIC_RELAXED);
+    if ((rc = mln_thread_pool_add(tpool, f)) != 0) {
+        __atomic_sub_fetch(&(cq->inflight), 1, __ATOMIC_RELAXED);
+        free(f);
+        errno = rc;
+        return NULL;
+    }
+    return f;
+})
+
+MLN_FUNC_VOID(, void, mln_thread_pool_future_release, (mln_thread_pool_future_t *f), (f), {
+    if (f == NULL) return;
+    if (MLN_ATOMIC_DEC(&(f->refs)) == 0) free(f);
 })
 
 MLN_CHAIN_FUNC_DEFINE(static inline, \
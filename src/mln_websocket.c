@@ -16,6 +16,54 @@
 #endif
 #include "mln_func.h"
 
+#if !defined(MLN_WEBSOCKET_DISABLE_SIMD) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define MLN_WEBSOCKET_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(MLN_ZLIB)
+#include <zlib.h>
+#include <limits.h>
+#endif
+
+/*
+ * permessage-deflate state, allocated by mln_websocket_deflate_enable.
+ * The two zlib streams are only set up once the first message needs them.
+ */
+typedef struct {
+    struct mln_websocket_deflate_attr  attr;
+    mln_u64_t                          in_len;/*inflated bytes of the current message*/
+    mln_u32_t                          offered:1;
+    mln_u32_t                          negotiated:1;
+    mln_u32_t                          deflate_ready:1;
+    mln_u32_t                          inflate_ready:1;
+    mln_u32_t                          deflate_reset:1;/*no context takeover for our compressor*/
+    mln_u32_t                          inflate_reset:1;/*no context takeover for the peer*/
+    mln_u32_t                          out_message:1;/*a compressed message is being sent*/
+    mln_u32_t                          in_message:1;/*a compressed message is being received*/
+    mln_u32_t                          deflate_bits:4;
+    mln_u32_t                          inflate_bits:4;
+    mln_u32_t                          padding:16;
+#if defined(MLN_ZLIB)
+    z_stream                           zdef;
+    z_stream                           zinf;
+#endif
+} mln_websocket_deflate_t;
+
+/*parameters of one permessage-deflate offer or response, -1 means absent*/
+typedef struct {
+    int                                server_no_context_takeover;
+    int                                client_no_context_takeover;
+    int                                server_max_window_bits;
+    int                                client_max_window_bits;/*0 means present without value*/
+} mln_websocket_deflate_params_t;
+
+#define M_WS_DEFLATE_HEADROOM 14 /*the largest frame header*/
+/*z_stream counts are uInt, so 64-bit lengths are fed to zlib in slices*/
+#define M_WS_ZSLICE(n) ((n) > (mln_u64_t)UINT_MAX? UINT_MAX: (uInt)(n))
+
 static mln_u64_t mln_websocket_hash_calc(mln_hash_t *h, void *key);
 static int mln_websocket_hash_cmp(mln_hash_t *h, void *key1, void *key2);
 static void mln_websocket_hash_free(void *data);
@@ -28,7 +76,20 @@ static mln_string_t *mln_websocket_extension_tokens(mln_alloc_t *pool, mln_strin
 static mln_u32_t mln_websocket_masking_key_generate(void);
 static int mln_websocket_is_valid_status_code(mln_u16_t status);
 static int mln_websocket_is_valid_utf8(mln_u8ptr_t data, mln_size_t len);
-static void mln_websocket_unmask_xor4(mln_u8ptr_t data, mln_size_t len, mln_u32_t masking_key);
+static inline void
+mln_websocket_mask_scalar(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t key32);
+static int
+mln_websocket_mask(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t masking_key, int utf8);
+static int mln_websocket_extension_next(mln_u8ptr_t *pos, mln_u8ptr_t end, mln_string_t *name, mln_string_t *params);
+static int mln_websocket_deflate_params_parse(mln_string_t *params, mln_websocket_deflate_params_t *out);
+static mln_string_t *mln_websocket_deflate_accept(mln_websocket_t *ws, mln_string_t *offers, mln_string_t *others);
+static mln_string_t *mln_websocket_deflate_offer(mln_websocket_t *ws);
+static int mln_websocket_deflate_confirm(mln_websocket_t *ws);
+static void mln_websocket_deflate_free(mln_websocket_deflate_t *d);
+static int mln_websocket_deflate_payload(mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+                                         mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen);
+static int mln_websocket_inflate_payload(mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+                                         mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen);
 
 MLN_FUNC(, int, mln_websocket_init, (mln_websocket_t *ws, mln_http_t *http), (ws, http), {
     struct mln_hash_attr hattr;
@@ -52,6 +113,7 @@ MLN_FUNC(, int, mln_websocket_init, (mln_websocket_t *ws, mln_http_t *http), (ws
     ws->data = NULL;
     ws->content = NULL;
     ws->extension_handler = NULL;
+    ws->deflate = NULL;
     ws->content_len = 0;
     ws->content_free = 0;
     ws->fin = 0;
@@ -104,6 +166,10 @@ MLN_FUNC_VOID(, void, mln_websocket_destroy, (mln_websocket_t *ws), (ws), {
     if (ws->args != NULL) mln_string_free(ws->args);
     if (ws->key != NULL) mln_string_free(ws->key);
     if (ws->content_free) mln_alloc_free(ws->content);
+    if (ws->deflate != NULL) {
+        mln_websocket_deflate_free((mln_websocket_deflate_t *)ws->deflate);
+        ws->deflate = NULL;
+    }
 })
 
 MLN_FUNC_VOID(, void, mln_websocket_free, (mln_websocket_t *ws), (ws), {
@@ -138,6 +204,7 @@ MLN_FUNC_VOID(, void, mln_websocket_reset, (mln_websocket_t *ws), (ws), {
         ws->content = NULL;
     }
     ws->extension_handler = NULL;
+    /*the permessage-deflate context lives as long as the connection*/
     ws->content_len = 0;
     ws->fin = 0;
     ws->rsv1 = ws->rsv2 = ws->rsv3 = 0;
@@ -176,7 +243,7 @@ MLN_FUNC(, int, mln_websocket_validate, (mln_websocket_t *ws), (ws), {
     if (ret != M_WS_RET_OK) return ret;
     if (mln_http_type_get(http) != M_HTTP_RESPONSE) return M_WS_RET_ERROR;
 
-    return M_WS_RET_OK;
+    return mln_websocket_deflate_confirm(ws);
 })
 
 MLN_FUNC(static, int, mln_websocket_validate_accept, \
@@ -275,6 +342,13 @@ MLN_FUNC(, int, mln_websocket_handshake_response_generate, \
     tmp = mln_http_field_iterator(http, &extension_key);
     if (tmp) {
         extension_val = mln_websocket_extension_tokens(ws->pool, tmp);
+        if (ws->deflate != NULL) {
+            mln_string_t *deflate_val = mln_websocket_deflate_accept(ws, tmp, extension_val);
+            if (deflate_val != NULL) {
+                if (extension_val != NULL) mln_string_free(extension_val);
+                extension_val = deflate_val;
+            }
+        }
     }
 
     mln_string_t *accept = mln_websocket_accept_field(http);
@@ -326,50 +400,31 @@ MLN_FUNC(, int, mln_websocket_handshake_response_generate, \
     return M_WS_RET_OK;
 })
 
+/*
+ * Echo the offered extension names without their parameters.
+ * permessage-deflate is left out, it is negotiated by mln_websocket_deflate_accept.
+ */
 MLN_FUNC(static, mln_string_t *, mln_websocket_extension_tokens, \
          (mln_alloc_t *pool, mln_string_t *in), (pool, in), \
 {
-    mln_string_t *tmp = mln_string_pool_dup(pool, in);
-    if (tmp == NULL) return NULL;
-    mln_string_t *array = mln_string_slice(tmp, ",");
-    if (array == NULL) {
-        mln_string_free(tmp);
-        return NULL;
-    }
-    mln_string_t *p = array;
-    mln_s8ptr_t pos, buf;
-    mln_uauto_t size = 0;
-    for (; p->len; ++p) {
-        if ((pos = strchr((char *)(p->data), ';')) == NULL) {
-            size += (p->len + 1);
-        } else {
-            size += (pos - (char *)(p->data) + 1);
-        }
+    mln_string_t name, params, t, *tmp;
+    mln_u8ptr_t pos = in->data, end = in->data + in->len;
+    mln_u8ptr_t buf;
+    mln_size_t size = 0;
+
+    if ((buf = (mln_u8ptr_t)mln_alloc_m(pool, in->len + 1)) == NULL) return NULL;
+    while (mln_websocket_extension_next(&pos, end, &name, &params)) {
+        if (!mln_string_const_strcasecmp(&name, "permessage-deflate")) continue;
+        if (size) buf[size++] = ',';
+        memcpy(buf + size, name.data, name.len);
+        size += name.len;
     }
-    if (!size) return NULL;
-
-    --size;
-    buf = (mln_s8ptr_t)mln_alloc_m(pool, size);
-    if (buf == NULL) {
-        mln_string_slice_free(array);
-        mln_string_free(tmp);
+    if (!size) {
+        mln_alloc_free(buf);
         return NULL;
     }
-    for (size = 0, p = array; p->len; ++p) {
-        if ((pos = strchr((char *)(p->data), ';')) == NULL) {
-            memcpy(buf+size, p->data, p->len);
-            size += p->len;
-        } else {
-            memcpy(buf+size, p->data, pos-(char *)(p->data));
-            size += (pos - (char *)(p->data));
-        }
-        buf[size++] = ',';
-    }
-    buf[--size] = '\0';
-    mln_string_slice_free(array);
-    mln_string_free(tmp);
+    buf[size] = 0;
 
-    mln_string_t t;
     mln_string_nset(&t, buf, size);
     tmp = mln_string_pool_dup(pool, &t);
     mln_alloc_free(buf);
@@ -451,9 +506,20 @@ MLN_FUNC(, int, mln_websocket_handshake_request_generate, \
         mln_string_free(key_val);
         return M_WS_RET_FAILED;
     }
+    /*kept for mln_websocket_validate*/
+    if (ws->key != NULL) mln_string_free(ws->key);
+    ws->key = key_val;
     if (mln_http_field_set(http, &upgrade_key, &upgrade_val) < 0) return M_WS_RET_FAILED;
     if (mln_http_field_set(http, &connection_key, &upgrade_key) < 0) return M_WS_RET_FAILED;
     if (mln_http_field_set(http, &version_key, &version_val) < 0) return M_WS_RET_FAILED;
+    if (ws->deflate != NULL) {
+        mln_string_t extension_key = mln_string("Sec-WebSocket-Extensions");
+        mln_string_t *extension_val = mln_websocket_deflate_offer(ws);
+        if (extension_val == NULL) return M_WS_RET_FAILED;
+        int ret = mln_http_field_set(http, &extension_key, extension_val);
+        mln_string_free(extension_val);
+        if (ret < 0) return M_WS_RET_FAILED;
+    }
 
     if (mln_hash_iterate(ws->fields, mln_websocket_iterate_set_fields, http) < 0)
         return M_WS_RET_FAILED;
@@ -674,10 +740,21 @@ MLN_FUNC(static, int, mln_websocket_is_valid_utf8, (mln_u8ptr_t data, mln_size_t
     mln_size_t i = 0;
     mln_u8_t b0, b1, b2, b3;
     mln_u32_t cp;
+    mln_u64_t w;
     while (i < len) {
         b0 = data[i];
         if (b0 < 0x80) {
-            i += 1;
+            /*skip ASCII a word at a time, or up to the first non-ASCII byte of the word*/
+            if (i + 8 <= len) {
+                memcpy(&w, data + i, 8);
+                if (!(w & 0x8080808080808080ULL)) {
+                    i += 8;
+                    continue;
+                }
+                while (data[i] < 0x80) ++i;
+            } else {
+                i += 1;
+            }
         } else if ((b0 & 0xE0) == 0xC0) {
             if (i + 1 >= len) return 0;
             b1 = data[i+1];
@@ -712,26 +789,214 @@ MLN_FUNC(static, int, mln_websocket_is_valid_utf8, (mln_u8ptr_t data, mln_size_t
     return 1;
 })
 
-MLN_FUNC(static, void, mln_websocket_unmask_xor4, (mln_u8ptr_t data, mln_size_t len, mln_u32_t masking_key), (data, len, masking_key), {
-    mln_size_t i = 0;
+/*
+ * Masking kernels. 'key32' is the masking key as laid out on the wire,
+ * loaded into a native word, and 'dst' may be equal to 'src'.
+ */
+static inline void
+mln_websocket_mask_scalar(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t key32)
+{
+    mln_u64_t w, key64 = ((mln_u64_t)key32 << 32) | key32;
+    mln_u8ptr_t key = (mln_u8ptr_t)&key32;
+    mln_size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, src + i, 8);
+        w ^= key64;
+        memcpy(dst + i, &w, 8);
+    }
+    for (; i < len; ++i) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
+
+#if defined(MLN_WEBSOCKET_SIMD)
+/*
+ * UTF-8 validation after Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". Each byte is classified by three
+ * nibble lookups (high and low nibble of the previous byte, high
+ * nibble of the current one), whose AND is non-zero for any invalid
+ * two-byte pattern. Missing or excess 3rd/4th continuation bytes are
+ * found by comparing against the lead bytes two and three back.
+ */
+#define M_WS_U8_TOO_SHORT  0x01
+#define M_WS_U8_TOO_LONG   0x02
+#define M_WS_U8_OVERLONG_3 0x04
+#define M_WS_U8_TOO_LARGE  0x08
+#define M_WS_U8_SURROGATE  0x10
+#define M_WS_U8_OVERLONG_2 0x20
+#define M_WS_U8_LARGE_1000 0x40
+#define M_WS_U8_OVERLONG_4 0x40
+#define M_WS_U8_TWO_CONTS  0x80
+#define M_WS_U8_CARRY      (M_WS_U8_TOO_SHORT | M_WS_U8_TOO_LONG | M_WS_U8_TWO_CONTS)
+
+#define mln_websocket_u8_table(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,q) \
+    _mm256_setr_epi8(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,q,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,q)
+
+struct mln_websocket_u8_state_s {
+    __m256i prev;
+    __m256i error;
+    __m256i incomplete;
+};
+
+static inline __attribute__((target("avx2"))) void
+mln_websocket_utf8_block_avx2(struct mln_websocket_u8_state_s *st, __m256i in)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i byte_1_high = mln_websocket_u8_table(
+        M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG,
+        M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG, M_WS_U8_TOO_LONG,
+        (char)M_WS_U8_TWO_CONTS, (char)M_WS_U8_TWO_CONTS, (char)M_WS_U8_TWO_CONTS, (char)M_WS_U8_TWO_CONTS,
+        M_WS_U8_TOO_SHORT | M_WS_U8_OVERLONG_2,
+        M_WS_U8_TOO_SHORT,
+        M_WS_U8_TOO_SHORT | M_WS_U8_OVERLONG_3 | M_WS_U8_SURROGATE,
+        M_WS_U8_TOO_SHORT | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000 | M_WS_U8_OVERLONG_4);
+    const __m256i byte_1_low = mln_websocket_u8_table(
+        (char)(M_WS_U8_CARRY | M_WS_U8_OVERLONG_3 | M_WS_U8_OVERLONG_2 | M_WS_U8_OVERLONG_4),
+        (char)(M_WS_U8_CARRY | M_WS_U8_OVERLONG_2),
+        (char)M_WS_U8_CARRY,
+        (char)M_WS_U8_CARRY,
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000 | M_WS_U8_SURROGATE),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000),
+        (char)(M_WS_U8_CARRY | M_WS_U8_TOO_LARGE | M_WS_U8_LARGE_1000));
+    const __m256i byte_2_high = mln_websocket_u8_table(
+        M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT,
+        M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT,
+        (char)(M_WS_U8_TOO_LONG | M_WS_U8_OVERLONG_2 | M_WS_U8_TWO_CONTS | \
+               M_WS_U8_OVERLONG_3 | M_WS_U8_LARGE_1000 | M_WS_U8_OVERLONG_4),
+        (char)(M_WS_U8_TOO_LONG | M_WS_U8_OVERLONG_2 | M_WS_U8_TWO_CONTS | \
+               M_WS_U8_OVERLONG_3 | M_WS_U8_TOO_LARGE),
+        (char)(M_WS_U8_TOO_LONG | M_WS_U8_OVERLONG_2 | M_WS_U8_TWO_CONTS | \
+               M_WS_U8_SURROGATE | M_WS_U8_TOO_LARGE),
+        (char)(M_WS_U8_TOO_LONG | M_WS_U8_OVERLONG_2 | M_WS_U8_TWO_CONTS | \
+               M_WS_U8_SURROGATE | M_WS_U8_TOO_LARGE),
+        M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT, M_WS_U8_TOO_SHORT);
+    /*the last three bytes must not start a sequence that needs more bytes*/
+    const __m256i max_tail = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m256i shifted, prev1, prev2, prev3, sc, must23;
+
+    if (!_mm256_movemask_epi8(in)) {
+        st->error = _mm256_or_si256(st->error, st->incomplete);
+        st->incomplete = _mm256_setzero_si256();
+        st->prev = in;
+        return;
+    }
+
+    shifted = _mm256_permute2x128_si256(st->prev, in, 0x21);
+    prev1 = _mm256_alignr_epi8(in, shifted, 15);
+    prev2 = _mm256_alignr_epi8(in, shifted, 14);
+    prev3 = _mm256_alignr_epi8(in, shifted, 13);
+
+    sc = _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble)));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+    must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80))), \
+                             _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80))));
+    must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+
+    st->error = _mm256_or_si256(st->error, _mm256_xor_si256(must23, sc));
+    st->incomplete = _mm256_subs_epu8(in, max_tail);
+    st->prev = in;
+}
+
+static __attribute__((target("avx2"))) int
+mln_websocket_mask_avx2(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t key32, int utf8)
+{
+    struct mln_websocket_u8_state_s st;
+    const __m256i key = _mm256_set1_epi32((int)key32);
+    int store = dst != src || key32 != 0;
+    mln_u8_t pad[32];
+    mln_size_t i;
+    __m256i in;
+
+    st.prev = st.error = st.incomplete = _mm256_setzero_si256();
+    for (i = 0; i + 32 <= len; i += 32) {
+        in = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i)), key);
+        if (store) _mm256_storeu_si256((__m256i *)(dst + i), in);
+        if (utf8) mln_websocket_utf8_block_avx2(&st, in);
+    }
+    if (i < len) {
+        if (store) mln_websocket_mask_scalar(dst + i, src + i, len - i, key32);
+        if (utf8) {
+            /*zero padding is ASCII, so a truncated sequence shows up as too short*/
+            memset(pad, 0, sizeof(pad));
+            memcpy(pad, dst + i, len - i);
+            mln_websocket_utf8_block_avx2(&st, _mm256_loadu_si256((const __m256i *)pad));
+        }
+    }
+    if (!utf8) return 1;
+
+    st.error = _mm256_or_si256(st.error, st.incomplete);
+    return _mm256_testz_si256(st.error, st.error);
+}
+
+/*
+ * SSE2 has no byte shuffle, so only the unmasking is vectorized here
+ * and UTF-8 is checked by the scalar validator from the first block
+ * holding a non-ASCII byte on.
+ */
+static int
+mln_websocket_mask_sse2(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t key32, int utf8)
+{
+    const __m128i key = _mm_set1_epi32((int)key32);
+    int store = dst != src || key32 != 0;
+    mln_size_t i, ascii = utf8? 0: len;
+    __m128i in;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        in = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), key);
+        if (store) _mm_storeu_si128((__m128i *)(dst + i), in);
+        if (ascii == i && !_mm_movemask_epi8(in)) ascii += 16;
+    }
+    if (i < len && store)
+        mln_websocket_mask_scalar(dst + i, src + i, len - i, key32);
+    if (ascii >= len) return 1;
+
+    return mln_websocket_is_valid_utf8(dst + ascii, len - ascii);
+}
+#endif
+
+/*
+ * XOR 'len' bytes of 'src' with the masking key into 'dst' and, if
+ * 'utf8' is set, validate the result as UTF-8 in the same pass.
+ * Return 0 if the UTF-8 check fails, otherwise 1.
+ */
+static int
+mln_websocket_mask(mln_u8ptr_t dst, mln_u8ptr_t src, mln_size_t len, mln_u32_t masking_key, int utf8)
+{
     mln_u8_t tmpkey[4];
+    mln_u32_t key32;
+
     tmpkey[0] = (masking_key >> 24) & 0xff;
     tmpkey[1] = (masking_key >> 16) & 0xff;
     tmpkey[2] = (masking_key >> 8) & 0xff;
     tmpkey[3] = masking_key & 0xff;
+    memcpy(&key32, tmpkey, 4);
+    if (!utf8 && dst == src && !key32) return 1;
 
-    mln_size_t aligned = len & ~3;
-    mln_u32_t *ptr32 = (mln_u32_t *)data;
-    mln_u32_t *key32 = (mln_u32_t *)tmpkey;
-    mln_size_t j;
-    for (j = 0; j < aligned; j += 4) {
-        ptr32[j/4] ^= *key32;
-    }
-
-    for (i = aligned; i < len; ++i) {
-        data[i] ^= tmpkey[i % 4];
-    }
-})
+#if defined(MLN_WEBSOCKET_SIMD)
+    if (len >= 32 && __builtin_cpu_supports("avx2"))
+        return mln_websocket_mask_avx2(dst, src, len, key32, utf8);
+    return mln_websocket_mask_sse2(dst, src, len, key32, utf8);
+#else
+    if (dst != src || key32 != 0)
+        mln_websocket_mask_scalar(dst, src, len, key32);
+    return !utf8 || mln_websocket_is_valid_utf8(dst, len);
+#endif
+}
 
 MLN_FUNC(static, mln_u32_t, mln_websocket_masking_key_generate, (void), (), {
     struct timeval tv;
@@ -741,6 +1006,506 @@ MLN_FUNC(static, mln_u32_t, mln_websocket_masking_key_generate, (void), (), {
     return ((mln_u32_t)tmp | (mln_u32_t)rand());
 })
 
+/*
+ * permessage-deflate (RFC 7692)
+ */
+MLN_FUNC(, int, mln_websocket_deflate_enable, \
+         (mln_websocket_t *ws, struct mln_websocket_deflate_attr *attr), (ws, attr), \
+{
+#if defined(MLN_ZLIB)
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+
+    if (attr != NULL) {
+        if (attr->window_bits < 9 || attr->window_bits > 15) return M_WS_RET_ERROR;
+        if (attr->peer_window_bits < 8 || attr->peer_window_bits > 15) return M_WS_RET_ERROR;
+        if (attr->mem_level < 1 || attr->mem_level > 9) return M_WS_RET_ERROR;
+        if (attr->level < -1 || attr->level > 9) return M_WS_RET_ERROR;
+    }
+    if (d == NULL) {
+        if ((d = (mln_websocket_deflate_t *)mln_alloc_m(ws->pool, sizeof(mln_websocket_deflate_t))) == NULL)
+            return M_WS_RET_FAILED;
+        memset(d, 0, sizeof(mln_websocket_deflate_t));
+        ws->deflate = d;
+    } else if (d->negotiated) {
+        return M_WS_RET_ERROR;
+    }
+
+    if (attr != NULL) {
+        d->attr = *attr;
+    } else {
+        d->attr.window_bits = 15;
+        d->attr.peer_window_bits = 15;
+        d->attr.mem_level = 8;
+        d->attr.level = Z_DEFAULT_COMPRESSION;
+        d->attr.no_context_takeover = 0;
+        d->attr.peer_no_context_takeover = 0;
+        d->attr.max_message = M_WS_DEFLATE_MAX_MESSAGE;
+    }
+    return M_WS_RET_OK;
+#else
+    return M_WS_RET_FAILED;
+#endif
+})
+
+MLN_FUNC(, int, mln_websocket_deflate_negotiated, (mln_websocket_t *ws), (ws), {
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+    return d != NULL && d->negotiated;
+})
+
+/*
+ * Walk one element of an extension list: 'name' is the extension token and
+ * 'params' is everything up to the next element, quoted strings included.
+ */
+MLN_FUNC(static, int, mln_websocket_extension_next, \
+         (mln_u8ptr_t *pos, mln_u8ptr_t end, mln_string_t *name, mln_string_t *params), \
+         (pos, end, name, params), \
+{
+    mln_u8ptr_t p = *pos, start, last;
+
+    while (p < end && (*p == ',' || *p == ' ' || *p == '\t')) ++p;
+    if (p >= end) return 0;
+
+    for (start = p; p < end && *p != ',' && *p != ';'; ++p)
+        ;
+    for (last = p; last > start && (last[-1] == ' ' || last[-1] == '\t'); --last)
+        ;
+    mln_string_nset(name, start, last - start);
+
+    for (start = p; p < end && *p != ','; ++p) {
+        if (*p == '"') {
+            for (++p; p < end && *p != '"'; ++p)
+                ;
+            if (p >= end) break;
+        }
+    }
+    mln_string_nset(params, start, p - start);
+    *pos = p;
+    return 1;
+})
+
+MLN_FUNC(static, int, mln_websocket_deflate_bits, (mln_u8ptr_t p, mln_size_t len), (p, len), {
+    if (len == 1 && (*p == '8' || *p == '9')) return *p - '0';
+    if (len == 2 && p[0] == '1' && p[1] >= '0' && p[1] <= '5') return 10 + p[1] - '0';
+    return -1;
+})
+
+/*
+ * Parse '; param[=value]' pairs. Unknown, duplicated or malformed parameters
+ * make the whole element invalid, as RFC 7692 requires.
+ */
+MLN_FUNC(static, int, mln_websocket_deflate_params_parse, \
+         (mln_string_t *params, mln_websocket_deflate_params_t *out), (params, out), \
+{
+    mln_u8ptr_t p = params->data, end = params->data + params->len;
+    mln_u8ptr_t vstart = NULL;
+    mln_string_t name;
+    mln_size_t vlen;
+    int has_value, bits;
+
+    out->server_no_context_takeover = out->client_no_context_takeover = -1;
+    out->server_max_window_bits = out->client_max_window_bits = -1;
+
+    while (p < end) {
+        if (*p == ';' || *p == ' ' || *p == '\t') {
+            ++p;
+            continue;
+        }
+        for (vstart = p; p < end && *p != ';' && *p != '=' && *p != ' ' && *p != '\t'; ++p)
+            ;
+        mln_string_nset(&name, vstart, p - vstart);
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+
+        has_value = 0;
+        vlen = 0;
+        if (p < end && *p == '=') {
+            for (++p; p < end && (*p == ' ' || *p == '\t'); ++p)
+                ;
+            if (p < end && *p == '"') {
+                for (vstart = ++p; p < end && *p != '"'; ++p)
+                    ;
+                if (p >= end) return -1;
+                vlen = p++ - vstart;
+            } else {
+                for (vstart = p; p < end && *p != ';' && *p != ' ' && *p != '\t'; ++p)
+                    ;
+                vlen = p - vstart;
+            }
+            has_value = 1;
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if (p < end && *p != ';') return -1;
+
+        if (!mln_string_const_strcasecmp(&name, "server_no_context_takeover")) {
+            if (has_value || out->server_no_context_takeover >= 0) return -1;
+            out->server_no_context_takeover = 1;
+        } else if (!mln_string_const_strcasecmp(&name, "client_no_context_takeover")) {
+            if (has_value || out->client_no_context_takeover >= 0) return -1;
+            out->client_no_context_takeover = 1;
+        } else if (!mln_string_const_strcasecmp(&name, "server_max_window_bits")) {
+            if (!has_value || out->server_max_window_bits >= 0) return -1;
+            if ((bits = mln_websocket_deflate_bits(vstart, vlen)) < 0) return -1;
+            out->server_max_window_bits = bits;
+        } else if (!mln_string_const_strcasecmp(&name, "client_max_window_bits")) {
+            if (out->client_max_window_bits >= 0) return -1;
+            if (!has_value) {
+                out->client_max_window_bits = 0;
+            } else {
+                if ((bits = mln_websocket_deflate_bits(vstart, vlen)) < 0) return -1;
+                out->client_max_window_bits = bits;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+})
+
+/*
+ * Server side: accept the first offer we can honour and build the response
+ * element, appended to 'others' (the other echoed extensions) if given.
+ */
+MLN_FUNC(static, mln_string_t *, mln_websocket_deflate_accept, \
+         (mln_websocket_t *ws, mln_string_t *offers, mln_string_t *others), (ws, offers, others), \
+{
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+    mln_websocket_deflate_params_t o;
+    mln_u8ptr_t pos = offers->data, end = offers->data + offers->len;
+    mln_string_t name, params, t;
+    mln_string_t *ret;
+    mln_u32_t dbits, ibits;
+    mln_size_t size;
+    char *buf;
+    int n = 0, peer_bits = 0;
+
+    if (d->negotiated) return NULL;
+
+    while (mln_websocket_extension_next(&pos, end, &name, &params)) {
+        if (mln_string_const_strcasecmp(&name, "permessage-deflate")) continue;
+        if (mln_websocket_deflate_params_parse(&params, &o) < 0) continue;
+        /*zlib can not compress with a 256-byte window*/
+        if (o.server_max_window_bits == 8) continue;
+
+        dbits = d->attr.window_bits;
+        if (o.server_max_window_bits > 0 && (mln_u32_t)o.server_max_window_bits < dbits)
+            dbits = o.server_max_window_bits;
+        ibits = o.client_max_window_bits > 0? (mln_u32_t)o.client_max_window_bits: 15;
+        if (o.client_max_window_bits >= 0 && d->attr.peer_window_bits < ibits) {
+            ibits = d->attr.peer_window_bits;
+            peer_bits = 1;
+        }
+
+        d->deflate_bits = dbits;
+        d->inflate_bits = ibits;
+        d->deflate_reset = d->attr.no_context_takeover || o.server_no_context_takeover > 0;
+        d->inflate_reset = d->attr.peer_no_context_takeover || o.client_no_context_takeover > 0;
+        d->negotiated = 1;
+        break;
+    }
+    if (!d->negotiated) return NULL;
+
+    size = (others != NULL? others->len + 2: 0) + 160;
+    if ((buf = (char *)mln_alloc_m(ws->pool, size)) == NULL) return NULL;
+    if (others != NULL) {
+        memcpy(buf, others->data, others->len);
+        n = others->len;
+        buf[n++] = ',';
+        buf[n++] = ' ';
+    }
+    n += snprintf(buf + n, size - n, "permessage-deflate");
+    if (d->deflate_reset) n += snprintf(buf + n, size - n, "; server_no_context_takeover");
+    if (d->inflate_reset) n += snprintf(buf + n, size - n, "; client_no_context_takeover");
+    if (d->deflate_bits < 15) n += snprintf(buf + n, size - n, "; server_max_window_bits=%u", d->deflate_bits);
+    if (peer_bits) n += snprintf(buf + n, size - n, "; client_max_window_bits=%u", d->inflate_bits);
+
+    mln_string_nset(&t, buf, n);
+    ret = mln_string_pool_dup(ws->pool, &t);
+    mln_alloc_free(buf);
+    return ret;
+})
+
+/*
+ * Client side: offer our preferences, client_max_window_bits is always sent
+ * since we can honour any limit the server picks.
+ */
+MLN_FUNC(static, mln_string_t *, mln_websocket_deflate_offer, (mln_websocket_t *ws), (ws), {
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+    mln_string_t t;
+    char buf[160];
+    int n;
+
+    n = snprintf(buf, sizeof(buf), "permessage-deflate");
+    if (d->attr.window_bits < 15)
+        n += snprintf(buf + n, sizeof(buf) - n, "; client_max_window_bits=%u", d->attr.window_bits);
+    else
+        n += snprintf(buf + n, sizeof(buf) - n, "; client_max_window_bits");
+    if (d->attr.peer_window_bits < 15)
+        n += snprintf(buf + n, sizeof(buf) - n, "; server_max_window_bits=%u", d->attr.peer_window_bits);
+    if (d->attr.no_context_takeover)
+        n += snprintf(buf + n, sizeof(buf) - n, "; client_no_context_takeover");
+    if (d->attr.peer_no_context_takeover)
+        n += snprintf(buf + n, sizeof(buf) - n, "; server_no_context_takeover");
+
+    d->offered = 1;
+    mln_string_nset(&t, buf, n);
+    return mln_string_pool_dup(ws->pool, &t);
+})
+
+/*
+ * Client side: check the server's answer against our offer.
+ * A response we did not ask for, or one we can not honour, fails the handshake.
+ */
+MLN_FUNC(static, int, mln_websocket_deflate_confirm, (mln_websocket_t *ws), (ws), {
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+    mln_websocket_deflate_params_t r;
+    mln_string_t key = mln_string("Sec-WebSocket-Extensions");
+    mln_string_t *val, name, params;
+    mln_u8ptr_t pos, end;
+    int found = 0;
+
+    if (d == NULL || !d->offered) return M_WS_RET_OK;
+    if ((val = mln_http_field_get(ws->http, &key)) == NULL) return M_WS_RET_OK;
+
+    pos = val->data;
+    end = val->data + val->len;
+    while (mln_websocket_extension_next(&pos, end, &name, &params)) {
+        if (mln_string_const_strcasecmp(&name, "permessage-deflate")) continue;
+        if (found++) return M_WS_RET_ERROR;
+        if (mln_websocket_deflate_params_parse(&params, &r) < 0) return M_WS_RET_ERROR;
+        if (r.client_max_window_bits == 0 || r.client_max_window_bits == 8) return M_WS_RET_ERROR;
+        if (d->attr.peer_window_bits < 15 && \
+            (r.server_max_window_bits < 0 || (mln_u32_t)r.server_max_window_bits > d->attr.peer_window_bits))
+            return M_WS_RET_ERROR;
+
+        d->deflate_bits = d->attr.window_bits;
+        if (r.client_max_window_bits > 0 && (mln_u32_t)r.client_max_window_bits < d->deflate_bits)
+            d->deflate_bits = r.client_max_window_bits;
+        d->inflate_bits = r.server_max_window_bits > 0? r.server_max_window_bits: 15;
+        d->deflate_reset = d->attr.no_context_takeover || r.client_no_context_takeover > 0;
+        d->inflate_reset = r.server_no_context_takeover > 0;
+    }
+    if (found) d->negotiated = 1;
+    return M_WS_RET_OK;
+})
+
+#if defined(MLN_ZLIB)
+MLN_FUNC(static, voidpf, mln_websocket_zalloc, \
+         (voidpf opaque, uInt items, uInt size), (opaque, items, size), \
+{
+    return mln_alloc_m((mln_alloc_t *)opaque, (mln_size_t)items * size);
+})
+
+MLN_FUNC_VOID(static, void, mln_websocket_zfree, \
+              (voidpf opaque, voidpf address), (opaque, address), \
+{
+    mln_alloc_free(address);
+})
+
+MLN_FUNC_VOID(static, void, mln_websocket_deflate_free, (mln_websocket_deflate_t *d), (d), {
+    if (d->deflate_ready) deflateEnd(&d->zdef);
+    if (d->inflate_ready) inflateEnd(&d->zinf);
+    mln_alloc_free(d);
+})
+
+/*
+ * Compress one frame payload into a new buffer with M_WS_DEFLATE_HEADROOM
+ * spare bytes in front, so the frame header can be written in place.
+ * The trailing 00 00 ff ff of the final frame is dropped.
+ */
+MLN_FUNC(static, int, mln_websocket_deflate_payload, \
+         (mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+          mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen), \
+         (ws, d, in, len, fin, out, olen), \
+{
+    z_stream *z = &d->zdef;
+    mln_u8ptr_t buf, nbuf;
+    mln_u64_t cap, ncap, done, left = len;
+    int ret;
+
+    if (!d->deflate_ready) {
+        z->zalloc = mln_websocket_zalloc;
+        z->zfree = mln_websocket_zfree;
+        z->opaque = ws->pool;
+        if (deflateInit2(z, d->attr.level, Z_DEFLATED, -(int)d->deflate_bits, \
+                         d->attr.mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+            return M_WS_RET_FAILED;
+        d->deflate_ready = 1;
+    }
+
+    cap = deflateBound(z, M_WS_ZSLICE(len)) + 16;
+    if ((buf = (mln_u8ptr_t)mln_alloc_m(ws->pool, M_WS_DEFLATE_HEADROOM + cap)) == NULL)
+        return M_WS_RET_FAILED;
+    z->next_in = in;
+    z->avail_in = 0;
+    z->next_out = buf + M_WS_DEFLATE_HEADROOM;
+    z->avail_out = M_WS_ZSLICE(cap);
+    while (1) {
+        if (!z->avail_in && left) {
+            z->avail_in = M_WS_ZSLICE(left);
+            left -= z->avail_in;
+        }
+        /*only the last slice is flushed*/
+        ret = deflate(z, left? Z_NO_FLUSH: Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) goto err;
+        /*
+         * A sync flush cut short by avail_out == 0 emits its marker again
+         * on the next call, so keep more than 6 bytes free.
+         */
+        if (z->avail_out > 6) {
+            if (!left) break;
+            continue;
+        }
+
+        done = z->next_out - (buf + M_WS_DEFLATE_HEADROOM);
+        if (cap - done > 6) {
+            z->avail_out = M_WS_ZSLICE(cap - done);
+            continue;
+        }
+        ncap = cap << 1;
+        if ((nbuf = (mln_u8ptr_t)mln_alloc_m(ws->pool, M_WS_DEFLATE_HEADROOM + ncap)) == NULL) goto err;
+        memcpy(nbuf + M_WS_DEFLATE_HEADROOM, buf + M_WS_DEFLATE_HEADROOM, done);
+        mln_alloc_free(buf);
+        buf = nbuf;
+        z->next_out = buf + M_WS_DEFLATE_HEADROOM + done;
+        z->avail_out = M_WS_ZSLICE(ncap - done);
+        cap = ncap;
+    }
+    *olen = z->next_out - (buf + M_WS_DEFLATE_HEADROOM);
+    if (fin) {
+        if (*olen >= 4) *olen -= 4;
+        if (d->deflate_reset) deflateReset(z);
+    }
+    *out = buf;
+    return M_WS_RET_OK;
+
+err:
+    mln_alloc_free(buf);
+    return M_WS_RET_FAILED;
+})
+
+/*
+ * Inflate one frame payload. The 00 00 ff ff tail is fed after the final
+ * frame, and the message as a whole may not grow past attr.max_message.
+ */
+MLN_FUNC(static, int, mln_websocket_inflate_payload, \
+         (mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+          mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen), \
+         (ws, d, in, len, fin, out, olen), \
+{
+    static mln_u8_t tail[4] = {0x00, 0x00, 0xff, 0xff};
+    z_stream *z = &d->zinf;
+    mln_u64_t limit = 0, cap, ncap, done, left = 0;
+    mln_u8ptr_t buf, nbuf;
+    int ret, round;
+
+    if (!d->inflate_ready) {
+        z->zalloc = mln_websocket_zalloc;
+        z->zfree = mln_websocket_zfree;
+        z->opaque = ws->pool;
+        z->next_in = Z_NULL;
+        z->avail_in = 0;
+        /*a larger window always inflates data made with a smaller one*/
+        if (inflateInit2(z, -(int)(d->inflate_bits < 9? 9: d->inflate_bits)) != Z_OK)
+            return M_WS_RET_FAILED;
+        d->inflate_ready = 1;
+    }
+
+    if (d->attr.max_message) {
+        if (d->in_len > d->attr.max_message) return M_WS_RET_ERROR;
+        limit = d->attr.max_message - d->in_len + 1;
+    }
+    cap = (len << 2) + 256;
+    if (limit && cap > limit) cap = limit;
+    if ((buf = (mln_u8ptr_t)mln_alloc_m(ws->pool, cap)) == NULL) return M_WS_RET_FAILED;
+    z->next_out = buf;
+    z->avail_out = M_WS_ZSLICE(cap);
+
+    for (round = 0; round < 2; ++round) {
+        if (round) {
+            if (!fin) break;
+            z->next_in = tail;
+            z->avail_in = sizeof(tail);
+        } else {
+            z->next_in = in;
+            z->avail_in = 0;
+            left = len;
+        }
+        while (z->avail_in || left || !z->avail_out) {
+            if (!z->avail_in && left) {
+                z->avail_in = M_WS_ZSLICE(left);
+                left -= z->avail_in;
+            }
+            if (!z->avail_out && (done = z->next_out - buf) < cap) {
+                z->avail_out = M_WS_ZSLICE(cap - done);
+            } else if (!z->avail_out) {
+                if (limit && cap >= limit) {
+                    ret = M_WS_RET_ERROR;
+                    goto err;
+                }
+                ncap = cap << 1;
+                if (limit && ncap > limit) ncap = limit;
+                if ((nbuf = (mln_u8ptr_t)mln_alloc_m(ws->pool, ncap)) == NULL) {
+                    ret = M_WS_RET_FAILED;
+                    goto err;
+                }
+                memcpy(nbuf, buf, cap);
+                mln_alloc_free(buf);
+                buf = nbuf;
+                z->next_out = buf + cap;
+                z->avail_out = M_WS_ZSLICE(ncap - cap);
+                cap = ncap;
+            }
+            ret = inflate(z, Z_SYNC_FLUSH);
+            if (ret == Z_STREAM_END) {
+                /*the peer closed its deflate stream, the next block starts afresh*/
+                inflateReset(z);
+            } else if (ret == Z_BUF_ERROR) {
+                if (z->avail_out) break;
+            } else if (ret != Z_OK) {
+                ret = ret == Z_MEM_ERROR? M_WS_RET_FAILED: M_WS_RET_ERROR;
+                goto err;
+            }
+        }
+    }
+
+    *olen = z->next_out - buf;
+    if (limit && *olen >= limit) {
+        ret = M_WS_RET_ERROR;
+        goto err;
+    }
+    d->in_len += *olen;
+    if (fin) {
+        d->in_len = 0;
+        if (d->inflate_reset) inflateReset(z);
+    }
+    *out = buf;
+    return M_WS_RET_OK;
+
+err:
+    mln_alloc_free(buf);
+    return ret;
+})
+#else
+MLN_FUNC_VOID(static, void, mln_websocket_deflate_free, (mln_websocket_deflate_t *d), (d), {
+    mln_alloc_free(d);
+})
+
+MLN_FUNC(static, int, mln_websocket_deflate_payload, \
+         (mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+          mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen), \
+         (ws, d, in, len, fin, out, olen), \
+{
+    return M_WS_RET_ERROR;
+})
+
+MLN_FUNC(static, int, mln_websocket_inflate_payload, \
+         (mln_websocket_t *ws, mln_websocket_deflate_t *d, mln_u8ptr_t in, \
+          mln_u64_t len, int fin, mln_u8ptr_t *out, mln_u64_t *olen), \
+         (ws, d, in, len, fin, out, olen), \
+{
+    return M_WS_RET_ERROR;
+})
+#endif
+
 MLN_FUNC(, int, mln_websocket_generate, \
          (mln_websocket_t *ws, mln_chain_t **out_cnode), (ws, out_cnode), \
 {
@@ -750,9 +1515,10 @@ MLN_FUNC(, int, mln_websocket_generate, \
     mln_chain_t *c;
     mln_alloc_t *pool = ws->pool;
     mln_u8_t payload_length = 0;
-    mln_u8ptr_t content = NULL;
+    mln_u8ptr_t content = NULL, zbuf = NULL;
     mln_u64_t clen = 0;
     mln_u32_t opcode = mln_websocket_get_opcode(ws);
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
 
     if (mln_websocket_get_ext_handler(ws) != NULL) {
         int ret = mln_websocket_get_ext_handler(ws)(ws);
@@ -763,6 +1529,17 @@ MLN_FUNC(, int, mln_websocket_generate, \
     clen = mln_websocket_get_content_len(ws);
     if (content == NULL && clen) return M_WS_RET_ERROR;
 
+    if (d != NULL && d->negotiated && opcode < M_WS_OPCODE_CLOSE) {
+        if (opcode != M_WS_OPCODE_CONTINUE) d->out_message = 1;
+        if (d->out_message) {
+            int ret = mln_websocket_deflate_payload(ws, d, content, clen, mln_websocket_get_fin(ws), &zbuf, &clen);
+            if (ret != M_WS_RET_OK) return ret;
+            content = zbuf + M_WS_DEFLATE_HEADROOM;
+            if (opcode != M_WS_OPCODE_CONTINUE) mln_websocket_set_rsv1(ws);
+            if (mln_websocket_get_fin(ws)) d->out_message = 0;
+        }
+    }
+
     if (opcode == M_WS_OPCODE_CLOSE) {
         clen += 2;
     }
@@ -788,19 +1565,30 @@ MLN_FUNC(, int, mln_websocket_generate, \
     if (mln_websocket_get_maskbit(ws)) size += 4;
 
     c = mln_chain_new(pool);
-    if (c == NULL) return M_WS_RET_FAILED;
+    if (c == NULL) {
+        mln_alloc_free(zbuf);
+        return M_WS_RET_FAILED;
+    }
     b = mln_buf_new(pool);
     if (b == NULL) {
         mln_chain_pool_release(c);
+        mln_alloc_free(zbuf);
         return M_WS_RET_FAILED;
     }
     c->buf = b;
-    buf = (mln_u8ptr_t)mln_alloc_m(pool, size);
-    if (buf == NULL) {
-        mln_chain_pool_release(c);
-        return M_WS_RET_FAILED;
+    if (zbuf != NULL) {
+        /*the compressed payload is framed in place, the header goes into the headroom*/
+        b->start = zbuf;
+        buf = content - (size - clen);
+    } else {
+        buf = (mln_u8ptr_t)mln_alloc_m(pool, size);
+        if (buf == NULL) {
+            mln_chain_pool_release(c);
+            return M_WS_RET_FAILED;
+        }
+        b->start = buf;
     }
-    b->left_pos = b->pos = b->start = buf;
+    b->left_pos = b->pos = buf;
     b->end = b->last = buf + size;
     b->in_memory = 1;
     b->last_buf = 1;
@@ -850,35 +1638,16 @@ MLN_FUNC(, int, mln_websocket_generate, \
         }
 
         mln_size_t remaining = clen - (opcode == M_WS_OPCODE_CLOSE ? 2 : 0);
-        /* Build key rotated by mask_offset (0 or 2) for remaining payload */
-        mln_u8_t rotkey[4];
-        if (mask_offset == 0) {
-            memcpy(rotkey, tmpkey, 4);
-        } else {
-            rotkey[0] = tmpkey[2]; rotkey[1] = tmpkey[3];
-            rotkey[2] = tmpkey[0]; rotkey[3] = tmpkey[1];
-        }
-        mln_size_t aligned = remaining & ~3;
-        mln_size_t k;
-        mln_u32_t key32_rot, word;
-        memcpy(&key32_rot, rotkey, 4);
-        for (k = 0; k < aligned; k += 4) {
-            memcpy(&word, pc + k, 4);
-            word ^= key32_rot;
-            memcpy(p + k, &word, 4);
-        }
-        p += aligned;
-        mln_size_t j;
-        for (j = aligned; j < remaining; ++j) {
-            *p++ = pc[j] ^ rotkey[j % 4];
-        }
+        /* the key is rotated by mask_offset (0 or 2) for the remaining payload */
+        if (mask_offset) m = (m << 16) | (m >> 16);
+        if (remaining) mln_websocket_mask(p, pc, remaining, m, 0);
     } else {
         if (opcode == M_WS_OPCODE_CLOSE) {
             *p++ = (mln_websocket_get_status(ws) >> 8) & 0xff;
             *p++ = mln_websocket_get_status(ws) & 0xff;
             clen -= 2;
         }
-        if (content != NULL) memcpy(p, content, clen);
+        if (content != NULL && p != content) memcpy(p, content, clen);
     }
 
     return M_WS_RET_OK;
@@ -890,11 +1659,13 @@ MLN_FUNC(, int, mln_websocket_parse, (mln_websocket_t *ws, mln_chain_t **in), (w
     mln_u64_t len, i, tmp;
     mln_u32_t masking_key = 0;
     mln_u8_t b1 = 0, b2 = 0;
+    mln_websocket_deflate_t *d = (mln_websocket_deflate_t *)ws->deflate;
+    int compressed = 0;
 
     for (i = 0; c != NULL; c = c->next) {
         if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
         p = c->buf->left_pos;
-        for (end = c->buf->end; p < end; ++p) {
+        for (end = c->buf->last; p < end; ++p) {
              if (i == 0) {
                  b1 = *p;
                  ++i;
@@ -916,13 +1687,13 @@ MLN_FUNC(, int, mln_websocket_parse, (mln_websocket_t *ws, mln_chain_t **in), (w
         i = 0;
 again127:
         for (; i < tmp; ++i) {
-            len |= ((*p++) << ((7 - i)<<3));
+            len |= ((mln_u64_t)(*p++) << ((7 - i)<<3));
         }
         if (tmp < 8) {
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -942,7 +1713,7 @@ again126:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -957,13 +1728,13 @@ again126:
         i = 0;
 againm:
         for (; i < tmp; ++i) {
-            masking_key |= ((*p++) << ((3 - i) << 3));
+            masking_key |= ((mln_u32_t)(*p++) << ((3 - i) << 3));
         }
         if (tmp < 4) {
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -990,7 +1761,7 @@ against:
                 for (c = c->next; c != NULL; c = c->next) {
                     if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                     p = c->buf->left_pos;
-                    end = c->buf->end;
+                    end = c->buf->last;
                     break;
                 }
                 if (c == NULL) return M_WS_RET_NOTYET;
@@ -1016,7 +1787,7 @@ againc:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) {
@@ -1049,6 +1820,16 @@ againc:
     if (b2 & 0x80) mln_websocket_set_masking_key(ws, masking_key);
     else mln_websocket_set_masking_key(ws, 0);
 
+    /*RSV1 marks the first frame of a compressed message, see RFC 7692*/
+    if (d != NULL && d->negotiated) {
+        if ((b1 & 0xf) == M_WS_OPCODE_TEXT || (b1 & 0xf) == M_WS_OPCODE_BINARY) {
+            d->in_message = (b1 & 0x40)? 1: 0;
+        } else if ((b1 & 0x40) || ((b1 & 0xf) != M_WS_OPCODE_CONTINUE && (b1 & 0xf) < M_WS_OPCODE_CLOSE)) {
+            goto bad;
+        }
+        compressed = (b1 & 0xf) < M_WS_OPCODE_CLOSE && d->in_message;
+    }
+
     if (mln_websocket_get_maskbit(ws)) {
         mln_u8_t tmpkey[4];
         mln_u16_t close_status = mln_websocket_get_status(ws);
@@ -1059,47 +1840,49 @@ againc:
         if (mln_websocket_get_opcode(ws) == M_WS_OPCODE_CLOSE && close_status != 0) {
             mln_u16_t unmasked_status = (mln_u16_t)((((close_status >> 8) & 0xff) ^ tmpkey[0]) << 8) | \
                                         (mln_u16_t)(((close_status & 0xff) ^ tmpkey[1]) & 0xff);
-            if (!mln_websocket_is_valid_status_code(unmasked_status)) {
-                if (content != NULL) mln_alloc_free(content);
-                return M_WS_RET_ERROR;
-            }
+            if (!mln_websocket_is_valid_status_code(unmasked_status)) goto bad;
             mln_websocket_set_status(ws, unmasked_status);
-        }
-        if (content != NULL && len > 0) {
-            mln_u32_t unmask_key = masking_key;
-            if (mln_websocket_get_opcode(ws) == M_WS_OPCODE_CLOSE && close_status != 0) {
-                /* 2 status bytes consumed 2 mask positions; rotate key by 2 to continue */
-                unmask_key = (masking_key << 16) | (masking_key >> 16);
-            }
-            mln_websocket_unmask_xor4(content, len, unmask_key);
+            /* 2 status bytes consumed 2 mask positions; rotate key by 2 to continue */
+            masking_key = (masking_key << 16) | (masking_key >> 16);
         }
     } else {
-        if ((b1 & 0x40) || (b1 & 0x20) || (b1 & 0x10)) {
-            if (mln_websocket_get_ext_handler(ws) == NULL) {
-                if (content != NULL) mln_alloc_free(content);
-                return M_WS_RET_ERROR;
-            }
-        }
+        if ((b1 & (compressed? 0x30: 0x70)) && mln_websocket_get_ext_handler(ws) == NULL) goto bad;
         if ((b1 & 0xf) == M_WS_OPCODE_CLOSE && mln_websocket_get_status(ws) != 0) {
-            if (!mln_websocket_is_valid_status_code(mln_websocket_get_status(ws))) {
-                if (content != NULL) mln_alloc_free(content);
-                return M_WS_RET_ERROR;
-            }
+            if (!mln_websocket_is_valid_status_code(mln_websocket_get_status(ws))) goto bad;
         }
+        masking_key = 0;
     }
 
-    if ((b1 & 0xf) == M_WS_OPCODE_TEXT && content != NULL && len > 0) {
-        if (!mln_websocket_is_valid_utf8(content, len)) {
-            if (content != NULL) mln_alloc_free(content);
-            return M_WS_RET_ERROR;
-        }
+    /*unmask and validate text in one pass, compressed text is validated once inflated*/
+    if (content != NULL && len > 0) {
+        if (!mln_websocket_mask(content, content, len, masking_key, !compressed && (b1 & 0xf) == M_WS_OPCODE_TEXT))
+            goto bad;
     }
 
-    if ((b1 & 0xf) >= M_WS_OPCODE_CLOSE && !mln_websocket_get_fin(ws)) {
-        if (content != NULL) mln_alloc_free(content);
-        return M_WS_RET_ERROR;
+    if (compressed) {
+        mln_u8ptr_t plain = NULL;
+        mln_u64_t plain_len = 0;
+        int ret = mln_websocket_inflate_payload(ws, d, content, len, b1 & 0x80, &plain, &plain_len);
+        if (ret == M_WS_RET_FAILED) {
+            mln_websocket_set_content(ws, NULL);
+            mln_websocket_reset_content_free(ws);
+            mln_alloc_free(content);
+            return M_WS_RET_FAILED;
+        }
+        if (ret != M_WS_RET_OK) goto bad;
+        if (b1 & 0x80) d->in_message = 0;
+        mln_alloc_free(content);
+        content = plain;
+        len = plain_len;
+        mln_websocket_set_content(ws, content);
+        mln_websocket_set_content_free(ws);
+        mln_websocket_set_content_len(ws, len);
+        if ((b1 & 0xf) == M_WS_OPCODE_TEXT && (b1 & 0x80) && !mln_websocket_is_valid_utf8(content, len))
+            goto bad;
     }
 
+    if ((b1 & 0xf) >= M_WS_OPCODE_CLOSE && !mln_websocket_get_fin(ws)) goto bad;
+
     if (mln_websocket_get_ext_handler(ws) != NULL) {
         int ret = mln_websocket_get_ext_handler(ws)(ws);
         if (ret != M_WS_RET_OK) return ret;
@@ -1126,5 +1909,12 @@ againc:
     }
 
     return M_WS_RET_OK;
+
+bad:
+    /*'content' is owned by 'ws' already*/
+    mln_websocket_set_content(ws, NULL);
+    mln_websocket_reset_content_free(ws);
+    if (content != NULL) mln_alloc_free(content);
+    return M_WS_RET_ERROR;
 })
 
@@ -10,12 +10,16 @@
  *   - mln_alloc_available_capacity bookkeeping
  *   - cascaded (parent) pools
  *   - complex multi-round alloc/free churn for stability
+ *   - shared memory pools: bitmap search, class free lists, fragmentation
+ *   - per-thread caches in front of a shared memory pool
+ *   - arena pools: bump allocation, no-op free, in-place realloc, reset
  *   - micro-benchmark to demonstrate hot-path throughput
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include "mln_alloc.h"
 
 static int nr_ok = 0;
@@ -301,6 +305,297 @@ static void test_benchmark(void)
     mln_alloc_destroy(pool);
 }
 
+/* --- arena pools -------------------------------------------------------- */
+
+static void test_arena(void)
+{
+    mln_alloc_t *pool = mln_alloc_arena_init(NULL, 0);
+    CHECK(pool != NULL, "arena init");
+
+    char *first = (char *)mln_alloc_m(pool, 10);
+    CHECK(first != NULL, "arena alloc");
+    CHECK(((unsigned long)first % M_ALLOC_ARENA_ALIGN) == 0, "arena alignment");
+    memcpy(first, "arena", 6);
+
+    int ok = 1;
+    for (int i = 1; i < 2000; ++i) {
+        unsigned char *p = (unsigned char *)mln_alloc_m(pool, i % 200 + 1);
+        if (p == NULL || ((unsigned long)p % M_ALLOC_ARENA_ALIGN) != 0) { ok = 0; break; }
+        memset(p, 0xab, i % 200 + 1);
+        mln_alloc_free(p); /* no-op */
+    }
+    CHECK(ok, "arena many small allocs");
+    CHECK(strcmp(first, "arena") == 0, "arena keeps earlier data");
+
+    /* growing the latest allocation stays in place */
+    char *g = (char *)mln_alloc_m(pool, 16);
+    memcpy(g, "grow", 5);
+    char *g2 = (char *)mln_alloc_re(pool, g, 64);
+    CHECK(g2 == g, "arena realloc grows in place");
+    char *other = (char *)mln_alloc_m(pool, 8);
+    char *g3 = (char *)mln_alloc_re(pool, g2, 256);
+    CHECK(g3 != NULL && g3 != g2 && other != NULL, "arena realloc moves when not last");
+    CHECK(strcmp(g3, "grow") == 0, "arena realloc copies data");
+
+    /* oversized requests get their own slab */
+    char *big = (char *)mln_alloc_c(pool, M_ALLOC_ARENA_SLAB_SIZE * 2);
+    CHECK(big != NULL && big[M_ALLOC_ARENA_SLAB_SIZE * 2 - 1] == 0, "arena large alloc");
+
+    /* reset rewinds to the first slab */
+    mln_alloc_reset(pool);
+    char *again = (char *)mln_alloc_m(pool, 10);
+    CHECK(again == first, "arena reset reuses slabs");
+    mln_alloc_destroy(pool);
+
+    /* capacity is accounted per slab */
+    pool = mln_alloc_arena_init(NULL, M_ALLOC_ARENA_SLAB_SIZE + 1024);
+    CHECK(mln_alloc_m(pool, 1000) != NULL, "capped arena alloc");
+    CHECK(mln_alloc_m(pool, M_ALLOC_ARENA_SLAB_SIZE) == NULL, "capped arena refuses overflow");
+    mln_alloc_reset(pool);
+    CHECK(mln_alloc_available_capacity(pool) == 1024, "capped arena keeps its slab on reset");
+    mln_alloc_destroy(pool);
+
+    /* arena on top of a parent pool */
+    mln_alloc_t *parent = mln_alloc_init(NULL, 0);
+    pool = mln_alloc_arena_init(parent, 0);
+    CHECK(pool != NULL, "arena with parent");
+    for (int i = 0; i < 100; ++i) ok &= mln_alloc_m(pool, 1000) != NULL;
+    CHECK(ok, "arena with parent allocs");
+    mln_alloc_destroy(pool);
+    mln_alloc_destroy(parent);
+
+    /* per-request pattern: allocate a burst, reset, repeat */
+    mln_alloc_t *heap = mln_alloc_init(NULL, 0);
+    pool = mln_alloc_arena_init(NULL, 0);
+    void *ptrs[256];
+    double t0 = now_sec();
+    for (int r = 0; r < 4000; ++r) {
+        for (int i = 0; i < 256; ++i) ptrs[i] = mln_alloc_m(heap, 24 + (i & 63));
+        for (int i = 0; i < 256; ++i) mln_alloc_free(ptrs[i]);
+    }
+    double t1 = now_sec();
+    for (int r = 0; r < 4000; ++r) {
+        for (int i = 0; i < 256; ++i) ptrs[i] = mln_alloc_m(pool, 24 + (i & 63));
+        mln_alloc_reset(pool);
+    }
+    double t2 = now_sec();
+    printf("  bench request burst: heap %.3f ms, arena %.3f ms\n",
+           (t1 - t0) * 1000.0, (t2 - t1) * 1000.0);
+    mln_alloc_destroy(pool);
+    mln_alloc_destroy(heap);
+}
+
+/* --- shared memory pools ------------------------------------------------ */
+
+#define SHM_SLOTS 512
+
+static int shm_nolock(void *locker)
+{
+    (void)locker;
+    return 0;
+}
+
+static void test_shm(void)
+{
+    static unsigned char *slots[SHM_SLOTS];
+    static mln_size_t sizes[SHM_SLOTS];
+    int locker, i, k, bad = 0, fails = 0;
+    mln_size_t before;
+    unsigned int seed = 12345;
+
+    mln_alloc_t *pool = mln_alloc_shm_init(16*1024*1024, &locker, shm_nolock, shm_nolock);
+    if (pool == NULL) {
+        printf("  shm pool unavailable, shm test skipped\n");
+        return;
+    }
+    before = mln_alloc_available_capacity(pool);
+    memset(slots, 0, sizeof(slots));
+
+    /* random churn over mixed sizes to fragment the bitmap */
+    double t0 = now_sec();
+    for (i = 0; i < 200000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % SHM_SLOTS;
+        if (slots[k] != NULL) {
+            if (slots[k][0] != (unsigned char)k || slots[k][sizes[k] - 1] != (unsigned char)k) ++bad;
+            mln_alloc_free(slots[k]);
+            slots[k] = NULL;
+            continue;
+        }
+        switch ((seed >> 20) & 7) {
+            case 0: sizes[k] = 20000 + (seed >> 4) % 60000; break;
+            case 1: sizes[k] = 2*1024*1024; break;
+            default: sizes[k] = 1 + (seed >> 4) % 2000; break;
+        }
+        if ((slots[k] = (unsigned char *)mln_alloc_m(pool, sizes[k])) == NULL) {
+            ++fails;
+            continue;
+        }
+        memset(slots[k], k, sizes[k]);
+    }
+    double t1 = now_sec();
+    for (k = 0; k < SHM_SLOTS; ++k) {
+        if (slots[k] == NULL) continue;
+        if (slots[k][0] != (unsigned char)k || slots[k][sizes[k] - 1] != (unsigned char)k) ++bad;
+        mln_alloc_free(slots[k]);
+    }
+    CHECK(bad == 0, "shm blocks never overlap");
+    CHECK(fails < 20000, "shm pool serves mixed sizes");
+    CHECK(mln_alloc_available_capacity(pool) == before, "shm pool fully reclaimed");
+    CHECK(pool->shm_head == NULL, "shm sub-blocks released");
+    printf("  bench shm churn x200000: %.3f ms (%d failed)\n", (t1 - t0) * 1000.0, fails);
+
+    /* freed small blocks are handed out again from the class lists */
+    void *a = mln_alloc_m(pool, 100);
+    void *b = mln_alloc_m(pool, 100);
+    mln_alloc_free(a);
+    void *c = mln_alloc_m(pool, 110);
+    CHECK(c == a, "shm class free list reuse");
+    mln_alloc_free(b);
+    mln_alloc_free(c);
+    CHECK(mln_alloc_available_capacity(pool) == before, "shm class lists drained");
+
+    mln_alloc_destroy(pool);
+}
+
+/* --- thread caches on a shared memory pool ------------------------------ */
+
+#define TC_THREADS 4
+#define TC_ROUNDS  20000
+#define TC_LIVE    32
+
+static pthread_mutex_t tc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static long tc_locks = 0;
+static mln_alloc_t *tc_pool = NULL;
+
+static int tc_lock(void *locker)
+{
+    if (pthread_mutex_lock((pthread_mutex_t *)locker) != 0) return -1;
+    ++tc_locks;
+    return 0;
+}
+
+static int tc_unlock(void *locker)
+{
+    return pthread_mutex_unlock((pthread_mutex_t *)locker) == 0? 0: -1;
+}
+
+static void *tc_worker(void *arg)
+{
+    unsigned char *live[TC_LIVE] = {0};
+    mln_size_t sizes[TC_LIVE];
+    long id = (long)arg, bad = 0;
+    int i, k;
+
+    for (i = 0; i < TC_ROUNDS; ++i) {
+        k = i % TC_LIVE;
+        if (live[k] != NULL) {
+            mln_size_t j;
+            for (j = 0; j < sizes[k]; ++j) {
+                if (live[k][j] != (unsigned char)(id + k)) {
+                    ++bad;
+                    break;
+                }
+            }
+            mln_alloc_tcache_free(live[k]);
+        }
+        sizes[k] = 8 + ((i * 37 + id * 11) % 3000);
+        live[k] = (unsigned char *)mln_alloc_tcache_m(tc_pool, sizes[k]);
+        if (live[k] == NULL) {
+            ++bad;
+            continue;
+        }
+        memset(live[k], (unsigned char)(id + k), sizes[k]);
+    }
+    for (k = 0; k < TC_LIVE; ++k) mln_alloc_tcache_free(live[k]);
+
+    /* odd workers flush explicitly, even ones rely on the thread exit hook */
+    if (id & 1) mln_alloc_tcache_flush(tc_pool);
+    return (void *)bad;
+}
+
+static pthread_barrier_t tc_barrier;
+
+static void *tc_holder(void *arg)
+{
+    void *p = mln_alloc_tcache_m(tc_pool, 64);
+
+    (void)arg;
+    mln_alloc_tcache_free(p);
+    pthread_barrier_wait(&tc_barrier); /* cache holds blocks of tc_pool */
+    pthread_barrier_wait(&tc_barrier); /* tc_pool destroyed */
+    /* a fresh pool may be mapped where the old one was */
+    mln_alloc_t *pool = mln_alloc_shm_init(1024*1024, &tc_mutex, tc_lock, tc_unlock);
+    if (pool != NULL) {
+        p = mln_alloc_tcache_m(pool, 64);
+        mln_alloc_tcache_free(p);
+        mln_alloc_tcache_flush(pool);
+        mln_alloc_destroy(pool);
+    }
+    return p == NULL? (void *)1: NULL;
+}
+
+static void test_tcache(void)
+{
+    pthread_t tids[TC_THREADS];
+    mln_size_t before;
+    long i, bad = 0;
+    void *ret;
+
+    tc_pool = mln_alloc_shm_init(8*1024*1024, &tc_mutex, tc_lock, tc_unlock);
+    if (tc_pool == NULL) {
+        printf("  shm pool unavailable, tcache test skipped\n");
+        return;
+    }
+    before = mln_alloc_available_capacity(tc_pool);
+
+    /* heap pools pass straight through */
+    mln_alloc_t *heap = mln_alloc_init(NULL, 0);
+    void *h = mln_alloc_tcache_m(heap, 100);
+    CHECK(h != NULL, "tcache alloc on heap pool");
+    mln_alloc_tcache_free(h);
+    mln_alloc_destroy(heap);
+
+    /* a block from the locked path may be released through the cache */
+    CHECK(tc_lock(&tc_mutex) == 0, "shm lock");
+    void *odd = mln_alloc_m(tc_pool, 77);
+    CHECK(tc_unlock(&tc_mutex) == 0, "shm unlock");
+    CHECK(odd != NULL, "plain shm alloc");
+    mln_alloc_tcache_free(odd);
+
+    for (i = 0; i < TC_THREADS; ++i)
+        CHECK(pthread_create(&tids[i], NULL, tc_worker, (void *)i) == 0, "tcache thread create");
+    for (i = 0; i < TC_THREADS; ++i) {
+        pthread_join(tids[i], &ret);
+        bad += (long)ret;
+    }
+    CHECK(bad == 0, "tcache blocks kept their contents");
+    CHECK(tc_locks < (long)TC_THREADS * TC_ROUNDS / 4, "tcache amortises pool locking");
+    printf("  tcache: %d ops, %ld lock acquisitions\n", TC_THREADS * TC_ROUNDS * 2, tc_locks);
+
+    /* the main thread's cache is returned on flush */
+    void *p = mln_alloc_tcache_m(tc_pool, 200);
+    CHECK(p != NULL, "tcache alloc on main thread");
+    mln_alloc_tcache_free(p);
+    mln_alloc_tcache_flush(tc_pool);
+    CHECK(mln_alloc_available_capacity(tc_pool) == before, "tcache returns every block");
+
+    mln_alloc_destroy(tc_pool);
+
+    /* a pool may be destroyed while other threads still cache its blocks */
+    tc_pool = mln_alloc_shm_init(8*1024*1024, &tc_mutex, tc_lock, tc_unlock);
+    CHECK(tc_pool != NULL, "second shm pool");
+    if (tc_pool == NULL) return;
+    CHECK(pthread_barrier_init(&tc_barrier, NULL, 2) == 0, "barrier init");
+    CHECK(pthread_create(&tids[0], NULL, tc_holder, NULL) == 0, "holder thread create");
+    pthread_barrier_wait(&tc_barrier);
+    mln_alloc_destroy(tc_pool);
+    pthread_barrier_wait(&tc_barrier);
+    pthread_join(tids[0], &ret);
+    CHECK(ret == NULL, "holder exits after its pool is gone");
+    pthread_barrier_destroy(&tc_barrier);
+}
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -311,6 +606,9 @@ int main(int argc, char *argv[])
     test_capacity();
     test_parent_child();
     test_churn();
+    test_arena();
+    test_shm();
+    test_tcache();
     test_benchmark();
 
     printf("\nalloc tests: %d passed, %d failed\n", nr_ok, nr_fail);
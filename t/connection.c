@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include "mln_connection.h"
+#include "mln_path.h"
 
 /* Helper function to calculate elapsed time in microseconds */
 static long elapsed_us(struct timespec *start, struct timespec *end)
@@ -805,6 +806,266 @@ static void test_recv_after_nonblock_send(void)
     printf("  PASS: recv after nonblock send\n");
 }
 
+/* Test 17: multi-buffer chain with partial writes on a non-blocking socket */
+static void test_send_multi_buf_partial(void)
+{
+    printf("Testing multi-buffer send with partial writes...\n");
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+
+    mln_tcp_conn_t conn_send;
+    assert(mln_tcp_conn_init(&conn_send, fds[0]) == 0);
+    mln_tcp_conn_set_nonblock(&conn_send, 1);
+
+    mln_alloc_t *pool = mln_tcp_conn_pool_get(&conn_send);
+
+    /* 64 buffers of 4 KB plus empty buffers and buffer-less nodes in between */
+    const int nbufs = 64, bsize = 4096, total = nbufs * bsize;
+    mln_chain_t *head = NULL, *tail = NULL;
+    for (int i = 0; i < nbufs; i++) {
+        mln_u8ptr_t data = (mln_u8ptr_t)mln_alloc_m(pool, bsize);
+        assert(data != NULL);
+        for (int j = 0; j < bsize; j++) data[j] = (mln_u8_t)((i * bsize + j) % 251);
+
+        mln_chain_t *c = mln_chain_new(pool);
+        mln_buf_t *b = mln_buf_new(pool);
+        assert(c != NULL && b != NULL);
+        c->buf = b;
+        b->left_pos = b->pos = b->start = data;
+        b->last = b->end = data + bsize;
+        b->in_memory = 1;
+        b->last_buf = 1;
+        b->last_in_chain = (i == nbufs - 1);
+        mln_chain_add(&head, &tail, c);
+
+        if (i % 8 == 3) {
+            c = mln_chain_new(pool);
+            assert(c != NULL);
+            mln_chain_add(&head, &tail, c);
+        } else if (i % 8 == 5) {
+            c = mln_chain_new(pool);
+            b = mln_buf_new(pool);
+            assert(c != NULL && b != NULL);
+            c->buf = b;
+            b->left_pos = b->pos = b->start = b->last = b->end = data;
+            b->in_memory = 1;
+            mln_chain_add(&head, &tail, c);
+        }
+    }
+
+    mln_u8ptr_t rcv = (mln_u8ptr_t)malloc(total);
+    assert(rcv != NULL);
+    int got = 0, ret = mln_tcp_conn_send_chain(&conn_send, head);
+    while (1) {
+        assert(ret != M_C_ERROR);
+        ssize_t n = read(fds[1], rcv + got, total - got);
+        if (n > 0) got += n;
+        if (ret == M_C_FINISH) {
+            if (got == total) break;
+            continue;
+        }
+        ret = mln_tcp_conn_send(&conn_send);
+    }
+
+    for (int i = 0; i < total; i++) assert(rcv[i] == (mln_u8_t)(i % 251));
+    assert(mln_tcp_conn_send_empty(&conn_send));
+    assert(!mln_tcp_conn_sent_empty(&conn_send));
+
+    free(rcv);
+    mln_tcp_conn_destroy(&conn_send);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("  PASS: multi-buffer partial writes\n");
+}
+
+static char *test_tmpfile_path(void)
+{
+    return "/tmp";
+}
+
+/*
+ * Test 18: memory header + file body + memory trailer in one send chain,
+ * through sendfile and through the copy path it falls back to
+ */
+static void test_send_mixed_file_chain(int no_sendfile)
+{
+    printf("Testing mixed memory/file send chain%s...\n", no_sendfile? " (copy path)": "");
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+    mln_path_hook_set(m_p_tmpfile, test_tmpfile_path);
+
+    mln_tcp_conn_t conn_send;
+    assert(mln_tcp_conn_init(&conn_send, fds[0]) == 0);
+    mln_tcp_conn_set_nonblock(&conn_send, 1);
+
+    mln_alloc_t *pool = mln_tcp_conn_pool_get(&conn_send);
+    const char *hdr = "HEADER|", *trl = "|TRAILER";
+    const int hlen = strlen(hdr), tlen = strlen(trl), flen = 512 * 1024, skip = 100;
+    const int total = hlen + (flen - skip) + tlen;
+    mln_chain_t *head = NULL, *tail = NULL, *c;
+    mln_buf_t *b;
+
+    /* header */
+    c = mln_chain_new(pool);
+    b = mln_buf_new(pool);
+    assert(c != NULL && b != NULL);
+    c->buf = b;
+    b->left_pos = b->pos = b->start = (mln_u8ptr_t)mln_alloc_m(pool, hlen);
+    assert(b->start != NULL);
+    memcpy(b->start, hdr, hlen);
+    b->last = b->end = b->start + hlen;
+    b->in_memory = 1;
+    b->last_buf = 1;
+    mln_chain_add(&head, &tail, c);
+
+    /* file body, starting at an offset inside the file */
+    mln_file_t *f = mln_file_tmp_open(pool);
+    assert(f != NULL);
+    mln_u8ptr_t content = (mln_u8ptr_t)malloc(flen);
+    assert(content != NULL);
+    for (int i = 0; i < flen; i++) content[i] = (mln_u8_t)(i % 253);
+    assert(write(mln_file_fd(f), content, flen) == flen);
+    c = mln_chain_new(pool);
+    b = mln_buf_new(pool);
+    assert(c != NULL && b != NULL);
+    c->buf = b;
+    b->file = f;
+    b->file_left_pos = b->file_pos = skip;
+    b->file_last = flen;
+    b->in_file = 1;
+    b->last_buf = 1;
+    b->no_sendfile = no_sendfile;
+    mln_chain_add(&head, &tail, c);
+
+    /* trailer */
+    c = mln_chain_new(pool);
+    b = mln_buf_new(pool);
+    assert(c != NULL && b != NULL);
+    c->buf = b;
+    b->left_pos = b->pos = b->start = (mln_u8ptr_t)mln_alloc_m(pool, tlen);
+    assert(b->start != NULL);
+    memcpy(b->start, trl, tlen);
+    b->last = b->end = b->start + tlen;
+    b->in_memory = 1;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+    mln_chain_add(&head, &tail, c);
+
+    mln_u8ptr_t rcv = (mln_u8ptr_t)malloc(total);
+    assert(rcv != NULL);
+    int got = 0, ret = mln_tcp_conn_send_chain(&conn_send, head);
+    while (1) {
+        assert(ret != M_C_ERROR);
+        ssize_t n = read(fds[1], rcv + got, total - got);
+        if (n > 0) got += n;
+        if (ret == M_C_FINISH) {
+            if (got == total) break;
+            continue;
+        }
+        ret = mln_tcp_conn_send(&conn_send);
+    }
+
+    assert(memcmp(rcv, hdr, hlen) == 0);
+    assert(memcmp(rcv + hlen, content + skip, flen - skip) == 0);
+    assert(memcmp(rcv + hlen + flen - skip, trl, tlen) == 0);
+    assert(mln_tcp_conn_send_empty(&conn_send));
+
+    free(content);
+    free(rcv);
+    mln_tcp_conn_destroy(&conn_send);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("  PASS: mixed memory/file chain\n");
+}
+
+/* Test 19: adaptive receive buffers and node recycling */
+static void test_recv_adaptive_recycle(void)
+{
+    printf("Testing adaptive receive buffers and recycling...\n");
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    int sz = 1024 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+
+    mln_tcp_conn_t conn_recv;
+    assert(mln_tcp_conn_init(&conn_recv, fds[1]) == 0);
+    mln_tcp_conn_set_nonblock(&conn_recv, 1);
+    assert(conn_recv.rcv_size == M_C_RECV_MIN);
+
+    const int total = 1024 * 1024;
+    mln_u8ptr_t data = (mln_u8ptr_t)malloc(total);
+    assert(data != NULL);
+    for (int i = 0; i < total; i++) data[i] = (mln_u8_t)(i % 241);
+
+    int sent = 0, got = 0, nodes = 0, ret;
+    while (got < total) {
+        if (sent < total) {
+            ssize_t n = write(fds[0], data + sent, total - sent);
+            if (n > 0) sent += n;
+        }
+        ret = mln_tcp_conn_recv(&conn_recv, M_C_TYPE_MEMORY);
+        assert(ret == M_C_NOTYET);
+
+        mln_chain_t *c;
+        while ((c = mln_tcp_conn_head(&conn_recv, M_C_RECV)) != NULL) {
+            mln_buf_t *b = c->buf;
+            int len = (int)mln_buf_left_size(b);
+            assert(len > 0 && got + len <= total);
+            assert((int)(b->end - b->start) >= len);
+            assert(memcmp(b->left_pos, data + got, len) == 0);
+            got += len;
+            ++nodes;
+            mln_tcp_conn_recycle(&conn_recv, mln_tcp_conn_pop(&conn_recv, M_C_RECV));
+        }
+    }
+    assert(conn_recv.rcv_size > M_C_RECV_MIN);
+    assert(conn_recv.free_cnt > 0 && conn_recv.free_cnt <= M_C_RECV_FREE_MAX);
+    assert(nodes < total / M_C_RECV_MIN);
+
+    mln_tcp_conn_destroy(&conn_recv);
+
+    /* a recycled buffer is reused by the next receive */
+    assert(mln_tcp_conn_init(&conn_recv, fds[1]) == 0);
+    mln_tcp_conn_set_nonblock(&conn_recv, 1);
+    assert(write(fds[0], "abc", 3) == 3);
+    assert(mln_tcp_conn_recv(&conn_recv, M_C_TYPE_MEMORY) == M_C_NOTYET);
+    mln_chain_t *c = mln_tcp_conn_pop(&conn_recv, M_C_RECV);
+    assert(c != NULL && mln_buf_left_size(c->buf) == 3);
+    mln_buf_t *recycled = c->buf;
+    mln_u8ptr_t recycled_mem = recycled->start;
+    /* the buffer prepared for the read that hit EAGAIN is already kept */
+    mln_u32_t free_cnt = conn_recv.free_cnt;
+    assert(free_cnt == 1);
+    mln_tcp_conn_recycle(&conn_recv, c);
+    assert(conn_recv.free_cnt == free_cnt + 1);
+
+    assert(write(fds[0], "x", 1) == 1);
+    assert(mln_tcp_conn_recv(&conn_recv, M_C_TYPE_MEMORY) == M_C_NOTYET);
+    c = mln_tcp_conn_head(&conn_recv, M_C_RECV);
+    assert(c != NULL && c->buf == recycled && c->buf->start == recycled_mem);
+    assert(mln_buf_left_size(c->buf) == 1 && *(c->buf->pos) == 'x');
+    assert(conn_recv.free_cnt == free_cnt);
+
+    free(data);
+    mln_tcp_conn_destroy(&conn_recv);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("  PASS: adaptive receive buffers (%d nodes for %d bytes)\n", nodes, total);
+}
+
 int main(void)
 {
     printf("=== Connection Module Comprehensive Tests ===\n\n");
@@ -825,6 +1086,10 @@ int main(void)
     test_recv_error();
     test_send_finish();
     test_recv_after_nonblock_send();
+    test_send_multi_buf_partial();
+    test_send_mixed_file_chain(0);
+    test_send_mixed_file_chain(1);
+    test_recv_adaptive_recycle();
 
     printf("\n=== All connection tests passed! ===\n");
     return 0;
@@ -1,7 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <pthread.h>
 #include "mln_event.h"
 
+static int pair[2];
+static int nrecv = 0;
+static int timed_out = 0;
+
 static void timer_handler(mln_event_t *ev, void *data)
 {
     printf("timer\n");
@@ -15,10 +21,334 @@ static void mln_fd_write(mln_event_t *ev, int fd, void *data)
     mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
 }
 
+static void guard_handler(mln_event_t *ev, void *data)
+{
+    timed_out = 1;
+    mln_event_break_set(ev);
+}
+
+static void mln_fd_read_again(mln_event_t *ev, int fd, void *data)
+{
+    char c;
+    if (read(fd, &c, 1) == 1) ++nrecv;
+    mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    mln_event_break_set(ev);
+}
+
+/*
+ * oneshot re-arm a few times, then clear the fd, close it and register a
+ * new descriptor that usually gets the same number back.
+ */
+static void mln_fd_read(mln_event_t *ev, int fd, void *data)
+{
+    char c;
+    if (read(fd, &c, 1) == 1) ++nrecv;
+    if (nrecv < 3) {
+        write(pair[1], "x", 1);
+        mln_event_fd_set(ev, fd, M_EV_RECV|M_EV_ONESHOT, M_EV_UNLIMITED, NULL, mln_fd_read);
+        return;
+    }
+    mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    close(pair[0]);
+    close(pair[1]);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        mln_event_break_set(ev);
+        return;
+    }
+    mln_event_fd_set(ev, pair[0], M_EV_RECV, M_EV_UNLIMITED, NULL, mln_fd_read_again);
+    write(pair[1], "y", 1);
+}
+
+static int test_rearm(void)
+{
+    mln_event_t *ev;
+
+    if ((ev = mln_event_new()) == NULL) {
+        fprintf(stderr, "event init failed.\n");
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        fprintf(stderr, "socketpair failed.\n");
+        return -1;
+    }
+    if (mln_event_timer_set(ev, 3000, NULL, guard_handler) < 0) {
+        fprintf(stderr, "timer set failed.\n");
+        return -1;
+    }
+    if (mln_event_fd_set(ev, pair[0], M_EV_RECV|M_EV_ONESHOT, M_EV_UNLIMITED, NULL, mln_fd_read) < 0) {
+        fprintf(stderr, "fd handler set failed.\n");
+        return -1;
+    }
+    write(pair[1], "x", 1);
+
+    mln_event_dispatch(ev);
+
+    mln_event_free(ev);
+    close(pair[0]);
+    close(pair[1]);
+
+    if (timed_out || nrecv != 4) {
+        fprintf(stderr, "re-arm test failed, received %d.\n", nrecv);
+        return -1;
+    }
+    return 0;
+}
+
+static void mln_fd_read_high(mln_event_t *ev, int fd, void *data)
+{
+    char c;
+    if (read(fd, &c, 1) == 1) ++(*(int *)data);
+    mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    mln_event_break_set(ev);
+}
+
+/*
+ * descriptors above the initial fd table size, the table has to grow twice.
+ * kept below FD_SETSIZE so that select builds can run it too.
+ */
+static int test_high_fd(void)
+{
+    mln_event_t *ev;
+    int fds[] = {100, 1000};
+    int i, hit;
+
+    if ((ev = mln_event_new()) == NULL) {
+        fprintf(stderr, "event init failed.\n");
+        return -1;
+    }
+    hit = mln_event_fd_set(ev, -1, M_EV_RECV, M_EV_UNLIMITED, NULL, mln_fd_read_high);
+    mln_event_free(ev);
+    if (hit != -1) {
+        fprintf(stderr, "negative fd accepted.\n");
+        return -1;
+    }
+
+    for (i = 0; i < (int)(sizeof(fds) / sizeof(int)); ++i) {
+        if ((ev = mln_event_new()) == NULL) {
+            fprintf(stderr, "event init failed.\n");
+            return -1;
+        }
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0 || dup2(pair[0], fds[i]) < 0) {
+            fprintf(stderr, "socketpair/dup2 failed.\n");
+            return -1;
+        }
+        hit = 0;
+        timed_out = 0;
+        if (mln_event_timer_set(ev, 3000, NULL, guard_handler) < 0) {
+            fprintf(stderr, "timer set failed.\n");
+            return -1;
+        }
+        if (mln_event_fd_set(ev, fds[i], M_EV_RECV, M_EV_UNLIMITED, &hit, mln_fd_read_high) < 0) {
+            fprintf(stderr, "fd handler set failed.\n");
+            return -1;
+        }
+        write(pair[1], "z", 1);
+        mln_event_dispatch(ev);
+        mln_event_free(ev);
+        close(fds[i]);
+        close(pair[0]);
+        close(pair[1]);
+        if (timed_out || hit != 1) {
+            fprintf(stderr, "fd %d not dispatched.\n", fds[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void stop_handler(mln_event_t *ev, void *data)
+{
+    mln_event_break_set(ev);
+}
+
+static void mln_fd_read_cleared(mln_event_t *ev, int fd, void *data)
+{
+    ++(*(int *)data);
+    mln_event_break_set(ev);
+}
+
+/*
+ * clear an fd and close it while a dup keeps the file open. The kernel
+ * registration has to be gone before the descriptor is freed, otherwise
+ * epoll keeps reporting the file with the freed descriptor attached.
+ */
+static int test_dup_clear(void)
+{
+    mln_event_t *ev;
+    int fds[2], copy, hit = 0;
+
+    if ((ev = mln_event_new()) == NULL) {
+        fprintf(stderr, "event init failed.\n");
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 || (copy = dup(fds[0])) < 0) {
+        fprintf(stderr, "socketpair/dup failed.\n");
+        return -1;
+    }
+    if (mln_event_fd_set(ev, fds[0], M_EV_RECV, M_EV_UNLIMITED, &hit, mln_fd_read_cleared) < 0) {
+        fprintf(stderr, "fd handler set failed.\n");
+        return -1;
+    }
+    /*one round so that the registration reaches the kernel*/
+    mln_event_timer_set(ev, 10, NULL, stop_handler);
+    mln_event_dispatch(ev);
+
+    mln_event_break_reset(ev);
+    mln_event_fd_set(ev, fds[0], M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    close(fds[0]);
+    write(fds[1], "z", 1);
+    mln_event_timer_set(ev, 200, NULL, stop_handler);
+    mln_event_dispatch(ev);
+
+    mln_event_free(ev);
+    close(copy);
+    close(fds[1]);
+    if (hit) {
+        fprintf(stderr, "cleared fd still dispatched.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int order[4], norder = 0;
+
+static void wheel_timer_handler(mln_event_t *ev, void *data)
+{
+    if (norder < 4) order[norder++] = (int)(long)data;
+    if ((long)data == 3) mln_event_break_set(ev);
+}
+
+static void wheel_fd_timeout_handler(mln_event_t *ev, int fd, void *data)
+{
+    if (norder < 4) order[norder++] = 2;
+    mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+}
+
+static int test_timer_wheel(void)
+{
+    mln_event_t *ev;
+    mln_event_timer_t *t;
+    struct mln_event_attr attr;
+    struct timeval start, end;
+    long elapsed;
+
+    attr.timer_wheel = 1;
+    attr.single_thread = 0;
+    if ((ev = mln_event_new_with_attr(&attr)) == NULL) {
+        fprintf(stderr, "event init failed.\n");
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        fprintf(stderr, "socketpair failed.\n");
+        return -1;
+    }
+    gettimeofday(&start, NULL);
+    /*400ms lies beyond the root wheel and has to be cascaded down*/
+    if (mln_event_timer_set(ev, 400, (void *)3, wheel_timer_handler) == NULL || \
+        mln_event_timer_set(ev, 10, (void *)1, wheel_timer_handler) == NULL || \
+        (t = mln_event_timer_set(ev, 30, (void *)9, wheel_timer_handler)) == NULL)
+    {
+        fprintf(stderr, "timer set failed.\n");
+        return -1;
+    }
+    mln_event_timer_cancel(ev, t);
+    /*re-armed timeout, only the last one counts*/
+    if (mln_event_fd_set(ev, pair[0], M_EV_RECV, 20, NULL, mln_fd_read) < 0 || \
+        mln_event_fd_set(ev, pair[0], M_EV_RECV, 100, NULL, mln_fd_read) < 0)
+    {
+        fprintf(stderr, "fd handler set failed.\n");
+        return -1;
+    }
+    mln_event_fd_timeout_handler_set(ev, pair[0], NULL, wheel_fd_timeout_handler);
+
+    mln_event_dispatch(ev);
+    gettimeofday(&end, NULL);
+
+    mln_event_free(ev);
+    close(pair[0]);
+    close(pair[1]);
+
+    elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+    if (norder != 3 || order[0] != 1 || order[1] != 2 || order[2] != 3 || elapsed < 400) {
+        fprintf(stderr, "timer wheel test failed, %d fired in %ldms.\n", norder, elapsed);
+        return -1;
+    }
+    return 0;
+}
+
+#define POST_NUM 10000
+static int nposted = 0;
+static pthread_t loop_tid;
+static int wrong_thread = 0;
+
+static void post_handler(mln_event_t *ev, void *data)
+{
+    if (!pthread_equal(pthread_self(), loop_tid)) wrong_thread = 1;
+    if (++nposted == POST_NUM) mln_event_break_set(ev);
+}
+
+static void *post_routine(void *arg)
+{
+    int i;
+    for (i = 0; i < POST_NUM; ++i) {
+        if (mln_event_post((mln_event_t *)arg, post_handler, NULL) < 0)
+            break;
+    }
+    return NULL;
+}
+
+static int test_single_thread_post(void)
+{
+    mln_event_t *ev;
+    pthread_t tid;
+    struct mln_event_attr attr;
+
+    attr.timer_wheel = 0;
+    attr.single_thread = 1;
+    if ((ev = mln_event_new_with_attr(&attr)) == NULL) {
+        fprintf(stderr, "event init failed.\n");
+        return -1;
+    }
+    if (ev->post_rfd >= 0) {
+        fprintf(stderr, "post channel created before the first post.\n");
+        return -1;
+    }
+    timed_out = 0;
+    if (mln_event_timer_set(ev, 5000, NULL, guard_handler) == NULL) {
+        fprintf(stderr, "timer set failed.\n");
+        return -1;
+    }
+    loop_tid = pthread_self();
+    if (pthread_create(&tid, NULL, post_routine, ev) != 0) {
+        fprintf(stderr, "pthread_create failed.\n");
+        return -1;
+    }
+    mln_event_dispatch(ev);
+    pthread_join(tid, NULL);
+    mln_event_free(ev);
+
+    if (timed_out || wrong_thread || nposted != POST_NUM) {
+        fprintf(stderr, "post test failed, %d handled.\n", nposted);
+        return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     mln_event_t *ev;
 
+    if (test_rearm() < 0)
+        return -1;
+    if (test_high_fd() < 0)
+        return -1;
+    if (test_dup_clear() < 0)
+        return -1;
+    if (test_timer_wheel() < 0)
+        return -1;
+    if (test_single_thread_post() < 0)
+        return -1;
+
     ev = mln_event_new();
     if (ev == NULL) {
         fprintf(stderr, "event init failed.\n");
@@ -861,6 +861,702 @@ static void test_e2e_post_with_body(void)
     printf("[PASS] test_e2e_post_with_body\n");
 }
 
+/* Framing tests: decoded body pieces are appended to a capture buffer */
+static char frame_body_buf[4096];
+static int frame_body_len = 0;
+static int frame_body_last = 0;
+
+static int frame_body_handler(mln_http_t *http, mln_chain_t **body_head, mln_chain_t **body_tail)
+{
+    mln_chain_t *c;
+    (void)http;
+    assert(body_tail != NULL && *body_tail != NULL);
+    for (c = *body_head; c != NULL; c = c->next) {
+        int sz = (int)mln_buf_left_size(c->buf);
+        assert(frame_body_len + sz < (int)sizeof(frame_body_buf));
+        if (sz > 0) memcpy(frame_body_buf + frame_body_len, c->buf->left_pos, sz);
+        frame_body_len += sz;
+        if (c->buf->last_in_chain) ++frame_body_last;
+    }
+    return M_HTTP_RET_OK;
+}
+
+static mln_chain_t *frame_chain(mln_alloc_t *pool, char *data, mln_size_t len)
+{
+    mln_chain_t *c;
+    mln_buf_t *b;
+
+    assert((c = mln_chain_new(pool)) != NULL);
+    assert((b = mln_buf_new(pool)) != NULL);
+    c->buf = b;
+    b->start = b->pos = b->left_pos = (mln_u8ptr_t)data;
+    b->last = b->end = (mln_u8ptr_t)data + len;
+    b->temporary = 1;
+    b->in_memory = 1;
+    return c;
+}
+
+static void test_chunked_parse(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c = NULL, *t = NULL, *n;
+    mln_string_t key;
+    char req[] = "POST /upload HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n"
+                 "5;name=x\r\nhello\r\n6\r\n world\r\n00\r\nX-Sum: 1\r\n\r\nNEXT";
+    mln_size_t i, len = sizeof(req) - 1;
+    int ret = M_HTTP_RET_OK;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, frame_body_handler)) != NULL);
+    mln_http_framing_set(http, 1);
+    pool = mln_tcp_conn_pool_get(&conn);
+    frame_body_len = frame_body_last = 0;
+
+    /* feed one byte per buffer so every state boundary is crossed */
+    for (i = 0; i < len; ++i) {
+        n = frame_chain(pool, req + i, 1);
+        if (c == NULL) c = t = n;
+        else { t->next = n; t = n; }
+        if (ret != M_HTTP_RET_DONE) {
+            ret = mln_http_parse(http, &c);
+            assert(ret != M_HTTP_RET_ERROR);
+            if (c == NULL) t = NULL;
+        }
+    }
+    assert(ret == M_HTTP_RET_DONE);
+    assert(mln_http_body_mode_get(http) == M_HTTP_BODY_UNKNOWN);
+    assert(frame_body_len == 11 && !memcmp(frame_body_buf, "hello world", 11));
+    assert(frame_body_last == 1);
+    mln_string_set(&key, "X-Sum");
+    assert(mln_http_field_get(http, &key) == NULL);
+
+    /* the pipelined bytes are untouched */
+    for (i = 0, n = c; n != NULL; n = n->next) i += mln_buf_left_size(n->buf);
+    assert(i == 4 && *(c->buf->left_pos) == 'N');
+    mln_chain_pool_release_all(c);
+
+    /* malformed chunk size */
+    mln_http_reset(http);
+    char bad[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    c = frame_chain(pool, bad, sizeof(bad) - 1);
+    assert(mln_http_parse(http, &c) == M_HTTP_RET_ERROR);
+    assert(mln_http_error_get(http) == M_HTTP_BAD_REQUEST);
+    mln_chain_pool_release_all(c);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_chunked_parse\n");
+}
+
+static void test_pipelining(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c;
+    char reqs[] = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+                  "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+                  "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nde\r\n0\r\n\r\n"
+                  "GET /d HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+                  "GET /e HTTP/1.1\r\nConnection: close\r\n\r\n";
+    const char *uris[] = {"/a", "/b", "/c", "/d", "/e"};
+    const char *bodies[] = {"", "abc", "de", "", ""};
+    int keepalive[] = {1, 1, 1, 1, 0};
+    int i;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, frame_body_handler)) != NULL);
+    mln_http_framing_set(http, 1);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    c = frame_chain(pool, reqs, sizeof(reqs) - 1);
+    for (i = 0; i < 5; ++i) {
+        frame_body_len = frame_body_last = 0;
+        assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+        assert(mln_http_uri_get(http)->len == strlen(uris[i]));
+        assert(!memcmp(mln_http_uri_get(http)->data, uris[i], strlen(uris[i])));
+        assert(frame_body_len == (int)strlen(bodies[i]));
+        assert(!memcmp(frame_body_buf, bodies[i], frame_body_len));
+        assert(mln_http_keepalive(http) == keepalive[i]);
+        mln_http_reset(http);
+        assert(mln_http_framing_get(http));
+    }
+    assert(c == NULL);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_pipelining\n");
+}
+
+static char *chunk_pieces[] = {"first,", "second,", "", "third"};
+
+static int chunk_gen_handler(mln_http_t *http, mln_chain_t **body_head, mln_chain_t **body_tail)
+{
+    long i = (long)mln_http_data_get(http);
+    mln_chain_t *c;
+
+    mln_http_data_set(http, (void *)(i + 1));
+    if (chunk_pieces[i][0]) {
+        c = frame_chain(mln_http_pool_get(http), chunk_pieces[i], strlen(chunk_pieces[i]));
+        mln_chain_add(body_head, body_tail, c);
+    }
+    return i == 3? M_HTTP_RET_DONE: M_HTTP_RET_OK;
+}
+
+static void test_chunked_generate(void)
+{
+    mln_http_t *http, *peer;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *head, *tail, *all = NULL, *last = NULL, *c;
+    mln_string_t key, val;
+    char wire[1024];
+    int ret, len = 0;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, (void *)0L, chunk_gen_handler)) != NULL);
+    mln_http_framing_set(http, 1);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    mln_http_type_set(http, M_HTTP_RESPONSE);
+    mln_http_status_set(http, M_HTTP_OK);
+    mln_http_version_set(http, M_HTTP_VERSION_1_1);
+    mln_string_set(&key, "Transfer-Encoding");
+    mln_string_set(&val, "chunked");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+
+    /* every call returns its output immediately, nothing is held back */
+    do {
+        head = tail = NULL;
+        ret = mln_http_generate(http, &head, &tail);
+        assert(ret != M_HTTP_RET_ERROR);
+        if (head == NULL) continue;
+        if (all == NULL) all = head;
+        else last->next = head;
+        for (last = head; last->next != NULL; last = last->next)
+            ;
+    } while (ret == M_HTTP_RET_OK);
+    assert((long)mln_http_data_get(http) == 4);
+    assert(last->buf->last_in_chain);
+
+    for (c = all; c != NULL; c = c->next) {
+        int sz = (int)mln_buf_left_size(c->buf);
+        memcpy(wire + len, c->buf->left_pos, sz);
+        len += sz;
+    }
+    wire[len] = 0;
+    assert(strstr(wire, "\r\n\r\n6\r\nfirst,\r\n7\r\nsecond,\r\n5\r\nthird\r\n0\r\n\r\n") != NULL);
+
+    /* and it decodes back */
+    assert((peer = mln_http_init(&conn, NULL, frame_body_handler)) != NULL);
+    mln_http_framing_set(peer, 1);
+    frame_body_len = frame_body_last = 0;
+    c = frame_chain(pool, wire, len);
+    assert(mln_http_parse(peer, &c) == M_HTTP_RET_DONE);
+    assert(c == NULL);
+    assert(mln_http_status_get(peer) == M_HTTP_OK);
+    assert(frame_body_len == 18 && !memcmp(frame_body_buf, "first,second,third", 18));
+
+    mln_chain_pool_release_all(all);
+    mln_http_destroy(peer);
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_chunked_generate\n");
+}
+
+static char index_req[] = "GET /search?q=melon HTTP/1.1\r\n"
+                          "Host: example.com\r\n"
+                          "User-Agent: curl/8.0\r\n"
+                          "Accept: text/html\r\n"
+                          "Accept-Encoding: gzip, br\r\n"
+                          "Accept-Language: en\r\n"
+                          "Connection: keep-alive\r\n"
+                          "Cache-Control: no-cache\r\n"
+                          "Cookie: a=1\r\n"
+                          "Referer: http://example.com/\r\n"
+                          "Origin: http://example.com\r\n"
+                          "X-Request-Id: 42\r\n"
+                          "X-Empty:\r\n"
+                          "accept: application/json\r\n"
+                          "If-None-Match: \"abc\"\r\n"
+                          "DNT: 1\r\n"
+                          "\r\n";
+
+static void check_index_fields(mln_http_t *http)
+{
+    mln_string_t key, *v;
+
+    assert(mln_http_uri_get(http)->len == 7 && !memcmp(mln_http_uri_get(http)->data, "/search", 7));
+    assert(mln_http_args_get(http)->len == 7 && !memcmp(mln_http_args_get(http)->data, "q=melon", 7));
+    assert((v = mln_http_known_field_get(http, M_HTTP_H_HOST)) != NULL);
+    assert(v->len == 11 && !memcmp(v->data, "example.com", 11));
+    assert((v = mln_http_known_field_get(http, M_HTTP_H_ACCEPT)) != NULL);
+    assert(v->len == 9 && !memcmp(v->data, "text/html", 9));
+    assert(mln_http_known_field_get(http, M_HTTP_H_CONTENT_LENGTH) == NULL);
+    mln_string_set(&key, "x-request-ID");
+    assert((v = mln_http_field_get(http, &key)) != NULL && v->len == 2 && !memcmp(v->data, "42", 2));
+    mln_string_set(&key, "X-Empty");
+    assert((v = mln_http_field_get(http, &key)) != NULL && v->len == 0);
+    mln_string_set(&key, "X-Missing");
+    assert(mln_http_field_get(http, &key) == NULL);
+    mln_string_set(&key, "Accept");
+    assert((v = mln_http_field_iterator(http, &key)) != NULL);
+    assert(v->len == 26 && !memcmp(v->data, "text/html,application/json", 26));
+    mln_string_free(v);
+    assert(mln_http_keepalive(http) == 1);
+}
+
+static void test_header_index(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c, *t, *n, *head, *tail;
+    mln_string_t key, val, *v;
+    char big[4096];
+    int i, len, ret;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    assert(mln_http_index_enable(http) == 0);
+    assert(mln_http_index_get(http) != NULL);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    /* single buffer: every field is a slice of the request */
+    c = frame_chain(pool, index_req, sizeof(index_req) - 1);
+    assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+    assert(mln_http_index_get(http)->nfield == 15);
+    check_index_fields(http);
+    mln_string_set(&key, "Host");
+    assert(mln_http_field_get(http, &key)->data > (mln_u8ptr_t)index_req);
+
+    /* set and remove act on indexed fields too */
+    mln_string_set(&key, "user-agent");
+    mln_string_set(&val, "melon");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    assert((v = mln_http_known_field_get(http, M_HTTP_H_USER_AGENT)) != NULL);
+    assert(v->len == 5 && !memcmp(v->data, "melon", 5));
+    mln_string_set(&key, "DNT");
+    mln_http_field_remove(http, &key);
+    assert(mln_http_field_get(http, &key) == NULL);
+
+    mln_http_type_set(http, M_HTTP_RESPONSE);
+    head = tail = NULL;
+    assert(mln_http_generate(http, &head, &tail) == M_HTTP_RET_DONE);
+    for (len = 0, n = head; n != NULL; n = n->next) {
+        memcpy(big + len, n->buf->left_pos, mln_buf_left_size(n->buf));
+        len += mln_buf_left_size(n->buf);
+    }
+    big[len] = 0;
+    assert(strstr(big, "\r\nHost: example.com\r\n") != NULL);
+    assert(strstr(big, "\r\nuser-agent: melon\r\n") != NULL);
+    assert(strstr(big, "curl") == NULL && strstr(big, "DNT") == NULL);
+    mln_chain_pool_release_all(head);
+    mln_http_reset(http);
+    mln_chain_pool_release_all(c);
+    assert(mln_http_index_get(http)->nfield == 0);
+
+    /* one byte per buffer: lines are assembled and input nodes are held */
+    c = t = NULL;
+    for (i = 0, ret = M_HTTP_RET_OK; i < (int)sizeof(index_req) - 1; ++i) {
+        n = frame_chain(pool, index_req + i, 1);
+        if (c == NULL) c = t = n;
+        else { t->next = n; t = n; }
+        ret = mln_http_parse(http, &c);
+        assert(ret != M_HTTP_RET_ERROR);
+        if (c == NULL) t = NULL;
+    }
+    assert(ret == M_HTTP_RET_DONE);
+    check_index_fields(http);
+    mln_http_reset(http);
+    mln_chain_pool_release_all(c);
+
+    /* fields beyond the index go to the hash */
+    len = sprintf(big, "GET / HTTP/1.1\r\n");
+    for (i = 0; i < M_HTTP_INDEX_FIELDS + 8; ++i)
+        len += sprintf(big + len, "X-F%d: %d\r\n", i, i);
+    len += sprintf(big + len, "\r\n");
+    c = frame_chain(pool, big, len);
+    assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+    assert(mln_http_index_get(http)->nfield == M_HTTP_INDEX_FIELDS);
+    mln_string_set(&key, "x-f3");
+    assert((v = mln_http_field_get(http, &key)) != NULL && v->len == 1 && v->data[0] == '3');
+    mln_string_set(&key, "X-F39");
+    assert((v = mln_http_field_get(http, &key)) != NULL && v->len == 2 && !memcmp(v->data, "39", 2));
+    mln_http_reset(http);
+    mln_chain_pool_release_all(c);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_header_index\n");
+}
+
+static long header_parse_loop(int use_index, int iterations)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c;
+    struct timespec start, end;
+    int i;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    if (use_index) assert(mln_http_index_enable(http) == 0);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        c = frame_chain(pool, index_req, sizeof(index_req) - 1);
+        assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+        assert(mln_http_known_field_get(http, M_HTTP_H_HOST) != NULL);
+        mln_http_reset(http);
+        mln_chain_pool_release_all(c);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+    return elapsed_us(&start, &end);
+}
+
+static void test_performance_header_index(void)
+{
+    int iterations = 100000;
+    long hashed = header_parse_loop(0, iterations);
+    long indexed = header_parse_loop(1, iterations);
+
+    printf("[PERF] 15-header parse: hash %ld us, index %ld us (%.2fx)\n",
+           hashed, indexed, indexed > 0? (double)hashed / indexed: 0.0);
+}
+
+static char browser_req[] = "GET /static/js/app.bundle.min.js?v=20240101&lang=en-US HTTP/1.1\r\n"
+    "Host: www.example-shop.com\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example-shop.com/products/category/electronics?page=2&sort=price\r\n"
+    "Cookie: session_id=8f14e45fceea167a5a36dedd4bea2543; cart=eyJpdGVtcyI6WzEsMiwzXX0; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "X-Requested-With-Application-Identifier: com.example.shop.web-frontend\r\n"
+    "\r\n";
+
+static void test_tokenizer(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c;
+    mln_string_t key, *v;
+    char req[512];
+    int i, len, name = 100;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    c = frame_chain(pool, browser_req, sizeof(browser_req) - 1);
+    assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+    assert(mln_http_uri_get(http)->len == 28);
+    assert(mln_http_args_get(http)->len == 21);
+    mln_string_set(&key, "X-Requested-With-Application-Identifier");
+    assert((v = mln_http_field_get(http, &key)) != NULL && v->len == 29);
+    mln_chain_pool_release_all(c);
+    mln_http_reset(http);
+
+    /* a bad byte is caught at every offset of a long name or value */
+    for (i = 0; i < 2 * name; ++i) {
+        len = sprintf(req, "GET / HTTP/1.1\r\n%.*s: %.*s\r\n\r\n", name, \
+                      "X-Long-Header-Name-Long-Header-Name-Long-Header-Name-Long-Header-Name-Long-Header-Name-Long-Header-Na", \
+                      name, \
+                      "value value value value value value value value value value value value value value value value value");
+        req[16 + i + (i >= name? 2: 0)] = i < name? '(': '\x01';
+        c = frame_chain(pool, req, len);
+        assert(mln_http_parse(http, &c) == M_HTTP_RET_ERROR);
+        assert(mln_http_error_get(http) == M_HTTP_BAD_REQUEST);
+        mln_chain_pool_release_all(c);
+        mln_http_reset(http);
+    }
+
+    /* a control byte in the request line */
+    len = sprintf(req, "GET /0123456789abcdef0123456789abcdef0123456789\x7f HTTP/1.1\r\n\r\n");
+    c = frame_chain(pool, req, len);
+    assert(mln_http_parse(http, &c) == M_HTTP_RET_ERROR);
+    mln_chain_pool_release_all(c);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_tokenizer\n");
+}
+
+static void test_performance_tokenizer(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *c;
+    struct timespec start, end;
+    long elapsed;
+    int i, iterations = 100000;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    assert(mln_http_index_enable(http) == 0);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        c = frame_chain(pool, browser_req, sizeof(browser_req) - 1);
+        assert(mln_http_parse(http, &c) == M_HTTP_RET_DONE);
+        mln_http_reset(http);
+        mln_chain_pool_release_all(c);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_us(&start, &end);
+
+    printf("[PERF] browser request parse: %d iterations in %ld us (%.2f MB/s)\n",
+           iterations, elapsed, (double)iterations * (sizeof(browser_req) - 1) / elapsed);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+}
+
+static int chain_flatten(mln_chain_t *c, char *buf, int size)
+{
+    int len = 0, sz;
+
+    for (; c != NULL; c = c->next) {
+        if (c->buf == NULL) continue;
+        sz = (int)mln_buf_left_size(c->buf);
+        assert(len + sz < size);
+        if (sz > 0) memcpy(buf + len, c->buf->left_pos, sz);
+        len += sz;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+static void test_zerocopy_generate(void)
+{
+    mln_http_t *http, *peer;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *head = NULL, *tail = NULL, *c;
+    mln_string_t key, val, *stored;
+    char csp[201], wire[2048];
+    int len, ref = 0, owned = 0;
+
+    memset(csp, 'a', sizeof(csp) - 1);
+    csp[sizeof(csp) - 1] = 0;
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    pool = mln_tcp_conn_pool_get(&conn);
+    mln_http_zerocopy_set(http, 1);
+
+    mln_http_type_set(http, M_HTTP_RESPONSE);
+    mln_http_status_set(http, M_HTTP_OK);
+    mln_http_version_set(http, M_HTTP_VERSION_1_1);
+    mln_string_set(&key, "Content-Security-Policy");
+    mln_string_set(&val, csp);
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    mln_string_set(&key, "Server");
+    mln_string_set(&val, "Melon");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    mln_string_set(&key, "Content-Security-Policy");
+    stored = mln_http_field_get(http, &key);
+
+    assert(mln_http_generate(http, &head, &tail) == M_HTTP_RET_DONE);
+    /* the long value is referred to, and the short ones share one buffer */
+    for (c = head; c != NULL; c = c->next) {
+        if (c->buf->left_pos == stored->data) {
+            assert(c->buf->temporary && mln_buf_left_size(c->buf) == 200);
+            ++ref;
+        }
+        if (!c->buf->temporary) ++owned;
+    }
+    assert(ref == 1 && owned == 1);
+    assert(tail->buf->last_in_chain);
+
+    len = chain_flatten(head, wire, sizeof(wire));
+    assert(!strncmp(wire, "HTTP/1.1 200 OK\r\n", 17));
+    assert(!strcmp(wire + len - 4, "\r\n\r\n"));
+    assert((peer = mln_http_init(&conn, NULL, NULL)) != NULL);
+    c = frame_chain(pool, wire, len);
+    assert(mln_http_parse(peer, &c) == M_HTTP_RET_DONE);
+    assert(mln_http_field_get(peer, &key)->len == 200);
+    mln_string_set(&key, "Server");
+    assert(!mln_string_strcmp(mln_http_field_get(peer, &key), &val));
+
+    mln_chain_pool_release_all(c);
+    mln_chain_pool_release_all(head);
+    mln_http_destroy(peer);
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_zerocopy_generate\n");
+}
+
+static void header_cache_response(mln_http_t *http)
+{
+    mln_string_t key, val;
+
+    mln_http_type_set(http, M_HTTP_RESPONSE);
+    mln_http_status_set(http, M_HTTP_OK);
+    mln_http_version_set(http, M_HTTP_VERSION_1_1);
+    mln_string_set(&key, "Server");
+    mln_string_set(&val, "Melon");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    mln_string_set(&key, "Content-Type");
+    mln_string_set(&val, "application/json");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    mln_string_set(&key, "Cache-Control");
+    mln_string_set(&val, "no-store");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+}
+
+static void test_header_cache(void)
+{
+    mln_http_t *http, *peer;
+    mln_tcp_conn_t conn;
+    mln_alloc_t *pool;
+    mln_chain_t *head, *tail, *c;
+    mln_http_header_cache_t *cache;
+    mln_string_t key, val, *v;
+    char wire[1024], cl[16];
+    int i, len;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    pool = mln_tcp_conn_pool_get(&conn);
+
+    header_cache_response(http);
+    assert((cache = mln_http_header_cache_new(http, pool)) != NULL);
+    assert(!cache->chunked);
+    assert(!strncmp((char *)cache->block.data, "HTTP/1.1 200 OK\r\n", 17));
+    assert(!memcmp(cache->block.data + cache->block.len - 2, "\r\n", 2));
+    assert(memcmp(cache->block.data + cache->block.len - 4, "\r\n\r\n", 4));
+    mln_http_reset(http);
+    mln_http_header_cache_set(http, cache);
+
+    for (i = 0; i < 3; ++i) {
+        /* only the per-response fields are set, the rest comes from the cache */
+        mln_http_type_set(http, M_HTTP_RESPONSE);
+        len = snprintf(cl, sizeof(cl), "%d", i * 100);
+        mln_string_set(&key, "Content-Length");
+        mln_string_nset(&val, cl, len);
+        assert(mln_http_field_set(http, &key, &val) == 0);
+
+        head = tail = NULL;
+        assert(mln_http_generate(http, &head, &tail) == M_HTTP_RET_DONE);
+        assert(head->buf->left_pos == cache->block.data && head->buf->temporary);
+        assert(tail->buf->last_in_chain);
+        len = chain_flatten(head, wire, sizeof(wire));
+        mln_chain_pool_release_all(head);
+
+        assert((peer = mln_http_init(&conn, NULL, NULL)) != NULL);
+        c = frame_chain(pool, wire, len);
+        assert(mln_http_parse(peer, &c) == M_HTTP_RET_DONE);
+        assert(mln_http_status_get(peer) == M_HTTP_OK);
+        assert(!mln_string_strcmp(mln_http_field_get(peer, &key), &val));
+        mln_string_set(&key, "Content-Type");
+        assert((v = mln_http_field_get(peer, &key)) != NULL && v->len == 16);
+        mln_string_set(&key, "Cache-Control");
+        assert(mln_http_field_get(peer, &key) != NULL);
+        mln_chain_pool_release_all(c);
+        mln_http_destroy(peer);
+
+        mln_http_reset(http);
+        assert(mln_http_header_cache_get(http) == cache);
+    }
+    mln_http_header_cache_free(cache);
+
+    /* a chunked cache keeps chunked framing on */
+    mln_http_header_cache_set(http, NULL);
+    header_cache_response(http);
+    mln_string_set(&key, "Transfer-Encoding");
+    mln_string_set(&val, "chunked");
+    assert(mln_http_field_set(http, &key, &val) == 0);
+    assert((cache = mln_http_header_cache_new(http, pool)) != NULL);
+    assert(cache->chunked);
+    mln_http_reset(http);
+    mln_http_header_cache_set(http, cache);
+    mln_http_framing_set(http, 1);
+    mln_http_type_set(http, M_HTTP_RESPONSE);
+    head = tail = NULL;
+    assert(mln_http_generate(http, &head, &tail) == M_HTTP_RET_DONE);
+    len = chain_flatten(head, wire, sizeof(wire));
+    assert(!strcmp(wire + len - 9, "\r\n\r\n0\r\n\r\n"));
+    mln_chain_pool_release_all(head);
+    mln_http_header_cache_free(cache);
+
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_header_cache\n");
+}
+
+static long generate_loop(mln_http_t *http, int iterations)
+{
+    struct timespec start, end;
+    mln_chain_t *head, *tail;
+    mln_string_t key, val;
+    int i;
+
+    mln_string_set(&key, "Content-Length");
+    mln_string_set(&val, "128");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        if (mln_http_header_cache_get(http) == NULL)
+            header_cache_response(http);
+        mln_http_type_set(http, M_HTTP_RESPONSE);
+        assert(mln_http_field_set(http, &key, &val) == 0);
+        head = tail = NULL;
+        assert(mln_http_generate(http, &head, &tail) == M_HTTP_RET_DONE);
+        mln_chain_pool_release_all(head);
+        mln_http_reset(http);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return elapsed_us(&start, &end);
+}
+
+static void test_performance_header_cache(void)
+{
+    mln_http_t *http;
+    mln_tcp_conn_t conn;
+    mln_http_header_cache_t *cache;
+    long plain, cached;
+    int iterations = 100000;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+
+    plain = generate_loop(http, iterations);
+    header_cache_response(http);
+    assert((cache = mln_http_header_cache_new(http, mln_tcp_conn_pool_get(&conn))) != NULL);
+    mln_http_reset(http);
+    mln_http_header_cache_set(http, cache);
+    cached = generate_loop(http, iterations);
+
+    printf("[PERF] response generate: %d iterations, %ld us plain, %ld us with header cache\n",
+           iterations, plain, cached);
+
+    mln_http_header_cache_free(cache);
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+}
+
 int main(void)
 {
     printf("===== HTTP Module Tests =====\n\n");
@@ -888,8 +1584,24 @@ int main(void)
     printf("\n=== Reset and Reuse ===\n");
     test_reset();
 
+    printf("\n=== Framing and Pipelining ===\n");
+    test_chunked_parse();
+    test_pipelining();
+    test_chunked_generate();
+
+    printf("\n=== Zero-copy Generation ===\n");
+    test_zerocopy_generate();
+    test_header_cache();
+
+    printf("\n=== Header Index ===\n");
+    test_header_index();
+    test_tokenizer();
+
     printf("\n=== Performance ===\n");
     test_performance_parse_generate();
+    test_performance_header_index();
+    test_performance_tokenizer();
+    test_performance_header_cache();
 
     printf("\n=== Stability ===\n");
     test_stability_parse_multiple();
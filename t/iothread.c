@@ -2,6 +2,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+
+#define RING_N 200000
+#define CALL_N 20000
 
 static void msg_handler(mln_iothread_t *t, mln_iothread_ep_type_t from, mln_iothread_msg_t *msg)
 {
@@ -21,6 +27,142 @@ static void *entry(void *args)
     return NULL;
 }
 
+static long ring_io_sum = 0, ring_user_n = 0, ring_user_sum = 0, ring_wakeups = 0;
+
+static void ring_handler(mln_iothread_t *t, mln_iothread_ep_type_t from, mln_iothread_msg_t *msg)
+{
+    if (from == user_thread && mln_iothread_msg_type(msg) == 1) {
+        /*io thread: answer a call*/
+        mln_iothread_msg_reply_set(msg, (void *)((long)mln_iothread_msg_data(msg) * 2));
+    } else if (from == user_thread) {
+        /*io thread: sum up and echo the message back*/
+        ring_io_sum += (long)mln_iothread_msg_data(msg);
+        while (mln_iothread_send(t, mln_iothread_msg_type(msg), mln_iothread_msg_data(msg), user_thread, 0) == 1)
+            sched_yield();
+    } else {
+        ++ring_user_n;
+        ring_user_sum += (long)mln_iothread_msg_data(msg);
+    }
+}
+
+static void *ring_entry(void *args)
+{
+    mln_iothread_t *t = (mln_iothread_t *)args;
+    struct pollfd pfd;
+
+    pfd.fd = mln_iothread_sockfd_get(t, io_thread);
+    pfd.events = POLLIN;
+    while (1) {
+        if (poll(&pfd, 1, -1) > 0) {
+            ++ring_wakeups;
+            mln_iothread_recv(t, user_thread);
+        }
+    }
+
+    return NULL;
+}
+
+static int ring_test(void)
+{
+    long i, expect = 0;
+    int rc;
+    mln_iothread_t t;
+    struct mln_iothread_attr attr;
+
+    attr.nthread = 1;
+    attr.entry = (mln_iothread_entry_t)ring_entry;
+    attr.args = &t;
+    attr.handler = (mln_iothread_msg_process_t)ring_handler;
+    attr.ring_size = 1000; /*rounded up to 1024*/
+    if (mln_iothread_init_with_attr(&t, &attr) < 0) {
+        fprintf(stderr, "ring iothread init failed\n");
+        return -1;
+    }
+    for (i = 1; i <= RING_N; ++i) {
+        while ((rc = mln_iothread_send(&t, 0, (void *)i, io_thread, 0)) == 1)
+            mln_iothread_recv(&t, io_thread);
+        if (rc < 0) {
+            fprintf(stderr, "ring send failed\n");
+            return -1;
+        }
+        expect += i;
+    }
+    while (ring_user_n < RING_N)
+        mln_iothread_recv(&t, io_thread);
+    mln_iothread_destroy(&t);
+    printf("ring: %ld echoed, %ld io wakeups\n", ring_user_n, ring_wakeups);
+    if (ring_user_n != RING_N || ring_io_sum != expect || ring_user_sum != expect) {
+        fprintf(stderr, "ring mismatch\n");
+        return -1;
+    }
+    return 0;
+}
+
+static long call_async_n = 0, call_async_sum = 0;
+
+static void call_reply(mln_iothread_t *t, mln_u32_t type, void *data, void *reply, void *udata)
+{
+    if ((long)reply != (long)data * 2)
+        fprintf(stderr, "async reply mismatch\n");
+    ++call_async_n;
+    call_async_sum += (long)reply;
+    if (call_async_n == CALL_N)
+        mln_event_break_set((mln_event_t *)udata);
+}
+
+static int call_test(void)
+{
+    long i, expect = 0, sum = 0;
+    void *reply;
+    int rc;
+    mln_iothread_t t;
+    mln_event_t *ev;
+    struct mln_iothread_attr attr;
+    struct timespec ts, te;
+
+    attr.nthread = 1;
+    attr.entry = (mln_iothread_entry_t)ring_entry;
+    attr.args = &t;
+    attr.handler = (mln_iothread_msg_process_t)ring_handler;
+    attr.ring_size = 256;
+    if ((ev = mln_event_new()) == NULL || mln_iothread_init_with_attr(&t, &attr) < 0) {
+        fprintf(stderr, "call iothread init failed\n");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (i = 1; i <= CALL_N; ++i) {
+        while ((rc = mln_iothread_call(&t, 1, (void *)i, io_thread, &reply)) == 1)
+            sched_yield();
+        if (rc < 0 || (long)reply != i * 2) {
+            fprintf(stderr, "call failed\n");
+            return -1;
+        }
+        expect += i * 2;
+        sum += (long)reply;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &te);
+    printf("call: %ld round trips, %.2f us each\n", (long)CALL_N, \
+           ((te.tv_sec - ts.tv_sec) * 1e6 + (te.tv_nsec - ts.tv_nsec) / 1e3) / CALL_N);
+
+    for (i = 1; i <= CALL_N; ++i) {
+        while ((rc = mln_iothread_call_async(&t, 1, (void *)i, io_thread, ev, call_reply, ev)) == 1)
+            sched_yield();
+        if (rc < 0) {
+            fprintf(stderr, "async call failed\n");
+            return -1;
+        }
+    }
+    mln_event_dispatch(ev);
+    mln_iothread_destroy(&t);
+    mln_event_free(ev);
+    if (sum != expect || call_async_n != CALL_N || call_async_sum != expect) {
+        fprintf(stderr, "call mismatch\n");
+        return -1;
+    }
+    return 0;
+}
+
 int main(void)
 {
     int i, rc;
@@ -40,7 +182,11 @@ int main(void)
     sleep(1);
     mln_iothread_destroy(&t);
     sleep(3);
+
+    if (ring_test() < 0 || call_test() < 0)
+        return -1;
     printf("DONE\n");
 
     return 0;
 }
+
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include "mln_string.h"
 
 /* Avoid conflict with mln_utils.h ASSERT */
@@ -200,8 +201,7 @@ static void test_decode_encode(void)
         mln_string_t k2 = mln_string("empty_arr");
         mln_json_t *ea = mln_json_obj_search(&j, &k2);
         ASSERT(ea && mln_json_is_array(ea), "empty_arr is array");
-        /* Note: empty array "[]" still produces 1 NONE-typed element internally */
-        ASSERT(mln_json_array_length(ea) >= 0, "empty_arr length >= 0");
+        ASSERT(mln_json_array_length(ea) == 0, "empty_arr length == 0");
 
         mln_string_t *enc = mln_json_encode(&j, 0);
         ASSERT(enc != NULL, "encode empty structures");
@@ -994,6 +994,636 @@ static void test_unicode_escape_encode(void)
     }
 }
 
+/* ===========================================================
+ *  Two-pass decode: index across 64-byte blocks, UTF-8, strictness
+ * =========================================================== */
+static int decode_text(const char *text, size_t len, mln_json_t *out)
+{
+    mln_string_t s;
+    mln_string_nset(&s, (char *)text, len);
+    return mln_json_decode(&s, out, NULL);
+}
+
+static void test_decode_index(void)
+{
+    char buf[256], expect[256];
+    mln_json_t j, *v;
+    int pad, k, ok, n;
+
+    /* runs of backslashes before a quote, moved across a block boundary */
+    ok = 1;
+    for (pad = 40; pad < 140 && ok; ++pad) {
+        for (k = 0; k <= 5 && ok; ++k) {
+            n = sprintf(buf, "[\"%*s", pad, "");
+            memset(buf + n, '\\', 2 * k);
+            n += 2 * k;
+            /* an escaped quote inside, then the closing one */
+            n += sprintf(buf + n, "\\\"x\",1]");
+            memset(expect, ' ', pad);
+            memset(expect + pad, '\\', k);
+            memcpy(expect + pad + k, "\"x", 2);
+            if (decode_text(buf, n, &j) < 0) { ok = 0; break; }
+            v = mln_json_array_search(&j, 0);
+            ok = v != NULL && mln_json_is_string(v) && mln_json_array_length(&j) == 2 && \
+                 mln_json_string_data_get(v)->len == (mln_size_t)(pad + k + 2) && \
+                 !memcmp(mln_json_string_data_get(v)->data, expect, pad + k + 2);
+            mln_json_destroy(&j);
+        }
+    }
+    ASSERT(ok, "decode: escaped quotes at every block offset");
+
+    /* multi-byte UTF-8 across block boundaries, valid and not */
+    {
+        const char *good[] = {"\xc3\xa9", "\xe4\xb8\xad", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", NULL};
+        const char *bad[] = {"\xc0\x80", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe4\xb8", "\x80", "\xff", NULL};
+        const char **p;
+        for (ok = 1, pad = 20; pad < 140; ++pad) {
+            for (p = good; *p != NULL; ++p) {
+                n = sprintf(buf, "{\"k\":\"%*s%s\"}", pad, "", *p);
+                if (decode_text(buf, n, &j) < 0) ok = 0;
+                else mln_json_destroy(&j);
+            }
+            for (p = bad; *p != NULL; ++p) {
+                n = sprintf(buf, "{\"k\":\"%*s%s\"}", pad, "", *p);
+                if (decode_text(buf, n, &j) == 0) { ok = 0; mln_json_destroy(&j); }
+            }
+        }
+        ASSERT(ok, "decode: UTF-8 checked across blocks");
+        ASSERT(decode_text("[\"\xe4\xb8", 4, &j) < 0, "decode: truncated sequence at the end");
+    }
+
+    /* strict structure, the same as the stream decoder */
+    {
+        const char *bad[] = {
+            "[1,]", "{\"a\":1,}", "[1 2]", "{\"a\" 1}", "{\"a\":1]", "[1}", "]", "1", "\"a\"",
+            "[1.]", "[1e]", "[01]", "[-]", "[+1]", "[tru]", "[truex]", "[\"a\\\"]", "{1:2}",
+            "[1] x", "[1][2]", "{,}", "[,1]", "[\"a\"\"b\"]", "[1\"a\"]", "[\\\"]", "  ", "[\"abc",
+            "[\"\\u00zz\"]", "[\"\\utd83\"]", "[\"\\u12\"]", "[\"\\udc00\"]", "[\"\\ud800x\"]", NULL
+        };
+        const char **p;
+        for (ok = 1, p = bad; *p != NULL; ++p) {
+            if (decode_text(*p, strlen(*p), &j) == 0) {
+                fprintf(stderr, "  accepted: %s\n", *p);
+                mln_json_destroy(&j);
+                ok = 0;
+            }
+        }
+        ASSERT(ok, "decode: malformed input rejected");
+    }
+    ASSERT(decode_text(" [ ]\n", 5, &j) == 0 && mln_json_array_length(&j) == 0, "decode: blank empty array");
+    mln_json_destroy(&j);
+    ASSERT(decode_text("[TRUE,Null,-0,0.5e-3,1E+2]", 26, &j) == 0 && mln_json_array_length(&j) == 5, "decode: literals and numbers");
+    v = mln_json_array_search(&j, 4);
+    ASSERT(v != NULL && mln_json_number_data_get(v) == 100, "decode: exponent");
+    mln_json_destroy(&j);
+
+    /* a large document */
+    {
+        mln_string_t *big;
+        clock_t start;
+        double t;
+        int rc;
+
+        mln_json_init(&j);
+        mln_json_generate(&j, "[]");
+        for (k = 0; k < 50000; ++k)
+            mln_json_generate(&j, "[{s:d,s:s,s:[d,t,n]}]", "id", k, "name", "two pass \xe4\xb8\xad json", "list", k, -k);
+        big = mln_json_encode(&j, 0);
+        mln_json_destroy(&j);
+        start = clock();
+        rc = mln_json_decode(big, &j, NULL);
+        t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        ASSERT(rc == 0 && mln_json_array_length(&j) == 50000, "decode: large document");
+        v = mln_json_array_search(&j, 49999);
+        ASSERT(v != NULL && mln_json_is_object(v), "decode: last record");
+        if (rc == 0) mln_json_destroy(&j);
+        fprintf(stderr, "  [PERF] decode %lu bytes: %.3fs\n", (unsigned long)big->len, t);
+        mln_string_free(big);
+    }
+}
+
+/* ===========================================================
+ *  Stream decode
+ * =========================================================== */
+static int stream_equal(mln_json_t *j, const char *text)
+{
+    mln_string_t s, *a, *b;
+    mln_json_t ref;
+    int rc;
+
+    mln_string_nset(&s, (char *)text, strlen(text));
+    if (mln_json_decode(&s, &ref, NULL) < 0) return 0;
+    a = mln_json_encode(j, 0);
+    b = mln_json_encode(&ref, 0);
+    rc = a != NULL && b != NULL && !mln_string_strcmp(a, b);
+    if (a != NULL) mln_string_free(a);
+    if (b != NULL) mln_string_free(b);
+    mln_json_destroy(&ref);
+    return rc;
+}
+
+/* feed 'text' in pieces of 'step' bytes, or split once at -step */
+static int stream_decode(const char *text, int step, mln_json_policy_t *policy, mln_json_t *out)
+{
+    mln_size_t len = strlen(text), off = 0, n;
+    mln_json_stream_t *s;
+    int rc = M_JSON_STREAM_NOTYET;
+
+    if ((s = mln_json_stream_new(policy, NULL, NULL)) == NULL) return -1;
+    while (off < len) {
+        if (step < 0) n = off? len - off: (mln_size_t)-step;
+        else n = len - off < (mln_size_t)step? len - off: (mln_size_t)step;
+        if ((rc = mln_json_stream_feed(s, (mln_u8ptr_t)text + off, n)) == M_JSON_STREAM_ERROR) break;
+        off += n;
+    }
+    if (rc == M_JSON_STREAM_DONE) rc = mln_json_stream_result(s, out);
+    else rc = -1;
+    mln_json_stream_free(s);
+    return rc;
+}
+
+typedef struct {
+    int events[6];
+    int max_depth;
+    double sum;
+} stream_counter_t;
+
+static int stream_handler(int event, mln_json_t *val, mln_size_t depth, void *data)
+{
+    stream_counter_t *c = (stream_counter_t *)data;
+    ++(c->events[event]);
+    if ((int)depth > c->max_depth) c->max_depth = (int)depth;
+    if (event == M_JSON_EVENT_VALUE && mln_json_is_number(val))
+        c->sum += mln_json_number_data_get(val);
+    return 0;
+}
+
+static void test_stream(void)
+{
+    const char *doc = "{\"name\":\"mel\\\"on\\\\\",\"list\":[1,-2.5e1,true,FALSE,null,\"\\u4e2d\\ud83d\\ude00\"],"
+                      "\"nested\":{\"a\":[[],{}],\"b\":{\"c\":[0.125,\"x\\\\\\\\\"]}},\"empty\":\"\"}";
+    mln_size_t len = strlen(doc);
+    int i, ok;
+    mln_json_t j;
+
+    /* every single split point */
+    ok = 1;
+    for (i = 1; i < (int)len; ++i) {
+        if (stream_decode(doc, -i, NULL, &j) < 0) { ok = 0; break; }
+        if (!stream_equal(&j, doc)) ok = 0;
+        mln_json_destroy(&j);
+        if (!ok) break;
+    }
+    ASSERT(ok, "stream: every split point matches decode");
+
+    /* one byte at a time */
+    ASSERT(stream_decode(doc, 1, NULL, &j) == 0, "stream: byte by byte");
+    ASSERT(stream_equal(&j, doc), "stream: byte by byte matches decode");
+    mln_json_destroy(&j);
+
+    /* whitespace and an empty root */
+    ASSERT(stream_decode(" \r\n[ ]\t", 1, NULL, &j) == 0, "stream: empty array root");
+    ASSERT(mln_json_is_array(&j) && mln_json_array_length(&j) == 0, "stream: empty array has no element");
+    mln_json_destroy(&j);
+    ASSERT(stream_decode("{ }", 1, NULL, &j) == 0, "stream: empty object root");
+    mln_json_destroy(&j);
+
+    /* structure is checked strictly */
+    {
+        const char *bad[] = {
+            "[1,]", "{\"a\":1,}", "[1 2]", "{\"a\" 1}", "{\"a\":1]", "[1}", "]", "1", "\"a\"",
+            "[1.]", "[1e]", "[01]", "[-]", "[+1]", "[tru]", "[truex]", "[\"a\\\"]", "{1:2}",
+            "[1] x", "[1][2]", "{,}", "[,1]",
+            "[\"\\u00zz\"]", "[\"\\utd83\"]", "[\"\\udc00\"]", "[\"\\ud800\\u0041\"]", NULL
+        };
+        const char **p;
+        for (ok = 1, p = bad; *p != NULL; ++p) {
+            for (i = 1; i <= 2; ++i) {
+                if (stream_decode(*p, i, NULL, &j) == 0) {
+                    fprintf(stderr, "  accepted: %s\n", *p);
+                    mln_json_destroy(&j);
+                    ok = 0;
+                }
+            }
+        }
+        ASSERT(ok, "stream: malformed input rejected");
+    }
+
+    /* invalid UTF-8 in strings, whole and cut at every fragment boundary */
+    {
+        const char *bad[] = {
+            "[\"\xff\"]", "{\"k\":\"\xff\"}", "{\"\xff\":1}", "[\"a\xc0\x80\"]", "[\"\xed\xa0\x80\"]",
+            "[\"\xf4\x90\x80\x80\"]", "[\"\xe4\xb8\"]", "[\"\x80\"]", "[\"\xe4\xb8\\n\"]", NULL
+        };
+        const char *good = "{\"\xc3\xa9\":[\"\xe4\xb8\xad\",\"x\xf0\x9f\x98\x80\\n\xf4\x8f\xbf\xbf\"]}";
+        const char **p;
+        for (ok = 1, p = bad; *p != NULL; ++p) {
+            for (i = 1; i <= (int)strlen(*p); ++i) {
+                if (stream_decode(*p, -i, NULL, &j) == 0) {
+                    fprintf(stderr, "  accepted: split %d of %s\n", i, *p);
+                    mln_json_destroy(&j);
+                    ok = 0;
+                }
+            }
+            if (stream_decode(*p, 1, NULL, &j) == 0) { mln_json_destroy(&j); ok = 0; }
+        }
+        ASSERT(ok, "stream: invalid UTF-8 rejected");
+        for (ok = 1, i = 1; i <= (int)strlen(good); ++i) {
+            if (stream_decode(good, -i, NULL, &j) < 0) { ok = 0; break; }
+            if (!stream_equal(&j, good)) ok = 0;
+            mln_json_destroy(&j);
+        }
+        ASSERT(ok, "stream: valid UTF-8 at every split point");
+    }
+
+    /* the document is not complete yet */
+    {
+        mln_json_stream_t *s = mln_json_stream_new(NULL, NULL, NULL);
+        ASSERT(mln_json_stream_feed(s, (mln_u8ptr_t)"{\"a\":[1", 7) == M_JSON_STREAM_NOTYET, "stream: partial is NOTYET");
+        ASSERT(mln_json_stream_result(s, &j) < 0, "stream: no result before DONE");
+        ASSERT(mln_json_stream_feed(s, (mln_u8ptr_t)"]}", 2) == M_JSON_STREAM_DONE, "stream: DONE");
+        ASSERT(mln_json_stream_feed(s, (mln_u8ptr_t)" \n", 2) == M_JSON_STREAM_DONE, "stream: trailing blank");
+        ASSERT(mln_json_stream_result(s, &j) == 0, "stream: result");
+        mln_json_destroy(&j);
+        ASSERT(mln_json_stream_feed(s, (mln_u8ptr_t)",", 1) == M_JSON_STREAM_ERROR, "stream: trailing garbage");
+        ASSERT(mln_json_stream_feed(s, (mln_u8ptr_t)" ", 1) == M_JSON_STREAM_ERROR, "stream: error is sticky");
+        mln_json_stream_free(s);
+    }
+
+    /* policy */
+    {
+        mln_json_policy_t policy;
+
+        mln_json_policy_init(policy, 2, 0, 0, 0, 0);
+        ASSERT(stream_decode("{\"a\":{\"b\":[1]}}", 3, &policy, &j) < 0, "stream: depth rejected");
+        ASSERT(mln_json_policy_error(policy) == M_JSON_DEPTH, "stream: DEPTH");
+
+        mln_json_policy_init(policy, 0, 3, 0, 0, 0);
+        ASSERT(stream_decode("{\"abc\":1}", 2, &policy, &j) == 0, "stream: keylen at limit");
+        mln_json_destroy(&j);
+        ASSERT(stream_decode("{\"a\\u0062cd\":1}", 2, &policy, &j) < 0, "stream: keylen rejected");
+        ASSERT(mln_json_policy_error(policy) == M_JSON_KEYLEN, "stream: KEYLEN");
+
+        mln_json_policy_init(policy, 0, 0, 4, 0, 0);
+        ASSERT(stream_decode("[\"\\u0041\\u0042\\u0043\\u0044\"]", 1, &policy, &j) == 0, "stream: escaped strlen at limit");
+        mln_json_destroy(&j);
+        ASSERT(stream_decode("[\"0123456789012345678901234567890\"]", 4, &policy, &j) < 0, "stream: strlen rejected");
+        ASSERT(mln_json_policy_error(policy) == M_JSON_STRLEN, "stream: STRLEN");
+
+        mln_json_policy_init(policy, 0, 0, 0, 2, 0);
+        ASSERT(stream_decode("[1,[],3]", 1, &policy, &j) < 0, "stream: arrelem rejected");
+        ASSERT(mln_json_policy_error(policy) == M_JSON_ARRELEM, "stream: ARRELEM");
+
+        mln_json_policy_init(policy, 0, 0, 0, 0, 1);
+        ASSERT(stream_decode("{\"a\":1,\"b\":{}}", 1, &policy, &j) < 0, "stream: objkv rejected");
+        ASSERT(mln_json_policy_error(policy) == M_JSON_OBJKV, "stream: OBJKV");
+    }
+
+    /* events */
+    {
+        stream_counter_t c;
+        mln_json_stream_t *s;
+
+        memset(&c, 0, sizeof(c));
+        s = mln_json_stream_new(NULL, stream_handler, &c);
+        for (i = 0; i < (int)len; i += 5)
+            if (mln_json_stream_feed(s, (mln_u8ptr_t)doc + i, len - i < 5? len - i: 5) == M_JSON_STREAM_ERROR) break;
+        ASSERT(i >= (int)len, "stream: events fed");
+        ASSERT(c.events[M_JSON_EVENT_OBJECT_BEGIN] == 4 && c.events[M_JSON_EVENT_OBJECT_END] == 4, "stream: object events");
+        ASSERT(c.events[M_JSON_EVENT_ARRAY_BEGIN] == 4 && c.events[M_JSON_EVENT_ARRAY_END] == 4, "stream: array events");
+        ASSERT(c.events[M_JSON_EVENT_KEY] == 7, "stream: key events");
+        ASSERT(c.events[M_JSON_EVENT_VALUE] == 10, "stream: value events");
+        ASSERT(c.max_depth == 4, "stream: depth");
+        ASSERT(c.sum == 1 - 25 + 0.125, "stream: number values");
+        ASSERT(mln_json_stream_result(s, &j) < 0, "stream: no DOM with a handler");
+        mln_json_stream_free(s);
+    }
+
+    /* chain fed straight from a buffer list */
+    {
+        mln_alloc_t *pool = mln_alloc_init(NULL, 0);
+        mln_chain_t *head = NULL, *tail = NULL, *c;
+        mln_json_stream_t *s = mln_json_stream_new(NULL, NULL, NULL);
+        int rc = M_JSON_STREAM_ERROR;
+
+        for (i = 0; i < (int)len; i += 7) {
+            c = mln_chain_new_with_buf(pool);
+            c->buf->left_pos = c->buf->pos = c->buf->start = (mln_u8ptr_t)doc + i;
+            c->buf->last = c->buf->end = (mln_u8ptr_t)doc + (len - i < 7? len: i + 7);
+            c->buf->in_memory = 1;
+            c->buf->temporary = 1;
+            mln_chain_add(&head, &tail, c);
+        }
+        rc = mln_json_stream_feed_chain(s, head);
+        ASSERT(rc == M_JSON_STREAM_DONE, "stream: chain DONE");
+        ASSERT(mln_buf_left_size(tail->buf) == 0, "stream: chain consumed");
+        ASSERT(mln_json_stream_result(s, &j) == 0 && stream_equal(&j, doc), "stream: chain result");
+        mln_json_destroy(&j);
+        mln_json_stream_free(s);
+        mln_chain_pool_release_all(head);
+        mln_alloc_destroy(pool);
+    }
+
+    /* a large document arriving in 4KB pieces */
+    {
+        mln_string_t *big;
+        stream_counter_t c;
+        mln_json_stream_t *s;
+        clock_t start;
+        double dom_t, sax_t;
+        mln_size_t peak;
+        int rc = M_JSON_STREAM_ERROR;
+
+        mln_json_init(&j);
+        ASSERT(mln_json_generate(&j, "[]") == 0, "stream: build large doc");
+        for (i = 0; i < 100000; ++i)
+            mln_json_generate(&j, "[{s:d,s:s,s:[d,d]}]", "id", i, "name", "streaming json", "pair", i, -i);
+        big = mln_json_encode(&j, 0);
+        mln_json_destroy(&j);
+        ASSERT(big != NULL, "stream: encode large doc");
+
+        start = clock();
+        memset(&c, 0, sizeof(c));
+        s = mln_json_stream_new(NULL, stream_handler, &c);
+        for (i = 0; i < (int)big->len; i += 4096)
+            rc = mln_json_stream_feed(s, big->data + i, big->len - i < 4096? big->len - i: 4096);
+        sax_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        peak = s->buf_cap + s->stack_cap * sizeof(mln_json_stream_frame_t);
+        ASSERT(rc == M_JSON_STREAM_DONE && c.events[M_JSON_EVENT_OBJECT_BEGIN] == 100000, "stream: large doc events");
+        mln_json_stream_free(s);
+
+        start = clock();
+        ASSERT(stream_decode((char *)big->data, 4096, NULL, &j) == 0, "stream: large doc DOM");
+        dom_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        mln_json_destroy(&j);
+
+        fprintf(stderr, "  [PERF] stream %lu bytes in 4KB pieces: events %.3fs (%lu bytes of state), DOM %.3fs\n",
+                (unsigned long)big->len, sax_t, (unsigned long)peak, dom_t);
+        mln_string_free(big);
+    }
+}
+
+/* ===========================================================
+ *  Numbers
+ * =========================================================== */
+static int num_text(const char *text, mln_json_t *out)
+{
+    mln_json_t j, *v;
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "[%s]", text);
+    if (decode_text(buf, n, &j) < 0) return -1;
+    v = mln_json_array_search(&j, 0);
+    *out = *v;
+    mln_json_destroy(&j);
+    return 0;
+}
+
+static int num_bits(const char *text, mln_u64_t bits)
+{
+    mln_json_t v;
+    double d;
+    mln_u64_t b;
+    if (num_text(text, &v) < 0 || !mln_json_is_number(&v) || mln_json_is_int(&v) || mln_json_is_uint(&v)) return 0;
+    d = mln_json_number_data_get(&v);
+    memcpy(&b, &d, sizeof(b));
+    return b == bits;
+}
+
+static int num_encode(double d, const char *expect)
+{
+    mln_json_t j;
+    mln_string_t *s;
+    char buf[64];
+    int rc;
+    mln_json_init(&j);
+    mln_json_generate(&j, "[F]", d);
+    s = mln_json_encode(&j, 0);
+    mln_json_destroy(&j);
+    snprintf(buf, sizeof(buf), "[%s]", expect);
+    rc = s != NULL && s->len == strlen(buf) && !memcmp(s->data, buf, s->len);
+    if (!rc && s != NULL) fprintf(stderr, "  encode %.17g: %.*s\n", d, (int)s->len, (char *)s->data);
+    if (s != NULL) mln_string_free(s);
+    return rc;
+}
+
+static void test_numbers(void)
+{
+    const char *ints = "[9007199254740993,-9223372036854775808,9223372036854775807,18446744073709551615,-0,0]";
+    mln_string_t in, *out;
+    mln_json_t j, v, *e;
+    mln_u64_t x = 88172645463325252ULL, b;
+    double d, r;
+    int i, ok;
+
+    /* integers stay exact */
+    mln_string_nset(&in, (char *)ints, strlen(ints));
+    ASSERT(mln_json_decode(&in, &j, NULL) == 0, "num: decode integers");
+    e = mln_json_array_search(&j, 0);
+    ASSERT(mln_json_is_int(e) && mln_json_int_data_get(e) == 9007199254740993LL, "num: above 2^53");
+    e = mln_json_array_search(&j, 1);
+    ASSERT(mln_json_is_int(e) && mln_json_int_data_get(e) == (-9223372036854775807LL - 1), "num: INT64_MIN");
+    e = mln_json_array_search(&j, 2);
+    ASSERT(mln_json_is_int(e) && mln_json_int_data_get(e) == 9223372036854775807LL, "num: INT64_MAX");
+    e = mln_json_array_search(&j, 3);
+    ASSERT(mln_json_is_uint(e) && mln_json_uint_data_get(e) == 18446744073709551615ULL, "num: UINT64_MAX");
+    ASSERT(mln_json_number_data_get(e) == 18446744073709551615.0, "num: uint as double");
+    e = mln_json_array_search(&j, 4);
+    ASSERT(!mln_json_is_int(e) && mln_json_number_data_get(e) == 0 && (1 / mln_json_number_data_get(e)) < 0, "num: -0 keeps its sign");
+    out = mln_json_encode(&j, 0);
+    ASSERT(out != NULL && out->len == strlen(ints) && !memcmp(out->data, ints, out->len), "num: integers round trip");
+    if (out != NULL) mln_string_free(out);
+    mln_json_destroy(&j);
+
+    ASSERT(num_text("18446744073709551616", &v) == 0 && !mln_json_is_uint(&v) && \
+           mln_json_number_data_get(&v) == 18446744073709551616.0, "num: beyond uint64 is a double");
+    ASSERT(num_text("-9223372036854775809", &v) == 0 && !mln_json_is_int(&v) && \
+           mln_json_number_data_get(&v) == -9223372036854775808.0, "num: beyond int64 is a double");
+    mln_json_init(&j);
+    mln_json_generate(&j, "[D,U]", (mln_s64_t)1234567890123456789LL, (mln_u64_t)18446744073709551614ULL);
+    out = mln_json_encode(&j, 0);
+    ASSERT(out != NULL && !mln_string_strcmp(out, &(mln_string_t)mln_string("[1234567890123456789,18446744073709551614]")), "num: generate D and U");
+    if (out != NULL) mln_string_free(out);
+    mln_json_destroy(&j);
+
+    /* correctly rounded */
+    ASSERT(num_bits("0.1", 0x3fb999999999999aULL), "num: 0.1");
+    ASSERT(num_bits("2.2250738585072011e-308", 0x000fffffffffffffULL), "num: largest subnormal");
+    ASSERT(num_bits("2.2250738585072014e-308", 0x0010000000000000ULL), "num: smallest normal");
+    ASSERT(num_bits("4.9e-324", 1) && num_bits("2e-324", 0), "num: smallest subnormal");
+    ASSERT(num_bits("1.7976931348623157e308", 0x7fefffffffffffffULL), "num: largest double");
+    ASSERT(num_bits("1e400", 0x7ff0000000000000ULL), "num: overflow");
+    ASSERT(num_bits("9007199254740993.0", 0x4340000000000000ULL), "num: halfway rounds to even");
+    ASSERT(num_bits("1.00000000000000011102230246251565404236316680908203125", 0x3ff0000000000000ULL), "num: long halfway");
+    ASSERT(num_bits("1.00000000000000011102230246251565404236316680908203126", 0x3ff0000000000001ULL), "num: just above halfway");
+    ASSERT(num_bits("7.0420557077594588669468784357561207962098443483187940792729600000e-196", 0x176a51ee757f42eaULL), "num: long mantissa");
+    ASSERT(num_bits("123456789012345678901234567890e-10", 0x43e56a95319d63e1ULL), "num: truncated digits");
+
+    /* shortest form */
+    ASSERT(num_encode(0.1, "0.1") && num_encode(3.14, "3.14") && num_encode(-99.5, "-99.5"), "num: short fractions");
+    ASSERT(num_encode(100, "100") && num_encode(1e21, "1e+21") && num_encode(1e20, "100000000000000000000"), "num: large");
+    ASSERT(num_encode(1e-6, "0.000001") && num_encode(1e-7, "1e-7") && num_encode(1.5e-300, "1.5e-300"), "num: small");
+    ASSERT(num_encode(5e-324, "5e-324") && num_encode(1.7976931348623157e308, "1.7976931348623157e+308"), "num: limits");
+    ASSERT(num_encode(0.1 + 0.2, "0.30000000000000004") && num_encode(-0.0, "-0"), "num: exact digits");
+    ASSERT(num_encode(2.0 / 0.0, "null") && num_encode(0.0 / 0.0, "null"), "num: no NaN or infinity in JSON");
+
+    /* random doubles read back exactly */
+    ok = 1;
+    for (i = 0; i < 100000 && ok; ++i) {
+        char buf[64];
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if ((x >> 52 & 0x7ff) == 0x7ff) continue;
+        memcpy(&d, &x, sizeof(d));
+        mln_json_init(&j);
+        mln_json_generate(&j, "[F]", d);
+        out = mln_json_encode(&j, 0);
+        mln_json_destroy(&j);
+        ok = out != NULL && out->len < sizeof(buf) && decode_text((char *)out->data, out->len, &j) == 0;
+        if (ok) {
+            r = mln_json_number_data_get(mln_json_array_search(&j, 0));
+            memcpy(&b, &r, sizeof(b));
+            ok = b == x;
+            if (!ok) fprintf(stderr, "  round trip %.17g: %.*s\n", d, (int)out->len, (char *)out->data);
+            mln_json_destroy(&j);
+        }
+        if (out != NULL) mln_string_free(out);
+    }
+    ASSERT(ok, "num: random doubles round trip");
+
+    /* a metrics payload */
+    {
+        mln_string_t *big;
+        clock_t start;
+        double enc_t, dec_t;
+        int rc;
+
+        mln_json_init(&j);
+        mln_json_generate(&j, "[]");
+        for (i = 0; i < 100000; ++i) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            mln_json_generate(&j, "[{s:D,s:F,s:F}]", "id", (mln_s64_t)(x >> 1), "v", (double)(x % 1000000) / 1000, "r", (double)(x % 997) / 7);
+        }
+        start = clock();
+        big = mln_json_encode(&j, 0);
+        enc_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        mln_json_destroy(&j);
+        ASSERT(big != NULL, "num: encode payload");
+        start = clock();
+        rc = mln_json_decode(big, &j, NULL);
+        dec_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        ASSERT(rc == 0, "num: decode payload");
+        if (rc == 0) mln_json_destroy(&j);
+        fprintf(stderr, "  [PERF] numbers %lu bytes: encode %.3fs, decode %.3fs\n", (unsigned long)big->len, enc_t, dec_t);
+        mln_string_free(big);
+    }
+}
+
+/* ===========================================================
+ *  Pool decode
+ * =========================================================== */
+static int pool_same(mln_json_t *a, mln_json_t *b)
+{
+    mln_string_t *x = mln_json_encode(a, 0), *y = mln_json_encode(b, 0);
+    int rc = x != NULL && y != NULL && !mln_string_strcmp(x, y);
+    if (x != NULL) mln_string_free(x);
+    if (y != NULL) mln_string_free(y);
+    return rc;
+}
+
+static void test_pool_decode(void)
+{
+    char text[] = "{\"name\":\"plain\",\"esc\":\"a\\nb\\u00e9\",\"list\":[1,\"x\",{\"k\":null}],\"e\":{}}";
+    mln_string_t in, key, *str;
+    mln_json_t j, ref, k, val, *v;
+    mln_json_policy_t policy;
+    mln_alloc_t *pool;
+    char name[16];
+    int i, ok;
+
+    mln_string_nset(&in, text, sizeof(text) - 1);
+    ASSERT((pool = mln_alloc_arena_init(NULL, M_ALLOC_INFINITE_SIZE)) != NULL, "pool: arena");
+    ASSERT(mln_json_pool_decode(&in, &j, NULL, NULL) < 0, "pool: pool required");
+    ASSERT(mln_json_pool_decode(&in, &j, NULL, pool) == 0, "pool: decode");
+    ASSERT(mln_json_decode(&in, &ref, NULL) == 0 && pool_same(&j, &ref), "pool: same as heap decode");
+    mln_json_destroy(&ref);
+
+    /* a plain string refers to the input, an escaped one is decoded */
+    mln_string_set(&key, "name");
+    v = mln_json_obj_search(&j, &key);
+    ASSERT(v != NULL && mln_json_is_string(v), "pool: plain string");
+    str = mln_json_string_data_get(v);
+    ASSERT(str->data == (mln_u8ptr_t)text + 9 && str->len == 5, "pool: plain string is a view");
+    mln_string_set(&key, "esc");
+    v = mln_json_obj_search(&j, &key);
+    ASSERT(v != NULL && mln_json_string_data_get(v)->len == 5 && \
+           !memcmp(mln_json_string_data_get(v)->data, "a\nb\xc3\xa9", 5), "pool: escaped string");
+    ASSERT(mln_json_string_data_get(v)->data < (mln_u8ptr_t)text || \
+           mln_json_string_data_get(v)->data >= (mln_u8ptr_t)text + sizeof(text), "pool: escaped string is a copy");
+
+    /* updates past the inline KV slots come from the pool as well */
+    ok = 1;
+    for (i = 0; i < 40 && ok; ++i) {
+        mln_string_nset(&key, name, snprintf(name, sizeof(name), "key%d", i));
+        mln_json_string_init(&k, mln_string_pool_dup(pool, &key));
+        mln_json_number_init(&val, i);
+        ok = mln_json_string_data_get(&k) != NULL && mln_json_obj_update(&j, &k, &val) == 0;
+    }
+    ASSERT(ok && mln_json_obj_element_num(&j) == 44, "pool: update pooled object");
+    mln_alloc_reset(pool);
+
+    /* errors leave nothing behind but pool memory */
+    mln_string_nset(&in, "[\"abc\",\"d\\qe\"]", 14);
+    ASSERT(mln_json_pool_decode(&in, &j, NULL, pool) < 0, "pool: bad escape");
+    mln_json_policy_init(policy, 2, 0, 2, 0, 0);
+    mln_string_nset(&in, "[\"abc\"]", 7);
+    ASSERT(mln_json_pool_decode(&in, &j, &policy, pool) < 0 && \
+           mln_json_policy_error(policy) == M_JSON_STRLEN, "pool: policy");
+    mln_alloc_destroy(pool);
+
+    /* a general pool can also give the tree back node by node */
+    ASSERT((pool = mln_alloc_init(NULL, 0)) != NULL, "pool: general pool");
+    mln_string_nset(&in, text, sizeof(text) - 1);
+    ASSERT(mln_json_pool_decode(&in, &j, NULL, pool) == 0, "pool: general pool decode");
+    mln_json_destroy(&j);
+    mln_alloc_destroy(pool);
+
+    /* one decode per request, then a reset */
+    {
+        mln_string_t *big;
+        clock_t start;
+        double heap_t, pool_t;
+        int rc = 0;
+
+        mln_json_init(&j);
+        mln_json_generate(&j, "[]");
+        for (i = 0; i < 500; ++i)
+            mln_json_generate(&j, "[{s:d,s:s,s:[d,t,n],s:{s:s}}]", "id", i, "name", "per request", "list", i, "m", "k", "v");
+        big = mln_json_encode(&j, 0);
+        mln_json_destroy(&j);
+        pool = mln_alloc_arena_init(NULL, M_ALLOC_INFINITE_SIZE);
+
+        start = clock();
+        for (i = 0; i < 200 && rc == 0; ++i) {
+            rc = mln_json_decode(big, &j, NULL);
+            if (rc == 0) mln_json_destroy(&j);
+        }
+        heap_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        ASSERT(rc == 0, "pool: heap requests");
+
+        start = clock();
+        for (i = 0; i < 200 && rc == 0; ++i) {
+            rc = mln_json_pool_decode(big, &j, NULL, pool);
+            mln_alloc_reset(pool);
+        }
+        pool_t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        ASSERT(rc == 0, "pool: pool requests");
+
+        fprintf(stderr, "  [PERF] 200 requests of %lu bytes: heap %.3fs, pool %.3fs\n",
+                (unsigned long)big->len, heap_t, pool_t);
+        mln_alloc_destroy(pool);
+        mln_string_free(big);
+    }
+}
+
 /* ===========================================================
  *  MAIN
  * =========================================================== */
@@ -1017,6 +1647,10 @@ int main(void)
     test_many_keys();
     test_special_key_encode();
     test_unicode_escape_encode();
+    test_decode_index();
+    test_stream();
+    test_numbers();
+    test_pool_decode();
 
     fprintf(stderr, "\n=== Results: %d passed, %d failed ===\n", passed, failed);
     return failed ? 1 : 0;
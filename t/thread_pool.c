@@ -869,6 +869,402 @@ static void test_performance_batch(void)
     }
 }
 
+/* ---------------------- 11. work-stealing mode --------------------- */
+
+#define WS_N      100000
+#define WS_BATCH  256
+#define WS_ROOTS  64
+#define WS_DEPTH  8
+
+static volatile long ws_processed = 0;
+static volatile long ws_sum       = 0;
+static volatile long ws_freed     = 0;
+
+static int ws_child(void *data)
+{
+    __sync_fetch_and_add(&ws_processed, 1);
+    __sync_fetch_and_add(&ws_sum, (long)data);
+    return 0;
+}
+
+static int ws_main(void *data)
+{
+    long sent = 0, i;
+    void *batch[WS_BATCH];
+    struct mln_thread_pool_info info;
+    (void)data;
+
+    while (sent < WS_N) {
+        long n = WS_N - sent;
+        if (n > WS_BATCH) n = WS_BATCH;
+        for (i = 0; i < n; ++i) batch[i] = (void *)(sent + i + 1);
+        if (mln_thread_pool_resource_addn(batch, n) != 0) {
+            ++g_failures;
+            return -1;
+        }
+        sent += n;
+        if (sent % (WS_BATCH * 64) == 0 && mln_thread_pool_resource_add((void *)0x1) == 0)
+            __sync_fetch_and_sub(&ws_sum, 1);
+    }
+    mln_thread_resource_info(&info);
+    CHECK(info.cur_num == 5, "work-stealing pool starts every worker");
+    while (__sync_fetch_and_add(&ws_processed, 0) < WS_N + WS_N / (WS_BATCH * 64)) usleep(1000);
+    return 0;
+}
+
+/* every task above depth 0 fans out into two more from inside the worker */
+static int ws_fanout_child(void *data)
+{
+    long depth = (long)data;
+    __sync_fetch_and_add(&ws_processed, 1);
+    if (depth > 1) {
+        void *sub[2] = {(void *)(depth - 1), (void *)(depth - 1)};
+        if (mln_thread_pool_resource_addn(sub, 2) != 0) ++g_failures;
+    }
+    return 0;
+}
+
+static int ws_fanout_main(void *data)
+{
+    long i, expected = WS_ROOTS * ((1L << WS_DEPTH) - 1);
+    (void)data;
+
+    for (i = 0; i < WS_ROOTS; ++i) {
+        if (mln_thread_pool_resource_add((void *)(long)WS_DEPTH) != 0) {
+            ++g_failures;
+            return -1;
+        }
+    }
+    while (__sync_fetch_and_add(&ws_processed, 0) < expected) usleep(1000);
+    return 0;
+}
+
+static int ws_slow_child(void *data)
+{
+    __sync_fetch_and_add(&ws_processed, 1);
+    usleep(2000);
+    free(data);
+    return 0;
+}
+
+static void ws_free(void *data)
+{
+    __sync_fetch_and_add(&ws_freed, 1);
+    free(data);
+}
+
+static int ws_quit_main(void *data)
+{
+    int i;
+    (void)data;
+
+    for (i = 0; i < 200; ++i) {
+        if (mln_thread_pool_resource_add(malloc(8)) != 0) ++g_failures;
+    }
+    usleep(10000);
+    mln_thread_quit();
+    return 0;
+}
+
+static void test_work_stealing(void)
+{
+    HEADER("work-stealing mode");
+    struct mln_thread_pool_attr attr = {0};
+    attr.child_process_handler = ws_child;
+    attr.main_process_handler  = ws_main;
+    attr.free_handler = t1_free;
+    attr.cond_timeout = 1000;
+    attr.max = 4;
+    attr.concurrency = 4;
+    attr.work_stealing = 1;
+
+    ws_processed = ws_sum = 0;
+    double t0 = monotonic_seconds();
+    int rc = mln_thread_pool_run(&attr);
+    double dt = monotonic_seconds() - t0;
+    CHECK(rc == 0, "thread_pool_run returned non-zero");
+    CHECK(ws_processed == WS_N + WS_N / (WS_BATCH * 64), "processed count mismatch");
+    CHECK(ws_sum == (long)WS_N * (WS_N + 1) / 2, "sum mismatch");
+    fprintf(stderr, "  processed=%ld in %.3fs\n", ws_processed, dt);
+
+    HEADER("work-stealing fan-out from workers");
+    ws_processed = 0;
+    attr.child_process_handler = ws_fanout_child;
+    attr.main_process_handler  = ws_fanout_main;
+    rc = mln_thread_pool_run(&attr);
+    CHECK(rc == 0, "thread_pool_run returned non-zero");
+    CHECK(ws_processed == WS_ROOTS * ((1L << WS_DEPTH) - 1), "fan-out count mismatch");
+    fprintf(stderr, "  processed=%ld\n", ws_processed);
+
+    HEADER("work-stealing quit frees leftovers");
+    ws_processed = ws_freed = 0;
+    attr.child_process_handler = ws_slow_child;
+    attr.main_process_handler  = ws_quit_main;
+    attr.free_handler = ws_free;
+    attr.max = 2;
+    rc = mln_thread_pool_run(&attr);
+    CHECK(rc == 0, "thread_pool_run returned non-zero");
+    fprintf(stderr, "  processed=%ld freed=%ld\n", ws_processed, ws_freed);
+    CHECK(ws_processed + ws_freed == 200, "every payload should be either processed or freed exactly once");
+}
+
+/* ---------------------- 12. instance-based pools -------------------- */
+/*
+ * Two pools live side by side and are fed from several plain threads
+ * at once. Also covers queue limits, destroy with pending work and an
+ * instance pool in work-stealing mode.
+ */
+
+#define IP_PRODUCERS 4
+#define IP_PER       5000
+
+static volatile long ip_cpu_done = 0;
+static volatile long ip_io_done  = 0;
+static volatile long ip_freed    = 0;
+static volatile int  ip_gate     = 0;
+static volatile int  ip_started  = 0;
+
+static int ip_cpu_child(void *data) { (void)data; __sync_fetch_and_add(&ip_cpu_done, 1); return 0; }
+static int ip_io_child(void *data) { (void)data; __sync_fetch_and_add(&ip_io_done, 1); return 0; }
+
+static int ip_blocked_child(void *data)
+{
+    __sync_fetch_and_add(&ip_started, 1);
+    while (!__sync_fetch_and_add(&ip_gate, 0)) usleep(500);
+    free(data);
+    __sync_fetch_and_add(&ip_io_done, 1);
+    return 0;
+}
+
+static void ip_free(void *data)
+{
+    __sync_fetch_and_add(&ip_freed, 1);
+    free(data);
+}
+
+static mln_thread_pool_t *ip_cpu, *ip_io;
+
+static void *ip_producer(void *arg)
+{
+    long i, id = (long)arg;
+    void *batch[4] = {(void *)1, (void *)1, (void *)1, (void *)1};
+    for (i = 0; i < IP_PER; ++i) {
+        if (id & 1) {
+            if (mln_thread_pool_submit(ip_cpu, (void *)1) != 0) ++g_failures;
+        } else if (i % 4 == 0) {
+            if (mln_thread_pool_submitn(ip_io, batch, 4) != 0) ++g_failures;
+        }
+    }
+    return NULL;
+}
+
+static void test_instance_pools(void)
+{
+    HEADER("instance pools side by side");
+    struct mln_thread_pool_attr attr = {0};
+    struct mln_thread_pool_info info;
+    pthread_t th[IP_PRODUCERS];
+    long i;
+    int rc;
+
+    attr.child_process_handler = ip_cpu_child;
+    attr.cond_timeout = 200;
+    attr.max = 3;
+    ip_cpu = mln_thread_pool_new(&attr);
+    attr.child_process_handler = ip_io_child;
+    attr.max = 2;
+    attr.cpu_affinity = 1;
+    ip_io = mln_thread_pool_new(&attr);
+    CHECK(ip_cpu != NULL && ip_io != NULL, "mln_thread_pool_new failed");
+    if (ip_cpu == NULL || ip_io == NULL) return;
+
+    for (i = 0; i < IP_PRODUCERS; ++i) pthread_create(&th[i], NULL, ip_producer, (void *)i);
+    for (i = 0; i < IP_PRODUCERS; ++i) pthread_join(th[i], NULL);
+    while (__sync_fetch_and_add(&ip_cpu_done, 0) < IP_PRODUCERS / 2 * IP_PER || \
+           __sync_fetch_and_add(&ip_io_done, 0) < IP_PRODUCERS / 2 * IP_PER)
+        usleep(1000);
+    mln_thread_pool_resource_info(ip_cpu, &info);
+    fprintf(stderr, "  cpu=%ld io=%ld cpu-workers=%u\n", ip_cpu_done, ip_io_done, info.cur_num);
+    CHECK(info.cur_num <= 3, "instance pool exceeded max");
+    CHECK(ip_cpu_done == IP_PRODUCERS / 2 * IP_PER, "cpu pool count mismatch");
+    CHECK(ip_io_done == IP_PRODUCERS / 2 * IP_PER, "io pool count mismatch");
+    mln_thread_pool_destroy(ip_cpu);
+    mln_thread_pool_destroy(ip_io);
+
+    HEADER("instance pool queue limit and destroy");
+    memset(&attr, 0, sizeof(attr));
+    attr.child_process_handler = ip_blocked_child;
+    attr.free_handler = ip_free;
+    attr.cond_timeout = 1000;
+    attr.max = 1;
+    attr.queue_max = 8;
+    ip_io_done = ip_freed = ip_gate = ip_started = 0;
+    ip_io = mln_thread_pool_new(&attr);
+    CHECK(ip_io != NULL, "mln_thread_pool_new failed");
+    if (ip_io == NULL) return;
+    /* park the only worker inside a task, then fill the queue */
+    if (mln_thread_pool_submit(ip_io, malloc(8)) != 0) ++g_failures;
+    while (!__sync_fetch_and_add(&ip_started, 0)) usleep(500);
+    for (i = 0; i < 8; ++i) {
+        if (mln_thread_pool_submit(ip_io, malloc(8)) != 0) ++g_failures;
+    }
+    void *extra = malloc(8);
+    rc = mln_thread_pool_submit(ip_io, extra);
+    CHECK(rc == EAGAIN, "submit beyond queue_max should return EAGAIN");
+    if (rc != 0) free(extra);
+    mln_thread_pool_resource_info(ip_io, &info);
+    CHECK(info.res_num == 8, "queued task count mismatch");
+    __sync_fetch_and_add(&ip_gate, 1);
+    mln_thread_pool_destroy(ip_io);
+    fprintf(stderr, "  processed=%ld freed=%ld\n", ip_io_done, ip_freed);
+    CHECK(ip_io_done + ip_freed == 9, "every payload should be either processed or freed exactly once");
+
+    HEADER("instance pool in work-stealing mode");
+    memset(&attr, 0, sizeof(attr));
+    attr.child_process_handler = ip_cpu_child;
+    attr.cond_timeout = 1000;
+    attr.max = 2;
+    attr.work_stealing = 1;
+    ip_cpu_done = 0;
+    ip_cpu = mln_thread_pool_new(&attr);
+    CHECK(ip_cpu != NULL, "mln_thread_pool_new failed");
+    if (ip_cpu == NULL) return;
+    for (i = 0; i < IP_PRODUCERS; i += 2) pthread_create(&th[i], NULL, ip_producer, (void *)(i + 1));
+    for (i = 0; i < IP_PRODUCERS; i += 2) pthread_join(th[i], NULL);
+    while (__sync_fetch_and_add(&ip_cpu_done, 0) < IP_PRODUCERS / 2 * IP_PER) usleep(1000);
+    mln_thread_pool_resource_info(ip_cpu, &info);
+    CHECK(info.cur_num == 2, "work-stealing instance pool starts every worker");
+    mln_thread_pool_destroy(ip_cpu);
+    CHECK(ip_cpu_done == IP_PRODUCERS / 2 * IP_PER, "work-stealing instance count mismatch");
+}
+
+/* -------------------- 13. futures and completions ------------------- */
+/*
+ * Offload tasks to a futures pool and harvest the results from an
+ * event loop. Then check that tasks dropped by destroy still complete,
+ * flagged as cancelled.
+ */
+
+#define FT_N 20000
+
+static volatile long ft_gate = 0;
+static long ft_done, ft_sum, ft_batches, ft_cancelled, ft_max_batch;
+
+static void *ft_square(void *data)
+{
+    long v = (long)data;
+    return (void *)(v * v);
+}
+
+static void *ft_blocked(void *data)
+{
+    while (!__sync_fetch_and_add(&ft_gate, 0)) usleep(500);
+    return data;
+}
+
+static void ft_handler(mln_thread_pool_cq_t *cq, mln_thread_pool_future_t **futures, mln_size_t n, void *data)
+{
+    mln_size_t i;
+    ++ft_batches;
+    if ((long)n > ft_max_batch) ft_max_batch = n;
+    for (i = 0; i < n; ++i) {
+        if (mln_thread_pool_future_cancelled(futures[i])) {
+            ++ft_cancelled;
+            continue;
+        }
+        CHECK((long)mln_thread_pool_future_result(futures[i]) == \
+              (long)mln_thread_pool_future_data(futures[i]) * (long)mln_thread_pool_future_data(futures[i]), \
+              "future result mismatch");
+        ft_sum += (long)mln_thread_pool_future_result(futures[i]);
+        ++ft_done;
+    }
+    if (data != NULL && ft_done + ft_cancelled == FT_N && mln_thread_pool_cq_inflight(cq) == 0)
+        mln_event_break_set((mln_event_t *)data);
+}
+
+static void ft_timeout(mln_event_t *ev, void *data)
+{
+    (void)data;
+    CHECK(0, "completions did not arrive in time");
+    mln_event_break_set(ev);
+}
+
+static void test_futures(void)
+{
+    HEADER("futures harvested by the event loop");
+    struct mln_thread_pool_attr attr = {0};
+    mln_thread_pool_t *pool;
+    mln_thread_pool_cq_t *cq;
+    mln_thread_pool_future_t *f, *held = NULL;
+    mln_event_t *ev;
+    long i, expected = 0;
+
+    attr.cond_timeout = 200;
+    attr.max = 4;
+    pool = mln_thread_pool_new(&attr);
+    ev = mln_event_new();
+    CHECK(pool != NULL && ev != NULL, "setup failed");
+    if (pool == NULL || ev == NULL) return;
+    cq = mln_thread_pool_cq_new(ev, ft_handler, ev);
+    CHECK(cq != NULL, "mln_thread_pool_cq_new failed");
+    if (cq == NULL) return;
+
+    ft_done = ft_sum = ft_batches = ft_cancelled = ft_max_batch = 0;
+    for (i = 1; i <= FT_N; ++i) {
+        if ((f = mln_thread_pool_async(pool, cq, ft_square, (void *)i)) == NULL) ++g_failures;
+        mln_thread_pool_future_release(f);
+        expected += i * i;
+    }
+    mln_event_timer_set(ev, 30000, NULL, ft_timeout);
+    mln_event_dispatch(ev);
+    fprintf(stderr, "  done=%ld batches=%ld largest=%ld\n", ft_done, ft_batches, ft_max_batch);
+    CHECK(ft_done == FT_N, "future count mismatch");
+    CHECK(ft_sum == expected, "future sum mismatch");
+    CHECK(ft_max_batch <= M_THREAD_POOL_CQ_BATCH, "batch larger than M_THREAD_POOL_CQ_BATCH");
+    CHECK(mln_thread_pool_cq_inflight(cq) == 0, "inflight should drop to zero");
+
+    mln_thread_pool_destroy(pool);
+    mln_thread_pool_cq_free(cq);
+    mln_event_free(ev);
+
+    HEADER("futures dropped by destroy are cancelled");
+    memset(&attr, 0, sizeof(attr));
+    attr.cond_timeout = 1000;
+    attr.max = 1;
+    attr.child_process_handler = ip_cpu_child;
+    pool = mln_thread_pool_new(&attr);
+    cq = mln_thread_pool_cq_new(NULL, ft_handler, NULL);
+    CHECK(pool != NULL && cq != NULL, "setup failed");
+    if (pool == NULL || cq == NULL) return;
+    errno = 0;
+    CHECK((f = mln_thread_pool_async(pool, cq, ft_blocked, NULL)) == NULL && errno == EINVAL, \
+          "async on a pool with its own handler should fail with EINVAL");
+    mln_thread_pool_destroy(pool);
+
+    attr.child_process_handler = NULL;
+    pool = mln_thread_pool_new(&attr);
+    CHECK(pool != NULL, "mln_thread_pool_new failed");
+    if (pool == NULL) return;
+    ft_done = ft_sum = ft_cancelled = ft_gate = 0;
+    for (i = 0; i < 64; ++i) {
+        if ((f = mln_thread_pool_async(pool, cq, ft_blocked, (void *)0)) == NULL) ++g_failures;
+        /* keep one handle past its delivery */
+        if (held == NULL) held = f;
+        else mln_thread_pool_future_release(f);
+    }
+    usleep(10000);
+    __sync_fetch_and_add(&ft_gate, 1);
+    mln_thread_pool_destroy(pool);
+    CHECK(mln_thread_pool_cq_inflight(cq) == 64, "every future should be in the queue");
+    CHECK(mln_thread_pool_cq_harvest(cq) == 64, "harvest count mismatch");
+    fprintf(stderr, "  done=%ld cancelled=%ld\n", ft_done, ft_cancelled);
+    CHECK(ft_done + ft_cancelled == 64, "every future should complete exactly once");
+    CHECK(mln_thread_pool_cq_harvest(cq) == 0, "queue should be empty");
+    CHECK(held != NULL && mln_thread_pool_future_data(held) == NULL, "held future outlives its delivery");
+    mln_thread_pool_future_release(held);
+    mln_thread_pool_cq_free(cq);
+}
+
 /* ------------------------------- main ------------------------------ */
 
 int main(int argc, char *argv[])
@@ -883,6 +1279,9 @@ int main(int argc, char *argv[])
     test_main_return_propagates();
     test_sequential_pools();
     test_stability();
+    test_work_stealing();
+    test_instance_pools();
+    test_futures();
     test_performance_single();
     test_performance_batch();
 
@@ -418,6 +418,386 @@ static void test_websocket_masking_operations(void)
     printf("[PASS] test_websocket_masking_operations\n");
 }
 
+static void test_websocket_masked_text_parse(void)
+{
+    mln_http_t *http;
+    mln_websocket_t *cli, *srv;
+    mln_tcp_conn_t conn;
+    mln_chain_t *out;
+    mln_u8_t data[1024], frame[16 + sizeof(data)];
+    const char *piece = "ab\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+    mln_u8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    int len, off, i, plen = (int)strlen(piece);
+
+    for (i = 0; i + plen <= (int)sizeof(data); i += plen) memcpy(data + i, piece, plen);
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    assert((cli = mln_websocket_new(http)) != NULL);
+    assert((srv = mln_websocket_new(http)) != NULL);
+
+    /* every length around the vector widths round-trips */
+    for (len = 0; len <= 20 * plen; len += plen) {
+        out = NULL;
+        assert(mln_websocket_text_generate(cli, &out, data, len, \
+                   M_WS_FLAG_NEW | M_WS_FLAG_END | M_WS_FLAG_CLIENT) == M_WS_RET_OK);
+        assert(mln_websocket_parse(srv, &out) == M_WS_RET_OK);
+        assert(out == NULL);
+        assert((int)mln_websocket_get_content_len(srv) == len);
+        assert(!len || !memcmp(mln_websocket_get_content(srv), data, len));
+        mln_websocket_reset(srv);
+    }
+
+    /* a masked frame with a broken sequence at any offset is rejected */
+    len = 27 * plen;
+    for (off = 0; off < len; off += 7) {
+        frame[0] = 0x80 | M_WS_OPCODE_TEXT;
+        frame[1] = 0x80 | 126;
+        frame[2] = len >> 8;
+        frame[3] = len & 0xff;
+        memcpy(frame + 4, key, 4);
+        memcpy(frame + 8, data, len);
+        frame[8 + off] = (data[off] & 0xc0) == 0x80? 'x': 0x80;
+        for (i = 0; i < len; ++i) frame[8 + i] ^= key[i & 3];
+        out = mln_chain_new(mln_tcp_conn_pool_get(&conn));
+        out->buf = mln_buf_new(mln_tcp_conn_pool_get(&conn));
+        out->buf->left_pos = out->buf->pos = out->buf->start = frame;
+        out->buf->last = out->buf->end = frame + 8 + len;
+        out->buf->in_memory = 1;
+        out->buf->temporary = 1;
+        assert(mln_websocket_parse(srv, &out) == M_WS_RET_ERROR);
+        assert(mln_websocket_get_content(srv) == NULL);
+        mln_chain_pool_release_all(out);
+        mln_websocket_reset(srv);
+    }
+
+    mln_websocket_free(cli);
+    mln_websocket_free(srv);
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_websocket_masked_text_parse\n");
+}
+
+static void test_websocket_performance_masked_text(void)
+{
+    mln_http_t *http;
+    mln_websocket_t *cli, *srv;
+    mln_tcp_conn_t conn;
+    mln_chain_t *out;
+    mln_u8_t *data;
+    const char *piece = "Hello, world! \xc3\xa9t\xc3\xa9 \xe2\x82\xac ";
+    struct timespec start, end;
+    long elapsed;
+    int i, size = 65536, iterations = 2000, plen = (int)strlen(piece);
+
+    assert((data = (mln_u8_t *)malloc(size)) != NULL);
+    for (i = 0; i + plen <= size; i += plen) memcpy(data + i, piece, plen);
+    for (; i < size; ++i) data[i] = 'z';
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+    assert((cli = mln_websocket_new(http)) != NULL);
+    assert((srv = mln_websocket_new(http)) != NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        out = NULL;
+        assert(mln_websocket_text_generate(cli, &out, data, size, \
+                   M_WS_FLAG_NEW | M_WS_FLAG_END | M_WS_FLAG_CLIENT) == M_WS_RET_OK);
+        assert(mln_websocket_parse(srv, &out) == M_WS_RET_OK);
+        mln_websocket_reset(srv);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_us(&start, &end);
+
+    printf("[PERF] websocket 64KB masked text generate+parse: %d iterations in %ld us (%.2f MB/s)\n",
+           iterations, elapsed, (double)iterations * size / elapsed);
+
+    free(data);
+    mln_websocket_free(cli);
+    mln_websocket_free(srv);
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+}
+
+static int deflate_handshake(mln_websocket_t *cli, mln_websocket_t *srv)
+{
+    mln_chain_t *head = NULL, *tail = NULL;
+
+    if (mln_websocket_handshake_request_generate(cli, &head, &tail) != M_WS_RET_OK) return -1;
+    if (mln_http_parse(mln_websocket_get_http(srv), &head) != M_HTTP_RET_DONE) return -1;
+    mln_chain_pool_release_all(head);
+
+    head = tail = NULL;
+    if (mln_websocket_handshake_response_generate(srv, &head, &tail) != M_WS_RET_OK) return -1;
+    mln_http_reset(mln_websocket_get_http(cli));
+    if (mln_http_parse(mln_websocket_get_http(cli), &head) != M_HTTP_RET_DONE) return -1;
+    mln_chain_pool_release_all(head);
+
+    return mln_websocket_validate(cli);
+}
+
+static mln_chain_t *raw_frame(mln_tcp_conn_t *conn, mln_u8ptr_t frame, int len)
+{
+    mln_chain_t *c = mln_chain_new(mln_tcp_conn_pool_get(conn));
+    c->buf = mln_buf_new(mln_tcp_conn_pool_get(conn));
+    c->buf->left_pos = c->buf->pos = c->buf->start = frame;
+    c->buf->last = c->buf->end = frame + len;
+    c->buf->in_memory = 1;
+    c->buf->temporary = 1;
+    return c;
+}
+
+static void test_websocket_deflate(void)
+{
+    mln_tcp_conn_t cconn, sconn;
+    mln_http_t *chttp, *shttp;
+    mln_websocket_t *cli, *srv;
+    mln_chain_t *out;
+    mln_string_t ext_key = mln_string("Sec-WebSocket-Extensions"), *ext;
+    struct mln_websocket_deflate_attr attr;
+    mln_u8_t data[4096], frame[64];
+    const char *piece = "{\"id\":42,\"name\":\"melon\",\"tags\":[\"\xc3\xa9t\xc3\xa9\"]} ";
+    int i, round, plen = (int)strlen(piece);
+
+    for (i = 0; i + plen <= (int)sizeof(data); i += plen) memcpy(data + i, piece, plen);
+    for (; i < (int)sizeof(data); ++i) data[i] = ' ';
+    assert(mln_tcp_conn_init(&cconn, -1) == 0);
+    assert(mln_tcp_conn_init(&sconn, -1) == 0);
+    assert((chttp = mln_http_init(&cconn, NULL, NULL)) != NULL);
+    assert((shttp = mln_http_init(&sconn, NULL, NULL)) != NULL);
+    assert((cli = mln_websocket_new(chttp)) != NULL);
+    assert((srv = mln_websocket_new(shttp)) != NULL);
+
+    attr.window_bits = 10;
+    attr.peer_window_bits = 11;
+    attr.mem_level = 4;
+    attr.level = 6;
+    attr.no_context_takeover = 1;
+    attr.peer_no_context_takeover = 0;
+    attr.max_message = 65536;
+    if (mln_websocket_deflate_enable(cli, &attr) == M_WS_RET_FAILED) {
+        printf("[SKIP] test_websocket_deflate: built without zlib\n");
+        goto out;
+    }
+    attr.window_bits = 16;
+    assert(mln_websocket_deflate_enable(srv, &attr) == M_WS_RET_ERROR);
+    assert(mln_websocket_deflate_enable(srv, NULL) == M_WS_RET_OK);
+
+    /* the server honours the client's window limits and context takeover choice */
+    assert(deflate_handshake(cli, srv) == M_WS_RET_OK);
+    assert(mln_websocket_deflate_negotiated(cli) && mln_websocket_deflate_negotiated(srv));
+    assert((ext = mln_http_field_get(chttp, &ext_key)) != NULL);
+    assert(!strncmp((char *)ext->data, "permessage-deflate; client_no_context_takeover; " \
+                    "server_max_window_bits=11; client_max_window_bits=10", ext->len));
+    mln_websocket_reset(cli);
+    mln_websocket_reset(srv);
+
+    /* messages in both directions, the server keeps its context between them */
+    for (round = 0; round < 3; ++round) {
+        out = NULL;
+        assert(mln_websocket_text_generate(cli, &out, data, sizeof(data), \
+                   M_WS_FLAG_NEW | M_WS_FLAG_END | M_WS_FLAG_CLIENT) == M_WS_RET_OK);
+        assert((out->buf->pos[0] & 0x40) && mln_buf_left_size(out->buf) < sizeof(data) / 8);
+        assert(mln_websocket_parse(srv, &out) == M_WS_RET_OK && out == NULL);
+        assert(mln_websocket_get_content_len(srv) == sizeof(data));
+        assert(!memcmp(mln_websocket_get_content(srv), data, sizeof(data)));
+        mln_websocket_reset(srv);
+
+        out = NULL;
+        assert(mln_websocket_binary_generate(srv, &out, data + round, 100, \
+                   M_WS_FLAG_NEW | M_WS_FLAG_END | M_WS_FLAG_SERVER) == M_WS_RET_OK);
+        if (round) assert(mln_buf_left_size(out->buf) < 16);
+        assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK && out == NULL);
+        assert(mln_websocket_get_content_len(cli) == 100);
+        assert(!memcmp(mln_websocket_get_content(cli), data + round, 100));
+        mln_websocket_reset(cli);
+    }
+
+    /* a fragmented message with a ping and an empty fragment in between */
+    out = NULL;
+    assert(mln_websocket_text_generate(srv, &out, data, 1000, M_WS_FLAG_NEW | M_WS_FLAG_SERVER) == M_WS_RET_OK);
+    assert(out->buf->pos[0] == (0x40 | M_WS_OPCODE_TEXT));
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+    assert(mln_websocket_get_content_len(cli) == 1000 && !memcmp(mln_websocket_get_content(cli), data, 1000));
+    mln_websocket_reset(cli);
+    assert(mln_websocket_ping_generate(srv, &out, M_WS_FLAG_SERVER) == M_WS_RET_OK);
+    assert(out->buf->pos[0] == (0x80 | M_WS_OPCODE_PING));
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+    mln_websocket_reset(cli);
+    assert(mln_websocket_text_generate(srv, &out, data, 0, M_WS_FLAG_SERVER) == M_WS_RET_OK);
+    assert(out->buf->pos[0] == M_WS_OPCODE_CONTINUE);
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+    mln_websocket_reset(cli);
+    assert(mln_websocket_text_generate(srv, &out, data + 1000, 3000, M_WS_FLAG_END | M_WS_FLAG_SERVER) == M_WS_RET_OK);
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+    assert(mln_websocket_get_content_len(cli) == 3000 && !memcmp(mln_websocket_get_content(cli), data + 1000, 3000));
+    mln_websocket_reset(cli);
+
+    /* the two "Hello" messages of RFC 7692 7.2.3.2, the second one uses the shared window */
+    memcpy(frame, "\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00\xc1\x05\xf2\x00\x11\x00\x00", 16);
+    out = raw_frame(&sconn, frame, 16);
+    for (i = 0; i < 2; ++i) {
+        assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+        assert(mln_websocket_get_content_len(cli) == 5 && !memcmp(mln_websocket_get_content(cli), "Hello", 5));
+        mln_websocket_reset(cli);
+    }
+    assert(out == NULL);
+
+    /* RSV1 on a control frame, a corrupted stream and an oversized message fail */
+    frame[0] = 0x80 | 0x40 | M_WS_OPCODE_PING;
+    frame[1] = 0;
+    out = raw_frame(&sconn, frame, 2);
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_ERROR);
+    mln_chain_pool_release_all(out);
+    frame[0] = 0x80 | 0x40 | M_WS_OPCODE_BINARY;
+    frame[1] = 4;
+    memcpy(frame + 2, "\xff\xff\xff\xff", 4);
+    out = raw_frame(&sconn, frame, 6);
+    assert(mln_websocket_parse(cli, &out) == M_WS_RET_ERROR);
+    assert(mln_websocket_get_content(cli) == NULL);
+    mln_chain_pool_release_all(out);
+
+    mln_websocket_free(cli);
+    assert((cli = mln_websocket_new(chttp)) != NULL);
+    attr.window_bits = 15;
+    assert(mln_websocket_deflate_enable(cli, &attr) == M_WS_RET_OK);
+    mln_websocket_free(srv);
+    mln_http_reset(shttp);
+    assert((srv = mln_websocket_new(shttp)) != NULL);
+    assert(mln_websocket_deflate_enable(srv, NULL) == M_WS_RET_OK);
+    assert(deflate_handshake(cli, srv) == M_WS_RET_OK);
+    mln_websocket_reset(cli);
+    mln_websocket_reset(srv);
+    memset(data, 0, sizeof(data));
+    for (i = 0; i < 17; ++i) {
+        out = NULL;
+        assert(mln_websocket_binary_generate(srv, &out, data, sizeof(data), \
+                   (i? 0: M_WS_FLAG_NEW) | (i == 16? M_WS_FLAG_END: 0) | M_WS_FLAG_SERVER) == M_WS_RET_OK);
+        if (i < 16) {
+            assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+        } else {
+            assert(mln_websocket_parse(cli, &out) == M_WS_RET_ERROR);
+            mln_chain_pool_release_all(out);
+        }
+        mln_websocket_reset(cli);
+    }
+
+out:
+    mln_websocket_free(cli);
+    mln_websocket_free(srv);
+    mln_http_destroy(chttp);
+    mln_http_destroy(shttp);
+    mln_tcp_conn_destroy(&cconn);
+    mln_tcp_conn_destroy(&sconn);
+
+    printf("[PASS] test_websocket_deflate\n");
+}
+
+static void test_websocket_deflate_decline(void)
+{
+    mln_tcp_conn_t conn;
+    mln_http_t *http;
+    mln_websocket_t *ws;
+    mln_chain_t *head, *tail;
+    mln_string_t key = mln_string("Sec-WebSocket-Key"), key_val = mln_string("dGhlIHNhbXBsZSBub25jZQ==");
+    mln_string_t ext_key = mln_string("Sec-WebSocket-Extensions"), *ext;
+    mln_string_t offers[] = {
+        mln_string("permessage-deflate; server_max_window_bits=8, x-webkit-deflate-frame"),
+        mln_string("permessage-deflate; client_max_window_bits=16; foo, permessage-deflate; server_no_context_takeover=1"),
+        mln_string("permessage-deflate; server_max_window_bits=\"12\"; client_max_window_bits, x-webkit-deflate-frame"),
+    };
+    int i, enable;
+
+    assert(mln_tcp_conn_init(&conn, -1) == 0);
+    assert((http = mln_http_init(&conn, NULL, NULL)) != NULL);
+
+    /* no answer that is not supported, and only well formed offers are taken */
+    for (enable = 0; enable < 2; ++enable) {
+        for (i = 0; i < (int)(sizeof(offers) / sizeof(offers[0])); ++i) {
+            mln_http_reset(http);
+            mln_http_type_set(http, M_HTTP_REQUEST);
+            assert(mln_http_field_set(http, &key, &key_val) == M_HTTP_RET_OK);
+            assert(mln_http_field_set(http, &ext_key, &offers[i]) == M_HTTP_RET_OK);
+            assert((ws = mln_websocket_new(http)) != NULL);
+            if (enable && mln_websocket_deflate_enable(ws, NULL) == M_WS_RET_FAILED) {
+                mln_websocket_free(ws);
+                printf("[SKIP] test_websocket_deflate_decline: built without zlib\n");
+                goto out;
+            }
+            head = tail = NULL;
+            assert(mln_websocket_handshake_response_generate(ws, &head, &tail) == M_WS_RET_OK);
+            mln_chain_pool_release_all(head);
+            ext = mln_http_field_get(http, &ext_key);
+            if (enable && i == 2) {
+                assert(mln_websocket_deflate_negotiated(ws));
+                assert(ext != NULL && !mln_string_const_strcmp(ext, "x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=12"));
+            } else {
+                assert(!mln_websocket_deflate_negotiated(ws));
+                assert(ext == NULL || !mln_string_const_strcmp(ext, "x-webkit-deflate-frame"));
+            }
+            mln_websocket_free(ws);
+        }
+    }
+
+out:
+    mln_http_destroy(http);
+    mln_tcp_conn_destroy(&conn);
+
+    printf("[PASS] test_websocket_deflate_decline\n");
+}
+
+static void test_websocket_performance_deflate(void)
+{
+    mln_tcp_conn_t cconn, sconn;
+    mln_http_t *chttp, *shttp;
+    mln_websocket_t *cli, *srv;
+    mln_chain_t *out;
+    char msg[256];
+    struct timespec start, end;
+    mln_u64_t plain = 0, wire = 0;
+    long elapsed;
+    int i, n, iterations = 20000;
+
+    assert(mln_tcp_conn_init(&cconn, -1) == 0);
+    assert(mln_tcp_conn_init(&sconn, -1) == 0);
+    assert((chttp = mln_http_init(&cconn, NULL, NULL)) != NULL);
+    assert((shttp = mln_http_init(&sconn, NULL, NULL)) != NULL);
+    assert((cli = mln_websocket_new(chttp)) != NULL);
+    assert((srv = mln_websocket_new(shttp)) != NULL);
+    if (mln_websocket_deflate_enable(cli, NULL) != M_WS_RET_OK || mln_websocket_deflate_enable(srv, NULL) != M_WS_RET_OK)
+        goto out;
+    assert(deflate_handshake(cli, srv) == M_WS_RET_OK);
+    mln_websocket_reset(cli);
+    mln_websocket_reset(srv);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        n = snprintf(msg, sizeof(msg), "{\"seq\":%d,\"user\":\"user%d\",\"event\":\"update\",\"price\":%d.%02d}", \
+                     i, i % 97, i * 7 % 1000, i % 100);
+        out = NULL;
+        assert(mln_websocket_text_generate(srv, &out, (mln_u8ptr_t)msg, n, \
+                   M_WS_FLAG_NEW | M_WS_FLAG_END | M_WS_FLAG_SERVER) == M_WS_RET_OK);
+        plain += n + 2;
+        wire += mln_buf_left_size(out->buf);
+        assert(mln_websocket_parse(cli, &out) == M_WS_RET_OK);
+        assert(mln_websocket_get_content_len(cli) == (mln_u64_t)n);
+        mln_websocket_reset(cli);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_us(&start, &end);
+
+    printf("[PERF] websocket permessage-deflate small JSON: %d messages in %ld us, %llu -> %llu bytes on the wire (%.1f%%)\n",
+           iterations, elapsed, (unsigned long long)plain, (unsigned long long)wire, wire * 100.0 / plain);
+
+out:
+    mln_websocket_free(cli);
+    mln_websocket_free(srv);
+    mln_http_destroy(chttp);
+    mln_http_destroy(shttp);
+    mln_tcp_conn_destroy(&cconn);
+    mln_tcp_conn_destroy(&sconn);
+}
+
 static void test_websocket_rsv_bits(void)
 {
     mln_http_t *http;
@@ -1142,10 +1522,15 @@ int main(void)
 
     printf("\n=== Masking Operations ===\n");
     test_websocket_masking_operations();
+    test_websocket_masked_text_parse();
 
     printf("\n=== RSV Bits ===\n");
     test_websocket_rsv_bits();
 
+    printf("\n=== permessage-deflate ===\n");
+    test_websocket_deflate();
+    test_websocket_deflate_decline();
+
     printf("\n=== Content Operations ===\n");
     test_websocket_content_operations();
     test_websocket_status_codes();
@@ -1158,6 +1543,8 @@ int main(void)
 
     printf("\n=== Performance ===\n");
     test_websocket_performance_generate_parse_roundtrip();
+    test_websocket_performance_masked_text();
+    test_websocket_performance_deflate();
 
     printf("\n=== Stability ===\n");
     test_websocket_stability_large_frames();